@@ -0,0 +1,106 @@
+#include "bench_common.h"
+#include "../src/vm/pool.h"
+#include <vector>
+
+// Allocation rate: scripts that mostly create short-lived objects, and the
+// same mix of block sizes through the pool and the global allocator directly.
+// Build with -DCXXX_POOL_ALLOCATOR=OFF to run the scripts on the global heap.
+
+static const char* kInstances = R"(
+class Point {
+    init(x, y) { this.x = x; this.y = y; }
+}
+var result = 0;
+for (var i = 0; i < 300000; i++) {
+    var p = Point(i, 1);
+    result = result + p.y;
+}
+)";
+
+static const char* kClosures = R"(
+fun adder(n) {
+    fun add(x) { return x + n; }
+    return add;
+}
+var result = 0;
+for (var i = 0; i < 300000; i++) {
+    result = adder(1)(result);
+}
+)";
+
+static const char* kBoundMethods = R"(
+class Counter {
+    init() { this.n = 0; }
+    bump() { this.n = this.n + 1; return this.n; }
+}
+var counter = Counter();
+var result = 0;
+for (var i = 0; i < 300000; i++) {
+    var bump = counter.bump;
+    result = bump();
+}
+)";
+
+static const char* kStrings = R"(
+var result = 0;
+for (var i = 0; i < 100000; i++) {
+    var s = "item" + i;
+    result = result + len(s) - len(s) + 1;
+}
+)";
+
+// Object-sized requests, replacing blocks of a fixed live set at random.
+template <typename Allocate, typename Free>
+static double churn(Allocate allocate, Free free) {
+    static const size_t kSizes[] = {24, 32, 40, 48, 64, 72, 96, 192};
+    const int live = 4096;
+    const int rounds = 2000000;
+    std::vector<void*> blocks(live);
+    std::vector<size_t> sizes(live);
+    for (int i = 0; i < live; i++) {
+        sizes[i] = kSizes[i % 8];
+        blocks[i] = allocate(sizes[i]);
+    }
+
+    uint32_t seed = 12345;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        int slot = (int)(seed >> 20) % live;
+        free(blocks[slot], sizes[slot]);
+        sizes[slot] = kSizes[(seed >> 8) & 7];
+        blocks[slot] = allocate(sizes[slot]);
+        *(char*)blocks[slot] = (char)i;
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < live; i++) free(blocks[i], sizes[i]);
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static void reportChurn(const char* name, double (*run)()) {
+    double best = 0.0;
+    for (int i = 0; i < 5; i++) {
+        double ms = run();
+        if (i == 0 || ms < best) best = ms;
+    }
+    std::cout << name << ": " << best << " ms" << std::endl;
+}
+
+int main() {
+    runBenchmark("instances", kInstances, 10, "result", 300000.0);
+    runBenchmark("closures", kClosures, 10, "result", 300000.0);
+    runBenchmark("bound_methods", kBoundMethods, 10, "result", 300000.0);
+    runBenchmark("strings", kStrings, 10, "result", 100000.0);
+
+    reportChurn("churn_pool", [] {
+        cxxx::Pool pool;
+        return churn([&](size_t size) { return pool.allocate(size); },
+                     [&](void* block, size_t size) { pool.free(block, size); });
+    });
+    reportChurn("churn_global", [] {
+        return churn([](size_t size) { return ::operator new(size); },
+                     [](void* block, size_t) { ::operator delete(block); });
+    });
+    return 0;
+}
@@ -0,0 +1,41 @@
+#ifndef cxxx_bench_common_h
+#define cxxx_bench_common_h
+
+#include "../src/include/cxxx.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+// Runs `script` in a fresh VM `runs` times and reports the best wall time.
+// If `checkGlobal` is given, its value must equal `expected` after each run.
+// `jit` turns on the baseline JIT where it is available.
+inline double runBenchmark(const char* name, const std::string& script, int runs = 10,
+                           const char* checkGlobal = nullptr, double expected = 0.0,
+                           bool jit = false) {
+    double best = 0.0;
+    for (int i = 0; i < runs; i++) {
+        cxxx::CXXX vm;
+        vm.setJITEnabled(jit);
+        auto start = std::chrono::steady_clock::now();
+        cxxx::InterpretResult result = vm.interpret(script);
+        auto end = std::chrono::steady_clock::now();
+
+        if (result != cxxx::InterpretResult::OK) {
+            std::cerr << name << ": script failed." << std::endl;
+            exit(1);
+        }
+        if (checkGlobal != nullptr && vm.getGlobalNumber(checkGlobal) != expected) {
+            std::cerr << name << ": expected " << checkGlobal << " == " << expected
+                      << ", got " << vm.getGlobalNumber(checkGlobal) << std::endl;
+            exit(1);
+        }
+
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (i == 0 || ms < best) best = ms;
+    }
+    std::cout << name << ": " << best << " ms" << std::endl;
+    return best;
+}
+
+#endif
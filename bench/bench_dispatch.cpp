@@ -0,0 +1,142 @@
+#include "bench_common.h"
+
+// Dispatch-bound workloads in the style of test_turing and test_nested.
+
+static const char* kNumericLoop = R"(
+var sum = 0;
+for (var i = 0; i < 2000000; i++) {
+    sum = sum + i;
+}
+)";
+
+static const char* kFib = R"(
+fun fib(n) {
+    if (n < 2) return n;
+    return fib(n - 1) + fib(n - 2);
+}
+var result = fib(25);
+)";
+
+static const char* kMethodCalls = R"(
+class Counter {
+    init() { this.n = 0; }
+    inc() { this.n = this.n + 1; }
+}
+var c = Counter();
+for (var i = 0; i < 500000; i++) {
+    c.inc();
+}
+var result = c.n;
+)";
+
+static const char* kNestedLoops = R"(
+var result = 0;
+var i = 0;
+while (i < 300) {
+    var j = 0;
+    while (j < 300) {
+        if (j == 150) {
+            j = j + 1;
+            continue;
+        }
+        result = result + 1;
+        j = j + 1;
+    }
+    i = i + 1;
+}
+)";
+
+static const char* kTuring = R"(
+class Node {
+  init(val, prev, next) {
+    this.val = val;
+    this.prev = prev;
+    this.next = next;
+  }
+}
+
+class Tape {
+  init() { this.current = Node(0, nil, nil); }
+  inc() { this.current.val = this.current.val + 1; }
+  dec() { this.current.val = this.current.val - 1; }
+  left() {
+    if (this.current.prev == nil) {
+      this.current.prev = Node(0, nil, this.current);
+    }
+    this.current = this.current.prev;
+  }
+  right() {
+    if (this.current.next == nil) {
+      this.current.next = Node(0, this.current, nil);
+    }
+    this.current = this.current.next;
+  }
+  get() { return this.current.val; }
+}
+
+fun interpret(code) {
+  var tape = Tape();
+  var ip = 0;
+  var codeLen = len(code);
+  while (ip < codeLen) {
+    var c = strAt(code, ip);
+    if (c == "+") {
+      tape.inc();
+    } else if (c == "-") {
+      tape.dec();
+    } else if (c == ">") {
+      tape.right();
+    } else if (c == "<") {
+      tape.left();
+    } else if (c == "[") {
+       if (tape.get() == 0) {
+         var depth = 1;
+         while (depth > 0) {
+           ip = ip + 1;
+           var cc = strAt(code, ip);
+           if (cc == "[") depth = depth + 1;
+           else if (cc == "]") depth = depth - 1;
+         }
+       }
+    } else if (c == "]") {
+       if (tape.get() != 0) {
+         var depth = 1;
+         while (depth > 0) {
+           ip = ip - 1;
+           var cc = strAt(code, ip);
+           if (cc == "]") depth = depth + 1;
+           else if (cc == "[") depth = depth - 1;
+         }
+       }
+    }
+    ip = ip + 1;
+  }
+  return tape.get();
+}
+
+var result = interpret("+++++++++++[>++++++++++[>+++++<-]<-]>>");
+)";
+
+// Accumulator-style recursion, kept shallow enough to run without tail calls.
+static const char* kTailCalls = R"(
+fun sum(n, acc) {
+    if (n == 0) return acc;
+    return sum(n - 1, acc + n);
+}
+var result = 0;
+for (var i = 0; i < 2000; i++) {
+    result = sum(200, 0);
+}
+)";
+
+// Pass --jit to run the same workloads with the baseline JIT enabled.
+int main(int argc, char* argv[]) {
+    bool jit = argc > 1 && std::string(argv[1]) == "--jit";
+    runBenchmark("numeric_loop", kNumericLoop, 10, "sum", 1999999000000.0, jit);
+    runBenchmark("fib", kFib, 10, "result", 75025.0, jit);
+    runBenchmark("method_calls", kMethodCalls, 10, "result", 500000.0, jit);
+    runBenchmark("nested_loops", kNestedLoops, 10, "result", 89700.0, jit);
+    runBenchmark("turing", kTuring, 10, "result", 550.0, jit);
+    runBenchmark("tail_calls", kTailCalls, 10, "result", 20100.0, jit);
+    return 0;
+}
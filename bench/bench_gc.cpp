@@ -0,0 +1,84 @@
+#include "bench_common.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include <algorithm>
+#include <vector>
+
+// Collector cost: short-lived garbage allocated next to a large long-lived
+// heap, with and without minor collections, and the pauses the program
+// sees with full collections in one piece, in slices, marked on a helper
+// thread, or swept lazily by the allocator.
+
+static const char* kLiveHeap = R"(
+class Node {
+    init(next, value) { this.next = next; this.value = value; }
+}
+var live = nil;
+for (var i = 0; i < 200000; i++) live = Node(live, i);
+
+var result = 0;
+for (var i = 0; i < 1000000; i++) {
+    var temp = Node(nil, i);
+    result = result + temp.value - i + 1;
+}
+)";
+
+static void runWithNursery(const char* name, size_t nursery) {
+    double best = 0.0;
+    for (int run = 0; run < 5; run++) {
+        cxxx::CXXX vm;
+        vm.setGCNurserySize(nursery);
+        auto start = std::chrono::steady_clock::now();
+        if (vm.interpret(kLiveHeap) != cxxx::InterpretResult::OK ||
+            vm.getGlobalNumber("result") != 1000000.0) {
+            std::cerr << name << ": script failed." << std::endl;
+            exit(1);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (run == 0 || ms < best) best = ms;
+    }
+    std::cout << name << ": " << best << " ms" << std::endl;
+}
+
+// Runs kLiveHeap once and reports the distribution of collector pauses.
+static void reportPauses(const char* name, size_t sliceBudget, bool concurrent = false, bool lazy = false) {
+    cxxx::VM vm;
+    std::vector<double> pauses;
+    vm.pauseLog = &pauses;
+    vm.sliceBudget = sliceBudget;
+    vm.concurrentMarking = concurrent;
+    vm.lazySweep = lazy;
+    auto start = std::chrono::steady_clock::now();
+    cxxx::ObjFunction* script = cxxx::compile(&vm, kLiveHeap);
+    if (script == nullptr) exit(1);
+    vm.pushRoot((cxxx::Obj*)script);
+    if (vm.interpret(script) != cxxx::InterpretResult::OK) {
+        std::cerr << name << ": script failed." << std::endl;
+        exit(1);
+    }
+    vm.popRoot();
+    auto end = std::chrono::steady_clock::now();
+
+    std::sort(pauses.begin(), pauses.end());
+    auto percentile = [&](double p) {
+        return pauses.empty() ? 0.0 : pauses[(size_t)(p * (pauses.size() - 1))];
+    };
+    std::cout << name << ": " << std::chrono::duration<double, std::milli>(end - start).count()
+              << " ms, " << pauses.size() << " pauses, p50 " << percentile(0.5) << " us, p99 "
+              << percentile(0.99) << " us, max " << (pauses.empty() ? 0.0 : pauses.back())
+              << " us" << std::endl;
+}
+
+int main() {
+    runBenchmark("live_heap", kLiveHeap, 5, "result", 1000000.0);
+    runWithNursery("live_heap_full_only", 0);
+    runWithNursery("live_heap_nursery_1m", 1024 * 1024);
+    reportPauses("pauses_stop_the_world", 0);
+    reportPauses("pauses_slices_1000", 1000);
+    reportPauses("pauses_slices_100", 100);
+    reportPauses("pauses_concurrent", 0, true);
+    reportPauses("pauses_concurrent_slices_1000", 1000, true);
+    reportPauses("pauses_lazy_sweep", 0, false, true);
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "bench_common.h"
+
+// Method lookup through deep class hierarchies, on the paths inline caches
+// do not cover (megamorphic call sites and super calls), and instanceof.
+
+// C0 defines step(); C1 .. C<depth> add nothing. Six sibling leaves
+// under C<depth> make a call site that sees all of them megamorphic.
+static std::string hierarchy(int depth) {
+    std::string source =
+        "class C0 {\n"
+        "    step() { this.n = this.n + 1; return this.n; }\n"
+        "}\n";
+    for (int i = 1; i <= depth; i++) {
+        source += "class C" + std::to_string(i) + " < C" + std::to_string(i - 1) + " {}\n";
+    }
+    for (int i = 0; i < 6; i++) {
+        source += "class Leaf" + std::to_string(i) + " < C" + std::to_string(depth) +
+                  " {\n"
+                  "    init() { this.n = 0; }\n"
+                  "    viaSuper() { return super.step(); }\n"
+                  "}\n";
+        source += "var leaf" + std::to_string(i) + " = Leaf" + std::to_string(i) + "();\n";
+    }
+    return source;
+}
+
+static std::string megamorphic(int depth) {
+    return hierarchy(depth) +
+        "fun call(o) { return o.step(); }\n"
+        "var result = 0;\n"
+        "for (var i = 0; i < 50000; i++) {\n"
+        "    call(leaf0); call(leaf1); call(leaf2);\n"
+        "    call(leaf3); call(leaf4); result = result + call(leaf5);\n"
+        "}\n";
+}
+
+static std::string superCalls(int depth) {
+    return hierarchy(depth) +
+        "var result = 0;\n"
+        "for (var i = 0; i < 100000; i++) {\n"
+        "    leaf0.viaSuper(); leaf1.viaSuper();\n"
+        "    result = leaf2.viaSuper();\n"
+        "}\n";
+}
+
+// Type tests against the root and the middle of the hierarchy.
+static std::string typeTests(int depth) {
+    return hierarchy(depth) +
+        "var result = 0;\n"
+        "for (var i = 0; i < 200000; i++) {\n"
+        "    if (leaf0 instanceof C0) result = result + 1;\n"
+        "    if (leaf1 instanceof C" + std::to_string(depth / 2) + ") result = result + 1;\n"
+        "    if (leaf2 instanceof Leaf3) result = result + 1;\n"
+        "}\n";
+}
+
+int main() {
+    runBenchmark("megamorphic_5_deep", megamorphic(5), 10, "result", 1250025000.0);
+    runBenchmark("megamorphic_10_deep", megamorphic(10), 10, "result", 1250025000.0);
+    runBenchmark("super_5_deep", superCalls(5), 10, "result", 100000.0);
+    runBenchmark("super_10_deep", superCalls(10), 10, "result", 100000.0);
+    runBenchmark("instanceof_5_deep", typeTests(5), 10, "result", 400000.0);
+    runBenchmark("instanceof_10_deep", typeTests(10), 10, "result", 400000.0);
+    return 0;
+}
@@ -0,0 +1,74 @@
+#include "bench_common.h"
+#include <fstream>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+
+// Memory and setup cost of many small VMs, each running a one-line script.
+
+static const char* kTiny = "var result = 1 + 2;";
+
+struct Memory {
+    long virtualKiB = 0;
+    long residentKiB = 0;
+};
+
+// This process's virtual and resident size (Linux only; zero elsewhere).
+static Memory processMemory() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    Memory memory;
+    if (!(statm >> size >> resident)) return memory;
+    long pageKiB = sysconf(_SC_PAGESIZE) / 1024;
+    memory.virtualKiB = size * pageKiB;
+    memory.residentKiB = resident * pageKiB;
+    return memory;
+}
+
+// Keeps `count` idle VMs alive and reports how much memory each adds.
+static void idleVMs(const char* name, int count) {
+    std::vector<std::unique_ptr<cxxx::CXXX>> vms;
+    vms.reserve(count);
+    Memory before = processMemory();
+    for (int i = 0; i < count; i++) {
+        vms.emplace_back(new cxxx::CXXX());
+        if (vms.back()->interpret(kTiny) != cxxx::InterpretResult::OK) {
+            std::cerr << name << ": script failed." << std::endl;
+            exit(1);
+        }
+    }
+    Memory after = processMemory();
+    std::cout << name << ": " << (double)(after.residentKiB - before.residentKiB) / count
+              << " KiB resident, " << (double)(after.virtualKiB - before.virtualKiB) / count
+              << " KiB virtual per VM" << std::endl;
+}
+
+// Creates, runs and destroys `count` VMs in turn.
+static void churn(const char* name, int count) {
+    double best = 0.0;
+    for (int run = 0; run < 5; run++) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++) {
+            cxxx::CXXX vm;
+            vm.interpret(kTiny);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (run == 0 || ms < best) best = ms;
+    }
+    std::cout << name << ": " << best << " ms" << std::endl;
+}
+
+int main() {
+    idleVMs("idle_vm", 1000);
+    churn("vm_churn_1000", 1000);
+    runBenchmark("deep_recursion", R"(
+        fun down(n) {
+            if (n == 0) return 0;
+            return down(n - 1) + n;
+        }
+        var result = 0;
+        for (var i = 0; i < 200; i++) result = down(200);
+    )", 10, "result", 20100.0);
+    return 0;
+}
@@ -0,0 +1,69 @@
+#include "bench_common.h"
+
+// Method-call and property-access heavy workloads.
+
+static const char* kInheritedCalls = R"(
+class L0 {
+    init() { this.n = 0; }
+    bump() { this.n = this.n + 1; }
+}
+class L1 < L0 {}
+class L2 < L1 {}
+class L3 < L2 {}
+class L4 < L3 {}
+class L5 < L4 { init() { this.n = 0; } }
+var o = L5();
+for (var i = 0; i < 300000; i++) {
+    o.bump();
+}
+var result = o.n;
+)";
+
+static const char* kFieldAccess = R"(
+class Vec {
+    init(x, y, z) { this.x = x; this.y = y; this.z = z; }
+    dot(o) { return this.x * o.x + this.y * o.y + this.z * o.z; }
+}
+var a = Vec(1, 2, 3);
+var b = Vec(4, 5, 6);
+var result = 0;
+for (var i = 0; i < 300000; i++) {
+    result = result + a.dot(b);
+}
+)";
+
+static const char* kPolymorphic = R"(
+class Circle { init() { this.r = 1; } area() { return this.r * 3; } }
+class Square { init() { this.s = 2; } area() { return this.s * this.s; } }
+class Tri { init() { this.b = 2; this.h = 3; } area() { return this.b * this.h / 2; } }
+var shapes0 = Circle();
+var shapes1 = Square();
+var shapes2 = Tri();
+var result = 0;
+for (var i = 0; i < 100000; i++) {
+    result = result + shapes0.area() + shapes1.area() + shapes2.area();
+}
+)";
+
+static const char* kAllocation = R"(
+class Point {
+    init(x, y) { this.x = x; this.y = y; }
+}
+class Point3 < Point {}
+class Empty {}
+var result = 0;
+for (var i = 0; i < 200000; i++) {
+    var p = Point(i, 1);
+    var q = Point3(1, i);
+    var e = Empty();
+    result = result + p.y + q.x;
+}
+)";
+
+int main() {
+    runBenchmark("inherited_calls", kInheritedCalls, 10, "result", 300000.0);
+    runBenchmark("field_access", kFieldAccess, 10, "result", 9600000.0);
+    runBenchmark("polymorphic", kPolymorphic, 10, "result", 1000000.0);
+    runBenchmark("allocation", kAllocation, 10, "result", 400000.0);
+    return 0;
+}
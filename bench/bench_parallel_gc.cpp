@@ -0,0 +1,60 @@
+#include "bench_common.h"
+#include <thread>
+
+// Full-collection time against CXXX::setGCThreads(): a heap of independent
+// trees, collected once with as much garbage as live data and then with
+// live data only. Speedups need as many cores as threads.
+
+static const char* kHeap = R"(
+class Tree {
+    init(depth) {
+        if (depth > 0) {
+            this.left = Tree(depth - 1);
+            this.right = Tree(depth - 1);
+        } else {
+            this.left = nil;
+            this.right = nil;
+        }
+    }
+}
+var a = Tree(15); Tree(15);
+var b = Tree(15); Tree(15);
+var c = Tree(15); Tree(15);
+var d = Tree(15); Tree(15);
+var e = Tree(15); Tree(15);
+var f = Tree(15); Tree(15);
+var g = Tree(15); Tree(15);
+var h = Tree(15); Tree(15);
+)";
+
+static void reportThreads(int threads) {
+    cxxx::CXXX vm;
+    vm.setGCThreshold((size_t)1 << 40);
+    vm.setGCNurserySize(0);
+    vm.setGCThreads(threads);
+    if (vm.interpret(kHeap) != cxxx::InterpretResult::OK) {
+        std::cerr << "threads_" << threads << ": script failed." << std::endl;
+        exit(1);
+    }
+
+    auto time = [&] {
+        auto start = std::chrono::steady_clock::now();
+        vm.collectGarbage();
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::milli>(end - start).count();
+    };
+    double withGarbage = time();
+    double live = 0.0;
+    for (int run = 0; run < 5; run++) {
+        double ms = time();
+        if (run == 0 || ms < live) live = ms;
+    }
+    std::cout << "threads_" << threads << ": " << withGarbage << " ms with garbage, "
+              << live << " ms live only" << std::endl;
+}
+
+int main() {
+    std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+    for (int threads : {1, 2, 4, 8}) reportThreads(threads);
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include "bench_common.h"
+
+// Arithmetic and comparisons between locals: the code the register
+// instructions cover. Build once with and once without CXXX_REGISTER_VM
+// to compare the two backends.
+
+static const char* kLocalArith = R"(
+fun run(n) {
+    var sum = 0;
+    var x = 0;
+    for (var i = 0; i < n; i++) {
+        x = i * 3;
+        x = x - i;
+        sum = sum + x;
+    }
+    return sum;
+}
+var result = run(2000000);
+)";
+
+static const char* kFibIter = R"(
+fun fib(n) {
+    var a = 0;
+    var b = 1;
+    var t = 0;
+    for (var i = 0; i < n; i++) {
+        t = a + b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+var result = 0;
+for (var k = 0; k < 20000; k++) result = fib(50);
+)";
+
+static const char* kNestedCompare = R"(
+fun count(n) {
+    var hits = 0;
+    for (var i = 0; i < n; i++) {
+        for (var j = 0; j < n; j++) {
+            if (i == j) hits = hits + 1;
+            if (j > i) hits = hits + 2;
+        }
+    }
+    return hits;
+}
+var result = count(1000);
+)";
+
+// Pass --jit to run the same workloads with the baseline JIT enabled.
+int main(int argc, char* argv[]) {
+    bool jit = argc > 1 && std::string(argv[1]) == "--jit";
+    runBenchmark("local_arith", kLocalArith, 10, "result", 3999998000000.0, jit);
+    runBenchmark("fib_iter", kFibIter, 10, "result", 12586269025.0, jit);
+    runBenchmark("nested_compare", kNestedCompare, 10, "result", 1000000.0, jit);
+    return 0;
+}
@@ -0,0 +1,91 @@
+#include "bench_common.h"
+#include <fstream>
+#include <unistd.h>
+
+// String-heavy scripts: building strings with `+` (string and number
+// operands), taking them apart with strAt(), and the memory a VM holds for
+// many short live strings.
+
+// This process's resident size in KiB (Linux only; zero elsewhere).
+static long residentKiB() {
+    std::ifstream statm("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(statm >> size >> resident)) return 0;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Keeps `count` distinct short strings alive and reports what each costs,
+// as the VM counts it and as resident memory.
+static void liveStrings(const char* name, int count) {
+    long before = residentKiB();
+    cxxx::CXXX vm;
+    vm.setGCThreshold((size_t)1 << 40);
+    std::string script = R"(
+        class Cell { init(value, next) { this.value = value; this.next = next; } }
+        var head = nil;
+        for (var i = 0; i < )" + std::to_string(count) + R"(; i++) head = Cell("s" + i, head);
+    )";
+    size_t empty = vm.getBytesAllocated();
+    if (vm.interpret(script) != cxxx::InterpretResult::OK) {
+        std::cerr << name << ": script failed." << std::endl;
+        exit(1);
+    }
+    vm.collectGarbage();
+    double counted = (double)(vm.getBytesAllocated() - empty) / count;
+    double resident = (double)(residentKiB() - before) * 1024 / count;
+    std::cout << name << ": " << counted << " bytes counted, " << resident
+              << " bytes resident per string and cell" << std::endl;
+}
+
+int main() {
+    runBenchmark("concat_strings", R"(
+        var total = 0;
+        for (var i = 0; i < 2000; i++) {
+            var s = "";
+            for (var j = 0; j < 20; j++) s = s + "ab";
+            total = total + len(s);
+        }
+    )", 10, "total", 80000.0);
+
+    runBenchmark("concat_numbers", R"(
+        var total = 0;
+        for (var i = 0; i < 100000; i++) {
+            var s = "key" + i;
+            total = total + len(s + "!");
+        }
+    )", 10, "total", 888890.0);
+
+    runBenchmark("str_at_scan", R"(
+        var text = "";
+        for (var i = 0; i < 100; i++) text = text + "the quick brown fox ";
+        var spaces = 0;
+        for (var round = 0; round < 50; round++) {
+            for (var i = 0; i < len(text); i++) {
+                if (strAt(text, i) == " ") spaces = spaces + 1;
+            }
+        }
+    )", 10, "spaces", 20000.0);
+
+    runBenchmark("reverse_words", R"(
+        var words = 0;
+        for (var round = 0; round < 2000; round++) {
+            var text = "lorem ipsum dolor sit amet consectetur adipiscing elit";
+            var word = "";
+            var out = "";
+            for (var i = 0; i < len(text); i++) {
+                var c = strAt(text, i);
+                if (c == " ") {
+                    out = word + " " + out;
+                    word = "";
+                    words = words + 1;
+                } else {
+                    word = word + c;
+                }
+            }
+            out = word + " " + out;
+        }
+    )", 10, "words", 14000.0);
+
+    liveStrings("live_strings", 200000);
+    return 0;
+}
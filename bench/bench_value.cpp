@@ -0,0 +1,42 @@
+#include "bench_common.h"
+
+// Workloads dominated by Value copies: VM stack traffic and table entries.
+
+static const char* kStackHeavy = R"(
+fun sum4(a, b, c, d) {
+    return a + b + c + d;
+}
+fun deep(n, a, b, c) {
+    if (n == 0) return a + b + c;
+    return deep(n - 1, a + 1, b, c) + sum4(a, b, c, n);
+}
+var result = 0;
+for (var i = 0; i < 20000; i++) {
+    result = result + deep(50, 1, 2, 3);
+}
+)";
+
+static const char* kTableHeavy = R"(
+class Point {
+    init(x, y) {
+        this.x = x;
+        this.y = y;
+        this.z = 0;
+        this.w = 0;
+    }
+}
+var result = 0;
+for (var i = 0; i < 200000; i++) {
+    var p = Point(i, 1);
+    p.z = p.x + p.y;
+    p.w = p.z + p.x;
+    result = result + p.w - p.z - p.x + 1;
+}
+)";
+
+int main() {
+    std::cout << "sizeof(Value) = " << sizeof(cxxx::Value) << std::endl;
+    runBenchmark("stack_heavy", kStackHeavy, 10, "result", 57120000.0);
+    runBenchmark("table_heavy", kTableHeavy, 10, "result", 200000.0);
+    return 0;
+}
@@ -27,13 +27,24 @@ std::string readFile(const char* path) {
     return buffer.str();
 }
 
+bool isCompiled(const std::string& path) {
+    return path.size() > 5 && path.compare(path.size() - 5, 5, ".cxxc") == 0;
+}
+
 void runFile(cxxx::CXXX& vm, const char* path) {
-    std::string source = readFile(path);
-    cxxx::InterpretResult result = vm.interpret(source);
+    cxxx::InterpretResult result = isCompiled(path)
+        ? vm.interpretCompiled(std::string(path))
+        : vm.interpret(readFile(path));
     if (result == cxxx::InterpretResult::COMPILE_ERROR) exit(65);
     if (result == cxxx::InterpretResult::RUNTIME_ERROR) exit(70);
 }
 
+// cxxx --compile out.cxxc script: writes the script's bytecode; running
+// out.cxxc later skips the scanner and compiler.
+void compileFile(cxxx::CXXX& vm, const char* out, const char* path) {
+    if (!vm.compileToFile(readFile(path), out)) exit(65);
+}
+
 int main(int argc, char* argv[]) {
     cxxx::CXXX vm;
 
@@ -41,8 +52,11 @@ int main(int argc, char* argv[]) {
         repl(vm);
     } else if (argc == 2) {
         runFile(vm, argv[1]);
+    } else if (argc == 4 && std::string(argv[1]) == "--compile") {
+        compileFile(vm, argv[2], argv[3]);
     } else {
         std::cerr << "Usage: cxxx [path]" << std::endl;
+        std::cerr << "       cxxx --compile out.cxxc path" << std::endl;
         exit(64);
     }
 
@@ -5,6 +5,7 @@
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
+#include <utility>
 #include <vector>
 
 namespace cxxx {
@@ -67,6 +68,9 @@ namespace cxxx {
         std::vector<int> breakJumps;
     };
 
+    // Longest instruction sequence the peephole helpers rewrite at once.
+    #define PEEPHOLE_WINDOW 4
+
     struct Compiler {
         struct Compiler* enclosing;
         ObjFunction* function;
@@ -78,6 +82,14 @@ namespace cxxx {
         int upvalueCount;
         int scopeDepth;
         Loop* loop;
+
+        // Peephole state: starts of the last PEEPHOLE_WINDOW complete
+        // instructions, newest first (-1 if unknown), how far the code has
+        // been scanned for them, and the furthest offset any jump lands on.
+        // Instructions before that offset must not be fused with later ones.
+        int recentInstructions[PEEPHOLE_WINDOW];
+        int scannedTo;
+        int jumpTarget;
     };
 
     struct ClassCompiler {
@@ -161,7 +173,12 @@ namespace cxxx {
     }
 
     uint8_t makeConstant(CompilerInstance* compiler, Value value) {
-        int constant = currentChunk(compiler)->addConstant(value);
+        int constant;
+        {
+            StoreGuard guard(compiler->vm);
+            constant = currentChunk(compiler)->addConstant(value);
+            compiler->vm->writeBarrier((Obj*)compiler->compiler->function, value);
+        }
         if (constant > 255) {
             error(compiler, "Too many constants in one chunk.");
             return 0;
@@ -169,6 +186,199 @@ namespace cxxx {
         return (uint8_t)constant;
     }
 
+    void emitInlineCache(CompilerInstance* compiler) {
+        int cache = currentChunk(compiler)->addInlineCache();
+        if (cache > UINT16_MAX) {
+            error(compiler, "Too many property accesses in one chunk.");
+        }
+        emitBytes(compiler, (cache >> 8) & 0xff, cache & 0xff);
+    }
+
+    void forgetInstructions(Compiler* compiler, int scannedTo) {
+        for (int i = 0; i < PEEPHOLE_WINDOW; i++) compiler->recentInstructions[i] = -1;
+        compiler->scannedTo = scannedTo;
+    }
+
+    // Finds the instruction boundaries emitted since the last call.
+    void scanInstructions(CompilerInstance* compiler) {
+        Compiler* current = compiler->compiler;
+        Chunk* chunk = currentChunk(compiler);
+        while (current->scannedTo < (int)chunk->code.size()) {
+            for (int i = PEEPHOLE_WINDOW - 1; i > 0; i--) {
+                current->recentInstructions[i] = current->recentInstructions[i - 1];
+            }
+            current->recentInstructions[0] = current->scannedTo;
+            current->scannedTo += chunk->instructionLength(current->scannedTo);
+        }
+    }
+
+    // Fills `starts` with the starts of the last `count` instructions, oldest
+    // first, if they may be rewritten together with the next one, i.e. no
+    // jump lands after the first of them.
+    bool fusableInstructions(CompilerInstance* compiler, int count, int* starts) {
+        scanInstructions(compiler);
+        Compiler* current = compiler->compiler;
+        int first = current->recentInstructions[count - 1];
+        if (first < 0 || current->jumpTarget > first) return false;
+        for (int i = 0; i < count; i++) starts[i] = current->recentInstructions[count - 1 - i];
+        return true;
+    }
+
+    // Start of the last instruction if it may be rewritten together with the
+    // next one; otherwise -1.
+    int fusableInstruction(CompilerInstance* compiler) {
+        int last;
+        return fusableInstructions(compiler, 1, &last) ? last : -1;
+    }
+
+    // Drops all code from `offset` on, which must be an instruction start.
+    void truncateCode(CompilerInstance* compiler, int offset) {
+        Chunk* chunk = currentChunk(compiler);
+        chunk->code.resize(offset);
+        chunk->lines.resize(offset);
+        forgetInstructions(compiler->compiler, offset);
+    }
+
+    void markJumpTarget(CompilerInstance* compiler) {
+        compiler->compiler->jumpTarget = (int)currentChunk(compiler)->code.size();
+    }
+
+#ifdef CXXX_REGISTER_VM
+    // Register-form replacement for a binary stack opcode: the _RR variant,
+    // whose _RK variant follows it. Returns -1 if there is none.
+    int registerArithmetic(uint8_t op) {
+        switch (op) {
+            case OP_ADD:      return OP_ADD_RR;
+            case OP_SUBTRACT: return OP_SUBTRACT_RR;
+            case OP_MULTIPLY: return OP_MULTIPLY_RR;
+            case OP_DIVIDE:   return OP_DIVIDE_RR;
+            default:          return -1;
+        }
+    }
+
+    // Rewrites the store `slots[A] = <expression>` ending in the OP_SET_LOCAL
+    // just emitted into one register instruction, if the
+    // expression is a local, a constant, or a binary operator applied to a
+    // local and a local or constant. The stored value is not left behind.
+    bool fuseRegisterStore(CompilerInstance* compiler) {
+        Chunk* chunk = currentChunk(compiler);
+        int starts[4];
+        if (!fusableInstructions(compiler, 2, starts)) return false;
+        uint8_t dst = chunk->code[starts[1] + 1];
+        uint8_t source = chunk->code[starts[0]];
+        if (source == OP_GET_LOCAL || source == OP_CONSTANT) {
+            uint8_t operand = chunk->code[starts[0] + 1];
+            truncateCode(compiler, starts[0]);
+            emitBytes(compiler, source == OP_GET_LOCAL ? OP_MOVE : OP_LOAD_CONSTANT, dst);
+            emitByte(compiler, operand);
+            return true;
+        }
+
+        if (!fusableInstructions(compiler, 4, starts)) return false;
+        int op = registerArithmetic(chunk->code[starts[2]]);
+        if (op < 0) return false;
+        uint8_t left = chunk->code[starts[0]];
+        uint8_t right = chunk->code[starts[1]];
+        uint8_t b = chunk->code[starts[0] + 1];
+        uint8_t c = chunk->code[starts[1] + 1];
+        if (left == OP_GET_LOCAL && right == OP_GET_LOCAL) {
+            // op is already the _RR form.
+        } else if (left == OP_GET_LOCAL && right == OP_CONSTANT) {
+            op++;
+        } else if (left == OP_CONSTANT && right == OP_GET_LOCAL && op == OP_MULTIPLY_RR &&
+                   chunk->constants[b].isNumber()) {
+            // Multiplying numbers commutes; `+` does not once strings are involved.
+            op = OP_MULTIPLY_RK;
+            std::swap(b, c);
+        } else {
+            return false;
+        }
+        truncateCode(compiler, starts[0]);
+        emitBytes(compiler, (uint8_t)op, dst);
+        emitBytes(compiler, b, c);
+        return true;
+    }
+
+    // Emits a register compare-and-jump for a condition that is a comparison
+    // between a local and a local or constant. Returns the offset of its jump
+    // operand for patchJump(), or -1.
+    int emitRegisterJumpIfFalse(CompilerInstance* compiler) {
+        Chunk* chunk = currentChunk(compiler);
+        int starts[3];
+        if (!fusableInstructions(compiler, 3, starts)) return -1;
+        int op;
+        switch (chunk->code[starts[2]]) {
+            case OP_LESS:    op = OP_LESS_JUMP_IF_FALSE_RR; break;
+            case OP_GREATER: op = OP_GREATER_JUMP_IF_FALSE_RR; break;
+            case OP_EQUAL:   op = OP_EQUAL_JUMP_IF_FALSE_RR; break;
+            default:         return -1;
+        }
+        uint8_t left = chunk->code[starts[0]];
+        uint8_t right = chunk->code[starts[1]];
+        uint8_t b = chunk->code[starts[0] + 1];
+        uint8_t c = chunk->code[starts[1] + 1];
+        if (left == OP_GET_LOCAL && right == OP_GET_LOCAL) {
+            // op is already the _RR form.
+        } else if (left == OP_GET_LOCAL && right == OP_CONSTANT) {
+            op++;
+        } else if (left == OP_CONSTANT && right == OP_GET_LOCAL) {
+            // k < x is x > k and vice versa; equality is symmetric.
+            if (op == OP_LESS_JUMP_IF_FALSE_RR) op = OP_GREATER_JUMP_IF_FALSE_RK;
+            else if (op == OP_GREATER_JUMP_IF_FALSE_RR) op = OP_LESS_JUMP_IF_FALSE_RK;
+            else op = OP_EQUAL_JUMP_IF_FALSE_RK;
+            std::swap(b, c);
+        } else {
+            return -1;
+        }
+        truncateCode(compiler, starts[0]);
+        emitBytes(compiler, (uint8_t)op, b);
+        emitByte(compiler, c);
+        emitBytes(compiler, 0xff, 0xff);
+        return currentChunk(compiler)->code.size() - 2;
+    }
+#endif
+
+    // Emits OP_POP, folding it into the instruction that produced the value
+    // where a superinstruction or plain deletion does the same job.
+    void emitPop(CompilerInstance* compiler) {
+        int last = fusableInstruction(compiler);
+        if (last >= 0) {
+            Chunk* chunk = currentChunk(compiler);
+            switch (chunk->code[last]) {
+                case OP_GET_LOCAL:
+                    truncateCode(compiler, last);
+                    return;
+                case OP_SET_LOCAL:
+#ifdef CXXX_REGISTER_VM
+                    if (fuseRegisterStore(compiler)) return;
+#endif
+                    chunk->code[last] = OP_SET_LOCAL_POP;
+                    return;
+                case OP_SET_GLOBAL:
+                    chunk->code[last] = OP_SET_GLOBAL_POP;
+                    return;
+                case OP_INCREMENT_LOCAL: {
+                    // Postfix `i++` pushed the old value first; nobody wants it.
+                    int starts[2];
+                    if (fusableInstructions(compiler, 2, starts) &&
+                        chunk->code[starts[0]] == OP_GET_LOCAL &&
+                        chunk->code[starts[0] + 1] == chunk->code[last + 1]) {
+                        uint8_t slot = chunk->code[last + 1];
+                        uint8_t delta = chunk->code[last + 2];
+                        truncateCode(compiler, starts[0]);
+                        emitBytes(compiler, OP_INCREMENT_LOCAL, slot);
+                        emitByte(compiler, delta);
+                        return;
+                    }
+                    break;
+                }
+                default:
+                    break;
+            }
+        }
+        emitByte(compiler, OP_POP);
+    }
+
     void emitConstant(CompilerInstance* compiler, Value value) {
         emitBytes(compiler, OP_CONSTANT, makeConstant(compiler, value));
     }
@@ -189,11 +399,40 @@ namespace cxxx {
         emitByte(compiler, OP_RETURN);
     }
 
+    // Records how deep the finished function's stack gets, so the VM checks
+    // for overflow once per call instead of on every push.
+    void measureStack(CompilerInstance* compiler, ObjFunction* function) {
+        if (compiler->parser.hadError) return;
+        function->maxStack = function->chunk.maxStackDepth(function->arity + 1);
+        if (function->maxStack < 0) error(compiler, "Inconsistent stack depth in generated code.");
+    }
+
     uint8_t identifierConstant(CompilerInstance* compiler, Token* name) {
         ObjString* string = copyString(compiler->vm, name->start, name->length);
         return makeConstant(compiler, OBJ_VAL((Obj*)string));
     }
 
+    // Globals are addressed by slot, resolved here once at compile time.
+    uint16_t globalSlot(CompilerInstance* compiler, Token* name) {
+        ObjString* string = copyString(compiler->vm, name->start, name->length);
+        int slot = compiler->vm->globalSlot(string);
+        if (slot > UINT16_MAX) {
+            error(compiler, "Too many global variables.");
+            return 0;
+        }
+        return (uint16_t)slot;
+    }
+
+    // Global ops take a 16-bit slot; local and upvalue ops a single byte.
+    void emitVariableOp(CompilerInstance* compiler, uint8_t op, int arg) {
+        if (op == OP_GET_GLOBAL || op == OP_SET_GLOBAL || op == OP_DEFINE_GLOBAL) {
+            emitByte(compiler, op);
+            emitBytes(compiler, (arg >> 8) & 0xff, arg & 0xff);
+        } else {
+            emitBytes(compiler, op, (uint8_t)arg);
+        }
+    }
+
     bool identifiersEqual(Token* a, Token* b) {
         if (a->length != b->length) return false;
         return memcmp(a->start, b->start, a->length) == 0;
@@ -302,6 +541,7 @@ namespace cxxx {
     void parsePrecedence(CompilerInstance* compiler, Precedence precedence);
     void variable(CompilerInstance* compiler, bool canAssign);
     int emitJump(CompilerInstance* compiler, uint8_t instruction);
+    int emitJumpIfFalse(CompilerInstance* compiler);
     void patchJump(CompilerInstance* compiler, int offset);
 
     uint8_t argumentList(CompilerInstance* compiler) {
@@ -334,50 +574,56 @@ namespace cxxx {
             getOp = OP_GET_UPVALUE;
             setOp = OP_SET_UPVALUE;
         } else {
-            arg = identifierConstant(compiler, &name);
+            arg = globalSlot(compiler, &name);
             getOp = OP_GET_GLOBAL;
             setOp = OP_SET_GLOBAL;
         }
 
         if (canAssign && match(compiler, TOKEN_EQUAL)) {
             expression(compiler);
-            emitBytes(compiler, setOp, (uint8_t)arg);
+            emitVariableOp(compiler, setOp, arg);
         } else if (canAssign && match(compiler, TOKEN_PLUS_EQUAL)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
              expression(compiler);
              emitByte(compiler, OP_ADD);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
         } else if (canAssign && match(compiler, TOKEN_MINUS_EQUAL)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
              expression(compiler);
              emitByte(compiler, OP_SUBTRACT);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
         } else if (canAssign && match(compiler, TOKEN_STAR_EQUAL)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
              expression(compiler);
              emitByte(compiler, OP_MULTIPLY);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
         } else if (canAssign && match(compiler, TOKEN_SLASH_EQUAL)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
              expression(compiler);
              emitByte(compiler, OP_DIVIDE);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
+        } else if (canAssign && getOp == OP_GET_LOCAL &&
+                   (match(compiler, TOKEN_PLUS_PLUS) || match(compiler, TOKEN_MINUS_MINUS))) {
+             bool increment = compiler->parser.previous.type == TOKEN_PLUS_PLUS;
+             emitVariableOp(compiler, getOp, arg);
+             emitBytes(compiler, OP_INCREMENT_LOCAL, (uint8_t)arg);
+             emitByte(compiler, increment ? 1 : (uint8_t)-1);
         } else if (canAssign && match(compiler, TOKEN_PLUS_PLUS)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
+             emitVariableOp(compiler, getOp, arg);
              emitConstant(compiler, NUMBER_VAL(1));
              emitByte(compiler, OP_ADD);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
              emitByte(compiler, OP_POP);
         } else if (canAssign && match(compiler, TOKEN_MINUS_MINUS)) {
-             emitBytes(compiler, getOp, (uint8_t)arg);
-             emitBytes(compiler, getOp, (uint8_t)arg);
+             emitVariableOp(compiler, getOp, arg);
+             emitVariableOp(compiler, getOp, arg);
              emitConstant(compiler, NUMBER_VAL(1));
              emitByte(compiler, OP_SUBTRACT);
-             emitBytes(compiler, setOp, (uint8_t)arg);
+             emitVariableOp(compiler, setOp, arg);
              emitByte(compiler, OP_POP);
         } else {
-            emitBytes(compiler, getOp, (uint8_t)arg);
+            emitVariableOp(compiler, getOp, arg);
         }
     }
 
@@ -392,12 +638,15 @@ namespace cxxx {
         if (canAssign && match(compiler, TOKEN_EQUAL)) {
             expression(compiler);
             emitBytes(compiler, OP_SET_PROPERTY, name);
+            emitInlineCache(compiler);
         } else if (match(compiler, TOKEN_LEFT_PAREN)) {
             uint8_t argCount = argumentList(compiler);
             emitBytes(compiler, OP_INVOKE, name);
             emitByte(compiler, argCount);
+            emitInlineCache(compiler);
         } else {
             emitBytes(compiler, OP_GET_PROPERTY, name);
+            emitInlineCache(compiler);
         }
     }
 
@@ -467,31 +716,36 @@ namespace cxxx {
             getOp = OP_GET_UPVALUE;
             setOp = OP_SET_UPVALUE;
         } else {
-            arg = identifierConstant(compiler, &name);
+            arg = globalSlot(compiler, &name);
             getOp = OP_GET_GLOBAL;
             setOp = OP_SET_GLOBAL;
         }
 
-        emitBytes(compiler, getOp, (uint8_t)arg);
+        if (getOp == OP_GET_LOCAL) {
+            emitBytes(compiler, OP_INCREMENT_LOCAL, (uint8_t)arg);
+            emitByte(compiler, operatorType == TOKEN_PLUS_PLUS ? 1 : (uint8_t)-1);
+            emitVariableOp(compiler, getOp, arg);
+            return;
+        }
+
+        emitVariableOp(compiler, getOp, arg);
         emitConstant(compiler, NUMBER_VAL(1));
         if (operatorType == TOKEN_PLUS_PLUS) {
             emitByte(compiler, OP_ADD);
         } else {
             emitByte(compiler, OP_SUBTRACT);
         }
-        emitBytes(compiler, setOp, (uint8_t)arg);
+        emitVariableOp(compiler, setOp, arg);
     }
 
     void ternary(CompilerInstance* compiler, bool canAssign) {
-        int thenJump = emitJump(compiler, OP_JUMP_IF_FALSE);
-        emitByte(compiler, OP_POP);
+        int thenJump = emitJumpIfFalse(compiler);
 
         parsePrecedence(compiler, PREC_ASSIGNMENT);
 
         int elseJump = emitJump(compiler, OP_JUMP);
 
         patchJump(compiler, thenJump);
-        emitByte(compiler, OP_POP);
 
         consume(compiler, TOKEN_COLON, "Expect ':' after '?' expression.");
         parsePrecedence(compiler, PREC_ASSIGNMENT);
@@ -622,25 +876,25 @@ namespace cxxx {
         parsePrecedence(compiler, PREC_ASSIGNMENT);
     }
 
-    uint8_t parseVariable(CompilerInstance* compiler, const char* errorMessage) {
+    uint16_t parseVariable(CompilerInstance* compiler, const char* errorMessage) {
         consume(compiler, TOKEN_IDENTIFIER, errorMessage);
 
         declareVariable(compiler);
         if (compiler->compiler->scopeDepth > 0 || compiler->compiler->type != TYPE_SCRIPT) return 0;
 
-        return identifierConstant(compiler, &compiler->parser.previous);
+        return globalSlot(compiler, &compiler->parser.previous);
     }
 
-    void defineVariable(CompilerInstance* compiler, uint8_t global) {
+    void defineVariable(CompilerInstance* compiler, uint16_t global) {
         if (compiler->compiler->scopeDepth > 0 || compiler->compiler->type != TYPE_SCRIPT) {
             markInitialized(compiler);
             return;
         }
-        emitBytes(compiler, OP_DEFINE_GLOBAL, global);
+        emitVariableOp(compiler, OP_DEFINE_GLOBAL, global);
     }
 
     void varDeclaration(CompilerInstance* compiler) {
-        uint8_t global = parseVariable(compiler, "Expect variable name.");
+        uint16_t global = parseVariable(compiler, "Expect variable name.");
 
         if (match(compiler, TOKEN_EQUAL)) {
             expression(compiler);
@@ -655,7 +909,7 @@ namespace cxxx {
     void expressionStatement(CompilerInstance* compiler) {
         expression(compiler);
         consume(compiler, TOKEN_SEMICOLON, "Expect ';' after expression.");
-        emitByte(compiler, OP_POP);
+        emitPop(compiler);
     }
 
     void printStatement(CompilerInstance* compiler) {
@@ -679,6 +933,21 @@ namespace cxxx {
         emitByte(compiler, offset & 0xff);
     }
 
+    // Jumps if the condition on top of the stack is falsey, popping it on
+    // both paths. A condition ending in `<` is fused into the jump.
+    int emitJumpIfFalse(CompilerInstance* compiler) {
+#ifdef CXXX_REGISTER_VM
+        int registerJump = emitRegisterJumpIfFalse(compiler);
+        if (registerJump >= 0) return registerJump;
+#endif
+        int last = fusableInstruction(compiler);
+        if (last >= 0 && currentChunk(compiler)->code[last] == OP_LESS) {
+            truncateCode(compiler, last);
+            return emitJump(compiler, OP_LESS_JUMP_IF_FALSE);
+        }
+        return emitJump(compiler, OP_POP_JUMP_IF_FALSE);
+    }
+
     void patchJump(CompilerInstance* compiler, int offset) {
         int jump = currentChunk(compiler)->code.size() - offset - 2;
         if (jump > UINT16_MAX) {
@@ -686,6 +955,7 @@ namespace cxxx {
         }
         currentChunk(compiler)->code[offset] = (jump >> 8) & 0xff;
         currentChunk(compiler)->code[offset + 1] = jump & 0xff;
+        markJumpTarget(compiler);
     }
 
     void declaration(CompilerInstance* compiler);
@@ -800,15 +1070,13 @@ namespace cxxx {
                     int jumpToEnd = emitJump(compiler, OP_JUMP);
                     switchLoop.breakJumps.push_back(jumpToEnd);
                     patchJump(compiler, previousCaseSkip);
-                    emitByte(compiler, OP_POP);
                 }
                 if (type == TOKEN_CASE) {
                     emitBytes(compiler, OP_GET_LOCAL, (uint8_t)(compiler->compiler->localCount - 1));
                     expression(compiler);
                     consume(compiler, TOKEN_COLON, "Expect ':' after case value.");
                     emitByte(compiler, OP_EQUAL);
-                    previousCaseSkip = emitJump(compiler, OP_JUMP_IF_FALSE);
-                    emitByte(compiler, OP_POP);
+                    previousCaseSkip = emitJumpIfFalse(compiler);
                 } else {
                     consume(compiler, TOKEN_COLON, "Expect ':' after default.");
                     previousCaseSkip = -1;
@@ -819,7 +1087,6 @@ namespace cxxx {
         }
         if (previousCaseSkip != -1) {
              patchJump(compiler, previousCaseSkip);
-             emitByte(compiler, OP_POP);
         }
         consume(compiler, TOKEN_RIGHT_BRACE, "Expect '}' after switch cases.");
         endLoop(compiler);
@@ -828,18 +1095,17 @@ namespace cxxx {
 
     void whileStatement(CompilerInstance* compiler) {
         int loopStart = currentChunk(compiler)->code.size();
+        markJumpTarget(compiler);
         Loop loop;
         beginLoop(compiler, &loop);
         loop.start = loopStart;
         consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
         expression(compiler);
         consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-        int exitJump = emitJump(compiler, OP_JUMP_IF_FALSE);
-        emitByte(compiler, OP_POP);
+        int exitJump = emitJumpIfFalse(compiler);
         statement(compiler);
         emitLoop(compiler, loopStart);
         patchJump(compiler, exitJump);
-        emitByte(compiler, OP_POP);
         endLoop(compiler);
     }
 
@@ -854,6 +1120,7 @@ namespace cxxx {
             expressionStatement(compiler);
         }
         int loopStart = currentChunk(compiler)->code.size();
+        markJumpTarget(compiler);
         Loop loop;
         beginLoop(compiler, &loop);
         loop.start = loopStart;
@@ -861,14 +1128,14 @@ namespace cxxx {
         if (!match(compiler, TOKEN_SEMICOLON)) {
             expression(compiler);
             consume(compiler, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
-            exitJump = emitJump(compiler, OP_JUMP_IF_FALSE);
-            emitByte(compiler, OP_POP);
+            exitJump = emitJumpIfFalse(compiler);
         }
         if (!match(compiler, TOKEN_RIGHT_PAREN)) {
             int bodyJump = emitJump(compiler, OP_JUMP);
             int incrementStart = currentChunk(compiler)->code.size();
+            markJumpTarget(compiler);
             expression(compiler);
-            emitByte(compiler, OP_POP);
+            emitPop(compiler);
             consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
             emitLoop(compiler, loopStart);
             loopStart = incrementStart;
@@ -879,7 +1146,6 @@ namespace cxxx {
         emitLoop(compiler, loopStart);
         if (exitJump != -1) {
             patchJump(compiler, exitJump);
-            emitByte(compiler, OP_POP);
         }
         endLoop(compiler);
         endScope(compiler);
@@ -889,12 +1155,10 @@ namespace cxxx {
         consume(compiler, TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
         expression(compiler);
         consume(compiler, TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-        int thenJump = emitJump(compiler, OP_JUMP_IF_FALSE);
-        emitByte(compiler, OP_POP);
+        int thenJump = emitJumpIfFalse(compiler);
         statement(compiler);
         int elseJump = emitJump(compiler, OP_JUMP);
         patchJump(compiler, thenJump);
-        emitByte(compiler, OP_POP);
         if (match(compiler, TOKEN_ELSE)) {
             statement(compiler);
         }
@@ -910,6 +1174,18 @@ namespace cxxx {
         } else {
             expression(compiler);
             consume(compiler, TOKEN_SEMICOLON, "Expect ';' after return value.");
+            // `return f(...)`, `return this.m(...)`, `return super.m(...)`:
+            // the call is the last thing this frame does, so let the callee
+            // have it. A jump landing on the OP_RETURN below does not matter;
+            // the call itself stays where it is.
+            scanInstructions(compiler);
+            int last = compiler->compiler->recentInstructions[0];
+            if (last >= 0) {
+                uint8_t& op = currentChunk(compiler)->code[last];
+                if (op == OP_CALL) op = OP_TAIL_CALL;
+                else if (op == OP_INVOKE) op = OP_TAIL_INVOKE;
+                else if (op == OP_SUPER_INVOKE) op = OP_TAIL_SUPER_INVOKE;
+            }
             emitByte(compiler, OP_RETURN);
         }
     }
@@ -944,17 +1220,24 @@ namespace cxxx {
         Compiler compiler;
         compiler.enclosing = compilerInstance->compiler;
         compiler.function = allocateFunction(compilerInstance->vm);
+        // Keep the function alive until it is stored in the enclosing chunk.
+        compilerInstance->vm->pushRoot((Obj*)compiler.function);
         compiler.type = type;
         compiler.localCount = 0;
         compiler.upvalueCount = 0;
         compiler.scopeDepth = 0;
         compiler.loop = nullptr;
+        forgetInstructions(&compiler, 0);
+        compiler.jumpTarget = 0;
         compilerInstance->compiler = &compiler;
 
         if (type != TYPE_SCRIPT) {
-            compiler.function->name = copyString(compilerInstance->vm,
+            ObjString* name = copyString(compilerInstance->vm,
                 compilerInstance->parser.previous.start,
                 compilerInstance->parser.previous.length);
+            StoreGuard guard(compilerInstance->vm);
+            compiler.function->name = name;
+            compilerInstance->vm->writeBarrier((Obj*)compiler.function, (Obj*)name);
         }
 
         Local* local = &compiler.locals[compiler.localCount++];
@@ -973,7 +1256,7 @@ namespace cxxx {
                 if (compiler.function->arity > 255) {
                     errorAtCurrent(compilerInstance, "Can't have more than 255 parameters.");
                 }
-                uint8_t constant = parseVariable(compilerInstance, "Expect parameter name.");
+                uint16_t constant = parseVariable(compilerInstance, "Expect parameter name.");
                 defineVariable(compilerInstance, constant);
             } while (match(compilerInstance, TOKEN_COMMA));
         }
@@ -984,6 +1267,7 @@ namespace cxxx {
         ObjFunction* function = compiler.function;
         function->upvalueCount = compiler.upvalueCount;
         emitReturn(compilerInstance);
+        measureStack(compilerInstance, function);
 
         compilerInstance->compiler = compiler.enclosing;
 
@@ -994,6 +1278,7 @@ namespace cxxx {
                  emitByte(compilerInstance, compiler.upvalues[i].index);
              }
         }
+        compilerInstance->vm->popRoot();
     }
 
     void method(CompilerInstance* compiler) {
@@ -1013,9 +1298,13 @@ namespace cxxx {
         Token className = compiler->parser.previous;
         uint8_t nameConstant = identifierConstant(compiler, &className);
         declareVariable(compiler);
+        uint16_t global = 0;
+        if (compiler->compiler->scopeDepth == 0 && compiler->compiler->type == TYPE_SCRIPT) {
+            global = globalSlot(compiler, &className);
+        }
 
         emitBytes(compiler, OP_CLASS, nameConstant);
-        defineVariable(compiler, nameConstant);
+        defineVariable(compiler, global);
 
         ClassCompiler classCompiler;
         classCompiler.enclosing = compiler->currentClass;
@@ -1050,7 +1339,7 @@ namespace cxxx {
     }
 
     void funDeclaration(CompilerInstance* compiler) {
-        uint8_t global = parseVariable(compiler, "Expect function name.");
+        uint16_t global = parseVariable(compiler, "Expect function name.");
         markInitialized(compiler);
         function(compiler, TYPE_FUNCTION);
         defineVariable(compiler, global);
@@ -1100,11 +1389,14 @@ namespace cxxx {
         Compiler compiler;
         compiler.enclosing = nullptr;
         compiler.function = allocateFunction(vm);
+        vm->pushRoot((Obj*)compiler.function);
         compiler.type = TYPE_SCRIPT;
         compiler.localCount = 0;
         compiler.upvalueCount = 0;
         compiler.scopeDepth = 0;
         compiler.loop = nullptr;
+        forgetInstructions(&compiler, 0);
+        compiler.jumpTarget = 0;
 
         Local* local = &compiler.locals[compiler.localCount++];
         local->depth = 0;
@@ -1122,12 +1414,14 @@ namespace cxxx {
         }
 
         emitReturn(&compilerInstance);
+        measureStack(&compilerInstance, compiler.function);
+        vm->popRoot();
 
         ObjFunction* function = compilerInstance.parser.hadError ? nullptr : compiler.function;
 
         #ifdef DEBUG_PRINT_CODE
         if (!compilerInstance.parser.hadError) {
-            function->chunk.disassemble(function->name != nullptr ? function->name->str.c_str() : "<script>");
+            function->chunk.disassemble(function->name != nullptr ? function->name->chars() : "<script>");
         }
         #endif
 
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <cstdint>
+#include <cstring>
 
 namespace cxxx {
 
@@ -16,12 +17,76 @@ namespace cxxx {
         VAL_BOOL,
         VAL_NIL,
         VAL_NUMBER,
-        VAL_OBJ
+        VAL_OBJ,
+        VAL_UNDEFINED // Internal: an unassigned global slot; never seen by scripts
     };
 
     // Forward declaration for Object (opaque to user)
     struct Obj;
 
+#ifdef CXXX_NAN_BOXING
+    // NaN-boxed representation: every Value is a single 64-bit word.
+    // Doubles are stored as-is. Everything else lives in the payload of a
+    // quiet NaN: nil/false/true use small tags, and objects set the sign
+    // bit and store the pointer in the low 48 bits.
+    struct Value {
+        uint64_t bits;
+
+        static constexpr uint64_t SIGN_BIT = 0x8000000000000000ull;
+        static constexpr uint64_t QNAN = 0x7ffc000000000000ull;
+        static constexpr uint64_t TAG_NIL = 1;
+        static constexpr uint64_t TAG_FALSE = 2;
+        static constexpr uint64_t TAG_TRUE = 3;
+        static constexpr uint64_t TAG_UNDEFINED = 4;
+
+        bool isBool() const { return (bits | 1) == (QNAN | TAG_TRUE); }
+        bool isNil() const { return bits == (QNAN | TAG_NIL); }
+        bool isNumber() const { return (bits & QNAN) != QNAN; }
+        bool isObj() const { return (bits & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT); }
+        bool isUndefined() const { return bits == (QNAN | TAG_UNDEFINED); }
+
+        double asNumber() const {
+            double number;
+            std::memcpy(&number, &bits, sizeof(double));
+            return number;
+        }
+        bool asBool() const { return bits == (QNAN | TAG_TRUE); }
+        Obj* asObj() const { return (Obj*)(uintptr_t)(bits & ~(SIGN_BIT | QNAN)); }
+
+        static Value boolean(bool value) {
+            Value v;
+            v.bits = QNAN | (value ? TAG_TRUE : TAG_FALSE);
+            return v;
+        }
+
+        static Value nil() {
+            Value v;
+            v.bits = QNAN | TAG_NIL;
+            return v;
+        }
+
+        static Value undefined() {
+            Value v;
+            v.bits = QNAN | TAG_UNDEFINED;
+            return v;
+        }
+
+        static Value number(double value) {
+            Value v;
+            std::memcpy(&v.bits, &value, sizeof(double));
+            return v;
+        }
+
+        static Value object(Obj* object) {
+            Value v;
+            v.bits = SIGN_BIT | QNAN | (uint64_t)(uintptr_t)object;
+            return v;
+        }
+    };
+
+    static_assert(sizeof(Value) == 8, "NaN-boxed Value must be one machine word");
+#else
+    // Tagged-union representation (default): a type tag plus a payload.
     struct Value {
         ValueType type;
         union {
@@ -34,6 +99,7 @@ namespace cxxx {
         bool isNil() const { return type == VAL_NIL; }
         bool isNumber() const { return type == VAL_NUMBER; }
         bool isObj() const { return type == VAL_OBJ; }
+        bool isUndefined() const { return type == VAL_UNDEFINED; }
 
         double asNumber() const { return as.number; }
         bool asBool() const { return as.boolean; }
@@ -53,6 +119,13 @@ namespace cxxx {
             return v;
         }
 
+        static Value undefined() {
+            Value v;
+            v.type = VAL_UNDEFINED;
+            v.as.number = 0;
+            return v;
+        }
+
         static Value number(double value) {
             Value v;
             v.type = VAL_NUMBER;
@@ -67,6 +140,7 @@ namespace cxxx {
             return v;
         }
     };
+#endif
 
     // Native function pointer type
     // We pass void* vm to allow native functions to allocate objects.
@@ -79,6 +153,17 @@ namespace cxxx {
 
         InterpretResult interpret(const std::string& source);
 
+        // Precompiled scripts. compileToFile() compiles `source` without
+        // running it and writes the bytecode to `path` (conventionally a
+        // .cxxc file), returning false on a compile or I/O error.
+        // interpretCompiled() runs such a file, or an in-memory copy of one,
+        // without scanning or compiling; it returns COMPILE_ERROR if the
+        // bytecode cannot be loaded. Files need not be trusted: a damaged
+        // one is rejected or stops with RUNTIME_ERROR.
+        bool compileToFile(const std::string& source, const std::string& path);
+        InterpretResult interpretCompiled(const std::string& path);
+        InterpretResult interpretCompiled(const void* data, size_t size);
+
         // For testing/debugging, return the last computation result as double.
         // Returns 0.0 if not a number or stack empty.
         double getResult();
@@ -95,6 +180,50 @@ namespace cxxx {
 
         void registerFunction(const char* name, NativeFn fn);
 
+        // Garbage collection. A collection runs automatically once the bytes
+        // allocated exceed the current threshold; afterwards the threshold is
+        // reset to (live bytes * growth factor), but never below the value
+        // given to setGCThreshold(). Defaults: 1 MiB and 2.0.
+        // In between, every `nursery` bytes of new objects (default 256 KiB)
+        // trigger a minor collection that only looks at objects allocated
+        // since the last one; 0 disables minor collections.
+        //
+        // With a nonzero slice budget a full collection no longer stops the
+        // program for its whole length: it runs in slices, each tracing or
+        // sweeping at most `objects` objects, spread over the allocations
+        // that follow. 0 (the default) collects in one pause.
+        //
+        // Concurrent marking moves the tracing of a full collection to a
+        // helper thread while the script keeps running; the script only
+        // pauses to start the cycle, to rescan its stack at the end of
+        // marking, and to sweep (in slices, given a slice budget). Off by
+        // default.
+        //
+        // A full collection that stops the program marks and sweeps on
+        // `threads` threads (default 1, at most 64); the helper threads are
+        // started on first use and sleep between collections.
+        //
+        // With lazy sweeping, a full collection ends once it has marked:
+        // dead objects are freed block by block as later allocations need
+        // the room, and minor collections carry on meanwhile. Off by
+        // default.
+        void collectGarbage();
+        size_t getBytesAllocated();
+        void setGCThreshold(size_t bytes);
+        void setGCGrowthFactor(double factor);
+        void setGCNurserySize(size_t bytes);
+        void setGCSliceBudget(size_t objects);
+        void setGCConcurrent(bool enabled);
+        void setGCThreads(int threads);
+        void setGCLazySweep(bool enabled);
+
+        // Baseline JIT. Off by default; when on, functions that have run
+        // `threshold` calls plus loop iterations (default 1000) are compiled
+        // to native code. setJITEnabled() returns whether the JIT is now on,
+        // which is always false on platforms it does not support.
+        bool setJITEnabled(bool enabled);
+        void setJITThreshold(int threshold);
+
         // Internal: load stdlib
         void loadStdLib();
 
@@ -4,7 +4,10 @@
 #include "object.h"
 #include "../compiler/compiler.h"
 #include "chunk.h"
+#include "jit.h"
+#include "bytecode.h"
 #include <iostream>
+#include <fstream>
 #include <cstring>
 
 namespace cxxx {
@@ -22,33 +25,61 @@ namespace cxxx {
         delete (VM*)vm;
     }
 
-    InterpretResult CXXX::interpret(const std::string& source) {
-        VM* v = (VM*)vm;
-
-        ObjFunction* function = compile(v, source);
+    // Runs a compiled or loaded script and records its result.
+    static InterpretResult runScript(VM* v, ObjFunction* function, double* lastResult) {
         if (function == nullptr) {
             return InterpretResult::COMPILE_ERROR;
         }
 
-        v->push(OBJ_VAL((Obj*)function));
         InterpretResult result = v->interpret(function);
 
         if (result == InterpretResult::OK) {
              if (!v->stackEmpty()) {
                  Value val = v->pop();
                  if (val.isNumber()) {
-                     lastResult = val.asNumber();
+                     *lastResult = val.asNumber();
                  } else {
-                     lastResult = 0.0;
+                     *lastResult = 0.0;
                  }
              } else {
-                 lastResult = 0.0;
+                 *lastResult = 0.0;
              }
         }
 
         return result;
     }
 
+    InterpretResult CXXX::interpret(const std::string& source) {
+        VM* v = (VM*)vm;
+        return runScript(v, compile(v, source), &lastResult);
+    }
+
+    bool CXXX::compileToFile(const std::string& source, const std::string& path) {
+        VM* v = (VM*)vm;
+        ObjFunction* function = compile(v, source);
+        if (function == nullptr) return false;
+
+        std::vector<uint8_t> bytes;
+        writeBytecode(v, function, &bytes);
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+            return false;
+        }
+        file.write((const char*)bytes.data(), (std::streamsize)bytes.size());
+        return (bool)file;
+    }
+
+    InterpretResult CXXX::interpretCompiled(const std::string& path) {
+        VM* v = (VM*)vm;
+        return runScript(v, readBytecodeFile(v, path), &lastResult);
+    }
+
+    InterpretResult CXXX::interpretCompiled(const void* data, size_t size) {
+        VM* v = (VM*)vm;
+        return runScript(v, readBytecode(v, (const uint8_t*)data, size), &lastResult);
+    }
+
     double CXXX::getResult() {
         return lastResult;
     }
@@ -57,7 +88,7 @@ namespace cxxx {
         VM* v = (VM*)vm;
         ObjString* str = copyString(v, name.c_str(), name.length());
         Value val;
-        if (v->globals.get(str, &val)) {
+        if (v->getGlobal(str, &val)) {
             if (val.isNumber()) return val.asNumber();
         }
         return 0.0;
@@ -67,7 +98,7 @@ namespace cxxx {
         VM* v = (VM*)vm;
         ObjString* str = copyString(v, name.c_str(), name.length());
         Value val;
-        if (v->globals.get(str, &val)) {
+        if (v->getGlobal(str, &val)) {
             if (val.isBool()) return val.asBool();
         }
         return false;
@@ -75,8 +106,11 @@ namespace cxxx {
 
     void CXXX::setGlobal(const std::string& name, Value val) {
         VM* v = (VM*)vm;
+        // Interning the name may collect; keep an object value alive meanwhile.
+        if (val.isObj()) v->pushRoot(val.asObj());
         ObjString* str = copyString(v, name.c_str(), name.length());
-        v->globals.set(str, val);
+        v->setGlobal(str, val);
+        if (val.isObj()) v->popRoot();
     }
 
     Value CXXX::createString(const std::string& s) {
@@ -88,6 +122,62 @@ namespace cxxx {
     void CXXX::registerFunction(const char* name, NativeFn fn) {
         VM* v = (VM*)vm;
         ObjString* fnName = copyString(v, name, strlen(name));
-        v->globals.set(fnName, Value::object((Obj*)allocateNative(v, fn)));
+        v->pushRoot((Obj*)fnName);
+        v->setGlobal(fnName, Value::object((Obj*)allocateNative(v, fn)));
+        v->popRoot();
+    }
+
+    void CXXX::collectGarbage() {
+        ((VM*)vm)->collectGarbage();
+    }
+
+    size_t CXXX::getBytesAllocated() {
+        return ((VM*)vm)->bytesAllocated;
+    }
+
+    void CXXX::setGCThreshold(size_t bytes) {
+        VM* v = (VM*)vm;
+        v->gcThreshold = bytes;
+        v->nextGC = bytes;
+    }
+
+    void CXXX::setGCGrowthFactor(double factor) {
+        ((VM*)vm)->gcGrowthFactor = factor;
+    }
+
+    void CXXX::setGCNurserySize(size_t bytes) {
+        ((VM*)vm)->nurserySize = bytes;
+    }
+
+    void CXXX::setGCSliceBudget(size_t objects) {
+        VM* v = (VM*)vm;
+        v->sliceBudget = objects;
+        if (objects == 0 && !v->concurrentMarking) v->finishCycle();
+    }
+
+    void CXXX::setGCConcurrent(bool enabled) {
+        VM* v = (VM*)vm;
+        v->finishCycle();
+        v->concurrentMarking = enabled;
+    }
+
+    void CXXX::setGCThreads(int threads) {
+        if (threads < 1) threads = 1;
+        if (threads > GC_THREADS_MAX) threads = GC_THREADS_MAX;
+        ((VM*)vm)->gcThreads = threads;
+    }
+
+    void CXXX::setGCLazySweep(bool enabled) {
+        ((VM*)vm)->lazySweep = enabled;
+    }
+
+    bool CXXX::setJITEnabled(bool enabled) {
+        VM* v = (VM*)vm;
+        v->jitEnabled = enabled && jitAvailable();
+        return v->jitEnabled;
+    }
+
+    void CXXX::setJITThreshold(int threshold) {
+        ((VM*)vm)->jitThreshold = threshold;
     }
 }
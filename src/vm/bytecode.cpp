@@ -0,0 +1,541 @@
+#include "bytecode.h"
+#include "vm.h"
+#include "object.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace cxxx {
+
+    static const char BYTECODE_MAGIC[4] = { 'C', 'X', 'X', 'C' };
+
+    // Nested functions are read recursively; a real script never gets close.
+    #define BYTECODE_MAX_DEPTH 256
+
+    enum ConstantTag : uint8_t {
+        CONSTANT_NIL,
+        CONSTANT_FALSE,
+        CONSTANT_TRUE,
+        CONSTANT_NUMBER,
+        CONSTANT_STRING,
+        CONSTANT_FUNCTION
+    };
+
+    static bool isGlobalOp(uint8_t op) {
+        return op == OP_DEFINE_GLOBAL || op == OP_GET_GLOBAL ||
+               op == OP_SET_GLOBAL || op == OP_SET_GLOBAL_POP;
+    }
+
+    namespace {
+
+        class BytecodeWriter {
+        public:
+            explicit BytecodeWriter(VM* vm) : vm(vm) {}
+
+            void write(ObjFunction* script, std::vector<uint8_t>* out) {
+                // The tables are only complete once the whole tree is seen.
+                function(script);
+
+                std::vector<uint8_t> body;
+                body.swap(bytes);
+                raw(BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+                u16(BYTECODE_VERSION);
+                u16(0);
+                u32((uint32_t)strings.size());
+                for (ObjString* string : strings) {
+                    u32((uint32_t)string->length);
+                    raw(string->chars(), string->length);
+                }
+                u32((uint32_t)globals.size());
+                for (uint32_t name : globals) u32(name);
+                bytes.insert(bytes.end(), body.begin(), body.end());
+                out->swap(bytes);
+            }
+
+        private:
+            VM* vm;
+            std::vector<uint8_t> bytes;
+            std::vector<ObjString*> strings;
+            std::unordered_map<ObjString*, uint32_t> stringIndices;
+            std::vector<uint32_t> globals; // String index of each global's name
+            std::unordered_map<int, uint16_t> globalIndices; // VM slot -> file index
+
+            void raw(const void* data, size_t length) {
+                const uint8_t* start = (const uint8_t*)data;
+                bytes.insert(bytes.end(), start, start + length);
+            }
+            void u8(uint8_t value) { bytes.push_back(value); }
+            void u16(uint16_t value) {
+                u8((uint8_t)value);
+                u8((uint8_t)(value >> 8));
+            }
+            void u32(uint32_t value) {
+                for (int i = 0; i < 4; i++) u8((uint8_t)(value >> (8 * i)));
+            }
+            void f64(double value) {
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(double));
+                for (int i = 0; i < 8; i++) u8((uint8_t)(bits >> (8 * i)));
+            }
+
+            uint32_t string(ObjString* string) {
+                auto found = stringIndices.find(string);
+                if (found != stringIndices.end()) return found->second;
+                uint32_t index = (uint32_t)strings.size();
+                strings.push_back(string);
+                stringIndices[string] = index;
+                return index;
+            }
+
+            uint16_t global(int slot) {
+                auto found = globalIndices.find(slot);
+                if (found != globalIndices.end()) return found->second;
+                uint16_t index = (uint16_t)globals.size();
+                globals.push_back(string(vm->globalNames[slot]));
+                globalIndices[slot] = index;
+                return index;
+            }
+
+            void function(ObjFunction* function) {
+                Chunk& chunk = function->chunk;
+                u32(function->name == nullptr ? 0 : string(function->name) + 1);
+                u32((uint32_t)function->arity);
+                u32((uint32_t)function->upvalueCount);
+
+                u32((uint32_t)chunk.constants.size());
+                for (Value constant : chunk.constants) {
+                    if (constant.isNil()) {
+                        u8(CONSTANT_NIL);
+                    } else if (constant.isBool()) {
+                        u8(constant.asBool() ? CONSTANT_TRUE : CONSTANT_FALSE);
+                    } else if (constant.isNumber()) {
+                        u8(CONSTANT_NUMBER);
+                        f64(constant.asNumber());
+                    } else if (isObjType(constant, OBJ_STRING)) {
+                        u8(CONSTANT_STRING);
+                        u32(string((ObjString*)constant.asObj()));
+                    } else {
+                        u8(CONSTANT_FUNCTION);
+                        this->function((ObjFunction*)constant.asObj());
+                    }
+                }
+
+                std::vector<uint8_t> code = chunk.code;
+                for (int offset = 0; offset < (int)code.size(); offset += chunk.instructionLength(offset)) {
+                    uint8_t op = code[offset];
+                    if (op == OP_ADD_NUM) {
+                        code[offset] = OP_ADD;
+                    } else if (op == OP_CALL_CLOSURE) {
+                        code[offset] = OP_CALL;
+                    } else if (isGlobalOp(op)) {
+                        uint16_t index = global(code[offset + 1] << 8 | code[offset + 2]);
+                        code[offset + 1] = (uint8_t)(index >> 8);
+                        code[offset + 2] = (uint8_t)index;
+                    }
+                }
+                u32((uint32_t)code.size());
+                raw(code.data(), code.size());
+
+                std::vector<std::pair<int, uint32_t>> runs;
+                for (int line : chunk.lines) {
+                    if (!runs.empty() && runs.back().first == line) {
+                        runs.back().second++;
+                    } else {
+                        runs.push_back({ line, 1 });
+                    }
+                }
+                u32((uint32_t)runs.size());
+                for (auto& run : runs) {
+                    u32((uint32_t)run.first);
+                    u32(run.second);
+                }
+
+                u32((uint32_t)chunk.inlineCaches.size());
+            }
+        };
+
+        class BytecodeReader {
+        public:
+            BytecodeReader(VM* vm, const uint8_t* data, size_t size)
+                : vm(vm), data(data), size(size), position(0), roots(0) {}
+
+            ObjFunction* read() {
+                ObjFunction* script = nullptr;
+                if (!header() || !stringTable() || !globalTable() || !function(0, &script)) {
+                    script = nullptr;
+                } else if (position != size) {
+                    script = nullptr;
+                    fail("trailing data");
+                } else {
+                    // Only a file that loads completely defines globals.
+                    for (ObjString* name : newGlobals) vm->globalSlot(name);
+                }
+                while (roots > 0) {
+                    vm->popRoot();
+                    roots--;
+                }
+                return script;
+            }
+
+        private:
+            VM* vm;
+            const uint8_t* data;
+            size_t size;
+            size_t position;
+            int roots; // Objects pushed with pushRoot() while loading
+            std::vector<ObjString*> strings;
+            std::vector<uint16_t> globals; // File index -> VM slot
+            // Names the VM has no slot for yet, in the order globalSlot()
+            // will give them slots once the file has loaded.
+            std::vector<ObjString*> newGlobals;
+
+            bool fail(const char* reason) {
+                std::cerr << "Invalid bytecode: " << reason << "." << std::endl;
+                return false;
+            }
+
+            bool has(size_t length) { return size - position >= length; }
+
+            bool u8(uint8_t* value) {
+                if (!has(1)) return false;
+                *value = data[position++];
+                return true;
+            }
+            bool u16(uint16_t* value) {
+                if (!has(2)) return false;
+                *value = (uint16_t)(data[position] | data[position + 1] << 8);
+                position += 2;
+                return true;
+            }
+            bool u32(uint32_t* value) {
+                if (!has(4)) return false;
+                *value = 0;
+                for (int i = 0; i < 4; i++) *value |= (uint32_t)data[position + i] << (8 * i);
+                position += 4;
+                return true;
+            }
+            bool f64(double* value) {
+                if (!has(8)) return false;
+                uint64_t bits = 0;
+                for (int i = 0; i < 8; i++) bits |= (uint64_t)data[position + i] << (8 * i);
+                std::memcpy(value, &bits, sizeof(double));
+                position += 8;
+                return true;
+            }
+            bool stringIndex(ObjString** string) {
+                uint32_t index;
+                if (!u32(&index) || index >= strings.size()) return false;
+                *string = strings[index];
+                return true;
+            }
+
+            bool header() {
+                uint16_t version, reserved;
+                if (!has(sizeof(BYTECODE_MAGIC)) ||
+                    std::memcmp(data, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) != 0) {
+                    return fail("not a CXXX bytecode file");
+                }
+                position += sizeof(BYTECODE_MAGIC);
+                if (!u16(&version) || !u16(&reserved)) return fail("truncated header");
+                if (version != BYTECODE_VERSION) {
+                    std::cerr << "Invalid bytecode: version " << version << ", expected "
+                              << BYTECODE_VERSION << "." << std::endl;
+                    return false;
+                }
+                return true;
+            }
+
+            bool stringTable() {
+                uint32_t count;
+                if (!u32(&count) || count > size) return fail("truncated string table");
+                for (uint32_t i = 0; i < count; i++) {
+                    uint32_t length;
+                    if (!u32(&length) || !has(length)) return fail("truncated string table");
+                    ObjString* string = copyString(vm, (const char*)data + position, (int)length);
+                    vm->pushRoot((Obj*)string);
+                    roots++;
+                    strings.push_back(string);
+                    position += length;
+                }
+                return true;
+            }
+
+            bool globalTable() {
+                uint32_t count;
+                if (!u32(&count) || count > UINT16_MAX + 1) return fail("bad global table");
+                std::unordered_map<ObjString*, int> pending;
+                for (uint32_t i = 0; i < count; i++) {
+                    ObjString* name;
+                    if (!stringIndex(&name)) return fail("bad global table");
+                    Value existing;
+                    int slot;
+                    if (vm->globalSlots.get(name, &existing)) {
+                        slot = (int)existing.asNumber();
+                    } else {
+                        auto found = pending.find(name);
+                        if (found != pending.end()) {
+                            slot = found->second;
+                        } else {
+                            slot = (int)(vm->globalValues.size() + newGlobals.size());
+                            pending[name] = slot;
+                            newGlobals.push_back(name);
+                        }
+                    }
+                    if (slot > UINT16_MAX) return fail("too many global variables");
+                    globals.push_back((uint16_t)slot);
+                }
+                return true;
+            }
+
+            bool function(int depth, ObjFunction** out) {
+                if (depth > BYTECODE_MAX_DEPTH) return fail("functions nested too deeply");
+                ObjFunction* function = allocateFunction(vm);
+                vm->pushRoot((Obj*)function);
+                roots++;
+                Chunk& chunk = function->chunk;
+
+                uint32_t name, arity, upvalueCount;
+                if (!u32(&name) || !u32(&arity) || !u32(&upvalueCount)) return fail("truncated function");
+                if (name > strings.size() || arity > 255 || upvalueCount > 256) return fail("bad function header");
+                {
+                    StoreGuard guard(vm);
+                    function->name = name == 0 ? nullptr : strings[name - 1];
+                    vm->writeBarrier((Obj*)function, (Obj*)function->name);
+                }
+                function->arity = (int)arity;
+                function->upvalueCount = (int)upvalueCount;
+
+                uint32_t constantCount;
+                if (!u32(&constantCount) || constantCount > 256) return fail("bad constant table");
+                for (uint32_t i = 0; i < constantCount; i++) {
+                    uint8_t tag;
+                    if (!u8(&tag)) return fail("truncated constant table");
+                    Value constant;
+                    switch (tag) {
+                        case CONSTANT_NIL: constant = NIL_VAL(); break;
+                        case CONSTANT_FALSE: constant = BOOL_VAL(false); break;
+                        case CONSTANT_TRUE: constant = BOOL_VAL(true); break;
+                        case CONSTANT_NUMBER: {
+                            double number;
+                            if (!f64(&number)) return fail("truncated constant table");
+                            constant = NUMBER_VAL(number);
+                            break;
+                        }
+                        case CONSTANT_STRING: {
+                            ObjString* string;
+                            if (!stringIndex(&string)) return fail("bad string constant");
+                            constant = OBJ_VAL((Obj*)string);
+                            break;
+                        }
+                        case CONSTANT_FUNCTION: {
+                            // Stays rooted until the whole file is loaded.
+                            ObjFunction* nested;
+                            if (!this->function(depth + 1, &nested)) return false;
+                            constant = OBJ_VAL((Obj*)nested);
+                            break;
+                        }
+                        default:
+                            return fail("unknown constant type");
+                    }
+                    StoreGuard guard(vm);
+                    chunk.addConstant(constant);
+                    vm->writeBarrier((Obj*)function, constant);
+                }
+
+                uint32_t codeLength;
+                if (!u32(&codeLength) || !has(codeLength)) return fail("truncated code");
+                chunk.code.assign(data + position, data + position + codeLength);
+                position += codeLength;
+
+                uint32_t runCount;
+                if (!u32(&runCount)) return fail("truncated line table");
+                for (uint32_t i = 0; i < runCount; i++) {
+                    uint32_t line, length;
+                    if (!u32(&line) || !u32(&length) || length > codeLength - chunk.lines.size()) {
+                        return fail("bad line table");
+                    }
+                    chunk.lines.insert(chunk.lines.end(), length, (int)line);
+                }
+                if (chunk.lines.size() != codeLength) return fail("bad line table");
+
+                uint32_t cacheCount;
+                if (!u32(&cacheCount) || cacheCount > UINT16_MAX + 1) return fail("bad inline cache count");
+                for (uint32_t i = 0; i < cacheCount; i++) chunk.addInlineCache();
+
+                if (!verifyCode(function)) return false;
+                // Also checks the local slots closures capture.
+                function->maxStack = chunk.maxStackDepth(function->arity + 1);
+                if (function->maxStack < 0) return fail("inconsistent stack depth");
+                *out = function;
+                return true;
+            }
+
+            // Checks every operand the VM and JIT trust the compiler to get
+            // right, and rewrites global operands to this VM's slots. Local
+            // slot operands are left to Chunk::maxStackDepth(); the types of
+            // stack values are left to the instructions that use them.
+            bool verifyCode(ObjFunction* function) {
+                Chunk& chunk = function->chunk;
+                std::vector<uint8_t>& code = chunk.code;
+                int length = (int)code.size();
+                std::vector<bool> starts(length + 1, false);
+                std::vector<int> targets;
+
+                int offset = 0;
+                while (offset < length) {
+                    starts[offset] = true;
+                    uint8_t op = code[offset];
+                    // Quickened forms are never written.
+                    if (op > OP_CALL_CLOSURE || op == OP_ADD_NUM || op == OP_CALL_CLOSURE) {
+                        return fail("unknown opcode");
+                    }
+                    if (op == OP_CLOSURE) {
+                        if (offset + 1 >= length || code[offset + 1] >= chunk.constants.size() ||
+                            !isObjType(chunk.constants[code[offset + 1]], OBJ_FUNCTION)) {
+                            return fail("bad closure operand");
+                        }
+                    }
+                    int next = offset + chunk.instructionLength(offset);
+                    if (next > length) return fail("truncated instruction");
+                    if (op == OP_CLOSURE) {
+                        // (isLocal, index) pairs: a local of this frame or
+                        // one of this function's own upvalues.
+                        for (int i = offset + 2; i < next; i += 2) {
+                            if (code[i] > 1 || (!code[i] && code[i + 1] >= function->upvalueCount)) {
+                                return fail("bad upvalue capture");
+                            }
+                        }
+                    }
+
+                    switch (op) {
+                        case OP_CONSTANT:
+                            if (code[offset + 1] >= chunk.constants.size()) return fail("bad constant operand");
+                            break;
+                        case OP_GET_UPVALUE:
+                        case OP_SET_UPVALUE:
+                            if (code[offset + 1] >= function->upvalueCount) return fail("bad upvalue operand");
+                            break;
+                        case OP_LOAD_CONSTANT:
+                            if (code[offset + 2] >= chunk.constants.size()) return fail("bad constant operand");
+                            break;
+                        case OP_ADD_RK:
+                        case OP_SUBTRACT_RK:
+                        case OP_MULTIPLY_RK:
+                        case OP_DIVIDE_RK:
+                            if (code[offset + 3] >= chunk.constants.size()) return fail("bad constant operand");
+                            break;
+                        case OP_LESS_JUMP_IF_FALSE_RK:
+                        case OP_GREATER_JUMP_IF_FALSE_RK:
+                        case OP_EQUAL_JUMP_IF_FALSE_RK:
+                            if (code[offset + 2] >= chunk.constants.size()) return fail("bad constant operand");
+                            targets.push_back(next + (code[offset + 3] << 8 | code[offset + 4]));
+                            break;
+                        case OP_LESS_JUMP_IF_FALSE_RR:
+                        case OP_GREATER_JUMP_IF_FALSE_RR:
+                        case OP_EQUAL_JUMP_IF_FALSE_RR:
+                            targets.push_back(next + (code[offset + 3] << 8 | code[offset + 4]));
+                            break;
+                        case OP_CLASS:
+                        case OP_METHOD:
+                        case OP_GET_SUPER:
+                        case OP_SUPER_INVOKE:
+                        case OP_TAIL_SUPER_INVOKE:
+                        case OP_GET_PROPERTY:
+                        case OP_SET_PROPERTY:
+                        case OP_INVOKE:
+                        case OP_TAIL_INVOKE:
+                            if (code[offset + 1] >= chunk.constants.size() ||
+                                !isObjType(chunk.constants[code[offset + 1]], OBJ_STRING)) {
+                                return fail("bad name operand");
+                            }
+                            if (op == OP_GET_PROPERTY || op == OP_SET_PROPERTY || op == OP_INVOKE || op == OP_TAIL_INVOKE) {
+                                int cache = code[next - 2] << 8 | code[next - 1];
+                                if (cache >= (int)chunk.inlineCaches.size()) return fail("bad inline cache operand");
+                            }
+                            break;
+                        case OP_DEFINE_GLOBAL:
+                        case OP_GET_GLOBAL:
+                        case OP_SET_GLOBAL:
+                        case OP_SET_GLOBAL_POP: {
+                            int index = code[offset + 1] << 8 | code[offset + 2];
+                            if (index >= (int)globals.size()) return fail("bad global operand");
+                            code[offset + 1] = (uint8_t)(globals[index] >> 8);
+                            code[offset + 2] = (uint8_t)globals[index];
+                            break;
+                        }
+                        case OP_JUMP:
+                        case OP_JUMP_IF_FALSE:
+                        case OP_POP_JUMP_IF_FALSE:
+                        case OP_LESS_JUMP_IF_FALSE:
+                            targets.push_back(next + (code[offset + 1] << 8 | code[offset + 2]));
+                            break;
+                        case OP_LOOP:
+                            targets.push_back(next - (code[offset + 1] << 8 | code[offset + 2]));
+                            break;
+                        default:
+                            break;
+                    }
+                    offset = next;
+                }
+                if (length == 0 || code[length - 1] != OP_RETURN) return fail("code does not end in a return");
+                for (int target : targets) {
+                    if (target < 0 || target >= length || !starts[target]) return fail("bad jump target");
+                }
+                return true;
+            }
+        };
+
+    }
+
+    void writeBytecode(VM* vm, ObjFunction* function, std::vector<uint8_t>* out) {
+        BytecodeWriter(vm).write(function, out);
+    }
+
+    ObjFunction* readBytecode(VM* vm, const uint8_t* data, size_t size) {
+        return BytecodeReader(vm, data, size).read();
+    }
+
+    ObjFunction* readBytecodeFile(VM* vm, const std::string& path) {
+#ifndef _WIN32
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) close(fd);
+            std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+            return nullptr;
+        }
+        size_t size = (size_t)info.st_size;
+        if (size == 0) {
+            close(fd);
+            return readBytecode(vm, nullptr, 0);
+        }
+        void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "Could not read file \"" << path << "\"." << std::endl;
+            return nullptr;
+        }
+        ObjFunction* function = readBytecode(vm, (const uint8_t*)data, size);
+        munmap(data, size);
+        return function;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cerr << "Could not open file \"" << path << "\"." << std::endl;
+            return nullptr;
+        }
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return readBytecode(vm, data.data(), data.size());
+#endif
+    }
+
+}
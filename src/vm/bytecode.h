@@ -0,0 +1,52 @@
+#ifndef cxxx_bytecode_h
+#define cxxx_bytecode_h
+
+#include "common.h"
+#include <string>
+#include <vector>
+
+namespace cxxx {
+
+    class VM;
+    struct ObjFunction;
+
+    // Precompiled scripts (.cxxc files). Layout, all integers little-endian:
+    //
+    //   header     "CXXC", u16 version, u16 reserved (0)
+    //   strings    u32 count, then per string: u32 length, bytes
+    //   globals    u32 count, then the u32 string index of each global name
+    //   function   the top-level script, as below
+    //
+    //   function   u32 name (string index + 1, or 0 for the script),
+    //              u32 arity, u32 upvalueCount, constants, code, lines,
+    //              u32 number of inline caches
+    //   constants  u32 count, then per constant a u8 tag (nil, false, true,
+    //              number, string, function) followed by nothing, an f64,
+    //              a u32 string index or a nested function
+    //   code       u32 length, bytes
+    //   lines      u32 number of runs, then (u32 line, u32 length) per run
+    //
+    // Code is stored unquickened. Global operands index the file's globals
+    // table and are remapped to the loading VM's slots by name, so a file
+    // runs in any VM. Bump BYTECODE_VERSION whenever the instruction set or
+    // this layout changes; other versions are rejected.
+    //
+    // Loading verifies every operand and the stack depth at each
+    // instruction, but not the types of the values instructions find on the
+    // stack. The VM checks those where a wrong type would be dereferenced,
+    // so a damaged file is rejected or stops with a runtime error.
+    #define BYTECODE_VERSION 4
+
+    void writeBytecode(VM* vm, ObjFunction* function, std::vector<uint8_t>* out);
+
+    // Rebuilds a script written by writeBytecode(). Returns nullptr, after
+    // reporting why, if `data` is not a valid file of this version.
+    ObjFunction* readBytecode(VM* vm, const uint8_t* data, size_t size);
+
+    // readBytecode() on a file, which is mapped rather than copied where the
+    // platform allows.
+    ObjFunction* readBytecodeFile(VM* vm, const std::string& path);
+
+}
+
+#endif
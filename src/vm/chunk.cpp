@@ -18,6 +18,276 @@ namespace cxxx {
         return constants.size() - 1;
     }
 
+    int Chunk::addInlineCache() {
+        InlineCache cache;
+        cache.count = 0;
+        cache.epoch = 0;
+        cache.shapeCount = 0;
+        inlineCaches.push_back(cache);
+        return inlineCaches.size() - 1;
+    }
+
+    void Chunk::dequicken(int offset, OpCode generic) {
+        if (dequickened.empty()) dequickened.resize(code.size());
+        dequickened[offset] = true;
+        code[offset] = generic;
+    }
+
+    int Chunk::instructionLength(int offset) const {
+        switch (code[offset]) {
+            case OP_CONSTANT:
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_POP:
+            case OP_CALL:
+            case OP_CALL_CLOSURE:
+            case OP_TAIL_CALL:
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_GET_SUPER:
+            case OP_GET_UPVALUE:
+            case OP_SET_UPVALUE:
+                return 2;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_POP_JUMP_IF_FALSE:
+            case OP_LESS_JUMP_IF_FALSE:
+            case OP_LOOP:
+            case OP_DEFINE_GLOBAL:
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_POP:
+            case OP_SUPER_INVOKE:
+            case OP_TAIL_SUPER_INVOKE:
+            case OP_INCREMENT_LOCAL:
+            case OP_MOVE:
+            case OP_LOAD_CONSTANT:
+                return 3;
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+            case OP_ADD_RR:
+            case OP_ADD_RK:
+            case OP_SUBTRACT_RR:
+            case OP_SUBTRACT_RK:
+            case OP_MULTIPLY_RR:
+            case OP_MULTIPLY_RK:
+            case OP_DIVIDE_RR:
+            case OP_DIVIDE_RK:
+                return 4;
+            case OP_LESS_JUMP_IF_FALSE_RR:
+            case OP_LESS_JUMP_IF_FALSE_RK:
+            case OP_GREATER_JUMP_IF_FALSE_RR:
+            case OP_GREATER_JUMP_IF_FALSE_RK:
+            case OP_EQUAL_JUMP_IF_FALSE_RR:
+            case OP_EQUAL_JUMP_IF_FALSE_RK:
+                return 5;
+            case OP_INVOKE:
+            case OP_TAIL_INVOKE:
+                return 5;
+            case OP_CLOSURE: {
+                ObjFunction* function = (ObjFunction*)constants[code[offset + 1]].asObj();
+                return 2 + 2 * function->upvalueCount;
+            }
+            default:
+                return 1;
+        }
+    }
+
+    int Chunk::maxStackDepth(int baseDepth) const {
+        int length = (int)code.size();
+        std::vector<bool> starts(length, false);
+        for (int offset = 0; offset < length; offset += instructionLength(offset)) {
+            starts[offset] = true;
+        }
+
+        // Depth on entry to each instruction, -1 until some path reaches it.
+        std::vector<int> depths(length, -1);
+        std::vector<int> worklist;
+        int maxDepth = baseDepth;
+        std::vector<int> slotOperands;
+        auto reach = [&](int target, int depth) {
+            if (target < 0 || target >= length || !starts[target]) return false;
+            if (depths[target] < 0) {
+                depths[target] = depth;
+                worklist.push_back(target);
+                return true;
+            }
+            return depths[target] == depth;
+        };
+        if (!reach(0, baseDepth)) return -1;
+
+        while (!worklist.empty()) {
+            int offset = worklist.back();
+            worklist.pop_back();
+            int depth = depths[offset];
+            int next = offset + instructionLength(offset);
+            int pops = 0;
+            int pushes = 0;
+            int scratch = 0;  // Pushed and popped again within the instruction
+            int slotLimit = 0; // Local slot operands must be below this
+            bool jumps = false;
+            int target = 0;
+            bool fallsThrough = true;
+            slotOperands.clear();
+
+            switch (code[offset]) {
+                case OP_CONSTANT:
+                case OP_GET_GLOBAL:
+                case OP_CLASS:
+                case OP_GET_UPVALUE:
+                    pushes = 1;
+                    break;
+                case OP_GET_LOCAL:
+                    pushes = 1;
+                    slotOperands.push_back(code[offset + 1]);
+                    break;
+                case OP_NEGATE:
+                case OP_NOT:
+                case OP_SET_GLOBAL:
+                case OP_GET_PROPERTY:
+                case OP_SET_UPVALUE:
+                    pops = 1;
+                    pushes = 1;
+                    break;
+                case OP_SET_LOCAL:
+                    pops = 1;
+                    pushes = 1;
+                    slotOperands.push_back(code[offset + 1]);
+                    break;
+                case OP_ADD:
+                case OP_ADD_NUM:
+                case OP_SUBTRACT:
+                case OP_MULTIPLY:
+                case OP_DIVIDE:
+                case OP_EQUAL:
+                case OP_GREATER:
+                case OP_LESS:
+                case OP_SET_PROPERTY:
+                case OP_INHERIT:
+                case OP_GET_SUPER:
+                case OP_INSTANCEOF:
+                case OP_METHOD:
+                    pops = 2;
+                    pushes = 1;
+                    break;
+                case OP_POP:
+                case OP_DEFINE_GLOBAL:
+                case OP_PRINT:
+                case OP_CLOSE_UPVALUE:
+                case OP_SET_GLOBAL_POP:
+                    pops = 1;
+                    break;
+                case OP_SET_LOCAL_POP:
+                    pops = 1;
+                    slotOperands.push_back(code[offset + 1]);
+                    break;
+                case OP_CALL:
+                case OP_CALL_CLOSURE:
+                case OP_TAIL_CALL: // Leaves a result when the callee is native
+                    pops = code[offset + 1] + 1;
+                    pushes = 1;
+                    break;
+                case OP_INVOKE:
+                case OP_TAIL_INVOKE:
+                    pops = code[offset + 2] + 1;
+                    pushes = 1;
+                    break;
+                case OP_SUPER_INVOKE:
+                case OP_TAIL_SUPER_INVOKE:
+                    pops = code[offset + 2] + 2;
+                    pushes = 1;
+                    break;
+                case OP_CLOSURE: {
+                    pushes = 1;
+                    // A captured local may be the slot the closure itself lands in.
+                    slotLimit = 1;
+                    for (int i = offset + 2; i < next; i += 2) {
+                        if (code[i]) slotOperands.push_back(code[i + 1]);
+                    }
+                    break;
+                }
+                case OP_JUMP:
+                    jumps = true;
+                    target = next + (code[offset + 1] << 8 | code[offset + 2]);
+                    fallsThrough = false;
+                    break;
+                case OP_LOOP:
+                    jumps = true;
+                    target = next - (code[offset + 1] << 8 | code[offset + 2]);
+                    fallsThrough = false;
+                    break;
+                case OP_JUMP_IF_FALSE:
+                    pops = 1;
+                    pushes = 1;
+                    jumps = true;
+                    target = next + (code[offset + 1] << 8 | code[offset + 2]);
+                    break;
+                case OP_POP_JUMP_IF_FALSE:
+                    pops = 1;
+                    jumps = true;
+                    target = next + (code[offset + 1] << 8 | code[offset + 2]);
+                    break;
+                case OP_LESS_JUMP_IF_FALSE:
+                    pops = 2;
+                    jumps = true;
+                    target = next + (code[offset + 1] << 8 | code[offset + 2]);
+                    break;
+                case OP_INCREMENT_LOCAL:
+                    scratch = 2; // A non-number goes through concatenate()
+                    slotOperands.push_back(code[offset + 1]);
+                    break;
+                case OP_MOVE:
+                case OP_LOAD_CONSTANT:
+                case OP_SUBTRACT_RR:
+                case OP_SUBTRACT_RK:
+                case OP_MULTIPLY_RR:
+                case OP_MULTIPLY_RK:
+                case OP_DIVIDE_RR:
+                case OP_DIVIDE_RK:
+                case OP_ADD_RR:
+                case OP_ADD_RK: {
+                    uint8_t op = code[offset];
+                    if (op == OP_ADD_RR || op == OP_ADD_RK) scratch = 2;
+                    slotOperands.push_back(code[offset + 1]);
+                    if (op != OP_LOAD_CONSTANT) slotOperands.push_back(code[offset + 2]);
+                    if (op == OP_ADD_RR || op == OP_SUBTRACT_RR || op == OP_MULTIPLY_RR || op == OP_DIVIDE_RR) {
+                        slotOperands.push_back(code[offset + 3]);
+                    }
+                    break;
+                }
+                case OP_LESS_JUMP_IF_FALSE_RR:
+                case OP_GREATER_JUMP_IF_FALSE_RR:
+                case OP_EQUAL_JUMP_IF_FALSE_RR:
+                    slotOperands.push_back(code[offset + 2]);
+                    // Fall through.
+                case OP_LESS_JUMP_IF_FALSE_RK:
+                case OP_GREATER_JUMP_IF_FALSE_RK:
+                case OP_EQUAL_JUMP_IF_FALSE_RK:
+                    slotOperands.push_back(code[offset + 1]);
+                    jumps = true;
+                    target = next + (code[offset + 3] << 8 | code[offset + 4]);
+                    break;
+                case OP_RETURN:
+                    pops = 1;
+                    fallsThrough = false;
+                    break;
+                default:
+                    return -1;
+            }
+
+            for (int operand : slotOperands) {
+                if (operand >= depth + slotLimit) return -1;
+            }
+            if (depth - pops < 1) return -1; // Slot 0 belongs to the callee.
+            int after = depth - pops + pushes;
+            if (depth + scratch > maxDepth) maxDepth = depth + scratch;
+            if (after > maxDepth) maxDepth = after;
+            if (jumps && !reach(target, after)) return -1;
+            if (fallsThrough && !reach(next, after)) return -1;
+        }
+        return maxDepth;
+    }
+
     void Chunk::disassemble(const char* name) {
         std::cout << "== " << name << " ==" << std::endl;
         for (int offset = 0; offset < code.size();) {
@@ -26,7 +296,9 @@ namespace cxxx {
     }
 
     int Chunk::disassembleInstruction(int offset) {
-        std::cout << std::setw(4) << std::setfill('0') << offset << " ";
+        // Opcode names below are printed left-aligned; reset the stream
+        // state so offsets and line numbers stay right-aligned.
+        std::cout << std::right << std::setw(4) << std::setfill('0') << offset << std::setfill(' ') << " ";
 
         if (offset > 0 && lines[offset] == lines[offset - 1]) {
             std::cout << "   | ";
@@ -53,6 +325,9 @@ namespace cxxx {
             case OP_ADD:
                 std::cout << "OP_ADD" << std::endl;
                 return offset + 1;
+            case OP_ADD_NUM:
+                std::cout << "OP_ADD_NUM" << std::endl;
+                return offset + 1;
             case OP_SUBTRACT:
                 std::cout << "OP_SUBTRACT" << std::endl;
                 return offset + 1;
@@ -86,6 +361,14 @@ namespace cxxx {
                     std::cout << std::left << std::setw(16) << "OP_JUMP_IF_FALSE" << offset << " -> " << offset + 3 + jump << std::endl;
                     return offset + 3;
                 }
+            case OP_POP_JUMP_IF_FALSE:
+            case OP_LESS_JUMP_IF_FALSE:
+                {
+                    uint16_t jump = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
+                    std::cout << (instruction == OP_POP_JUMP_IF_FALSE ? "OP_POP_JUMP_IF_FALSE " : "OP_LESS_JUMP_IF_FALSE ")
+                              << offset << " -> " << offset + 3 + jump << std::endl;
+                    return offset + 3;
+                }
             case OP_LOOP:
                 {
                     uint16_t jump = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
@@ -97,37 +380,172 @@ namespace cxxx {
                 return offset + 1;
             case OP_DEFINE_GLOBAL:
                 {
-                    uint8_t constant = code[offset + 1];
-                    std::cout << std::left << std::setw(16) << "OP_DEFINE_GLOBAL" << (int)constant << " '";
-                    printValue(constants[constant]);
-                    std::cout << "'" << std::endl;
-                    return offset + 2;
+                    uint16_t slot = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
+                    std::cout << std::left << std::setw(16) << "OP_DEFINE_GLOBAL" << " slot " << slot << std::endl;
+                    return offset + 3;
                 }
             case OP_GET_GLOBAL:
                 {
-                    uint8_t constant = code[offset + 1];
-                    std::cout << std::left << std::setw(16) << "OP_GET_GLOBAL" << (int)constant << " '";
-                    printValue(constants[constant]);
-                    std::cout << "'" << std::endl;
-                    return offset + 2;
+                    uint16_t slot = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
+                    std::cout << std::left << std::setw(16) << "OP_GET_GLOBAL" << " slot " << slot << std::endl;
+                    return offset + 3;
                 }
             case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_POP:
                 {
-                    uint8_t constant = code[offset + 1];
-                    std::cout << std::left << std::setw(16) << "OP_SET_GLOBAL" << (int)constant << " '";
+                    uint16_t slot = (uint16_t)((code[offset + 1] << 8) | code[offset + 2]);
+                    std::cout << std::left << std::setw(16)
+                              << (instruction == OP_SET_GLOBAL ? "OP_SET_GLOBAL" : "OP_SET_GLOBAL_POP")
+                              << " slot " << slot << std::endl;
+                    return offset + 3;
+                }
+            case OP_GET_LOCAL:
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_POP:
+                {
+                    uint8_t slot = code[offset + 1];
+                    const char* name = instruction == OP_GET_LOCAL ? "OP_GET_LOCAL"
+                        : instruction == OP_SET_LOCAL ? "OP_SET_LOCAL" : "OP_SET_LOCAL_POP";
+                    std::cout << std::left << std::setw(16) << name << (int)slot << std::endl;
+                    return offset + 2;
+                }
+            case OP_INCREMENT_LOCAL:
+                {
+                    uint8_t slot = code[offset + 1];
+                    int8_t delta = (int8_t)code[offset + 2];
+                    std::cout << "OP_INCREMENT_LOCAL " << (int)slot
+                              << " by " << (int)delta << std::endl;
+                    return offset + 3;
+                }
+            case OP_MOVE:
+                std::cout << std::left << std::setw(16) << "OP_MOVE" << (int)code[offset + 1]
+                          << " <- " << (int)code[offset + 2] << std::endl;
+                return offset + 3;
+            case OP_LOAD_CONSTANT:
+                {
+                    uint8_t constant = code[offset + 2];
+                    std::cout << std::left << std::setw(16) << "OP_LOAD_CONSTANT" << (int)code[offset + 1]
+                              << " <- " << (int)constant << " '";
                     printValue(constants[constant]);
                     std::cout << "'" << std::endl;
-                    return offset + 2;
+                    return offset + 3;
+                }
+            case OP_ADD_RR:
+            case OP_ADD_RK:
+            case OP_SUBTRACT_RR:
+            case OP_SUBTRACT_RK:
+            case OP_MULTIPLY_RR:
+            case OP_MULTIPLY_RK:
+            case OP_DIVIDE_RR:
+            case OP_DIVIDE_RK:
+                {
+                    static const char* const names[] = {
+                        "OP_ADD_RR", "OP_ADD_RK", "OP_SUBTRACT_RR", "OP_SUBTRACT_RK",
+                        "OP_MULTIPLY_RR", "OP_MULTIPLY_RK", "OP_DIVIDE_RR", "OP_DIVIDE_RK"
+                    };
+                    bool constant = (instruction - OP_ADD_RR) % 2 == 1;
+                    std::cout << std::left << std::setw(16) << names[instruction - OP_ADD_RR]
+                              << (int)code[offset + 1] << " <- " << (int)code[offset + 2] << ", ";
+                    if (constant) {
+                        std::cout << "'";
+                        printValue(constants[code[offset + 3]]);
+                        std::cout << "'" << std::endl;
+                    } else {
+                        std::cout << (int)code[offset + 3] << std::endl;
+                    }
+                    return offset + 4;
+                }
+            case OP_LESS_JUMP_IF_FALSE_RR:
+            case OP_LESS_JUMP_IF_FALSE_RK:
+            case OP_GREATER_JUMP_IF_FALSE_RR:
+            case OP_GREATER_JUMP_IF_FALSE_RK:
+            case OP_EQUAL_JUMP_IF_FALSE_RR:
+            case OP_EQUAL_JUMP_IF_FALSE_RK:
+                {
+                    static const char* const names[] = {
+                        "OP_LESS_JUMP_IF_FALSE_RR", "OP_LESS_JUMP_IF_FALSE_RK",
+                        "OP_GREATER_JUMP_IF_FALSE_RR", "OP_GREATER_JUMP_IF_FALSE_RK",
+                        "OP_EQUAL_JUMP_IF_FALSE_RR", "OP_EQUAL_JUMP_IF_FALSE_RK"
+                    };
+                    bool constant = (instruction - OP_LESS_JUMP_IF_FALSE_RR) % 2 == 1;
+                    uint16_t jump = (uint16_t)((code[offset + 3] << 8) | code[offset + 4]);
+                    std::cout << names[instruction - OP_LESS_JUMP_IF_FALSE_RR] << " " << (int)code[offset + 1] << ", ";
+                    if (constant) {
+                        std::cout << "'";
+                        printValue(constants[code[offset + 2]]);
+                        std::cout << "'";
+                    } else {
+                        std::cout << (int)code[offset + 2];
+                    }
+                    std::cout << " " << offset << " -> " << offset + 5 + jump << std::endl;
+                    return offset + 5;
                 }
             case OP_CALL:
+            case OP_CALL_CLOSURE:
+            case OP_TAIL_CALL:
                 {
+                    const char* name = instruction == OP_CALL ? "OP_CALL"
+                                     : instruction == OP_CALL_CLOSURE ? "OP_CALL_CLOSURE" : "OP_TAIL_CALL";
                     uint8_t argCount = code[offset + 1];
-                    std::cout << std::left << std::setw(16) << "OP_CALL" << (int)argCount << std::endl;
+                    std::cout << std::left << std::setw(16) << name << (int)argCount << std::endl;
                     return offset + 2;
                 }
+            case OP_GET_PROPERTY:
+            case OP_SET_PROPERTY:
+                {
+                    uint8_t constant = code[offset + 1];
+                    uint16_t cache = (uint16_t)((code[offset + 2] << 8) | code[offset + 3]);
+                    std::cout << std::left << std::setw(16)
+                              << (instruction == OP_GET_PROPERTY ? "OP_GET_PROPERTY" : "OP_SET_PROPERTY")
+                              << (int)constant << " '";
+                    printValue(constants[constant]);
+                    std::cout << "' ic " << cache << std::endl;
+                    return offset + 4;
+                }
+            case OP_INVOKE:
+            case OP_TAIL_INVOKE:
+                {
+                    uint8_t constant = code[offset + 1];
+                    uint8_t argCount = code[offset + 2];
+                    uint16_t cache = (uint16_t)((code[offset + 3] << 8) | code[offset + 4]);
+                    std::cout << std::left << std::setw(16)
+                              << (instruction == OP_INVOKE ? "OP_INVOKE" : "OP_TAIL_INVOKE") << "(" << (int)argCount << " args) "
+                              << (int)constant << " '";
+                    printValue(constants[constant]);
+                    std::cout << "' ic " << cache << std::endl;
+                    return offset + 5;
+                }
             case OP_PRINT:
                 std::cout << "OP_PRINT" << std::endl;
                 return offset + 1;
+            case OP_CLASS:
+            case OP_METHOD:
+            case OP_GET_SUPER:
+                {
+                    uint8_t constant = code[offset + 1];
+                    const char* name = instruction == OP_CLASS ? "OP_CLASS"
+                        : instruction == OP_METHOD ? "OP_METHOD" : "OP_GET_SUPER";
+                    std::cout << std::left << std::setw(16) << name << (int)constant << " '";
+                    printValue(constants[constant]);
+                    std::cout << "'" << std::endl;
+                    return offset + 2;
+                }
+            case OP_SUPER_INVOKE:
+            case OP_TAIL_SUPER_INVOKE:
+                {
+                    uint8_t constant = code[offset + 1];
+                    uint8_t argCount = code[offset + 2];
+                    std::cout << std::left << std::setw(16)
+                              << (instruction == OP_SUPER_INVOKE ? "OP_SUPER_INVOKE" : "OP_TAIL_SUPER_INVOKE")
+                              << "(" << (int)argCount << " args) "
+                              << (int)constant << " '";
+                    printValue(constants[constant]);
+                    std::cout << "'" << std::endl;
+                    return offset + 3;
+                }
+            case OP_INHERIT:
+                std::cout << "OP_INHERIT" << std::endl;
+                return offset + 1;
             case OP_CLOSURE:
                 {
                     offset++;
@@ -136,11 +554,12 @@ namespace cxxx {
                     printValue(constants[constant]);
                     std::cout << std::endl;
 
-                    ObjFunction* function = (ObjFunction*)constants[constant].as.obj;
+                    ObjFunction* function = (ObjFunction*)constants[constant].asObj();
                     for (int i = 0; i < function->upvalueCount; i++) {
                         int isLocal = code[offset++];
                         int index = code[offset++];
-                        std::cout << std::setw(4) << std::setfill('0') << offset - 2 << "    |                     "
+                        std::cout << std::right << std::setw(4) << std::setfill('0') << offset - 2 << std::setfill(' ')
+                                  << "    |                     "
                                   << (isLocal ? "local" : "upvalue") << " " << index << std::endl;
                     }
                     return offset;
@@ -43,7 +43,66 @@ namespace cxxx {
         OP_GET_UPVALUE,
         OP_SET_UPVALUE,
         OP_CLOSE_UPVALUE,
-        OP_INSTANCEOF
+        OP_INSTANCEOF,
+        OP_TAIL_CALL,          // OP_CALL in return position; the callee reuses the frame
+        OP_TAIL_INVOKE,        // OP_INVOKE in return position, likewise
+        OP_TAIL_SUPER_INVOKE,  // OP_SUPER_INVOKE in return position, likewise
+        // Superinstructions: fused forms of the most frequent opcode
+        // sequences, emitted by the compiler's peephole helpers.
+        OP_POP_JUMP_IF_FALSE,  // OP_JUMP_IF_FALSE that pops the condition on both paths
+        OP_LESS_JUMP_IF_FALSE, // OP_LESS + OP_POP_JUMP_IF_FALSE
+        OP_INCREMENT_LOCAL,    // Slot, signed delta: `i++` / `i--` on a local
+        OP_SET_LOCAL_POP,      // OP_SET_LOCAL + OP_POP
+        OP_SET_GLOBAL_POP,     // OP_SET_GLOBAL + OP_POP
+        // Register forms: three-address instructions that read and write
+        // frame slots directly instead of going through the stack. R is a
+        // slot, K a constant index. Emitted when the compiler is built with
+        // CXXX_REGISTER_VM, but always executable.
+        OP_MOVE,               // A B: slots[A] = slots[B]
+        OP_LOAD_CONSTANT,      // A K: slots[A] = K
+        OP_ADD_RR,             // A B C: slots[A] = slots[B] + slots[C]
+        OP_ADD_RK,             // A B K: slots[A] = slots[B] + K
+        OP_SUBTRACT_RR,
+        OP_SUBTRACT_RK,
+        OP_MULTIPLY_RR,
+        OP_MULTIPLY_RK,
+        OP_DIVIDE_RR,
+        OP_DIVIDE_RK,
+        OP_LESS_JUMP_IF_FALSE_RR,    // B C, 16-bit offset: jump unless slots[B] < slots[C]
+        OP_LESS_JUMP_IF_FALSE_RK,    // B K, 16-bit offset
+        OP_GREATER_JUMP_IF_FALSE_RR,
+        OP_GREATER_JUMP_IF_FALSE_RK,
+        OP_EQUAL_JUMP_IF_FALSE_RR,
+        OP_EQUAL_JUMP_IF_FALSE_RK,
+        // Quickened forms: never emitted by the compiler. The VM rewrites a
+        // generic instruction into one of these in place once it has seen
+        // the operand types, and rewrites it back when the guess fails.
+        OP_ADD_NUM,            // OP_ADD on two numbers
+        OP_CALL_CLOSURE        // OP_CALL of a closure with matching arity
+    };
+
+    struct ObjClass;
+
+    #define INLINE_CACHE_ENTRIES 4
+
+    struct Shape;
+
+    // Per-site cache for OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE.
+    // Holds up to INLINE_CACHE_ENTRIES receiver classes with the method each
+    // one resolved to, and up to INLINE_CACHE_ENTRIES receiver shapes with
+    // the field slot the name lives in (-1 if the shape lacks it). A set
+    // site that adds the field also records the shape it transitions to.
+    // Method entries are only valid while `epoch` matches VM::methodEpoch;
+    // shapes never die, so shape entries stay valid.
+    struct InlineCache {
+        ObjClass* classes[INLINE_CACHE_ENTRIES];
+        Obj* methods[INLINE_CACHE_ENTRIES];
+        int count;
+        uint32_t epoch;
+        Shape* shapes[INLINE_CACHE_ENTRIES];
+        Shape* transitions[INLINE_CACHE_ENTRIES];
+        int fieldIndices[INLINE_CACHE_ENTRIES];
+        int shapeCount;
     };
 
     class Chunk {
@@ -53,10 +112,31 @@ namespace cxxx {
 
         void write(uint8_t byte, int line);
         int addConstant(Value value);
+        int addInlineCache();
 
         std::vector<uint8_t> code;
         std::vector<int> lines;
         std::vector<Value> constants;
+        std::vector<InlineCache> inlineCaches;
+
+        // Quickened sites that had to fall back to their generic form stay
+        // generic: a site that sees both kinds of operand would otherwise
+        // rewrite itself on every change. Indexed by offset, and empty until
+        // the first fallback.
+        std::vector<bool> dequickened;
+
+        bool mayQuicken(int offset) const { return dequickened.empty() || !dequickened[offset]; }
+        // Rewrites the instruction at `offset` back to `generic` for good.
+        void dequicken(int offset, OpCode generic);
+
+        // Size in bytes of the instruction starting at `offset`.
+        int instructionLength(int offset) const;
+
+        // Deepest the stack gets running this code from `baseDepth` values
+        // (the callee and its arguments), or -1 if some path pops below the
+        // callee, reaches a join at two different depths, names a local
+        // slot that does not exist yet, or runs off the end.
+        int maxStackDepth(int baseDepth) const;
 
         // Debugging / Disassembly
         void disassemble(const char* name);
@@ -6,6 +6,17 @@
 #include <stdint.h>
 #include "../include/cxxx.h"
 
+// Marks memory the VM owns but nothing may touch (free pool blocks, dead
+// objects) so AddressSanitizer reports stray accesses.
+#if defined(__SANITIZE_ADDRESS__)
+    #include <sanitizer/asan_interface.h>
+    #define CXXX_POISON(pointer, size) ASAN_POISON_MEMORY_REGION(pointer, size)
+    #define CXXX_UNPOISON(pointer, size) ASAN_UNPOISON_MEMORY_REGION(pointer, size)
+#else
+    #define CXXX_POISON(pointer, size) ((void)(pointer), (void)(size))
+    #define CXXX_UNPOISON(pointer, size) ((void)(pointer), (void)(size))
+#endif
+
 namespace cxxx {
     // Value and NativeFn are now defined in cxxx.h
 }
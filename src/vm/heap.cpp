@@ -0,0 +1,308 @@
+#include "heap.h"
+#include <cstring>
+#include <new>
+
+namespace cxxx {
+
+    Heap::Heap() {
+        youngLarge = nullptr;
+        oldLarge = nullptr;
+        epoch = 1;
+        cursor = nullptr;
+        limit = nullptr;
+        current = nullptr;
+        nextLine = HEAP_LINES;
+        overflowCursor = nullptr;
+        overflowLimit = nullptr;
+        overflow = nullptr;
+        largeObjects = 0;
+        finalizer = nullptr;
+        finalizerOwner = nullptr;
+        sweepIndex = 0;
+        sweepEnd = 0;
+    }
+
+    Heap::~Heap() {
+        for (Block* block : blocks) {
+            CXXX_UNPOISON(block, HEAP_BLOCK_SIZE);
+            block->~Block();
+            ::operator delete(block, std::align_val_t(HEAP_BLOCK_SIZE));
+        }
+        for (LargeChunk** list : {&youngLarge, &oldLarge}) {
+            while (*list != nullptr) {
+                LargeChunk* chunk = *list;
+                *list = chunk->next;
+                ::operator delete(chunk, std::align_val_t(HEAP_BLOCK_SIZE));
+            }
+        }
+    }
+
+    void Heap::setOld(void* object) {
+        Block* block = blockOf(object);
+        if (block->kind == CHUNK_LARGE) {
+            promoteLarge(chunkOf(object));
+        } else {
+            setBit(block->old, object);
+        }
+    }
+
+    void Heap::release(void* object, size_t size) {
+        if (blockOf(object)->kind == CHUNK_LARGE) {
+            LargeChunk* chunk = chunkOf(object);
+            unlinkLarge(chunk);
+            largeObjects--;
+            ::operator delete(chunk, std::align_val_t(HEAP_BLOCK_SIZE));
+            return;
+        }
+        CXXX_POISON(object, (size + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1));
+    }
+
+    // C++17 has no atomic access to plain memory; GCC and Clang have
+    // builtins for it.
+    bool Heap::markAtomic(void* object) {
+        Block* block = blockOf(object);
+        if (block->kind == CHUNK_LARGE) {
+            bool* marked = &chunkOf(object)->marked;
+            #if defined(__GNUC__)
+                if (__atomic_load_n(marked, __ATOMIC_RELAXED)) return false;
+                return !__atomic_exchange_n(marked, true, __ATOMIC_RELAXED);
+            #else
+                std::atomic<bool>* bit = reinterpret_cast<std::atomic<bool>*>(marked);
+                if (bit->load(std::memory_order_relaxed)) return false;
+                return !bit->exchange(true, std::memory_order_relaxed);
+            #endif
+        }
+        size_t granule = granuleOf(object);
+        uint64_t bit = (uint64_t)1 << (granule % 64);
+        uint64_t* word = &block->marks[granule / 64];
+        #if defined(__GNUC__)
+            if (__atomic_load_n(word, __ATOMIC_RELAXED) & bit) return false;
+            return !(__atomic_fetch_or(word, bit, __ATOMIC_RELAXED) & bit);
+        #else
+            std::atomic<uint64_t>* atomicWord = reinterpret_cast<std::atomic<uint64_t>*>(word);
+            if (atomicWord->load(std::memory_order_relaxed) & bit) return false;
+            return !(atomicWord->fetch_or(bit, std::memory_order_relaxed) & bit);
+        #endif
+    }
+
+    void Heap::markLinesAtomic(void* object, size_t size) {
+        Block* block = blockOf(object);
+        if (block->kind == CHUNK_LARGE) return;
+        size_t offset = (uintptr_t)object & (HEAP_BLOCK_SIZE - 1);
+        for (size_t line = offset / HEAP_LINE_SIZE; line <= (offset + size - 1) / HEAP_LINE_SIZE; line++) {
+            #if defined(__GNUC__)
+                __atomic_store_n(&block->live[line], epoch, __ATOMIC_RELAXED);
+            #else
+                reinterpret_cast<std::atomic<uint8_t>*>(&block->live[line])->store(epoch, std::memory_order_relaxed);
+            #endif
+        }
+    }
+
+    void Heap::finishSweep(Block* block) {
+        memset(block->marks, 0, sizeof(block->marks));
+        if (block->allocating || block->listed || block->freeLines == 0) return;
+        block->listed = true;
+        if (block->freeLines == HEAP_LINES - HEAP_FIRST_LINE) {
+            freeBlocks.push_back(block);
+        } else {
+            recyclable.push_back(block);
+        }
+    }
+
+    void Heap::beginSweep() {
+        unlistAll();
+        sweepIndex = 0;
+        sweepEnd = blocks.size();
+    }
+
+    size_t Heap::sweepNext() {
+        Block* block = blocks[sweepIndex++];
+        sweepBlock(block, SWEEP_OLD, [](void*) {});
+        size_t dead = 0;
+        forEach(block, block->marks, [&](void* object) {
+            finalizer(finalizerOwner, object);
+            dead++;
+        });
+        finishSweep(block);
+        return dead;
+    }
+
+    void Heap::resetAllocator() {
+        if (current != nullptr) current->allocating = false;
+        if (overflow != nullptr) overflow->allocating = false;
+        current = nullptr;
+        overflow = nullptr;
+        cursor = limit = nullptr;
+        overflowCursor = overflowLimit = nullptr;
+        nextLine = HEAP_LINES;
+    }
+
+    void Heap::clearTouched() {
+        for (Block* block : touched) block->touched = false;
+        touched.clear();
+        if (current != nullptr) touch(current);
+        if (overflow != nullptr) touch(overflow);
+    }
+
+    void Heap::unlistAll() {
+        for (std::vector<Block*>* list : {&recyclable, &freeBlocks}) {
+            for (Block* block : *list) block->listed = false;
+            list->clear();
+        }
+    }
+
+    void Heap::releaseFreeBlocks() {
+        size_t keep = (blocks.size() - freeBlocks.size()) / 2;
+        if (keep < HEAP_FREE_RESERVE) keep = HEAP_FREE_RESERVE;
+        if (freeBlocks.size() <= keep) return;
+
+        // Blocks still named by the touched list stay.
+        size_t kept = 0;
+        for (Block* block : freeBlocks) {
+            if (kept < keep || block->touched) {
+                freeBlocks[kept++] = block;
+            } else {
+                block->kind = CHUNK_LARGE; // Flags it for the pass below
+            }
+        }
+        freeBlocks.resize(kept);
+        size_t live = 0;
+        for (Block* block : blocks) {
+            if (block->kind == CHUNK_BLOCK) {
+                blocks[live++] = block;
+            } else {
+                CXXX_UNPOISON(block, HEAP_BLOCK_SIZE);
+                block->~Block();
+                ::operator delete(block, std::align_val_t(HEAP_BLOCK_SIZE));
+            }
+        }
+        blocks.resize(live);
+    }
+
+    void Heap::promoteLarge(LargeChunk* chunk) {
+        if (chunk->old) return;
+        unlinkLarge(chunk);
+        chunk->old = true;
+        pushLarge(chunk, &oldLarge);
+    }
+
+    void* Heap::allocateSlow(size_t size) {
+        if (size > HEAP_LARGE_SIZE) return allocateLarge(size);
+
+        char* object;
+        if (size > HEAP_LINE_SIZE) {
+            if (size > (size_t)(overflowLimit - overflowCursor)) {
+                if (overflow != nullptr) overflow->allocating = false;
+                overflow = takeBlock(true);
+                overflowCursor = (char*)overflow + HEAP_FIRST_LINE * HEAP_LINE_SIZE;
+                overflowLimit = (char*)overflow + HEAP_BLOCK_SIZE;
+                memset(overflow->used + HEAP_FIRST_LINE, 1, HEAP_LINES - HEAP_FIRST_LINE);
+            }
+            object = overflowCursor;
+            overflowCursor += size;
+        } else {
+            // Any hole fits an object of at most a line.
+            while (!nextHole()) {
+                if (current != nullptr) current->allocating = false;
+                current = takeBlock(false);
+                nextLine = HEAP_FIRST_LINE;
+            }
+            object = cursor;
+            cursor += size;
+        }
+        CXXX_UNPOISON(object, size);
+        setBit(blockOf(object)->starts, object);
+        return object;
+    }
+
+    // Moves the bump region to current's next run of free lines, all of
+    // which count as used from now on.
+    bool Heap::nextHole() {
+        if (current == nullptr) return false;
+        int line = nextLine;
+        while (line < HEAP_LINES && current->used[line]) line++;
+        if (line == HEAP_LINES) return false;
+        int end = line;
+        while (end < HEAP_LINES && !current->used[end]) current->used[end++] = 1;
+        cursor = (char*)current + line * HEAP_LINE_SIZE;
+        limit = (char*)current + end * HEAP_LINE_SIZE;
+        nextLine = end;
+        return true;
+    }
+
+    // A block for the allocator: a recyclable one unless `wantFree`, else a
+    // free one, sweeping queued blocks until one of those turns up; else a
+    // new one.
+    Block* Heap::takeBlock(bool wantFree) {
+        Block* block = nullptr;
+        for (;;) {
+            while (block == nullptr && !wantFree && !recyclable.empty()) {
+                block = recyclable.back();
+                recyclable.pop_back();
+                block->listed = false;
+                if (block->allocating) block = nullptr;
+            }
+            while (block == nullptr && !freeBlocks.empty()) {
+                block = freeBlocks.back();
+                freeBlocks.pop_back();
+                block->listed = false;
+                if (block->allocating) block = nullptr;
+            }
+            if (block != nullptr || !sweepPending()) break;
+            sweepNext();
+        }
+        if (block == nullptr) block = newBlock();
+        block->allocating = true;
+        touch(block);
+        return block;
+    }
+
+    Block* Heap::newBlock() {
+        void* memory = ::operator new(HEAP_BLOCK_SIZE, std::align_val_t(HEAP_BLOCK_SIZE));
+        Block* block = new (memory) Block();
+        block->kind = CHUNK_BLOCK;
+        block->freeLines = HEAP_LINES - HEAP_FIRST_LINE;
+        for (int line = 0; line < HEAP_FIRST_LINE; line++) block->used[line] = 1;
+        CXXX_POISON((char*)block + HEAP_FIRST_LINE * HEAP_LINE_SIZE,
+                    HEAP_BLOCK_SIZE - HEAP_FIRST_LINE * HEAP_LINE_SIZE);
+        blocks.push_back(block);
+        return block;
+    }
+
+    void Heap::touch(Block* block) {
+        if (block->touched) return;
+        block->touched = true;
+        touched.push_back(block);
+    }
+
+    void* Heap::allocateLarge(size_t size) {
+        void* memory = ::operator new(HEAP_LARGE_OFFSET + size, std::align_val_t(HEAP_BLOCK_SIZE));
+        LargeChunk* chunk = new (memory) LargeChunk();
+        chunk->kind = CHUNK_LARGE;
+        chunk->marked = false;
+        chunk->old = false;
+        chunk->size = size;
+        pushLarge(chunk, &youngLarge);
+        largeObjects++;
+        return objectIn(chunk);
+    }
+
+    void Heap::unlinkLarge(LargeChunk* chunk) {
+        if (chunk->prev != nullptr) {
+            chunk->prev->next = chunk->next;
+        } else if (chunk->old) {
+            oldLarge = chunk->next;
+        } else {
+            youngLarge = chunk->next;
+        }
+        if (chunk->next != nullptr) chunk->next->prev = chunk->prev;
+    }
+
+    void Heap::pushLarge(LargeChunk* chunk, LargeChunk** list) {
+        chunk->prev = nullptr;
+        chunk->next = *list;
+        if (*list != nullptr) (*list)->prev = chunk;
+        *list = chunk;
+    }
+
+}
@@ -0,0 +1,315 @@
+#ifndef cxxx_heap_h
+#define cxxx_heap_h
+
+#include "common.h"
+#include <atomic>
+#include <vector>
+
+namespace cxxx {
+
+    // Objects live in blocks of HEAP_BLOCK_SIZE bytes, aligned to their size
+    // so an object's block is its address rounded down. A block is divided
+    // into lines; the allocator bumps through holes of free lines and the
+    // collector frees whole lines. Objects start on HEAP_GRANULE boundaries.
+    #define HEAP_BLOCK_SIZE (32 * 1024)
+    #define HEAP_LINE_SIZE 128
+    #define HEAP_GRANULE 16
+    #define HEAP_LINES (HEAP_BLOCK_SIZE / HEAP_LINE_SIZE)
+    #define HEAP_GRANULES (HEAP_BLOCK_SIZE / HEAP_GRANULE)
+    #define HEAP_BITMAP_WORDS (HEAP_GRANULES / 64)
+    // Bigger objects get a chunk of their own.
+    #define HEAP_LARGE_SIZE (8 * 1024)
+    // Completely free blocks kept for reuse after a full collection, at
+    // least; beyond this, up to half as many as are in use.
+    #define HEAP_FREE_RESERVE 16
+
+    enum ChunkKind : uint8_t {
+        CHUNK_BLOCK,
+        CHUNK_LARGE
+    };
+
+    // Header at the start of every block. The bitmaps keep the collector's
+    // per-object state out of the objects: bit i stands for the granule at
+    // offset i * HEAP_GRANULE.
+    struct Block {
+        ChunkKind kind;
+        bool allocating; // Holds one of the allocator's bump regions
+        bool listed;     // On Heap::recyclable or Heap::freeBlocks
+        bool touched;    // On Heap::touched
+        int freeLines;   // After the last sweep
+        uint64_t starts[HEAP_BITMAP_WORDS]; // Every object
+        uint64_t old[HEAP_BITMAP_WORDS];    // Objects that survived a collection
+        uint64_t marks[HEAP_BITMAP_WORDS];  // Reached in this collection
+        uint8_t used[HEAP_LINES];           // Lines the allocator must skip
+        uint8_t live[HEAP_LINES];           // Heap::epoch if the line holds a surviving object
+    };
+
+    #define HEAP_FIRST_LINE ((int)((sizeof(Block) + HEAP_LINE_SIZE - 1) / HEAP_LINE_SIZE))
+
+    // Header of a chunk holding a single large object, HEAP_LARGE_OFFSET
+    // bytes before it. The chunk is aligned like a block, so blockOf()
+    // finds the header for either kind.
+    struct LargeChunk {
+        ChunkKind kind;
+        bool marked;
+        bool old;          // On Heap::oldLarge, else on youngLarge
+        LargeChunk* prev;
+        LargeChunk* next;
+        size_t size;
+    };
+
+    #define HEAP_LARGE_OFFSET ((sizeof(LargeChunk) + HEAP_GRANULE - 1) / HEAP_GRANULE * HEAP_GRANULE)
+
+    // What sweepBlock() treats as dead when unmarked.
+    enum SweepKind {
+        SWEEP_ALL,   // Every object; survivors become old
+        SWEEP_OLD,   // Old objects only (the sweep of an incremental cycle)
+        SWEEP_YOUNG  // Young objects only; survivors become old
+    };
+
+    // A VM's object heap: a mark-region (Immix-style) space of blocks plus
+    // a list of large objects. The heap knows nothing of object types; the
+    // VM marks, decides what is dead and finalizes it.
+    //
+    // Line maps: `used` is what the allocator reads. Taking a hole marks all
+    // of it used, so the allocator never hands out a line twice between
+    // sweeps. A sweep resets `used` from `live`, which marking stamps with
+    // the current epoch for every line a reached object covers. Survivors
+    // of young collections and objects allocated while a cycle sweeps are
+    // stamped too, so between full collections `live` covers every old
+    // object and a young sweep can rebuild `used` from it alone.
+    class Heap {
+    public:
+        Heap();
+        ~Heap();
+        Heap(const Heap&) = delete;
+        Heap& operator=(const Heap&) = delete;
+
+        // Memory for a young object of `size` bytes.
+        void* allocate(size_t size) {
+            size = (size + HEAP_GRANULE - 1) & ~(size_t)(HEAP_GRANULE - 1);
+            char* object = cursor;
+            if (size <= (size_t)(limit - object)) {
+                cursor = object + size;
+                CXXX_UNPOISON(object, size);
+                setBit(blockOf(object)->starts, object);
+                return object;
+            }
+            return allocateSlow(size);
+        }
+
+        // Makes a new object old, for objects allocated while a cycle marks.
+        void setOld(void* object);
+        // Gives back the memory of a dead object of `size` bytes once the
+        // sweep has cleared its bits.
+        void release(void* object, size_t size);
+
+        static Block* blockOf(const void* object) {
+            return (Block*)((uintptr_t)object & ~(uintptr_t)(HEAP_BLOCK_SIZE - 1));
+        }
+        static LargeChunk* chunkOf(const void* object) {
+            return (LargeChunk*)((char*)object - HEAP_LARGE_OFFSET);
+        }
+        static void* objectIn(LargeChunk* chunk) {
+            return (char*)chunk + HEAP_LARGE_OFFSET;
+        }
+
+        static bool isMarked(const void* object) {
+            Block* block = blockOf(object);
+            if (block->kind == CHUNK_LARGE) return chunkOf(object)->marked;
+            size_t granule = granuleOf(object);
+            return (block->marks[granule / 64] >> (granule % 64)) & 1;
+        }
+        // Sets the mark, reporting whether it was clear.
+        static bool mark(void* object) {
+            Block* block = blockOf(object);
+            if (block->kind == CHUNK_LARGE) {
+                LargeChunk* chunk = chunkOf(object);
+                if (chunk->marked) return false;
+                chunk->marked = true;
+                return true;
+            }
+            size_t granule = granuleOf(object);
+            uint64_t bit = (uint64_t)1 << (granule % 64);
+            uint64_t* word = &block->marks[granule / 64];
+            if (*word & bit) return false;
+            *word |= bit;
+            return true;
+        }
+        // mark() for objects other threads may be marking at the same time.
+        static bool markAtomic(void* object);
+
+        // Stamps the lines `object` covers as live in this collection.
+        void markLines(void* object, size_t size) {
+            Block* block = blockOf(object);
+            if (block->kind == CHUNK_LARGE) return;
+            size_t offset = (uintptr_t)object & (HEAP_BLOCK_SIZE - 1);
+            for (size_t line = offset / HEAP_LINE_SIZE; line <= (offset + size - 1) / HEAP_LINE_SIZE; line++) {
+                block->live[line] = epoch;
+            }
+        }
+        // markLines() for parallel marking.
+        void markLinesAtomic(void* object, size_t size);
+
+        // Starts a full marking: lines stamped before no longer count.
+        void beginMarking() {
+            if (++epoch == 0) epoch = 1;
+        }
+
+        // Sweeps a block's bitmaps after marking. Dead objects keep their
+        // bit in `marks`, for the caller to finalize, and lose it everywhere
+        // else; `promote` is called for each young survivor that becomes
+        // old. The line maps are rebuilt. Touches only `block`, so blocks
+        // can be swept on several threads; finishSweep() must follow on the
+        // allocating thread.
+        template <typename Promote>
+        void sweepBlock(Block* block, SweepKind kind, Promote promote) {
+            for (int i = 0; i < HEAP_BITMAP_WORDS; i++) {
+                uint64_t marks = block->marks[i];
+                uint64_t candidates = kind == SWEEP_ALL ? block->starts[i]
+                                    : kind == SWEEP_OLD ? block->old[i]
+                                    : block->starts[i] & ~block->old[i];
+                uint64_t dead = candidates & ~marks;
+                if (kind != SWEEP_OLD) {
+                    forEachBit(marks & ~block->old[i], block, i, promote);
+                    block->old[i] = (block->old[i] | marks) & ~dead;
+                } else {
+                    block->old[i] &= ~dead;
+                }
+                block->starts[i] &= ~dead;
+                block->marks[i] = dead;
+            }
+            int freeLines = 0;
+            for (int line = HEAP_FIRST_LINE; line < HEAP_LINES; line++) {
+                uint8_t live = block->live[line] == epoch;
+                block->live[line] = live ? epoch : 0;
+                block->used[line] = live;
+                freeLines += !live;
+            }
+            block->freeLines = freeLines;
+        }
+
+        // Calls f(object) for each object whose bit is set in `bits`.
+        template <typename F>
+        static void forEach(Block* block, const uint64_t* bits, F f) {
+            for (int i = 0; i < HEAP_BITMAP_WORDS; i++) forEachBit(bits[i], block, i, f);
+        }
+
+        // Makes every young object old, calling promote(object) for each,
+        // and empties `touched`.
+        template <typename Promote>
+        void promoteYoung(Promote promote) {
+            for (Block* block : touched) {
+                for (int i = 0; i < HEAP_BITMAP_WORDS; i++) {
+                    forEachBit(block->starts[i] & ~block->old[i], block, i, promote);
+                    block->old[i] = block->starts[i];
+                }
+            }
+            while (youngLarge != nullptr) {
+                promote(objectIn(youngLarge));
+                promoteLarge(youngLarge);
+            }
+            clearTouched();
+        }
+
+        // Clears the dead bits sweepBlock() left and makes the block's free
+        // lines available to the allocator.
+        void finishSweep(Block* block);
+
+        // Deferred sweeping. After a full marking, beginSweep() queues every
+        // block with SWEEP_OLD; sweepNext() sweeps the next one and hands its
+        // dead objects to the finalizer. The allocator sweeps queued blocks
+        // itself, until one has free lines, before it takes a fresh block,
+        // so lines are reclaimed as allocation needs them.
+        typedef void (*Finalizer)(void* owner, void* object);
+        void setFinalizer(Finalizer finalizer, void* owner) {
+            this->finalizer = finalizer;
+            finalizerOwner = owner;
+        }
+        void beginSweep();
+        bool sweepPending() const { return sweepIndex < sweepEnd; }
+        // Returns how many objects the block held that died.
+        size_t sweepNext();
+
+        // Lets go of the bump regions; the next allocation looks for a hole
+        // in the blocks the sweeps listed.
+        void resetAllocator();
+        // Empties `touched`, except for the blocks the allocator is in.
+        void clearTouched();
+        // Empties `recyclable` and `freeBlocks`, for sweeps of every block to
+        // refill.
+        void unlistAll();
+        // Returns completely free blocks beyond the reserve to the system.
+        void releaseFreeBlocks();
+
+        void promoteLarge(LargeChunk* chunk);
+
+        size_t blockCount() const { return blocks.size(); }
+        size_t largeCount() const { return largeObjects; }
+
+        std::vector<Block*> blocks;      // Every block, in creation order
+        std::vector<Block*> touched;     // Holding objects allocated since the last collection
+        std::vector<Block*> recyclable;  // Swept, with free lines
+        std::vector<Block*> freeBlocks;  // Swept, with nothing in them
+        LargeChunk* youngLarge;
+        LargeChunk* oldLarge;
+        uint8_t epoch;
+
+    private:
+        // The bump region for objects up to a line long: a hole in `current`.
+        char* cursor;
+        char* limit;
+        Block* current;
+        int nextLine; // Where the search for current's next hole starts
+        // Longer objects bump through a block of their own rather than skip
+        // small holes.
+        char* overflowCursor;
+        char* overflowLimit;
+        Block* overflow;
+        size_t largeObjects;
+        Finalizer finalizer;
+        void* finalizerOwner;
+        size_t sweepIndex; // Next of `blocks` queued for sweepNext()
+        size_t sweepEnd;   // Blocks that existed at beginSweep()
+
+        void* allocateSlow(size_t size);
+        void* allocateLarge(size_t size);
+        bool nextHole();
+        Block* takeBlock(bool wantFree);
+        Block* newBlock();
+        void touch(Block* block);
+        void unlinkLarge(LargeChunk* chunk);
+        void pushLarge(LargeChunk* chunk, LargeChunk** list);
+
+        static size_t granuleOf(const void* object) {
+            return ((uintptr_t)object & (HEAP_BLOCK_SIZE - 1)) / HEAP_GRANULE;
+        }
+        static void setBit(uint64_t* bitmap, const void* object) {
+            size_t granule = granuleOf(object);
+            bitmap[granule / 64] |= (uint64_t)1 << (granule % 64);
+        }
+        static int lowestBit(uint64_t word) {
+            #if defined(__GNUC__)
+                return __builtin_ctzll(word);
+            #else
+                int bit = 0;
+                while (!(word & 1)) {
+                    word >>= 1;
+                    bit++;
+                }
+                return bit;
+            #endif
+        }
+        template <typename F>
+        static void forEachBit(uint64_t word, Block* block, int index, F& f) {
+            while (word != 0) {
+                int bit = lowestBit(word);
+                word &= word - 1;
+                f((void*)((char*)block + ((size_t)index * 64 + bit) * HEAP_GRANULE));
+            }
+        }
+    };
+
+}
+
+#endif
@@ -0,0 +1,837 @@
+#include "jit.h"
+
+#ifdef CXXX_JIT
+
+#include "vm.h"
+#include "object.h"
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+namespace cxxx {
+
+    struct JitCode {
+        uint8_t* memory;
+        size_t size;
+        // Native offset of every bytecode offset that starts an instruction,
+        // -1 elsewhere. Native offset 0 is the prologue, which jumps to the
+        // entry it is given.
+        std::vector<int32_t> entries;
+    };
+
+    // Signature of the prologue: returns a JitStatus.
+    typedef int (*JitEntryFn)(VM* vm, CallFrame* frame, const uint8_t* entry);
+
+    // Out-of-line work called from native code. Native code stores its cached
+    // stackTop back into the VM before every call and reloads it and its frame
+    // afterwards, so helpers see an ordinary VM. Each returns 0 after
+    // reporting a runtime error and nonzero otherwise.
+    struct JitRuntime {
+        // OP_ADD when the operands are not both numbers.
+        static int add(VM* vm) {
+            return vm->concatenate();
+        }
+
+        // OP_EQUAL when the operands are not both numbers.
+        static int equal(VM* vm) {
+            vm->stackTop[-2] = BOOL_VAL(valuesEqual(vm->stackTop[-2], vm->stackTop[-1]));
+            vm->stackTop--;
+            return 1;
+        }
+
+        static int call(VM* vm, int argCount) {
+            int baseFrame = vm->frameCount;
+            if (!vm->callValue(vm->peek(argCount), argCount)) return 0;
+            return vm->runCallee(baseFrame);
+        }
+
+        static int invoke(VM* vm, ObjString* name, int argCount, InlineCache* cache) {
+            int baseFrame = vm->frameCount;
+            if (!vm->invokeCached(name, argCount, cache)) return 0;
+            return vm->runCallee(baseFrame);
+        }
+
+        static int getProperty(VM* vm, ObjString* name, InlineCache* cache) {
+            return vm->getProperty(name, cache);
+        }
+
+        static int setProperty(VM* vm, ObjString* name, InlineCache* cache) {
+            return vm->setProperty(name, cache);
+        }
+
+        static int getUpvalue(VM* vm, int slot) {
+            CallFrame* frame = &vm->frames[vm->frameCount - 1];
+            return vm->push(*frame->closure->upvalues[slot]->location);
+        }
+
+        static int setUpvalue(VM* vm, int slot) {
+            CallFrame* frame = &vm->frames[vm->frameCount - 1];
+            ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+            StoreGuard guard(vm);
+            *upvalue->location = vm->peek(0);
+            vm->writeBarrier((Obj*)upvalue, vm->peek(0));
+            return 1;
+        }
+
+        // Reached only when an object was stored into the global.
+        static int globalBarrier(VM* vm, int slot) {
+            vm->globalBarrier(slot, vm->globalValues[slot]);
+            return 1;
+        }
+
+        static int closeUpvalue(VM* vm) {
+            vm->closeUpvalues(vm->stackTop - 1);
+            vm->stackTop--;
+            return 1;
+        }
+
+        static int print(VM* vm) {
+            printValue(vm->pop());
+            std::cout << std::endl;
+            return 1;
+        }
+
+        // OP_RETURN from any function but the top-level script.
+        static int returnFrom(VM* vm) {
+            CallFrame* frame = &vm->frames[vm->frameCount - 1];
+            Value result = vm->pop();
+            vm->closeUpvalues(frame->slots);
+            vm->frameCount--;
+            vm->stackTop = frame->slots;
+            return vm->push(result);
+        }
+
+        static Value** stackTopAddress(VM* vm) { return &vm->stackTop; }
+        static CallFrame** framesAddress(VM* vm) { return &vm->frames; }
+    };
+
+    namespace {
+
+        enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+        enum Xmm { XMM0, XMM1, XMM2 };
+
+        enum Cond { CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_BE = 0x6, CC_A = 0x7, CC_P = 0xa, CC_NP = 0xb };
+
+        // ALU opcodes in their `op r/m64, r64` form.
+        enum Alu { ALU_ADD = 0x01, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_CMP = 0x39 };
+
+        struct Label {
+            int position = -1;
+            std::vector<int> uses; // rel32 fields waiting for `position`
+        };
+
+        // Just enough of an x86-64 assembler for the templates below. Memory
+        // operands are always [base + disp].
+        class Assembler {
+        public:
+            std::vector<uint8_t> code;
+
+            int size() const { return (int)code.size(); }
+
+            void emit(uint8_t byte) { code.push_back(byte); }
+            void emit32(uint32_t value) {
+                for (int i = 0; i < 4; i++) emit((uint8_t)(value >> (8 * i)));
+            }
+            void emit64(uint64_t value) {
+                for (int i = 0; i < 8; i++) emit((uint8_t)(value >> (8 * i)));
+            }
+
+            void bind(Label& label) {
+                label.position = size();
+                for (int use : label.uses) patch(use, label.position);
+                label.uses.clear();
+            }
+
+            void movLoad(int dst, int base, int32_t disp) { rex(true, dst, base); emit(0x8b); memory(dst, base, disp); }
+            void movStore(int base, int32_t disp, int src) { rex(true, src, base); emit(0x89); memory(src, base, disp); }
+            void movReg(int dst, int src) { rex(true, src, dst); emit(0x89); emit(0xc0 | (src & 7) << 3 | (dst & 7)); }
+            void movImm(int dst, uint64_t imm) { rex(true, 0, dst); emit(0xb8 | (dst & 7)); emit64(imm); }
+            // Zero-extends into the full register.
+            void movImm32(int dst, uint32_t imm) { rex(false, 0, dst); emit(0xb8 | (dst & 7)); emit32(imm); }
+            void lea(int dst, int base, int32_t disp) { rex(true, dst, base); emit(0x8d); memory(dst, base, disp); }
+
+            void alu(Alu op, int dst, int src) { rex(true, src, dst); emit(op); emit(0xc0 | (src & 7) << 3 | (dst & 7)); }
+            void cmpLoad(int reg, int base, int32_t disp) { rex(true, reg, base); emit(0x3b); memory(reg, base, disp); }
+            void testEax() { emit(0x85); emit(0xc0); }
+
+            void store32(int base, int32_t disp, uint32_t imm) { rex(false, 0, base); emit(0xc7); memory(0, base, disp); emit32(imm); }
+            void cmp32(int base, int32_t disp, uint32_t imm) { rex(false, 0, base); emit(0x81); memory(7, base, disp); emit32(imm); }
+            void cmp8(int base, int32_t disp, uint8_t imm) { rex(false, 0, base); emit(0x80); memory(7, base, disp); emit(imm); }
+
+            void movsdLoad(int xmm, int base, int32_t disp) { sse(0xf2, 0x10, xmm, base, disp); }
+            void movsdStore(int base, int32_t disp, int xmm) { sse(0xf2, 0x11, xmm, base, disp); }
+            void addsd(int dst, int src) { sseReg(0xf2, 0x58, dst, src); }
+            void subsd(int dst, int src) { sseReg(0xf2, 0x5c, dst, src); }
+            void mulsd(int dst, int src) { sseReg(0xf2, 0x59, dst, src); }
+            void divsd(int dst, int src) { sseReg(0xf2, 0x5e, dst, src); }
+            void xorpd(int dst, int src) { sseReg(0x66, 0x57, dst, src); }
+            void ucomisd(int a, int b) { sseReg(0x66, 0x2e, a, b); }
+            void movqToXmm(int xmm, int reg) { emit(0x66); rex(true, xmm, reg); emit(0x0f); emit(0x6e); emit(0xc0 | (xmm & 7) << 3 | (reg & 7)); }
+
+            // eax = condition ? 1 : 0
+            void setEax(Cond cond) {
+                emit(0x0f); emit(0x90 | cond); emit(0xc0); // setcc al
+                emit(0x0f); emit(0xb6); emit(0xc0);        // movzx eax, al
+            }
+            // eax = (ZF && !PF): ucomisd equality, false for NaN.
+            void setEaxEqual() {
+                emit(0x0f); emit(0x90 | CC_E); emit(0xc0);  // sete al
+                emit(0x0f); emit(0x90 | CC_NP); emit(0xc1); // setnp cl
+                emit(0x20); emit(0xc8);                     // and al, cl
+                emit(0x0f); emit(0xb6); emit(0xc0);         // movzx eax, al
+            }
+
+            void jcc(Cond cond, Label& label) { emit(0x0f); emit(0x80 | cond); use(label); }
+            void jmp(Label& label) { emit(0xe9); use(label); }
+            void jmpReg(int reg) { rex(false, 0, reg); emit(0xff); emit(0xe0 | (reg & 7)); }
+            void callReg(int reg) { rex(false, 0, reg); emit(0xff); emit(0xd0 | (reg & 7)); }
+            void push(int reg) { rex(false, 0, reg); emit(0x50 | (reg & 7)); }
+            void pop(int reg) { rex(false, 0, reg); emit(0x58 | (reg & 7)); }
+            void subRsp(int8_t imm) { emit(0x48); emit(0x83); emit(0xec); emit((uint8_t)imm); }
+            void addRsp(int8_t imm) { emit(0x48); emit(0x83); emit(0xc4); emit((uint8_t)imm); }
+            void ret() { emit(0xc3); }
+
+        private:
+            void rex(bool wide, int reg, int base) {
+                uint8_t prefix = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+                if (prefix != 0x40) emit(prefix);
+            }
+
+            void memory(int reg, int base, int32_t disp) {
+                int mod = disp == 0 && (base & 7) != RBP ? 0 : (disp >= -128 && disp <= 127 ? 1 : 2);
+                emit((uint8_t)(mod << 6 | (reg & 7) << 3 | (base & 7)));
+                if ((base & 7) == RSP) emit(0x24); // SIB: no index
+                if (mod == 1) emit((uint8_t)(int8_t)disp);
+                if (mod == 2) emit32((uint32_t)disp);
+            }
+
+            void sse(uint8_t prefix, uint8_t op, int xmm, int base, int32_t disp) {
+                emit(prefix); rex(false, xmm, base); emit(0x0f); emit(op); memory(xmm, base, disp);
+            }
+            void sseReg(uint8_t prefix, uint8_t op, int dst, int src) {
+                emit(prefix); emit(0x0f); emit(op); emit(0xc0 | (dst & 7) << 3 | (src & 7));
+            }
+
+            void use(Label& label) {
+                int field = size();
+                emit32(0);
+                if (label.position >= 0) {
+                    patch(field, label.position);
+                } else {
+                    label.uses.push_back(field);
+                }
+            }
+
+            void patch(int field, int target) {
+                int32_t rel = target - (field + 4);
+                std::memcpy(&code[field], &rel, 4);
+            }
+        };
+
+        // Register assignment inside compiled code. All are callee-saved, so
+        // they survive helper calls.
+        const int VM_REG = RBP;        // VM*
+        const int STACK_TOP_PTR = RBX; // &vm->stackTop
+        const int STACK_TOP = R12;     // Cached vm->stackTop
+        const int SLOTS = R13;         // frame->slots
+        const int FRAME = R14;         // CallFrame*
+        const int CONSTANTS = R15;     // chunk.constants.data()
+        // [rsp + FRAME_OFFSET] holds FRAME's byte offset into vm->frames,
+        // which moves when a call grows it.
+        const int32_t FRAME_OFFSET = 0;
+
+        const int32_t VALUE_SIZE = (int32_t)sizeof(Value);
+#ifdef CXXX_NAN_BOXING
+        const int32_t PAYLOAD = 0;
+#else
+        const int32_t PAYLOAD = (int32_t)offsetof(Value, as);
+#endif
+
+        class JitCompiler {
+        public:
+            JitCompiler(VM* vm, ObjFunction* function)
+                : vm(vm), function(function), chunk(function->chunk),
+                  labels(chunk.code.size()), exits(chunk.code.size()) {}
+
+            JitCode* compile();
+
+        private:
+            VM* vm;
+            ObjFunction* function;
+            Chunk& chunk;
+            Assembler a;
+            std::vector<Label> labels; // Start of each bytecode instruction
+            std::vector<Label> exits;  // Hand the instruction back to the interpreter
+            Label epilogue;
+            Label error;
+
+            int32_t top(int distance) { return -VALUE_SIZE * (distance + 1); }
+            int32_t slot(int index) { return VALUE_SIZE * index; }
+
+            uint8_t byteAt(int offset) { return chunk.code[offset]; }
+            uint16_t shortAt(int offset) { return (uint16_t)(chunk.code[offset] << 8 | chunk.code[offset + 1]); }
+
+            void emitPrologue();
+            void emitEpilogue();
+            void emitExits();
+            bool emitInstruction(int offset);
+
+            void copyValue(int dstBase, int32_t dstDisp, int srcBase, int32_t srcDisp);
+            void adjustStack(int values) { a.lea(STACK_TOP, STACK_TOP, VALUE_SIZE * values); }
+            void guardNumber(int base, int32_t disp, Label& fail);
+            void guardDefined(int base, int32_t disp, Label& fail);
+            void guardObject(int base, int32_t disp, Label& fail);
+            void emitGlobalBarrier(int global);
+            void storeNumber(int base, int32_t disp, int xmm);
+            void storeBool(int base, int32_t disp);
+            void loadFalsey(int base, int32_t disp);
+            void loadGlobals();
+            void callHelper(void* helper, uint64_t arg1 = 0, uint64_t arg2 = 0, uint64_t arg3 = 0);
+        };
+
+        void JitCompiler::copyValue(int dstBase, int32_t dstDisp, int srcBase, int32_t srcDisp) {
+            for (int32_t part = 0; part < VALUE_SIZE; part += 8) {
+                a.movLoad(RAX, srcBase, srcDisp + part);
+                a.movStore(dstBase, dstDisp + part, RAX);
+            }
+        }
+
+        void JitCompiler::guardNumber(int base, int32_t disp, Label& fail) {
+#ifdef CXXX_NAN_BOXING
+            a.movLoad(RAX, base, disp);
+            a.movImm(RCX, Value::QNAN);
+            a.alu(ALU_AND, RAX, RCX);
+            a.alu(ALU_CMP, RAX, RCX);
+            a.jcc(CC_E, fail);
+#else
+            a.cmp32(base, disp, VAL_NUMBER);
+            a.jcc(CC_NE, fail);
+#endif
+        }
+
+        void JitCompiler::guardDefined(int base, int32_t disp, Label& fail) {
+#ifdef CXXX_NAN_BOXING
+            a.movLoad(RAX, base, disp);
+            a.movImm(RCX, Value::QNAN | Value::TAG_UNDEFINED);
+            a.alu(ALU_CMP, RAX, RCX);
+            a.jcc(CC_E, fail);
+#else
+            a.cmp32(base, disp, VAL_UNDEFINED);
+            a.jcc(CC_E, fail);
+#endif
+        }
+
+        void JitCompiler::guardObject(int base, int32_t disp, Label& fail) {
+#ifdef CXXX_NAN_BOXING
+            a.movLoad(RAX, base, disp);
+            a.movImm(RCX, Value::QNAN | Value::SIGN_BIT);
+            a.alu(ALU_AND, RAX, RCX);
+            a.alu(ALU_CMP, RAX, RCX);
+            a.jcc(CC_NE, fail);
+#else
+            a.cmp32(base, disp, VAL_OBJ);
+            a.jcc(CC_NE, fail);
+#endif
+        }
+
+        // After a store of top(0) into global `global`; numbers and other
+        // immediates never need remembering.
+        void JitCompiler::emitGlobalBarrier(int global) {
+            Label done;
+            guardObject(STACK_TOP, top(0), done);
+            callHelper((void*)&JitRuntime::globalBarrier, global);
+            a.bind(done);
+        }
+
+        void JitCompiler::storeNumber(int base, int32_t disp, int xmm) {
+#ifndef CXXX_NAN_BOXING
+            a.store32(base, disp, VAL_NUMBER);
+#endif
+            a.movsdStore(base, disp + PAYLOAD, xmm);
+        }
+
+        // Stores eax (0 or 1) as a bool.
+        void JitCompiler::storeBool(int base, int32_t disp) {
+#ifdef CXXX_NAN_BOXING
+            a.movImm(RCX, Value::QNAN | Value::TAG_FALSE);
+            a.alu(ALU_ADD, RAX, RCX);
+            a.movStore(base, disp, RAX);
+#else
+            a.store32(base, disp, VAL_BOOL);
+            a.movStore(base, disp + PAYLOAD, RAX);
+#endif
+        }
+
+        // eax = isFalsey(value) ? 1 : 0
+        void JitCompiler::loadFalsey(int base, int32_t disp) {
+            Label done, truthy;
+#ifdef CXXX_NAN_BOXING
+            a.movLoad(RCX, base, disp);
+            a.movImm32(RAX, 1);
+            a.movImm(RDX, Value::QNAN | Value::TAG_NIL);
+            a.alu(ALU_CMP, RCX, RDX);
+            a.jcc(CC_E, done);
+            a.movImm(RDX, Value::QNAN | Value::TAG_FALSE);
+            a.alu(ALU_CMP, RCX, RDX);
+            a.jcc(CC_E, done);
+#else
+            a.movImm32(RAX, 1);
+            a.cmp32(base, disp, VAL_NIL);
+            a.jcc(CC_E, done);
+            a.cmp32(base, disp, VAL_BOOL);
+            a.jcc(CC_NE, truthy);
+            a.cmp8(base, disp + PAYLOAD, 0);
+            a.jcc(CC_E, done);
+#endif
+            a.bind(truthy);
+            a.movImm32(RAX, 0);
+            a.bind(done);
+        }
+
+        // rdx = vm->globalsData. The array may move whenever a new global is
+        // declared, so its address is reloaded on every access.
+        void JitCompiler::loadGlobals() {
+            a.movLoad(RDX, VM_REG, (int32_t)((char*)&vm->globalsData - (char*)vm));
+        }
+
+        void JitCompiler::callHelper(void* helper, uint64_t arg1, uint64_t arg2, uint64_t arg3) {
+            a.movStore(STACK_TOP_PTR, 0, STACK_TOP);
+            a.movReg(RDI, VM_REG);
+            a.movImm(RSI, arg1);
+            a.movImm(RDX, arg2);
+            a.movImm(RCX, arg3);
+            a.movImm(RAX, (uint64_t)(uintptr_t)helper);
+            a.callReg(RAX);
+            a.movLoad(STACK_TOP, STACK_TOP_PTR, 0);
+            a.movImm(RCX, (uint64_t)(uintptr_t)JitRuntime::framesAddress(vm));
+            a.movLoad(FRAME, RCX, 0);
+            a.movLoad(RCX, RSP, FRAME_OFFSET);
+            a.alu(ALU_ADD, FRAME, RCX);
+            a.movLoad(SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+            a.testEax();
+            a.jcc(CC_E, error);
+        }
+
+        void JitCompiler::emitPrologue() {
+            a.push(RBP);
+            a.push(RBX);
+            a.push(R12);
+            a.push(R13);
+            a.push(R14);
+            a.push(R15);
+            a.subRsp(8); // Six pushes plus the return address: realign to 16.
+            a.movReg(VM_REG, RDI);
+            a.movReg(FRAME, RSI);
+            a.movImm(RCX, (uint64_t)(uintptr_t)JitRuntime::framesAddress(vm));
+            a.movLoad(RCX, RCX, 0);
+            a.movReg(RAX, FRAME);
+            a.alu(ALU_SUB, RAX, RCX);
+            a.movStore(RSP, FRAME_OFFSET, RAX);
+            a.movImm(STACK_TOP_PTR, (uint64_t)(uintptr_t)JitRuntime::stackTopAddress(vm));
+            a.movLoad(STACK_TOP, STACK_TOP_PTR, 0);
+            a.movLoad(SLOTS, FRAME, (int32_t)offsetof(CallFrame, slots));
+            a.movImm(CONSTANTS, (uint64_t)(uintptr_t)chunk.constants.data());
+            a.jmpReg(RDX);
+        }
+
+        void JitCompiler::emitEpilogue() {
+            a.bind(error);
+            a.movImm32(RAX, (uint32_t)JitStatus::RUNTIME_ERROR);
+            a.bind(epilogue);
+            a.addRsp(8);
+            a.pop(R15);
+            a.pop(R14);
+            a.pop(R13);
+            a.pop(R12);
+            a.pop(RBX);
+            a.pop(RBP);
+            a.ret();
+        }
+
+        // Exit stubs: publish stackTop and point ip back at the instruction.
+        void JitCompiler::emitExits() {
+            for (size_t offset = 0; offset < exits.size(); offset++) {
+                if (exits[offset].uses.empty()) continue;
+                a.bind(exits[offset]);
+                a.movStore(STACK_TOP_PTR, 0, STACK_TOP);
+                a.movImm(RAX, (uint64_t)(uintptr_t)(chunk.code.data() + offset));
+                a.movStore(FRAME, (int32_t)offsetof(CallFrame, ip), RAX);
+                a.movImm32(RAX, (uint32_t)JitStatus::EXITED);
+                a.jmp(epilogue);
+            }
+        }
+
+        // Emits the template for the instruction at `offset`. Anything that
+        // may bail out to the interpreter does so before touching the stack.
+        // Returns false for instructions left to the interpreter entirely.
+        bool JitCompiler::emitInstruction(int offset) {
+            Label& interpret = exits[offset];
+            int next = offset + chunk.instructionLength(offset);
+
+            switch (chunk.code[offset]) {
+                case OP_CONSTANT:
+                    copyValue(STACK_TOP, 0, CONSTANTS, slot(byteAt(offset + 1)));
+                    adjustStack(1);
+                    return true;
+                case OP_POP:
+                    adjustStack(-1);
+                    return true;
+                case OP_GET_LOCAL:
+                    copyValue(STACK_TOP, 0, SLOTS, slot(byteAt(offset + 1)));
+                    adjustStack(1);
+                    return true;
+                case OP_SET_LOCAL:
+                    copyValue(SLOTS, slot(byteAt(offset + 1)), STACK_TOP, top(0));
+                    return true;
+                case OP_SET_LOCAL_POP:
+                    copyValue(SLOTS, slot(byteAt(offset + 1)), STACK_TOP, top(0));
+                    adjustStack(-1);
+                    return true;
+                case OP_GET_GLOBAL: {
+                    int32_t global = slot(shortAt(offset + 1));
+                    loadGlobals();
+                    guardDefined(RDX, global, interpret);
+                    copyValue(STACK_TOP, 0, RDX, global);
+                    adjustStack(1);
+                    return true;
+                }
+                case OP_DEFINE_GLOBAL:
+                    loadGlobals();
+                    copyValue(RDX, slot(shortAt(offset + 1)), STACK_TOP, top(0));
+                    emitGlobalBarrier(shortAt(offset + 1));
+                    adjustStack(-1);
+                    return true;
+                case OP_SET_GLOBAL:
+                case OP_SET_GLOBAL_POP: {
+                    int32_t global = slot(shortAt(offset + 1));
+                    loadGlobals();
+                    guardDefined(RDX, global, interpret);
+                    copyValue(RDX, global, STACK_TOP, top(0));
+                    emitGlobalBarrier(shortAt(offset + 1));
+                    if (chunk.code[offset] == OP_SET_GLOBAL_POP) adjustStack(-1);
+                    return true;
+                }
+                case OP_ADD:
+                case OP_ADD_NUM: {
+                    Label generic, done;
+                    guardNumber(STACK_TOP, top(1), generic);
+                    guardNumber(STACK_TOP, top(0), generic);
+                    a.movsdLoad(XMM0, STACK_TOP, top(1) + PAYLOAD);
+                    a.movsdLoad(XMM1, STACK_TOP, top(0) + PAYLOAD);
+                    a.addsd(XMM0, XMM1);
+                    storeNumber(STACK_TOP, top(1), XMM0);
+                    adjustStack(-1);
+                    a.jmp(done);
+                    a.bind(generic);
+                    callHelper((void*)&JitRuntime::add);
+                    a.bind(done);
+                    return true;
+                }
+                case OP_SUBTRACT:
+                case OP_MULTIPLY:
+                case OP_DIVIDE: {
+                    guardNumber(STACK_TOP, top(1), interpret);
+                    guardNumber(STACK_TOP, top(0), interpret);
+                    a.movsdLoad(XMM0, STACK_TOP, top(1) + PAYLOAD);
+                    a.movsdLoad(XMM1, STACK_TOP, top(0) + PAYLOAD);
+                    if (chunk.code[offset] == OP_SUBTRACT) {
+                        a.subsd(XMM0, XMM1);
+                    } else if (chunk.code[offset] == OP_MULTIPLY) {
+                        a.mulsd(XMM0, XMM1);
+                    } else {
+                        // The interpreter reports division by zero. NaN
+                        // divisors compare equal here too; they just take
+                        // the slow path.
+                        a.xorpd(XMM2, XMM2);
+                        a.ucomisd(XMM1, XMM2);
+                        a.jcc(CC_E, interpret);
+                        a.divsd(XMM0, XMM1);
+                    }
+                    storeNumber(STACK_TOP, top(1), XMM0);
+                    adjustStack(-1);
+                    return true;
+                }
+                case OP_NEGATE:
+                    guardNumber(STACK_TOP, top(0), interpret);
+                    a.movImm(RAX, 0x8000000000000000ull); // Sign bit
+                    a.movqToXmm(XMM1, RAX);
+                    a.movsdLoad(XMM0, STACK_TOP, top(0) + PAYLOAD);
+                    a.xorpd(XMM0, XMM1);
+                    storeNumber(STACK_TOP, top(0), XMM0);
+                    return true;
+                case OP_GREATER:
+                case OP_LESS:
+                    guardNumber(STACK_TOP, top(1), interpret);
+                    guardNumber(STACK_TOP, top(0), interpret);
+                    a.movsdLoad(XMM0, STACK_TOP, top(1) + PAYLOAD);
+                    a.movsdLoad(XMM1, STACK_TOP, top(0) + PAYLOAD);
+                    // a > b is "above"; a < b is b > a. Unordered is neither.
+                    if (chunk.code[offset] == OP_GREATER) {
+                        a.ucomisd(XMM0, XMM1);
+                    } else {
+                        a.ucomisd(XMM1, XMM0);
+                    }
+                    a.setEax(CC_A);
+                    storeBool(STACK_TOP, top(1));
+                    adjustStack(-1);
+                    return true;
+                case OP_EQUAL: {
+                    Label generic, done;
+                    guardNumber(STACK_TOP, top(1), generic);
+                    guardNumber(STACK_TOP, top(0), generic);
+                    a.movsdLoad(XMM0, STACK_TOP, top(1) + PAYLOAD);
+                    a.movsdLoad(XMM1, STACK_TOP, top(0) + PAYLOAD);
+                    a.ucomisd(XMM0, XMM1);
+                    a.setEaxEqual();
+                    storeBool(STACK_TOP, top(1));
+                    adjustStack(-1);
+                    a.jmp(done);
+                    a.bind(generic);
+                    callHelper((void*)&JitRuntime::equal);
+                    a.bind(done);
+                    return true;
+                }
+                case OP_NOT:
+                    loadFalsey(STACK_TOP, top(0));
+                    storeBool(STACK_TOP, top(0));
+                    return true;
+                case OP_JUMP:
+                    a.jmp(labels[next + shortAt(offset + 1)]);
+                    return true;
+                case OP_LOOP:
+                    a.jmp(labels[next - shortAt(offset + 1)]);
+                    return true;
+                case OP_JUMP_IF_FALSE:
+                    loadFalsey(STACK_TOP, top(0));
+                    a.testEax();
+                    a.jcc(CC_NE, labels[next + shortAt(offset + 1)]);
+                    return true;
+                case OP_POP_JUMP_IF_FALSE:
+                    loadFalsey(STACK_TOP, top(0));
+                    adjustStack(-1); // lea leaves the flags alone
+                    a.testEax();
+                    a.jcc(CC_NE, labels[next + shortAt(offset + 1)]);
+                    return true;
+                case OP_LESS_JUMP_IF_FALSE:
+                    guardNumber(STACK_TOP, top(1), interpret);
+                    guardNumber(STACK_TOP, top(0), interpret);
+                    a.movsdLoad(XMM0, STACK_TOP, top(1) + PAYLOAD);
+                    a.movsdLoad(XMM1, STACK_TOP, top(0) + PAYLOAD);
+                    adjustStack(-2);
+                    a.ucomisd(XMM1, XMM0);
+                    a.jcc(CC_BE, labels[next + shortAt(offset + 1)]);
+                    return true;
+                case OP_INCREMENT_LOCAL: {
+                    int32_t local = slot(byteAt(offset + 1));
+                    double delta = (int8_t)byteAt(offset + 2);
+                    uint64_t deltaBits;
+                    std::memcpy(&deltaBits, &delta, sizeof(double));
+                    guardNumber(SLOTS, local, interpret);
+                    a.movImm(RAX, deltaBits);
+                    a.movqToXmm(XMM1, RAX);
+                    a.movsdLoad(XMM0, SLOTS, local + PAYLOAD);
+                    a.addsd(XMM0, XMM1);
+                    storeNumber(SLOTS, local, XMM0);
+                    return true;
+                }
+                case OP_GET_UPVALUE:
+                    callHelper((void*)&JitRuntime::getUpvalue, byteAt(offset + 1));
+                    return true;
+                case OP_SET_UPVALUE:
+                    callHelper((void*)&JitRuntime::setUpvalue, byteAt(offset + 1));
+                    return true;
+                case OP_CLOSE_UPVALUE:
+                    callHelper((void*)&JitRuntime::closeUpvalue);
+                    return true;
+                case OP_GET_PROPERTY:
+                case OP_SET_PROPERTY: {
+                    ObjString* name = (ObjString*)chunk.constants[byteAt(offset + 1)].asObj();
+                    InlineCache* cache = &chunk.inlineCaches[shortAt(offset + 2)];
+                    void* helper = chunk.code[offset] == OP_GET_PROPERTY
+                        ? (void*)&JitRuntime::getProperty
+                        : (void*)&JitRuntime::setProperty;
+                    callHelper(helper, (uint64_t)(uintptr_t)name, (uint64_t)(uintptr_t)cache);
+                    return true;
+                }
+                case OP_CALL:
+                case OP_CALL_CLOSURE:
+                    callHelper((void*)&JitRuntime::call, byteAt(offset + 1));
+                    return true;
+                case OP_INVOKE: {
+                    ObjString* name = (ObjString*)chunk.constants[byteAt(offset + 1)].asObj();
+                    InlineCache* cache = &chunk.inlineCaches[shortAt(offset + 3)];
+                    callHelper((void*)&JitRuntime::invoke, (uint64_t)(uintptr_t)name,
+                               byteAt(offset + 2), (uint64_t)(uintptr_t)cache);
+                    return true;
+                }
+                case OP_TAIL_CALL:
+                case OP_TAIL_INVOKE:
+                case OP_TAIL_SUPER_INVOKE:
+                    // Swaps the function running in this very frame; run()
+                    // does that and re-enters native code for the callee.
+                    return false;
+                case OP_PRINT:
+                    callHelper((void*)&JitRuntime::print);
+                    return true;
+                case OP_RETURN:
+                    // The script's own return ends the run; leave it to run().
+                    if (function->name == nullptr) return false;
+                    callHelper((void*)&JitRuntime::returnFrom);
+                    a.movImm32(RAX, (uint32_t)JitStatus::RETURNED);
+                    a.jmp(epilogue);
+                    return true;
+                case OP_MOVE:
+                    copyValue(SLOTS, slot(byteAt(offset + 1)), SLOTS, slot(byteAt(offset + 2)));
+                    return true;
+                case OP_LOAD_CONSTANT:
+                    copyValue(SLOTS, slot(byteAt(offset + 1)), CONSTANTS, slot(byteAt(offset + 2)));
+                    return true;
+                case OP_ADD_RR:
+                case OP_ADD_RK:
+                case OP_SUBTRACT_RR:
+                case OP_SUBTRACT_RK:
+                case OP_MULTIPLY_RR:
+                case OP_MULTIPLY_RK:
+                case OP_DIVIDE_RR:
+                case OP_DIVIDE_RK: {
+                    // Register forms never touch the stack, so every operand
+                    // mismatch, including string concatenation, is left to
+                    // the interpreter.
+                    uint8_t op = chunk.code[offset];
+                    int right = (op - OP_ADD_RR) % 2 == 1 ? CONSTANTS : SLOTS;
+                    int32_t b = slot(byteAt(offset + 2));
+                    int32_t c = slot(byteAt(offset + 3));
+                    guardNumber(SLOTS, b, interpret);
+                    guardNumber(right, c, interpret);
+                    a.movsdLoad(XMM0, SLOTS, b + PAYLOAD);
+                    a.movsdLoad(XMM1, right, c + PAYLOAD);
+                    if (op == OP_ADD_RR || op == OP_ADD_RK) {
+                        a.addsd(XMM0, XMM1);
+                    } else if (op == OP_SUBTRACT_RR || op == OP_SUBTRACT_RK) {
+                        a.subsd(XMM0, XMM1);
+                    } else if (op == OP_MULTIPLY_RR || op == OP_MULTIPLY_RK) {
+                        a.mulsd(XMM0, XMM1);
+                    } else {
+                        a.xorpd(XMM2, XMM2);
+                        a.ucomisd(XMM1, XMM2);
+                        a.jcc(CC_E, interpret);
+                        a.divsd(XMM0, XMM1);
+                    }
+                    storeNumber(SLOTS, slot(byteAt(offset + 1)), XMM0);
+                    return true;
+                }
+                case OP_LESS_JUMP_IF_FALSE_RR:
+                case OP_LESS_JUMP_IF_FALSE_RK:
+                case OP_GREATER_JUMP_IF_FALSE_RR:
+                case OP_GREATER_JUMP_IF_FALSE_RK:
+                case OP_EQUAL_JUMP_IF_FALSE_RR:
+                case OP_EQUAL_JUMP_IF_FALSE_RK: {
+                    uint8_t op = chunk.code[offset];
+                    int right = (op - OP_LESS_JUMP_IF_FALSE_RR) % 2 == 1 ? CONSTANTS : SLOTS;
+                    int32_t b = slot(byteAt(offset + 1));
+                    int32_t c = slot(byteAt(offset + 2));
+                    Label& target = labels[next + shortAt(offset + 3)];
+                    guardNumber(SLOTS, b, interpret);
+                    guardNumber(right, c, interpret);
+                    a.movsdLoad(XMM0, SLOTS, b + PAYLOAD);
+                    a.movsdLoad(XMM1, right, c + PAYLOAD);
+                    if (op == OP_LESS_JUMP_IF_FALSE_RR || op == OP_LESS_JUMP_IF_FALSE_RK) {
+                        a.ucomisd(XMM1, XMM0);
+                        a.jcc(CC_BE, target);
+                    } else if (op == OP_GREATER_JUMP_IF_FALSE_RR || op == OP_GREATER_JUMP_IF_FALSE_RK) {
+                        a.ucomisd(XMM0, XMM1);
+                        a.jcc(CC_BE, target);
+                    } else {
+                        // Unordered (NaN) compares unequal.
+                        a.ucomisd(XMM0, XMM1);
+                        a.jcc(CC_P, target);
+                        a.jcc(CC_NE, target);
+                    }
+                    return true;
+                }
+                default:
+                    // Class definitions, closures, super calls and instanceof.
+                    return false;
+            }
+        }
+
+        JitCode* JitCompiler::compile() {
+            emitPrologue();
+
+            std::vector<int32_t> entries(chunk.code.size(), -1);
+            for (int offset = 0; offset < (int)chunk.code.size(); offset += chunk.instructionLength(offset)) {
+                a.bind(labels[offset]);
+                entries[offset] = a.size();
+                if (!emitInstruction(offset)) a.jmp(exits[offset]);
+            }
+
+            emitExits();
+            emitEpilogue();
+
+            // Map writable, then flip to executable: never both at once.
+            size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+            size_t size = (a.code.size() + pageSize - 1) / pageSize * pageSize;
+            void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return nullptr;
+            std::memcpy(memory, a.code.data(), a.code.size());
+            if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(memory, size);
+                return nullptr;
+            }
+
+            JitCode* code = new JitCode();
+            code->memory = (uint8_t*)memory;
+            code->size = size;
+            code->entries = std::move(entries);
+            return code;
+        }
+
+    }
+
+    bool jitAvailable() {
+        return true;
+    }
+
+    JitCode* jitCompile(VM* vm, ObjFunction* function) {
+        return JitCompiler(vm, function).compile();
+    }
+
+    void jitFree(JitCode* code) {
+        munmap(code->memory, code->size);
+        delete code;
+    }
+
+    JitStatus jitRun(VM* vm, CallFrame* frame, JitCode* code) {
+        size_t offset = (size_t)(frame->ip - frame->closure->function->chunk.code.data());
+        int32_t entry = code->entries[offset];
+        if (entry < 0) return JitStatus::EXITED;
+        JitEntryFn run = (JitEntryFn)(void*)code->memory;
+        return (JitStatus)run(vm, frame, code->memory + entry);
+    }
+
+}
+
+#else
+
+namespace cxxx {
+
+    bool jitAvailable() {
+        return false;
+    }
+
+    JitCode* jitCompile(VM*, ObjFunction*) {
+        return nullptr;
+    }
+
+    void jitFree(JitCode*) {
+    }
+
+    JitStatus jitRun(VM*, CallFrame*, JitCode*) {
+        return JitStatus::EXITED;
+    }
+
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef cxxx_jit_h
+#define cxxx_jit_h
+
+#include "common.h"
+
+namespace cxxx {
+
+    class VM;
+    struct CallFrame;
+    struct ObjFunction;
+
+    // Calls plus loop back-edges a function must execute in the interpreter
+    // before it is compiled to native code.
+    #define JIT_HOT_THRESHOLD 1000
+
+    // How native code left a frame.
+    enum class JitStatus {
+        RETURNED,     // The frame returned: it is popped and its result pushed
+        EXITED,       // Hit something the JIT does not handle; the frame's ip
+                      // points at that instruction and the interpreter resumes it
+        RUNTIME_ERROR // A runtime error was reported
+    };
+
+    // Native code for one function, owned by the ObjFunction.
+    struct JitCode;
+
+    // The baseline JIT translates each bytecode instruction into a fixed
+    // x86-64 template that works directly on the VM's value stack and
+    // CallFrame, so a frame can move between native code and the interpreter
+    // at any instruction boundary. It is only built on Linux x86-64 (the
+    // CXXX_JIT define); elsewhere these are stubs and jitAvailable() is false.
+    bool jitAvailable();
+    JitCode* jitCompile(VM* vm, ObjFunction* function);
+    void jitFree(JitCode* code);
+
+    // Runs `frame` natively from its current ip.
+    JitStatus jitRun(VM* vm, CallFrame* frame, JitCode* code);
+
+}
+
+#endif
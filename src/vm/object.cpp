@@ -1,8 +1,10 @@
 #include "object.h"
 #include "table.h"
 #include "vm.h"
+#include "jit.h"
 #include <iostream>
 #include <cstring>
+#include <new>
 
 namespace cxxx {
 
@@ -15,65 +17,103 @@ namespace cxxx {
         return hash;
     }
 
-    ObjString* allocateString(VM* vm, const std::string& str) {
-        ObjString* obj = new ObjString();
-        obj->type = OBJ_STRING;
-        obj->isMarked = false;
-        obj->next = vm->objects;
-        vm->objects = obj;
-        obj->str = str;
-        obj->hash = hashString(str.c_str(), str.length());
-        return obj;
+    // Every object goes through here: the size is charged to the VM (which may
+    // collect first) and the object is carved from the VM's heap. It starts
+    // out young unless an incremental cycle is marking.
+    // `extra` covers memory owned by the object but allocated separately;
+    // `trailing` bytes are allocated directly after the object itself.
+    template <typename T>
+    static T* allocateObject(VM* vm, ObjType type, size_t extra = 0, size_t trailing = 0) {
+        vm->trackAllocation(sizeof(T) + extra + trailing);
+        T* object = new (vm->heap.allocate(sizeof(T) + trailing)) T();
+        object->type = type;
+        object->isRemembered = false;
+        if (vm->gcPhase == GC_MARK) {
+            // Traced in this cycle only if something reaches it.
+            object->isOld = true;
+            vm->heap.setOld(object);
+        } else {
+            object->isOld = false;
+            // The cycle's sweep rebuilds line maps from what marking
+            // stamped, so its young objects stamp their own lines.
+            if (vm->gcPhase == GC_SWEEP) vm->heap.markLines(object, sizeof(T) + trailing);
+        }
+        return object;
     }
 
-    ObjString* copyString(VM* vm, const char* chars, int length) {
-        uint32_t hash = hashString(chars, length);
-        ObjString* interned = vm->strings.findString(chars, length, hash);
-        if (interned != nullptr) return interned;
+    template <typename T>
+    static void destroyObject(VM* vm, T* object, size_t trailing = 0) {
+        object->~T();
+        vm->heap.release(object, sizeof(T) + trailing);
+    }
+
+    // Arrays and tables owned by an object come from the VM's pool; the
+    // caller charges their size.
+    template <typename T>
+    static T* allocateArray(VM* vm, int count) {
+        return (T*)vm->pool.allocate(sizeof(T) * count);
+    }
+
+    template <typename T>
+    static void freeArray(VM* vm, T* array, int count) {
+        vm->pool.free(array, sizeof(T) * count);
+    }
+
+    static Table* allocateTable(VM* vm) {
+        return new (vm->pool.allocate(sizeof(Table))) Table(&vm->pool, &vm->bytesAllocated);
+    }
+
+    static void freeTable(VM* vm, Table* table) {
+        table->~Table();
+        vm->pool.free(table, sizeof(Table));
+    }
 
-        ObjString* obj = allocateString(vm, std::string(chars, length));
+    // The hash is the caller's, worked out once for the interning lookup.
+    static ObjString* allocateString(VM* vm, const char* chars, int length, uint32_t hash) {
+        ObjString* obj = allocateObject<ObjString>(vm, OBJ_STRING, 0, length + 1);
+        obj->length = length;
+        obj->hash = hash;
+        memcpy(obj->chars(), chars, length);
+        obj->chars()[length] = '\0';
         vm->strings.set(obj, NIL_VAL());
         return obj;
     }
 
-    ObjString* takeString(VM* vm, char* chars, int length) {
+    ObjString* copyString(VM* vm, const char* chars, int length) {
         uint32_t hash = hashString(chars, length);
         ObjString* interned = vm->strings.findString(chars, length, hash);
-        if (interned != nullptr) return interned;
+        if (interned != nullptr) {
+            vm->shade((Obj*)interned);
+            return interned;
+        }
+        return allocateString(vm, chars, length, hash);
+    }
 
-        ObjString* obj = allocateString(vm, std::string(chars, length));
-        vm->strings.set(obj, NIL_VAL());
-        return obj;
+    ObjString* takeString(VM* vm, char* chars, int length) {
+        return copyString(vm, chars, length);
     }
 
     ObjNative* allocateNative(VM* vm, NativeFn function) {
-        ObjNative* native = new ObjNative();
-        native->type = OBJ_NATIVE;
-        native->isMarked = false;
-        native->next = vm->objects;
-        vm->objects = native;
+        ObjNative* native = allocateObject<ObjNative>(vm, OBJ_NATIVE);
         native->function = function;
         return native;
     }
 
     ObjFunction* allocateFunction(VM* vm) {
-        ObjFunction* function = new ObjFunction();
-        function->type = OBJ_FUNCTION;
-        function->isMarked = false;
-        function->next = vm->objects;
-        vm->objects = function;
+        ObjFunction* function = allocateObject<ObjFunction>(vm, OBJ_FUNCTION);
         function->arity = 0;
         function->upvalueCount = 0;
         function->name = nullptr;
+        // Until the compiler or loader has measured the code, claim the
+        // whole stack: such a function may only run at its base.
+        function->maxStack = STACK_MAX;
+        function->hotness = 0;
+        function->jit = nullptr;
         return function;
     }
 
     ObjUpvalue* allocateUpvalue(VM* vm, Value* slot) {
-        ObjUpvalue* upvalue = new ObjUpvalue();
-        upvalue->type = OBJ_UPVALUE;
-        upvalue->isMarked = false;
-        upvalue->next = vm->objects;
-        vm->objects = upvalue;
+        ObjUpvalue* upvalue = allocateObject<ObjUpvalue>(vm, OBJ_UPVALUE);
         upvalue->location = slot;
         upvalue->closed = NIL_VAL();
         upvalue->nextUpvalue = nullptr;
@@ -81,13 +121,10 @@ namespace cxxx {
     }
 
     ObjClosure* allocateClosure(VM* vm, ObjFunction* function) {
-        ObjClosure* closure = new ObjClosure();
-        closure->type = OBJ_CLOSURE;
-        closure->isMarked = false;
-        closure->next = vm->objects;
-        vm->objects = closure;
+        ObjClosure* closure = allocateObject<ObjClosure>(vm, OBJ_CLOSURE,
+            sizeof(ObjUpvalue*) * function->upvalueCount);
         closure->function = function;
-        closure->upvalues = new ObjUpvalue*[function->upvalueCount];
+        closure->upvalues = allocateArray<ObjUpvalue*>(vm, function->upvalueCount);
         closure->upvalueCount = function->upvalueCount;
         for (int i = 0; i < function->upvalueCount; i++) {
             closure->upvalues[i] = nullptr;
@@ -96,120 +133,258 @@ namespace cxxx {
     }
 
     ObjClass* allocateClass(VM* vm, ObjString* name) {
-        ObjClass* klass = new ObjClass();
-        klass->type = OBJ_CLASS;
-        klass->isMarked = false;
-        klass->next = vm->objects;
-        vm->objects = klass;
+        ObjClass* klass = allocateObject<ObjClass>(vm, OBJ_CLASS, sizeof(Table) + sizeof(ObjClass*));
         klass->name = name;
-        klass->methods = new Table();
+        klass->methods = allocateTable(vm);
+        // A new class may reuse the address of a collected one that inline
+        // caches still remember.
+        vm->methodEpoch++;
         klass->superclass = nullptr;
+        klass->depth = 0;
+        klass->display = allocateArray<ObjClass*>(vm, 1);
+        klass->display[0] = klass;
+        klass->initializer = nullptr;
+        klass->fieldCountHint = 0;
         return klass;
     }
 
+    void classSetSuperclass(VM* vm, ObjClass* klass, ObjClass* superclass) {
+        int depth = superclass->depth + 1;
+        ObjClass** display = allocateArray<ObjClass*>(vm, depth + 1);
+        for (int i = 0; i < depth; i++) {
+            display[i] = superclass->display[i];
+        }
+        display[depth] = klass;
+        // Charged without collecting: the caller holds both classes in
+        // unpublished stack slots.
+        vm->bytesAllocated += sizeof(ObjClass*) * depth;
+        freeArray(vm, klass->display, klass->depth + 1);
+        klass->superclass = superclass;
+        klass->depth = depth;
+        klass->display = display;
+    }
+
     ObjInstance* allocateInstance(VM* vm, ObjClass* klass) {
-        ObjInstance* instance = new ObjInstance();
-        instance->type = OBJ_INSTANCE;
-        instance->isMarked = false;
-        instance->next = vm->objects;
-        vm->objects = instance;
+        // Reserve inline room for as many fields as the class's instances
+        // have needed so far; most instances then never allocate again.
+        int inlineCapacity = klass->fieldCountHint;
+        ObjInstance* instance = allocateObject<ObjInstance>(vm, OBJ_INSTANCE, 0,
+            sizeof(Value) * inlineCapacity);
         instance->klass = klass;
-        instance->fields = new Table();
+        instance->shape = vm->emptyShape;
+        instance->fields = (Value*)(instance + 1);
+        instance->fieldCapacity = inlineCapacity;
+        instance->inlineCapacity = inlineCapacity;
+        instance->dictionary = nullptr;
         return instance;
     }
 
+    int shapeFind(Shape* shape, ObjString* key) {
+        for (; shape->key != nullptr; shape = shape->parent) {
+            if (shape->key == key) return shape->fieldCount - 1;
+        }
+        return -1;
+    }
+
+    Shape* shapeTransition(VM* vm, Shape* shape, ObjString* key) {
+        for (Shape* next : shape->transitions) {
+            if (next->key == key) return next;
+        }
+
+        Shape* next = new Shape();
+        next->parent = shape;
+        next->key = key;
+        vm->shade((Obj*)key);
+        next->fieldCount = shape->fieldCount + 1;
+        shape->transitions.push_back(next);
+        vm->shapes.push_back(next);
+        return next;
+    }
+
+    static void freeFieldArray(VM* vm, ObjInstance* instance) {
+        if (instance->fields != (Value*)(instance + 1)) {
+            vm->bytesAllocated -= sizeof(Value) * instance->fieldCapacity;
+            freeArray(vm, instance->fields, instance->fieldCapacity);
+        }
+        instance->fields = (Value*)(instance + 1);
+        instance->fieldCapacity = instance->inlineCapacity;
+    }
+
+    // Moves every field into a hash table. Used once an instance has too
+    // many fields for a linear shape walk to stay cheap.
+    static void convertToDictionary(VM* vm, ObjInstance* instance) {
+        Table* dictionary = allocateTable(vm);
+        vm->bytesAllocated += sizeof(Table);
+        for (Shape* shape = instance->shape; shape->key != nullptr; shape = shape->parent) {
+            dictionary->set(shape->key, instance->fields[shape->fieldCount - 1]);
+        }
+        freeFieldArray(vm, instance);
+        instance->shape = nullptr;
+        instance->dictionary = dictionary;
+    }
+
+    void instanceAppendField(VM* vm, ObjInstance* instance, Shape* next, Value value) {
+        StoreGuard guard(vm);
+        int count = next->fieldCount;
+        if (count > instance->fieldCapacity) {
+            int capacity = instance->fieldCapacity < 4 ? 4 : instance->fieldCapacity * 2;
+            Value* fields = allocateArray<Value>(vm, capacity);
+            for (int i = 0; i < count - 1; i++) {
+                fields[i] = instance->fields[i];
+            }
+            freeFieldArray(vm, instance);
+            vm->bytesAllocated += sizeof(Value) * capacity;
+            instance->fields = fields;
+            instance->fieldCapacity = capacity;
+        }
+
+        instance->fields[count - 1] = value;
+        vm->writeBarrier(instance, value);
+        instance->shape = next;
+        if (count > instance->klass->fieldCountHint) {
+            instance->klass->fieldCountHint = count;
+        }
+    }
+
+    bool instanceGetField(ObjInstance* instance, ObjString* key, Value* value) {
+        if (instance->dictionary != nullptr) return instance->dictionary->get(key, value);
+
+        int index = shapeFind(instance->shape, key);
+        if (index < 0) return false;
+        *value = instance->fields[index];
+        return true;
+    }
+
+    void instanceSetField(VM* vm, ObjInstance* instance, ObjString* key, Value value) {
+        StoreGuard guard(vm);
+        if (instance->dictionary != nullptr) {
+            instance->dictionary->set(key, value);
+            vm->writeBarrier(instance, (Obj*)key);
+            vm->writeBarrier(instance, value);
+            return;
+        }
+
+        int index = shapeFind(instance->shape, key);
+        if (index >= 0) {
+            instance->fields[index] = value;
+            vm->writeBarrier(instance, value);
+            return;
+        }
+
+        if (instance->shape->fieldCount == SHAPE_MAX_FIELDS) {
+            convertToDictionary(vm, instance);
+            instance->dictionary->set(key, value);
+            vm->writeBarrier(instance, (Obj*)key);
+            vm->writeBarrier(instance, value);
+            return;
+        }
+        instanceAppendField(vm, instance, shapeTransition(vm, instance->shape, key), value);
+    }
+
     ObjBoundMethod* allocateBoundMethod(VM* vm, Value receiver, ObjClosure* method) {
-        ObjBoundMethod* bound = new ObjBoundMethod();
-        bound->type = OBJ_BOUND_METHOD;
-        bound->isMarked = false;
-        bound->next = vm->objects;
-        vm->objects = bound;
+        ObjBoundMethod* bound = allocateObject<ObjBoundMethod>(vm, OBJ_BOUND_METHOD);
         bound->receiver = receiver;
         bound->method = method;
         return bound;
     }
 
-    void freeObject(Obj* obj) {
+    void freeObject(VM* vm, Obj* obj) {
         switch (obj->type) {
             case OBJ_STRING: {
                 ObjString* string = (ObjString*)obj;
-                delete string;
+                vm->bytesAllocated -= string->size();
+                destroyObject(vm, string, string->length + 1);
                 break;
             }
             case OBJ_NATIVE: {
-                delete (ObjNative*)obj;
+                vm->bytesAllocated -= sizeof(ObjNative);
+                destroyObject(vm, (ObjNative*)obj);
                 break;
             }
             case OBJ_FUNCTION: {
                 ObjFunction* function = (ObjFunction*)obj;
-                delete function;
+                vm->bytesAllocated -= sizeof(ObjFunction);
+                if (function->jit != nullptr) jitFree(function->jit);
+                destroyObject(vm, function);
                 break;
             }
             case OBJ_CLOSURE: {
                 ObjClosure* closure = (ObjClosure*)obj;
-                delete[] closure->upvalues;
-                delete closure;
+                vm->bytesAllocated -= sizeof(ObjClosure) + sizeof(ObjUpvalue*) * closure->upvalueCount;
+                freeArray(vm, closure->upvalues, closure->upvalueCount);
+                destroyObject(vm, closure);
                 break;
             }
             case OBJ_UPVALUE: {
-                delete (ObjUpvalue*)obj;
+                vm->bytesAllocated -= sizeof(ObjUpvalue);
+                destroyObject(vm, (ObjUpvalue*)obj);
                 break;
             }
             case OBJ_CLASS: {
                 ObjClass* klass = (ObjClass*)obj;
-                delete klass->methods;
-                delete klass;
+                vm->bytesAllocated -= sizeof(ObjClass) + sizeof(Table) + sizeof(ObjClass*) * (klass->depth + 1);
+                freeTable(vm, klass->methods);
+                freeArray(vm, klass->display, klass->depth + 1);
+                destroyObject(vm, klass);
                 break;
             }
             case OBJ_INSTANCE: {
                 ObjInstance* instance = (ObjInstance*)obj;
-                delete instance->fields;
-                delete instance;
+                freeFieldArray(vm, instance);
+                if (instance->dictionary != nullptr) {
+                    vm->bytesAllocated -= sizeof(Table);
+                    freeTable(vm, instance->dictionary);
+                }
+                vm->bytesAllocated -= sizeof(ObjInstance) + sizeof(Value) * instance->inlineCapacity;
+                destroyObject(vm, instance, sizeof(Value) * instance->inlineCapacity);
                 break;
             }
             case OBJ_BOUND_METHOD: {
-                delete (ObjBoundMethod*)obj;
+                vm->bytesAllocated -= sizeof(ObjBoundMethod);
+                destroyObject(vm, (ObjBoundMethod*)obj);
                 break;
             }
         }
     }
 
     void printObject(Value value) {
-        switch (value.as.obj->type) {
-            case OBJ_STRING:
-                std::cout << ((ObjString*)value.as.obj)->str;
+        switch (value.asObj()->type) {
+            case OBJ_STRING: {
+                ObjString* string = (ObjString*)value.asObj();
+                std::cout.write(string->chars(), string->length);
                 break;
+            }
             case OBJ_NATIVE:
                 std::cout << "<native fn>";
                 break;
             case OBJ_FUNCTION:
-                if (((ObjFunction*)value.as.obj)->name == nullptr) {
+                if (((ObjFunction*)value.asObj())->name == nullptr) {
                     std::cout << "<script>";
                 } else {
-                    std::cout << "<fn " << ((ObjFunction*)value.as.obj)->name->str << ">";
+                    std::cout << "<fn " << ((ObjFunction*)value.asObj())->name->chars() << ">";
                 }
                 break;
             case OBJ_CLOSURE:
-                if (((ObjClosure*)value.as.obj)->function->name == nullptr) {
+                if (((ObjClosure*)value.asObj())->function->name == nullptr) {
                     std::cout << "<script>";
                 } else {
-                    std::cout << "<fn " << ((ObjClosure*)value.as.obj)->function->name->str << ">";
+                    std::cout << "<fn " << ((ObjClosure*)value.asObj())->function->name->chars() << ">";
                 }
                 break;
             case OBJ_UPVALUE:
                 std::cout << "upvalue";
                 break;
             case OBJ_CLASS:
-                std::cout << ((ObjClass*)value.as.obj)->name->str;
+                std::cout << ((ObjClass*)value.asObj())->name->chars();
                 break;
             case OBJ_INSTANCE:
-                std::cout << ((ObjInstance*)value.as.obj)->klass->name->str << " instance";
+                std::cout << ((ObjInstance*)value.asObj())->klass->name->chars() << " instance";
                 break;
             case OBJ_BOUND_METHOD:
-                if (((ObjBoundMethod*)value.as.obj)->method->function->name == nullptr) {
+                if (((ObjBoundMethod*)value.asObj())->method->function->name == nullptr) {
                     std::cout << "<script>";
                 } else {
-                    std::cout << "<fn " << ((ObjBoundMethod*)value.as.obj)->method->function->name->str << ">";
+                    std::cout << "<fn " << ((ObjBoundMethod*)value.asObj())->method->function->name->chars() << ">";
                 }
                 break;
         }
@@ -5,6 +5,7 @@
 #include "value.h"
 #include "chunk.h"
 #include <string>
+#include <vector>
 
 namespace cxxx {
 
@@ -21,16 +22,27 @@ namespace cxxx {
 
     struct Obj; // Forward declare
     class VM;   // Forward declare
+    struct JitCode;
 
+    // Objects live in the VM's Heap, which keeps their mark bits and knows
+    // where each one starts, so the header needs no mark or list link.
     struct Obj {
         ObjType type;
-        bool isMarked;
-        Obj* next; // For GC
+        bool isOld;        // Survived a collection; see VM::collectYoung()
+        bool isRemembered; // Old, and on VM::remembered
     };
 
+    // The characters, NUL-terminated, follow the header in the same
+    // allocation; a string is sized once, when it is made, and never
+    // changes after.
     struct ObjString : public Obj {
-        std::string str;
+        int length;
         uint32_t hash;
+
+        char* chars() { return reinterpret_cast<char*>(this + 1); }
+        const char* chars() const { return reinterpret_cast<const char*>(this + 1); }
+        // Bytes the whole allocation takes, header and NUL included.
+        size_t size() const { return sizeof(ObjString) + length + 1; }
     };
 
     struct ObjNative : public Obj {
@@ -42,6 +54,9 @@ namespace cxxx {
         int upvalueCount;
         Chunk chunk;
         ObjString* name;
+        int maxStack; // Deepest the stack gets in a frame, counting the slots
+        int hotness;  // Calls plus loop back-edges, until the JIT compiles it
+        JitCode* jit; // Native code, or nullptr while interpreted
     };
 
     struct ObjUpvalue : public Obj {
@@ -59,16 +74,45 @@ namespace cxxx {
     // Forward declare Table
     class Table;
 
+    // Instances with more fields than this switch to dictionary mode.
+    #define SHAPE_MAX_FIELDS 32
+
+    // Hidden class describing the layout of an instance's field array.
+    // Shapes form a transition tree keyed by field insertion order, so
+    // instances that gained the same fields in the same order share one.
+    // Shapes are owned by the VM and live as long as it does.
+    struct Shape {
+        Shape* parent;
+        ObjString* key;                 // Field added by the transition into this shape
+        int fieldCount;                 // Fields in this layout; `key` lives at fieldCount - 1
+        std::vector<Shape*> transitions;
+    };
+
     struct ObjClass : public Obj {
         ObjString* name;
+        // Own methods plus, copied down by OP_INHERIT, every inherited one,
+        // so a method is always one lookup away whatever the depth.
         Table* methods;
         // Optional superclass, can be null
         struct ObjClass* superclass;
+        // Ancestor display: display[i] is the ancestor at depth i, counting
+        // the root as 0, and display[depth] the class itself. A class is a
+        // subclass of `c` iff c->depth <= depth && display[c->depth] == c.
+        int depth;
+        struct ObjClass** display;
+        // The `init` method, own or inherited, or nullptr; also in `methods`.
+        struct ObjClosure* initializer;
+        // Most fields any instance has grown to; sizes new instances' inline storage.
+        int fieldCountHint;
     };
 
     struct ObjInstance : public Obj {
         ObjClass* klass;
-        Table* fields;
+        Shape* shape;       // nullptr in dictionary mode
+        Value* fields;      // shape->fieldCount values, inline or on the heap
+        int fieldCapacity;
+        int inlineCapacity; // Value slots allocated directly after the object
+        Table* dictionary;  // Field storage in dictionary mode, otherwise nullptr
     };
 
     struct ObjBoundMethod : public Obj {
@@ -77,11 +121,10 @@ namespace cxxx {
     };
 
     inline bool isObjType(Value value, ObjType type) {
-        return value.isObj() && value.as.obj->type == type;
+        return value.isObj() && value.asObj()->type == type;
     }
 
     // Helper functions
-    ObjString* allocateString(VM* vm, const std::string& str);
     // Uses vm->strings for interning if vm is provided (though vm is required now)
     ObjString* copyString(VM* vm, const char* chars, int length);
     ObjString* takeString(VM* vm, char* chars, int length);
@@ -91,10 +134,19 @@ namespace cxxx {
     ObjUpvalue* allocateUpvalue(VM* vm, Value* slot);
     ObjClosure* allocateClosure(VM* vm, ObjFunction* function);
     ObjClass* allocateClass(VM* vm, ObjString* name);
+    // Links a class that has no superclass yet under `superclass`.
+    void classSetSuperclass(VM* vm, ObjClass* klass, ObjClass* superclass);
     ObjInstance* allocateInstance(VM* vm, ObjClass* klass);
     ObjBoundMethod* allocateBoundMethod(VM* vm, Value receiver, ObjClosure* method);
 
-    void freeObject(Obj* obj);
+    // Shapes and instance fields
+    int shapeFind(Shape* shape, ObjString* key);
+    Shape* shapeTransition(VM* vm, Shape* shape, ObjString* key);
+    bool instanceGetField(ObjInstance* instance, ObjString* key, Value* value);
+    void instanceSetField(VM* vm, ObjInstance* instance, ObjString* key, Value value);
+    void instanceAppendField(VM* vm, ObjInstance* instance, Shape* next, Value value);
+
+    void freeObject(VM* vm, Obj* obj);
     void printObject(Value value);
 
 }
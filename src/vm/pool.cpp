@@ -0,0 +1,35 @@
+#include "pool.h"
+
+namespace cxxx {
+
+    Pool::Pool() {
+        for (Block*& list : freeLists) list = nullptr;
+    }
+
+    Pool::~Pool() {
+        for (void* slab : slabs) {
+            CXXX_UNPOISON(slab, POOL_SLAB_SIZE);
+            ::operator delete(slab);
+        }
+    }
+
+    void* Pool::refill(int sizeClass) {
+        size_t blockSize = (size_t)(sizeClass + 1) * POOL_GRANULE;
+        char* slab = (char*)::operator new(POOL_SLAB_SIZE);
+        slabs.push_back(slab);
+
+        // The first block is handed out; the rest go on the free list in
+        // address order.
+        size_t blocks = POOL_SLAB_SIZE / blockSize;
+        Block* list = nullptr;
+        for (size_t i = blocks - 1; i > 0; i--) {
+            Block* block = (Block*)(slab + i * blockSize);
+            block->next = list;
+            list = block;
+        }
+        freeLists[sizeClass] = list;
+        CXXX_POISON(slab + blockSize, (blocks - 1) * blockSize);
+        return slab;
+    }
+
+}
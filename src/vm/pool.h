@@ -0,0 +1,75 @@
+#ifndef cxxx_pool_h
+#define cxxx_pool_h
+
+#include "common.h"
+#include <new>
+#include <vector>
+
+namespace cxxx {
+
+    // Requests are rounded up to a multiple of POOL_GRANULE; anything larger
+    // than POOL_MAX_SIZE goes to the global allocator.
+    #define POOL_GRANULE 16
+    #define POOL_MAX_SIZE 512
+    #define POOL_SLAB_SIZE 4096
+
+    // Size-segregated allocator for the small arrays and tables a VM's
+    // objects own; the objects themselves live in the VM's Heap. Each size
+    // class carves POOL_SLAB_SIZE slabs into equal blocks and keeps the free
+    // ones on a list; slabs go back to the system only when the pool is
+    // destroyed. Callers pass the size back to free(), so blocks carry no
+    // header. Built as plain ::operator new/delete without the
+    // CXXX_POOL_ALLOCATOR define.
+    class Pool {
+    public:
+        Pool();
+        ~Pool();
+        Pool(const Pool&) = delete;
+        Pool& operator=(const Pool&) = delete;
+
+        void* allocate(size_t size) {
+#ifdef CXXX_POOL_ALLOCATOR
+            if (size - 1 < POOL_MAX_SIZE) {
+                int sizeClass = (int)((size - 1) / POOL_GRANULE);
+                Block* block = freeLists[sizeClass];
+                if (block == nullptr) return refill(sizeClass);
+                CXXX_UNPOISON(block, (size_t)(sizeClass + 1) * POOL_GRANULE);
+                freeLists[sizeClass] = block->next;
+                return block;
+            }
+#endif
+            return ::operator new(size);
+        }
+
+        // `size` must be what the block was allocated with.
+        void free(void* pointer, size_t size) {
+#ifdef CXXX_POOL_ALLOCATOR
+            if (size - 1 < POOL_MAX_SIZE) {
+                int sizeClass = (int)((size - 1) / POOL_GRANULE);
+                Block* block = (Block*)pointer;
+                block->next = freeLists[sizeClass];
+                freeLists[sizeClass] = block;
+                CXXX_POISON(block, (size_t)(sizeClass + 1) * POOL_GRANULE);
+                return;
+            }
+#endif
+            ::operator delete(pointer);
+        }
+
+        size_t slabCount() const { return slabs.size(); }
+
+    private:
+        struct Block {
+            Block* next;
+        };
+
+        Block* freeLists[POOL_MAX_SIZE / POOL_GRANULE];
+        std::vector<void*> slabs;
+
+        // Carves a new slab for `sizeClass` and returns its first block.
+        void* refill(int sizeClass);
+    };
+
+}
+
+#endif
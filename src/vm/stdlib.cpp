@@ -14,20 +14,18 @@ namespace cxxx {
         if (argCount != 1 || !isObjType(args[0], OBJ_STRING)) {
             return NIL_VAL();
         }
-        ObjString* strObj = (ObjString*)args[0].as.obj;
-        return NUMBER_VAL((double)strObj->str.length());
+        ObjString* strObj = (ObjString*)args[0].asObj();
+        return NUMBER_VAL((double)strObj->length);
     }
 
     Value strAtNative(void* vm, int argCount, Value* args) {
         if (argCount != 2 || !isObjType(args[0], OBJ_STRING) || !args[1].isNumber()) {
             return NIL_VAL();
         }
-        ObjString* strObj = (ObjString*)args[0].as.obj;
+        ObjString* strObj = (ObjString*)args[0].asObj();
         int index = (int)args[1].asNumber();
-        if (index < 0 || index >= strObj->str.length()) return NIL_VAL();
-
-        std::string sub = strObj->str.substr(index, 1);
-        return OBJ_VAL((Obj*)copyString((VM*)vm, sub.c_str(), 1));
+        if (index < 0 || index >= strObj->length) return NIL_VAL();
+        return OBJ_VAL((Obj*)copyString((VM*)vm, strObj->chars() + index, 1));
     }
 
     // Init stdlib
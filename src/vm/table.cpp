@@ -6,14 +6,29 @@ namespace cxxx {
 
     #define TABLE_MAX_LOAD 0.75
 
-    Table::Table() {
+    Table::Table(Pool* pool, size_t* allocationCounter) : pool(pool), allocationCounter(allocationCounter) {
         count = 0;
         capacity = 0;
         entries = nullptr;
     }
 
     Table::~Table() {
-        delete[] entries;
+        if (allocationCounter != nullptr) *allocationCounter -= sizeof(Entry) * capacity;
+        freeEntries(entries, capacity);
+    }
+
+    Entry* Table::allocateEntries(int capacity) {
+        size_t size = sizeof(Entry) * capacity;
+        return (Entry*)(pool != nullptr ? pool->allocate(size) : ::operator new(size));
+    }
+
+    void Table::freeEntries(Entry* entries, int capacity) {
+        if (entries == nullptr) return;
+        if (pool != nullptr) {
+            pool->free(entries, sizeof(Entry) * capacity);
+        } else {
+            ::operator delete(entries);
+        }
     }
 
     Entry* Table::findEntry(Entry* entries, int capacity, ObjString* key) {
@@ -72,7 +87,7 @@ namespace cxxx {
     }
 
     void Table::adjustCapacity(int capacity) {
-        Entry* newEntries = new Entry[capacity];
+        Entry* newEntries = allocateEntries(capacity);
         for (int i = 0; i < capacity; i++) {
             newEntries[i].key = nullptr;
             newEntries[i].value = NIL_VAL();
@@ -89,7 +104,10 @@ namespace cxxx {
             count++;
         }
 
-        delete[] entries;
+        if (allocationCounter != nullptr) {
+            *allocationCounter += sizeof(Entry) * (capacity - this->capacity);
+        }
+        freeEntries(entries, this->capacity);
         entries = newEntries;
         this->capacity = capacity;
     }
@@ -119,11 +137,18 @@ namespace cxxx {
         return true;
     }
 
+    void Table::addAll(Table* to) {
+        for (int i = 0; i < capacity; i++) {
+            Entry* entry = &entries[i];
+            if (entry->key != nullptr) to->set(entry->key, entry->value);
+        }
+    }
+
     // Debug helper
     void printTable(Table* table) {
         for (int i = 0; i < table->capacity; i++) {
             if (table->entries[i].key != nullptr) {
-                std::cout << "Index " << i << ": key=" << table->entries[i].key->str
+                std::cout << "Index " << i << ": key=" << table->entries[i].key->chars()
                           << " (" << table->entries[i].key << ")"
                           << " hash=" << table->entries[i].key->hash << std::endl;
             }
@@ -151,9 +176,9 @@ namespace cxxx {
             if (entry->key == nullptr) {
                 // Stop if we find an empty non-tombstone entry.
                 if (entry->value.isNil()) return nullptr;
-            } else if (entry->key->str.length() == length &&
-                       entry->key->hash == hash &&
-                       memcmp(entry->key->str.c_str(), chars, length) == 0) {
+            } else if (entry->key->hash == hash &&
+                       entry->key->length == length &&
+                       memcmp(entry->key->chars(), chars, length) == 0) {
                 // We found it.
                 return entry->key;
             }
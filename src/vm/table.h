@@ -4,6 +4,7 @@
 #include "common.h"
 #include "value.h"
 #include "object.h"
+#include "pool.h"
 
 namespace cxxx {
 
@@ -14,11 +15,17 @@ namespace cxxx {
 
     class Table {
     public:
-        Table();
+        // The entry array comes from `pool` when one is given, otherwise
+        // from the global allocator. If `allocationCounter` is given, the
+        // array's size is added to (and on destruction removed from) the
+        // counter so the GC can see it.
+        Table(Pool* pool = nullptr, size_t* allocationCounter = nullptr);
         ~Table();
 
         bool set(ObjString* key, Value value);
         bool get(ObjString* key, Value* value);
+        // Copies every entry into `to`, overwriting keys it already has.
+        void addAll(Table* to);
 
         // debug
         friend void printTable(Table* table);
@@ -30,6 +37,12 @@ namespace cxxx {
         Entry* entries;
 
     private:
+        Pool* pool;
+        size_t* allocationCounter;
+
+        Entry* allocateEntries(int capacity);
+        void freeEntries(Entry* entries, int capacity);
+
         Entry* findEntry(Entry* entries, int capacity, ObjString* key);
         void adjustCapacity(int capacity);
     };
@@ -1,42 +1,36 @@
 #include "value.h"
 #include "object.h"
 #include <iostream>
+#include <cstring>
 
 namespace cxxx {
 
+    // Written against the accessor API only, so it works for both the
+    // tagged-union and the NaN-boxed representation of Value.
     bool valuesEqual(Value a, Value b) {
-        if (a.type != b.type) return false;
-        switch (a.type) {
-            case VAL_BOOL: return a.as.boolean == b.as.boolean;
-            case VAL_NIL: return true;
-            case VAL_NUMBER: return a.as.number == b.as.number;
-            case VAL_OBJ: {
-                if (a.as.obj == b.as.obj) return true;
-                if (a.as.obj->type == OBJ_STRING && b.as.obj->type == OBJ_STRING) {
-                    ObjString* sa = (ObjString*)a.as.obj;
-                    ObjString* sb = (ObjString*)b.as.obj;
-                    return sa->str == sb->str;
-                }
-                return false;
+        if (a.isNumber()) return b.isNumber() && a.asNumber() == b.asNumber();
+        if (a.isBool()) return b.isBool() && a.asBool() == b.asBool();
+        if (a.isNil()) return b.isNil();
+        if (a.isObj() && b.isObj()) {
+            if (a.asObj() == b.asObj()) return true;
+            if (a.asObj()->type == OBJ_STRING && b.asObj()->type == OBJ_STRING) {
+                ObjString* sa = (ObjString*)a.asObj();
+                ObjString* sb = (ObjString*)b.asObj();
+                return sa->length == sb->length && memcmp(sa->chars(), sb->chars(), sa->length) == 0;
             }
-            default: return false; // Should not happen
         }
+        return false;
     }
 
     void printValue(Value value) {
-        switch (value.type) {
-            case VAL_BOOL:
-                std::cout << (value.as.boolean ? "true" : "false");
-                break;
-            case VAL_NIL:
-                std::cout << "nil";
-                break;
-            case VAL_NUMBER:
-                std::cout << value.as.number;
-                break;
-            case VAL_OBJ:
-                printObject(value);
-                break;
+        if (value.isBool()) {
+            std::cout << (value.asBool() ? "true" : "false");
+        } else if (value.isNil()) {
+            std::cout << "nil";
+        } else if (value.isNumber()) {
+            std::cout << value.asNumber();
+        } else if (value.isObj()) {
+            printObject(value);
         }
     }
 }
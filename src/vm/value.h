@@ -23,6 +23,10 @@ namespace cxxx {
         return Value::object(object);
     }
 
+    inline Value UNDEFINED_VAL() {
+        return Value::undefined();
+    }
+
     // Helper methods
     bool valuesEqual(Value a, Value b);
     void printValue(Value value);
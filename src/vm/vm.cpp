@@ -1,27 +1,78 @@
 #include "vm.h"
+#include "jit.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
 
 namespace cxxx {
 
-    VM::VM() : globals(), strings() {
+    VM::VM() : globalSlots(&pool, &bytesAllocated), strings(&pool, &bytesAllocated) {
+        frames = new CallFrame[FRAMES_INITIAL];
+        frameCapacity = FRAMES_INITIAL;
+        stack = new Value[STACK_INITIAL];
+        stackLimit = stack + STACK_INITIAL;
         resetStack();
         openUpvalues = nullptr;
-        objects = nullptr;
+        collectingYoung = false;
         frameCount = 0;
+        bytesAllocated = 0;
+        nextGC = GC_INITIAL_THRESHOLD;
+        gcThreshold = GC_INITIAL_THRESHOLD;
+        gcGrowthFactor = GC_HEAP_GROW_FACTOR;
+        youngBytes = 0;
+        nurserySize = GC_NURSERY_SIZE;
+        shapesScanned = 0;
+        gcPhase = GC_IDLE;
+        sliceBudget = 0;
+        sliceDebt = 0;
+        lazySweep = false;
+        pauseLog = nullptr;
+        concurrentMarking = false;
+        markerActive = false;
+        storeLocked = false;
+        storesWaiting = 0;
+        markerDone = false;
+        markerStop = false;
+        gcThreads = 1;
+        heap.setFinalizer([](void* vm, void* object) { freeObject((VM*)vm, (Obj*)object); }, this);
+        methodEpoch = 0;
+        jitEnabled = false;
+        jitThreshold = JIT_HOT_THRESHOLD;
+        emptyShape = new Shape();
+        emptyShape->parent = nullptr;
+        emptyShape->key = nullptr;
+        emptyShape->fieldCount = 0;
+        shapes.push_back(emptyShape);
+
+        // A collection while interning must see the whole array.
+        for (int i = 0; i < SYMBOL_COUNT; i++) symbols[i] = nullptr;
+        symbols[SYMBOL_INIT] = copyString(this, "init", 4);
     }
 
     VM::~VM() {
         free();
+        for (Shape* shape : shapes) {
+            delete shape;
+        }
+        delete[] frames;
+        delete[] stack;
     }
 
     void VM::init() {
         resetStack();
         openUpvalues = nullptr;
-        objects = nullptr;
         frameCount = 0;
     }
 
     void VM::free() {
+        if (markerActive) {
+            markerStop = true;
+            joinMarker();
+        }
         freeObjects();
     }
 
@@ -32,9 +83,12 @@ namespace cxxx {
     }
 
     bool VM::push(Value value) {
-        if (stackTop - stack >= STACK_MAX) {
-            std::cerr << "Stack overflow!" << std::endl;
-            return false;
+        if (stackTop == stackLimit) {
+            if (stackTop - stack >= STACK_MAX) {
+                std::cerr << "Stack overflow!" << std::endl;
+                return false;
+            }
+            growStack((size_t)(stackTop - stack) + 1);
         }
         *stackTop = value;
         stackTop++;
@@ -58,363 +112,854 @@ namespace cxxx {
         return stackTop == stack;
     }
 
+    bool VM::reserve(int frames, size_t values) {
+        if (frames > FRAMES_MAX || values > STACK_MAX) {
+            std::cerr << "Stack overflow." << std::endl;
+            return false;
+        }
+        if (frames > frameCapacity) growFrames(frames);
+        if (values > (size_t)(stackLimit - stack)) growStack(values);
+        return true;
+    }
+
+    void VM::growFrames(int capacity) {
+        int grown = frameCapacity;
+        while (grown < capacity) grown *= 2;
+        if (grown > FRAMES_MAX) grown = FRAMES_MAX;
+
+        CallFrame* moved = new CallFrame[grown];
+        std::copy(frames, frames + frameCount, moved);
+        delete[] frames;
+        frames = moved;
+        frameCapacity = grown;
+    }
+
+    // Moves the stack to a bigger buffer and rebases every pointer into it:
+    // the stack top, each frame's window and the open upvalues.
+    void VM::growStack(size_t capacity) {
+        size_t grown = (size_t)(stackLimit - stack);
+        while (grown < capacity) grown *= 2;
+        if (grown > STACK_MAX) grown = STACK_MAX;
+
+        Value* moved = new Value[grown];
+        std::copy(stack, stackTop, moved);
+        for (int i = 0; i < frameCount; i++) {
+            frames[i].slots = moved + (frames[i].slots - stack);
+        }
+        for (ObjUpvalue* upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextUpvalue) {
+            upvalue->location = moved + (upvalue->location - stack);
+        }
+        stackTop = moved + (stackTop - stack);
+        delete[] stack;
+        stack = moved;
+        stackLimit = moved + grown;
+    }
+
     InterpretResult VM::interpret(ObjFunction* function) {
+        // The function is not reachable from anywhere until its closure is on
+        // the stack, so keep it alive across the allocation.
+        pushRoot((Obj*)function);
         ObjClosure* closure = allocateClosure(this, function);
+        popRoot();
         if (!push(OBJ_VAL((Obj*)closure))) return InterpretResult::RUNTIME_ERROR;
-        if (!callValue(OBJ_VAL((Obj*)closure), 0)) return InterpretResult::RUNTIME_ERROR;
+        if (!call(closure, 0)) {
+            resetStack();
+            return InterpretResult::RUNTIME_ERROR;
+        }
 
-        return run();
+        InterpretResult result = run(0);
+        // run() bails out without unwinding, and may not even have published
+        // its stack top, so drop whatever the error left behind. Closures
+        // that escaped keep the values they captured.
+        if (result == InterpretResult::RUNTIME_ERROR) {
+            closeUpvalues(stack);
+            resetStack();
+        }
+        return result;
+    }
+
+    int VM::globalSlot(ObjString* name) {
+        Value slot;
+        if (globalSlots.get(name, &slot)) return (int)slot.asNumber();
+
+        int index = (int)globalValues.size();
+        globalSlots.set(name, NUMBER_VAL(index));
+        globalNames.push_back(name);
+        globalValues.push_back(UNDEFINED_VAL());
+        globalsData = globalValues.data();
+        globalRemembered.push_back(false);
+        bytesAllocated += sizeof(ObjString*) + sizeof(Value);
+        if (!name->isOld) rememberGlobal(index);
+        shade((Obj*)name);
+        return index;
+    }
+
+    bool VM::getGlobal(ObjString* name, Value* value) {
+        Value slot;
+        if (!globalSlots.get(name, &slot)) return false;
+        Value global = globalValues[(int)slot.asNumber()];
+        if (global.isUndefined()) return false;
+        *value = global;
+        return true;
+    }
+
+    void VM::setGlobal(ObjString* name, Value value) {
+        int slot = globalSlot(name);
+        globalValues[slot] = value;
+        globalBarrier(slot, value);
     }
 
     bool isFalsey(Value value) {
         return value.isNil() || (value.isBool() && !value.asBool());
     }
 
-    InterpretResult VM::run() {
-        CallFrame* frame = &frames[frameCount - 1];
+    InterpretResult VM::run(int baseFrame) {
+        // The current frame's ip, the stack top and the constant table live
+        // in locals. Anything that reaches them through the VM instead (calls,
+        // allocation, which may collect, the slow paths, the JIT) runs between
+        // SAVE_STATE(), which publishes ip and the stack top, and
+        // LOAD_STATE(), which picks up the then-current frame again.
+        CallFrame* frame;
+        uint8_t* ip;
+        Value* sp;
+        Value* constants;
 
-        #define READ_BYTE() (*frame->ip++)
-        #define READ_CONSTANT() (frame->closure->function->chunk.constants[READ_BYTE()])
-        #define READ_STRING() ((ObjString*)READ_CONSTANT().as.obj)
-        #define PUSH(value) do { if (!push(value)) return InterpretResult::RUNTIME_ERROR; } while(false)
+        #define LOAD_FRAME() \
+            (frame = &frames[frameCount - 1], ip = frame->ip, \
+             constants = frame->closure->function->chunk.constants.data())
+        #define LOAD_STATE() (LOAD_FRAME(), sp = stackTop)
+        #define SAVE_STATE() (frame->ip = ip, stackTop = sp)
 
-        for (;;) {
-            #ifdef DEBUG_TRACE_EXECUTION
-                std::cout << "          ";
-                for (Value* slot = stack; slot < stackTop; slot++) {
-                    std::cout << "[ ";
-                    printValue(*slot);
-                    std::cout << " ]";
-                }
-                std::cout << std::endl;
-                frame->closure->function->chunk.disassembleInstruction((int)(frame->ip - frame->closure->function->chunk.code.data()));
-            #endif
+        LOAD_STATE();
+
+        #define READ_BYTE() (*ip++)
+        #define READ_CONSTANT() (constants[READ_BYTE()])
+        #define READ_STRING() ((ObjString*)READ_CONSTANT().asObj())
+        #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+        #define READ_INLINE_CACHE() (&frame->closure->function->chunk.inlineCaches[READ_SHORT()])
+        // Unchecked: callValue() made sure the frame has room for the
+        // function's maxStack slots before it started running.
+        #define PUSH(value) (*sp++ = (value))
+        #define POP() (*--sp)
+        #define DROP() (--sp) // POP() for a value nobody reads
+        #define PEEK(distance) (sp[-1 - (distance)])
+        // Rewrites the instruction `length` bytes back, which just ran, to
+        // its quickened form, unless it has fallen back before; and back.
+        #define QUICKEN(length, quickened) \
+            do { \
+                Chunk& chunk = frame->closure->function->chunk; \
+                if (chunk.mayQuicken((int)(ip - (length) - chunk.code.data()))) ip[-(length)] = (quickened); \
+            } while (false)
+        #define DEQUICKEN(length, generic) \
+            do { \
+                Chunk& chunk = frame->closure->function->chunk; \
+                chunk.dequicken((int)(ip - (length) - chunk.code.data()), (generic)); \
+            } while (false)
 
-            uint8_t instruction;
-            switch (instruction = READ_BYTE()) {
-                case OP_CONSTANT: {
+        // Register forms read their operands straight from the frame: R is
+        // a slot, K a constant.
+        #define READ_REGISTER() (frame->slots[READ_BYTE()])
+        // slots[dst] = b + c, concatenating like OP_ADD unless both are numbers.
+        #define ADD_INTO(dst, b, c) \
+            do { \
+                if ((b).isNumber() && (c).isNumber()) { \
+                    frame->slots[dst] = NUMBER_VAL((b).asNumber() + (c).asNumber()); \
+                } else { \
+                    PUSH(b); \
+                    PUSH(c); \
+                    SAVE_STATE(); \
+                    if (!concatenate()) return InterpretResult::RUNTIME_ERROR; \
+                    sp = stackTop; \
+                    frame->slots[dst] = POP(); \
+                } \
+            } while (false)
+        #define DIVIDE_INTO(dst, b, c) \
+            do { \
+                double divisor = (c).asNumber(); \
+                if (divisor == 0) { \
+                    std::cerr << "Division by zero." << std::endl; \
+                    return InterpretResult::RUNTIME_ERROR; \
+                } \
+                frame->slots[dst] = NUMBER_VAL((b).asNumber() / divisor); \
+            } while (false)
+
+        #ifdef DEBUG_TRACE_EXECUTION
+            #define TRACE_INSTRUCTION() \
+                do { \
+                    std::cout << "          "; \
+                    for (Value* slot = stack; slot < sp; slot++) { \
+                        std::cout << "[ "; \
+                        printValue(*slot); \
+                        std::cout << " ]"; \
+                    } \
+                    std::cout << std::endl; \
+                    frame->closure->function->chunk.disassembleInstruction( \
+                        (int)(ip - frame->closure->function->chunk.code.data())); \
+                } while (false)
+        #else
+            #define TRACE_INSTRUCTION() do { } while (false)
+        #endif
+
+        #ifdef CXXX_JIT
+            // Runs the top frame natively if its function is hot. The native
+            // code either finishes the frame or exits back here, leaving ip at
+            // an instruction it does not handle. Expects the state saved.
+            #define ENTER_JIT() \
+                do { \
+                    if (jitEnabled) { \
+                        CallFrame* top = &frames[frameCount - 1]; \
+                        if (tierUp(top->closure->function)) { \
+                            if (jitRun(this, top, top->closure->function->jit) == JitStatus::RUNTIME_ERROR) \
+                                return InterpretResult::RUNTIME_ERROR; \
+                            if (frameCount == baseFrame) return InterpretResult::OK; \
+                        } \
+                    } \
+                    LOAD_STATE(); \
+                } while (false)
+            // After a call instruction. `frame` may be stale if the call grew
+            // the frame array, but a frame the call pushed has not run yet,
+            // so its ip is still at its first instruction; the caller's is
+            // past the call.
+            #define ENTER_CALLEE() \
+                do { \
+                    CallFrame* callee = &frames[frameCount - 1]; \
+                    if (callee->ip == callee->closure->function->chunk.code.data()) ENTER_JIT(); \
+                    else LOAD_STATE(); \
+                } while (false)
+        #else
+            #define ENTER_JIT() LOAD_STATE()
+            #define ENTER_CALLEE() LOAD_STATE()
+        #endif
+
+        #ifdef CXXX_COMPUTED_GOTO
+            // Direct-threaded dispatch: every handler ends with its own indirect
+            // jump, so the branch predictor can learn per-opcode successors.
+            // The table must list the handlers in OpCode order.
+            static void* const dispatchTable[] = {
+                &&TARGET_OP_CONSTANT, &&TARGET_OP_RETURN, &&TARGET_OP_NEGATE,
+                &&TARGET_OP_ADD, &&TARGET_OP_SUBTRACT, &&TARGET_OP_MULTIPLY,
+                &&TARGET_OP_DIVIDE, &&TARGET_OP_NOT, &&TARGET_OP_EQUAL,
+                &&TARGET_OP_GREATER, &&TARGET_OP_LESS, &&TARGET_OP_JUMP,
+                &&TARGET_OP_JUMP_IF_FALSE, &&TARGET_OP_LOOP, &&TARGET_OP_POP,
+                &&TARGET_OP_DEFINE_GLOBAL, &&TARGET_OP_GET_GLOBAL, &&TARGET_OP_SET_GLOBAL,
+                &&TARGET_OP_GET_LOCAL, &&TARGET_OP_SET_LOCAL, &&TARGET_OP_CALL,
+                &&TARGET_OP_PRINT, &&TARGET_OP_CLASS, &&TARGET_OP_METHOD,
+                &&TARGET_OP_GET_PROPERTY, &&TARGET_OP_SET_PROPERTY, &&TARGET_OP_INVOKE,
+                &&TARGET_OP_INHERIT, &&TARGET_OP_GET_SUPER, &&TARGET_OP_SUPER_INVOKE,
+                &&TARGET_OP_CLOSURE, &&TARGET_OP_GET_UPVALUE, &&TARGET_OP_SET_UPVALUE,
+                &&TARGET_OP_CLOSE_UPVALUE, &&TARGET_OP_INSTANCEOF, &&TARGET_OP_TAIL_CALL,
+                &&TARGET_OP_TAIL_INVOKE, &&TARGET_OP_TAIL_SUPER_INVOKE,
+                &&TARGET_OP_POP_JUMP_IF_FALSE, &&TARGET_OP_LESS_JUMP_IF_FALSE,
+                &&TARGET_OP_INCREMENT_LOCAL, &&TARGET_OP_SET_LOCAL_POP, &&TARGET_OP_SET_GLOBAL_POP,
+                &&TARGET_OP_MOVE, &&TARGET_OP_LOAD_CONSTANT,
+                &&TARGET_OP_ADD_RR, &&TARGET_OP_ADD_RK, &&TARGET_OP_SUBTRACT_RR, &&TARGET_OP_SUBTRACT_RK,
+                &&TARGET_OP_MULTIPLY_RR, &&TARGET_OP_MULTIPLY_RK, &&TARGET_OP_DIVIDE_RR, &&TARGET_OP_DIVIDE_RK,
+                &&TARGET_OP_LESS_JUMP_IF_FALSE_RR, &&TARGET_OP_LESS_JUMP_IF_FALSE_RK,
+                &&TARGET_OP_GREATER_JUMP_IF_FALSE_RR, &&TARGET_OP_GREATER_JUMP_IF_FALSE_RK,
+                &&TARGET_OP_EQUAL_JUMP_IF_FALSE_RR, &&TARGET_OP_EQUAL_JUMP_IF_FALSE_RK,
+                &&TARGET_OP_ADD_NUM, &&TARGET_OP_CALL_CLOSURE
+            };
+            static_assert(sizeof(dispatchTable) / sizeof(dispatchTable[0]) == OP_CALL_CLOSURE + 1,
+                          "dispatchTable is out of sync with OpCode");
+
+            #define DISPATCH() \
+                do { \
+                    TRACE_INSTRUCTION(); \
+                    uint8_t instruction = READ_BYTE(); \
+                    if (instruction > OP_CALL_CLOSURE) return InterpretResult::RUNTIME_ERROR; \
+                    goto *dispatchTable[instruction]; \
+                } while (false)
+            #define CASE(op) case op: TARGET_##op
+        #else
+            #define DISPATCH() break
+            #define CASE(op) case op
+        #endif
+
+        // In threaded mode the switch only performs the first dispatch; every
+        // handler then jumps straight to its successor through dispatchTable.
+        for (;;) {
+            TRACE_INSTRUCTION();
+            switch (READ_BYTE()) {
+                CASE(OP_CONSTANT): {
                     Value constant = READ_CONSTANT();
                     PUSH(constant);
-                    break;
+                    DISPATCH();
                 }
-                case OP_ADD: {
-                    if (isObjType(peek(0), OBJ_STRING) && isObjType(peek(1), OBJ_STRING)) {
-                        ObjString* b = (ObjString*)peek(0).as.obj;
-                        ObjString* a = (ObjString*)peek(1).as.obj;
-                        std::string s = a->str + b->str;
-                        pop();
-                        pop();
-                        PUSH(OBJ_VAL((Obj*)copyString(this, s.c_str(), (int)s.length())));
-                    } else if (peek(0).isNumber() && peek(1).isNumber()) {
-                        double b = pop().asNumber();
-                        double a = pop().asNumber();
+                CASE(OP_ADD): {
+                    if (PEEK(0).isNumber() && PEEK(1).isNumber()) {
+                        QUICKEN(1, OP_ADD_NUM);
+                        double b = POP().asNumber();
+                        double a = POP().asNumber();
                         PUSH(NUMBER_VAL(a + b));
-                    } else if (isObjType(peek(0), OBJ_STRING) && peek(1).isNumber()) {
-                        // Number + String -> String
-                        ObjString* b = (ObjString*)peek(0).as.obj;
-                        double aVal = peek(1).asNumber();
-                        std::string aStr = std::to_string(aVal);
-                        if (aStr.find('.') != std::string::npos) {
-                            while (aStr.back() == '0') aStr.pop_back();
-                            if (aStr.back() == '.') aStr.pop_back();
-                        }
-                        std::string s = aStr + b->str;
-                        pop();
-                        pop();
-                        PUSH(OBJ_VAL((Obj*)copyString(this, s.c_str(), (int)s.length())));
-                    } else if (peek(0).isNumber() && isObjType(peek(1), OBJ_STRING)) {
-                        // String + Number -> String
-                        double bVal = peek(0).asNumber();
-                        ObjString* a = (ObjString*)peek(1).as.obj;
-                        std::string bStr = std::to_string(bVal);
-                        if (bStr.find('.') != std::string::npos) {
-                            while (bStr.back() == '0') bStr.pop_back();
-                            if (bStr.back() == '.') bStr.pop_back();
-                        }
-                        std::string s = a->str + bStr;
-                        pop();
-                        pop();
-                        PUSH(OBJ_VAL((Obj*)copyString(this, s.c_str(), (int)s.length())));
                     } else {
-                        std::cerr << "Operands must be numbers or strings." << std::endl;
-                        return InterpretResult::RUNTIME_ERROR;
+                        SAVE_STATE();
+                        if (!concatenate()) return InterpretResult::RUNTIME_ERROR;
+                        sp = stackTop;
                     }
-                    break;
+                    DISPATCH();
                 }
-                case OP_SUBTRACT: {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
+                CASE(OP_ADD_NUM): {
+                    if (!PEEK(0).isNumber() || !PEEK(1).isNumber()) {
+                        DEQUICKEN(1, OP_ADD);
+                        SAVE_STATE();
+                        if (!concatenate()) return InterpretResult::RUNTIME_ERROR;
+                        sp = stackTop;
+                        DISPATCH();
+                    }
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
+                    PUSH(NUMBER_VAL(a + b));
+                    DISPATCH();
+                }
+                CASE(OP_SUBTRACT): {
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
                     PUSH(NUMBER_VAL(a - b));
-                    break;
+                    DISPATCH();
                 }
-                case OP_MULTIPLY: {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
+                CASE(OP_MULTIPLY): {
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
                     PUSH(NUMBER_VAL(a * b));
-                    break;
+                    DISPATCH();
                 }
-                case OP_DIVIDE: {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
+                CASE(OP_DIVIDE): {
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
                     if (b == 0) {
                         std::cerr << "Division by zero." << std::endl;
                         return InterpretResult::RUNTIME_ERROR;
                     }
                     PUSH(NUMBER_VAL(a / b));
-                    break;
+                    DISPATCH();
                 }
-                case OP_NOT: {
-                    PUSH(BOOL_VAL(isFalsey(pop())));
-                    break;
+                CASE(OP_NOT): {
+                    PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+                    DISPATCH();
                 }
-                case OP_EQUAL: {
-                    Value b = pop();
-                    Value a = pop();
+                CASE(OP_EQUAL): {
+                    Value b = POP();
+                    Value a = POP();
                     PUSH(BOOL_VAL(valuesEqual(a, b)));
-                    break;
+                    DISPATCH();
                 }
-                case OP_GREATER: {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
+                CASE(OP_GREATER): {
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
                     PUSH(BOOL_VAL(a > b));
-                    break;
+                    DISPATCH();
                 }
-                case OP_LESS: {
-                    double b = pop().asNumber();
-                    double a = pop().asNumber();
+                CASE(OP_LESS): {
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
                     PUSH(BOOL_VAL(a < b));
-                    break;
+                    DISPATCH();
                 }
-                case OP_JUMP: {
+                CASE(OP_JUMP): {
                     uint16_t offset = (uint16_t)(READ_BYTE() << 8);
                     offset |= READ_BYTE();
-                    frame->ip += offset;
-                    break;
+                    ip += offset;
+                    DISPATCH();
                 }
-                case OP_JUMP_IF_FALSE: {
+                CASE(OP_JUMP_IF_FALSE): {
                     uint16_t offset = (uint16_t)(READ_BYTE() << 8);
                     offset |= READ_BYTE();
-                    if (isFalsey(peek(0))) {
-                        frame->ip += offset;
+                    if (isFalsey(PEEK(0))) {
+                        ip += offset;
                     }
-                    break;
+                    DISPATCH();
                 }
-                case OP_LOOP: {
+                CASE(OP_LOOP): {
                     uint16_t offset = (uint16_t)(READ_BYTE() << 8);
                     offset |= READ_BYTE();
-                    frame->ip -= offset;
-                    break;
+                    ip -= offset;
+                    // A hot loop continues natively from its header.
+                    if (jitEnabled) {
+                        SAVE_STATE();
+                        ENTER_JIT();
+                    }
+                    DISPATCH();
                 }
-                case OP_POP: {
-                    pop();
-                    break;
+                CASE(OP_POP): {
+                    DROP();
+                    DISPATCH();
                 }
-                case OP_GET_LOCAL: {
+                CASE(OP_GET_LOCAL): {
                     uint8_t slot = READ_BYTE();
                     PUSH(frame->slots[slot]);
-                    break;
+                    DISPATCH();
                 }
-                case OP_SET_LOCAL: {
+                CASE(OP_SET_LOCAL): {
                     uint8_t slot = READ_BYTE();
-                    frame->slots[slot] = peek(0);
-                    break;
+                    frame->slots[slot] = PEEK(0);
+                    DISPATCH();
                 }
-                case OP_GET_GLOBAL: {
-                    ObjString* name = READ_STRING();
-                    Value value;
-                    if (!globals.get(name, &value)) {
-                        std::cerr << "Undefined variable '" << name->str << "'." << std::endl;
+                CASE(OP_GET_GLOBAL): {
+                    uint16_t slot = READ_SHORT();
+                    Value value = globalValues[slot];
+                    if (value.isUndefined()) {
+                        std::cerr << "Undefined variable '" << globalNames[slot]->chars() << "'." << std::endl;
                         return InterpretResult::RUNTIME_ERROR;
                     }
                     PUSH(value);
-                    break;
+                    DISPATCH();
                 }
-                case OP_DEFINE_GLOBAL: {
-                    ObjString* name = READ_STRING();
-                    globals.set(name, peek(0));
-                    pop();
-                    break;
+                CASE(OP_DEFINE_GLOBAL): {
+                    uint16_t slot = READ_SHORT();
+                    globalValues[slot] = PEEK(0);
+                    globalBarrier(slot, PEEK(0));
+                    DROP();
+                    DISPATCH();
                 }
-                case OP_SET_GLOBAL: {
-                    ObjString* name = READ_STRING();
-                    if (globals.set(name, peek(0))) {
-                        globals.deleteEntry(name);
-                        std::cerr << "Undefined variable '" << name->str << "'." << std::endl;
+                CASE(OP_SET_GLOBAL): {
+                    uint16_t slot = READ_SHORT();
+                    if (globalValues[slot].isUndefined()) {
+                        std::cerr << "Undefined variable '" << globalNames[slot]->chars() << "'." << std::endl;
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    break;
+                    globalValues[slot] = PEEK(0);
+                    globalBarrier(slot, PEEK(0));
+                    DISPATCH();
                 }
-                case OP_CLASS: {
-                    PUSH(OBJ_VAL((Obj*)allocateClass(this, READ_STRING())));
-                    break;
+                CASE(OP_CLASS): {
+                    ObjString* name = READ_STRING();
+                    SAVE_STATE();
+                    PUSH(OBJ_VAL((Obj*)allocateClass(this, name)));
+                    DISPATCH();
                 }
-                case OP_METHOD: {
-                    defineMethod(READ_STRING());
-                    break;
+                CASE(OP_METHOD): {
+                    ObjString* name = READ_STRING();
+                    SAVE_STATE();
+                    if (!defineMethod(name)) return InterpretResult::RUNTIME_ERROR;
+                    sp = stackTop;
+                    DISPATCH();
                 }
-                case OP_GET_PROPERTY: {
-                    if (!isObjType(peek(0), OBJ_INSTANCE)) {
-                        std::cerr << "Only instances have properties." << std::endl;
-                        return InterpretResult::RUNTIME_ERROR;
-                    }
-                    ObjInstance* instance = (ObjInstance*)peek(0).as.obj;
+                CASE(OP_GET_PROPERTY): {
                     ObjString* name = READ_STRING();
-
-                    Value value;
-                    if (instance->fields->get(name, &value)) {
-                        pop(); // Instance.
-                        PUSH(value);
-                        break;
-                    }
-
-                    if (!bindMethod(instance->klass, name)) {
-                        return InterpretResult::RUNTIME_ERROR;
+                    InlineCache* cache = READ_INLINE_CACHE();
+                    // Monomorphic hit: the field's slot is known from the shape alone.
+                    if (isObjType(PEEK(0), OBJ_INSTANCE)) {
+                        ObjInstance* instance = (ObjInstance*)PEEK(0).asObj();
+                        if (cache->shapeCount > 0 && cache->shapes[0] == instance->shape &&
+                            cache->fieldIndices[0] >= 0) {
+                            sp[-1] = instance->fields[cache->fieldIndices[0]];
+                            DISPATCH();
+                        }
                     }
-                    break;
+                    SAVE_STATE();
+                    if (!getProperty(name, cache)) return InterpretResult::RUNTIME_ERROR;
+                    sp = stackTop;
+                    DISPATCH();
                 }
-                case OP_SET_PROPERTY: {
-                    if (!isObjType(peek(1), OBJ_INSTANCE)) {
-                        std::cerr << "Only instances have fields." << std::endl;
-                        return InterpretResult::RUNTIME_ERROR;
+                CASE(OP_SET_PROPERTY): {
+                    ObjString* name = READ_STRING();
+                    InlineCache* cache = READ_INLINE_CACHE();
+                    if (isObjType(PEEK(1), OBJ_INSTANCE)) {
+                        ObjInstance* instance = (ObjInstance*)PEEK(1).asObj();
+                        if (cache->shapeCount > 0 && cache->shapes[0] == instance->shape &&
+                            cache->fieldIndices[0] >= 0) {
+                            {
+                                StoreGuard guard(this);
+                                instance->fields[cache->fieldIndices[0]] = PEEK(0);
+                                writeBarrier(instance, PEEK(0));
+                            }
+                            sp[-2] = sp[-1];
+                            sp--;
+                            DISPATCH();
+                        }
                     }
-                    ObjInstance* instance = (ObjInstance*)peek(1).as.obj;
-                    instance->fields->set(READ_STRING(), peek(0));
-                    Value value = pop();
-                    pop();
-                    PUSH(value);
-                    break;
+                    SAVE_STATE();
+                    if (!setProperty(name, cache)) return InterpretResult::RUNTIME_ERROR;
+                    sp = stackTop;
+                    DISPATCH();
                 }
-                case OP_INVOKE: {
+                CASE(OP_INVOKE): {
                     ObjString* method = READ_STRING();
                     int argCount = READ_BYTE();
-                    if (!invoke(method, argCount)) {
+                    InlineCache* cache = READ_INLINE_CACHE();
+                    SAVE_STATE();
+                    if (!invokeCached(method, argCount, cache)) {
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    frame = &frames[frameCount - 1];
-                    break;
+                    ENTER_CALLEE();
+                    DISPATCH();
                 }
-                case OP_INHERIT: {
-                    Value superclass = peek(1);
+                CASE(OP_INHERIT): {
+                    Value superclass = PEEK(1);
                     if (!isObjType(superclass, OBJ_CLASS)) {
                         std::cerr << "Superclass must be a class." << std::endl;
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    ObjClass* subclass = (ObjClass*)peek(0).as.obj;
-                    subclass->superclass = (ObjClass*)superclass.as.obj; // Set superclass
-                    pop(); // Subclass.
-                    break;
+                    if (!isObjType(PEEK(0), OBJ_CLASS)) {
+                        std::cerr << "Only classes can inherit." << std::endl;
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ObjClass* subclass = (ObjClass*)PEEK(0).asObj();
+                    {
+                        StoreGuard guard(this);
+                        classSetSuperclass(this, subclass, (ObjClass*)superclass.asObj());
+                        // Copy-down inheritance: the subclass body has not run
+                        // yet, so its own methods override these as they are
+                        // defined. The superclass is complete by now.
+                        subclass->superclass->methods->addAll(subclass->methods);
+                        subclass->initializer = subclass->superclass->initializer;
+                        writeBarrier(subclass, superclass);
+                    }
+                    methodEpoch++;
+                    DROP(); // Subclass.
+                    DISPATCH();
                 }
-                case OP_GET_SUPER: {
+                CASE(OP_GET_SUPER): {
                     ObjString* name = READ_STRING();
-                    ObjClass* superclass = (ObjClass*)pop().as.obj;
+                    if (!isObjType(PEEK(0), OBJ_CLASS)) {
+                        std::cerr << "Superclass must be a class." << std::endl;
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ObjClass* superclass = (ObjClass*)POP().asObj();
+                    SAVE_STATE();
                     if (!bindMethod(superclass, name)) {
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    break;
+                    sp = stackTop;
+                    DISPATCH();
                 }
-                case OP_SUPER_INVOKE: {
+                CASE(OP_SUPER_INVOKE): {
                     ObjString* method = READ_STRING();
                     int argCount = READ_BYTE();
-                    ObjClass* superclass = (ObjClass*)pop().as.obj;
+                    if (!isObjType(PEEK(0), OBJ_CLASS)) {
+                        std::cerr << "Superclass must be a class." << std::endl;
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ObjClass* superclass = (ObjClass*)POP().asObj();
+                    SAVE_STATE();
                     if (!invokeFromClass(superclass, method, argCount)) {
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    frame = &frames[frameCount - 1];
-                    break;
+                    ENTER_CALLEE();
+                    DISPATCH();
                 }
-                case OP_CALL: {
+                CASE(OP_CALL): {
                     int argCount = READ_BYTE();
-                    if (!callValue(peek(argCount), argCount)) {
+                    Value callee = PEEK(argCount);
+                    if (isObjType(callee, OBJ_CLOSURE) &&
+                        ((ObjClosure*)callee.asObj())->function->arity == argCount) {
+                        QUICKEN(2, OP_CALL_CLOSURE);
+                    }
+                    SAVE_STATE();
+                    if (!callValue(callee, argCount)) {
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    frame = &frames[frameCount - 1];
-                    break;
+                    ENTER_CALLEE();
+                    DISPATCH();
+                }
+                CASE(OP_CALL_CLOSURE): {
+                    int argCount = READ_BYTE();
+                    Value callee = PEEK(argCount);
+                    if (!isObjType(callee, OBJ_CLOSURE) ||
+                        ((ObjClosure*)callee.asObj())->function->arity != argCount) {
+                        DEQUICKEN(2, OP_CALL);
+                        SAVE_STATE();
+                        if (!callValue(callee, argCount)) {
+                            return InterpretResult::RUNTIME_ERROR;
+                        }
+                        ENTER_CALLEE();
+                        DISPATCH();
+                    }
+                    ObjClosure* closure = (ObjClosure*)callee.asObj();
+                    Value* slots = sp - argCount - 1;
+                    if (frameCount == frameCapacity || slots + closure->function->maxStack > stackLimit) {
+                        SAVE_STATE();
+                        if (!reserve(frameCount + 1, (size_t)(slots - stack) + closure->function->maxStack)) {
+                            return InterpretResult::RUNTIME_ERROR;
+                        }
+                        LOAD_STATE(); // Either array may have moved.
+                        slots = sp - argCount - 1;
+                    }
+                    frame->ip = ip;
+                    frame = &frames[frameCount++];
+                    frame->closure = closure;
+                    frame->slots = slots;
+                    ip = closure->function->chunk.code.data();
+                    constants = closure->function->chunk.constants.data();
+                    if (jitEnabled) {
+                        SAVE_STATE();
+                        ENTER_JIT();
+                    }
+                    DISPATCH();
+                }
+                CASE(OP_TAIL_CALL): {
+                    int argCount = READ_BYTE();
+                    SAVE_STATE();
+                    if (!tailCallValue(PEEK(argCount), argCount)) {
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ENTER_CALLEE();
+                    DISPATCH();
+                }
+                CASE(OP_TAIL_INVOKE): {
+                    ObjString* method = READ_STRING();
+                    int argCount = READ_BYTE();
+                    InlineCache* cache = READ_INLINE_CACHE();
+                    SAVE_STATE();
+                    if (!invokeCached(method, argCount, cache, true)) {
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ENTER_CALLEE();
+                    DISPATCH();
+                }
+                CASE(OP_TAIL_SUPER_INVOKE): {
+                    ObjString* method = READ_STRING();
+                    int argCount = READ_BYTE();
+                    if (!isObjType(PEEK(0), OBJ_CLASS)) {
+                        std::cerr << "Superclass must be a class." << std::endl;
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ObjClass* superclass = (ObjClass*)POP().asObj();
+                    SAVE_STATE();
+                    if (!invokeFromClass(superclass, method, argCount, true)) {
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    ENTER_CALLEE();
+                    DISPATCH();
                 }
-                case OP_PRINT: {
-                    printValue(pop());
+                CASE(OP_PRINT): {
+                    printValue(POP());
                     std::cout << std::endl;
-                    break;
+                    DISPATCH();
                 }
-                case OP_CLOSURE: {
-                    ObjFunction* function = (ObjFunction*)READ_CONSTANT().as.obj;
+                CASE(OP_CLOSURE): {
+                    ObjFunction* function = (ObjFunction*)READ_CONSTANT().asObj();
+                    SAVE_STATE();
                     ObjClosure* closure = allocateClosure(this, function);
                     PUSH(OBJ_VAL((Obj*)closure));
+                    stackTop = sp; // Capturing allocates.
                     for (int i = 0; i < closure->upvalueCount; i++) {
                         uint8_t isLocal = READ_BYTE();
                         uint8_t index = READ_BYTE();
-                        if (isLocal) {
-                            closure->upvalues[i] = captureUpvalue(frame->slots + index);
-                        } else {
-                            closure->upvalues[i] = frame->closure->upvalues[index];
-                        }
+                        ObjUpvalue* upvalue = isLocal ? captureUpvalue(frame->slots + index)
+                                                      : frame->closure->upvalues[index];
+                        // Capturing may have collected, promoting the closure,
+                        // or started a cycle that has the marker reading it.
+                        StoreGuard guard(this);
+                        closure->upvalues[i] = upvalue;
+                        writeBarrier(closure, upvalue);
                     }
-                    break;
+                    DISPATCH();
                 }
-                case OP_GET_UPVALUE: {
+                CASE(OP_GET_UPVALUE): {
                     uint8_t slot = READ_BYTE();
                     PUSH(*frame->closure->upvalues[slot]->location);
-                    break;
+                    DISPATCH();
+                }
+                CASE(OP_SET_UPVALUE): {
+                    ObjUpvalue* upvalue = frame->closure->upvalues[READ_BYTE()];
+                    {
+                        StoreGuard guard(this);
+                        *upvalue->location = PEEK(0);
+                        writeBarrier(upvalue, PEEK(0));
+                    }
+                    DISPATCH();
+                }
+                CASE(OP_CLOSE_UPVALUE): {
+                    closeUpvalues(sp - 1);
+                    DROP();
+                    DISPATCH();
                 }
-                case OP_SET_UPVALUE: {
+                CASE(OP_POP_JUMP_IF_FALSE): {
+                    uint16_t offset = READ_SHORT();
+                    if (isFalsey(POP())) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_LESS_JUMP_IF_FALSE): {
+                    uint16_t offset = READ_SHORT();
+                    double b = POP().asNumber();
+                    double a = POP().asNumber();
+                    if (!(a < b)) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_INCREMENT_LOCAL): {
                     uint8_t slot = READ_BYTE();
-                    *frame->closure->upvalues[slot]->location = peek(0);
-                    break;
+                    int8_t delta = (int8_t)READ_BYTE();
+                    Value local = frame->slots[slot];
+                    // `--` mirrors OP_SUBTRACT, which does not check its operands;
+                    // `++` on a non-number behaves like OP_ADD with 1.
+                    if (local.isNumber() || delta < 0) {
+                        frame->slots[slot] = NUMBER_VAL(local.asNumber() + delta);
+                    } else {
+                        PUSH(local);
+                        PUSH(NUMBER_VAL(delta));
+                        SAVE_STATE();
+                        if (!concatenate()) return InterpretResult::RUNTIME_ERROR;
+                        sp = stackTop;
+                        frame->slots[slot] = POP();
+                    }
+                    DISPATCH();
                 }
-                case OP_CLOSE_UPVALUE: {
-                    closeUpvalues(stackTop - 1);
-                    pop();
-                    break;
+                CASE(OP_SET_LOCAL_POP): {
+                    uint8_t slot = READ_BYTE();
+                    frame->slots[slot] = POP();
+                    DISPATCH();
                 }
-                case OP_INSTANCEOF: {
-                    Value superclass = peek(0);
+                CASE(OP_SET_GLOBAL_POP): {
+                    uint16_t slot = READ_SHORT();
+                    if (globalValues[slot].isUndefined()) {
+                        std::cerr << "Undefined variable '" << globalNames[slot]->chars() << "'." << std::endl;
+                        return InterpretResult::RUNTIME_ERROR;
+                    }
+                    globalValues[slot] = POP();
+                    globalBarrier(slot, *sp);
+                    DISPATCH();
+                }
+                CASE(OP_MOVE): {
+                    uint8_t dst = READ_BYTE();
+                    frame->slots[dst] = READ_REGISTER();
+                    DISPATCH();
+                }
+                CASE(OP_LOAD_CONSTANT): {
+                    uint8_t dst = READ_BYTE();
+                    frame->slots[dst] = READ_CONSTANT();
+                    DISPATCH();
+                }
+                CASE(OP_ADD_RR): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    ADD_INTO(dst, b, c);
+                    DISPATCH();
+                }
+                CASE(OP_ADD_RK): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    ADD_INTO(dst, b, c);
+                    DISPATCH();
+                }
+                CASE(OP_SUBTRACT_RR): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    frame->slots[dst] = NUMBER_VAL(b.asNumber() - c.asNumber());
+                    DISPATCH();
+                }
+                CASE(OP_SUBTRACT_RK): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    frame->slots[dst] = NUMBER_VAL(b.asNumber() - c.asNumber());
+                    DISPATCH();
+                }
+                CASE(OP_MULTIPLY_RR): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    frame->slots[dst] = NUMBER_VAL(b.asNumber() * c.asNumber());
+                    DISPATCH();
+                }
+                CASE(OP_MULTIPLY_RK): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    frame->slots[dst] = NUMBER_VAL(b.asNumber() * c.asNumber());
+                    DISPATCH();
+                }
+                CASE(OP_DIVIDE_RR): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    DIVIDE_INTO(dst, b, c);
+                    DISPATCH();
+                }
+                CASE(OP_DIVIDE_RK): {
+                    uint8_t dst = READ_BYTE();
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    DIVIDE_INTO(dst, b, c);
+                    DISPATCH();
+                }
+                CASE(OP_LESS_JUMP_IF_FALSE_RR): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    uint16_t offset = READ_SHORT();
+                    if (!(b.asNumber() < c.asNumber())) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_LESS_JUMP_IF_FALSE_RK): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    uint16_t offset = READ_SHORT();
+                    if (!(b.asNumber() < c.asNumber())) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_GREATER_JUMP_IF_FALSE_RR): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    uint16_t offset = READ_SHORT();
+                    if (!(b.asNumber() > c.asNumber())) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_GREATER_JUMP_IF_FALSE_RK): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    uint16_t offset = READ_SHORT();
+                    if (!(b.asNumber() > c.asNumber())) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_EQUAL_JUMP_IF_FALSE_RR): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_REGISTER();
+                    uint16_t offset = READ_SHORT();
+                    if (!valuesEqual(b, c)) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_EQUAL_JUMP_IF_FALSE_RK): {
+                    Value b = READ_REGISTER();
+                    Value c = READ_CONSTANT();
+                    uint16_t offset = READ_SHORT();
+                    if (!valuesEqual(b, c)) ip += offset;
+                    DISPATCH();
+                }
+                CASE(OP_INSTANCEOF): {
+                    Value superclass = PEEK(0);
                     if (!isObjType(superclass, OBJ_CLASS)) {
                         std::cerr << "Right operand must be a class." << std::endl;
                         return InterpretResult::RUNTIME_ERROR;
                     }
-                    Value instance = peek(1);
+                    Value instance = PEEK(1);
                     if (!isObjType(instance, OBJ_INSTANCE)) {
-                        pop(); // superclass
-                        pop(); // instance
+                        DROP(); // superclass
+                        DROP(); // instance
                         PUSH(BOOL_VAL(false));
-                        break;
+                        DISPATCH();
                     }
 
-                    ObjClass* targetClass = (ObjClass*)superclass.as.obj;
-                    ObjInstance* obj = (ObjInstance*)instance.as.obj;
-                    ObjClass* currentClass = obj->klass;
+                    // One probe into the instance's class display, however
+                    // deep either class sits.
+                    ObjClass* targetClass = (ObjClass*)superclass.asObj();
+                    ObjClass* klass = ((ObjInstance*)instance.asObj())->klass;
+                    bool found = targetClass->depth <= klass->depth &&
+                                 klass->display[targetClass->depth] == targetClass;
 
-                    bool found = false;
-                    while (currentClass != nullptr) {
-                        if (currentClass == targetClass) {
-                            found = true;
-                            break;
-                        }
-                        currentClass = currentClass->superclass;
-                    }
-
-                    pop(); // superclass
-                    pop(); // instance
+                    DROP(); // superclass
+                    DROP(); // instance
                     PUSH(BOOL_VAL(found));
-                    break;
+                    DISPATCH();
                 }
-                case OP_NEGATE: {
-                    PUSH(NUMBER_VAL(-pop().asNumber()));
-                    break;
+                CASE(OP_NEGATE): {
+                    PEEK(0) = NUMBER_VAL(-PEEK(0).asNumber());
+                    DISPATCH();
                 }
-                case OP_RETURN: {
-                    Value result = pop();
+                CASE(OP_RETURN): {
+                    Value result = POP();
                     closeUpvalues(frame->slots);
                     frameCount--;
-                    if (frameCount == 0) {
-                        pop();
-                        PUSH(result);
+                    sp = frame->slots;
+                    PUSH(result);
+                    if (frameCount == baseFrame) {
+                        stackTop = sp;
                         return InterpretResult::OK;
                     }
-
-                    stackTop = frame->slots;
-                    PUSH(result);
-                    frame = &frames[frameCount - 1];
-                    break;
+                    LOAD_FRAME();
+                    DISPATCH();
                 }
                 default:
                     return InterpretResult::RUNTIME_ERROR;
@@ -424,6 +969,44 @@ namespace cxxx {
         #undef READ_BYTE
         #undef READ_CONSTANT
         #undef READ_STRING
+        #undef READ_SHORT
+        #undef READ_INLINE_CACHE
+        #undef PUSH
+        #undef POP
+        #undef DROP
+        #undef PEEK
+        #undef QUICKEN
+        #undef DEQUICKEN
+        #undef LOAD_FRAME
+        #undef LOAD_STATE
+        #undef SAVE_STATE
+        #undef READ_REGISTER
+        #undef ADD_INTO
+        #undef DIVIDE_INTO
+        #undef TRACE_INSTRUCTION
+        #undef DISPATCH
+        #undef CASE
+        #undef ENTER_JIT
+        #undef ENTER_CALLEE
+    }
+
+    bool VM::tierUp(ObjFunction* function) {
+        if (function->jit != nullptr) return true;
+        if (++function->hotness < jitThreshold) return false;
+        function->jit = jitCompile(this, function);
+        // Never retry a function the JIT could not compile.
+        if (function->jit == nullptr) function->hotness = INT_MIN;
+        return function->jit != nullptr;
+    }
+
+    bool VM::runCallee(int baseFrame) {
+        if (frameCount == baseFrame) return true; // Native function, or a class without init.
+        CallFrame* frame = &frames[frameCount - 1];
+        if (jitEnabled && tierUp(frame->closure->function)) {
+            JitStatus status = jitRun(this, frame, frame->closure->function->jit);
+            if (status != JitStatus::EXITED) return status == JitStatus::RETURNED;
+        }
+        return run(baseFrame) == InterpretResult::OK;
     }
 
     ObjUpvalue* VM::captureUpvalue(Value* local) {
@@ -452,130 +1035,669 @@ namespace cxxx {
     }
 
     void VM::closeUpvalues(Value* last) {
+        StoreGuard guard(this);
         while (openUpvalues != nullptr && openUpvalues->location >= last) {
             ObjUpvalue* upvalue = openUpvalues;
             upvalue->closed = *upvalue->location;
             upvalue->location = &upvalue->closed;
+            writeBarrier(upvalue, upvalue->closed);
             openUpvalues = upvalue->nextUpvalue;
         }
     }
 
-    void VM::defineMethod(ObjString* name) {
+    bool VM::defineMethod(ObjString* name) {
         Value method = peek(0);
-        ObjClass* klass = (ObjClass*)peek(1).as.obj;
+        if (!isObjType(peek(1), OBJ_CLASS) || !isObjType(method, OBJ_CLOSURE)) {
+            std::cerr << "Methods must be closures defined on a class." << std::endl;
+            return false;
+        }
+        ObjClass* klass = (ObjClass*)peek(1).asObj();
+        StoreGuard guard(this);
         klass->methods->set(name, method);
+        if (name == symbols[SYMBOL_INIT]) klass->initializer = (ObjClosure*)method.asObj();
+        writeBarrier(klass, (Obj*)name);
+        writeBarrier(klass, method);
+        methodEpoch++;
         pop();
+        return true;
     }
 
     bool VM::bindMethod(ObjClass* klass, ObjString* name) {
         Value method;
-        ObjClass* current = klass;
-        while (current != nullptr) {
-            if (current->methods->get(name, &method)) {
-                ObjBoundMethod* bound = allocateBoundMethod(this, peek(0), (ObjClosure*)method.as.obj);
-                pop();
-                if (!push(OBJ_VAL((Obj*)bound))) return false;
-                return true;
-            }
-            current = current->superclass;
+        if (!klass->methods->get(name, &method)) {
+            std::cerr << "Undefined property '" << name->chars() << "'." << std::endl;
+            return false;
         }
+        ObjBoundMethod* bound = allocateBoundMethod(this, peek(0), (ObjClosure*)method.asObj());
+        stackTop[-1] = OBJ_VAL((Obj*)bound);
+        return true;
+    }
 
-        std::cerr << "Undefined property '" << name->str << "'." << std::endl;
-        return false;
+    // Pushes a frame for `closure`, whose receiver or callee slot and
+    // arguments are already on the stack.
+    bool VM::call(ObjClosure* closure, int argCount) {
+        if (argCount != closure->function->arity) {
+            std::cerr << "Expected " << closure->function->arity << " arguments but got " << argCount << "." << std::endl;
+            return false;
+        }
+        // The only overflow check the frame gets: run() pushes unchecked.
+        Value* slots = stackTop - argCount - 1;
+        if (frameCount == frameCapacity || slots + closure->function->maxStack > stackLimit) {
+            if (!reserve(frameCount + 1, (size_t)(slots - stack) + closure->function->maxStack)) return false;
+            slots = stackTop - argCount - 1;
+        }
+        CallFrame* newFrame = &frames[frameCount++];
+        newFrame->closure = closure;
+        newFrame->ip = closure->function->chunk.code.data();
+        newFrame->slots = slots;
+        return true;
     }
 
     bool VM::callValue(Value callee, int argCount) {
         if (isObjType(callee, OBJ_BOUND_METHOD)) {
-            ObjBoundMethod* bound = (ObjBoundMethod*)callee.as.obj;
+            ObjBoundMethod* bound = (ObjBoundMethod*)callee.asObj();
             stackTop[-argCount - 1] = bound->receiver;
-            return callValue(OBJ_VAL((Obj*)bound->method), argCount);
+            return call(bound->method, argCount);
         }
         else if (isObjType(callee, OBJ_CLASS)) {
-            ObjClass* klass = (ObjClass*)callee.as.obj;
+            ObjClass* klass = (ObjClass*)callee.asObj();
             stackTop[-argCount - 1] = OBJ_VAL(allocateInstance(this, klass));
-            Value initializer;
-            if (klass->methods->get(copyString(this, "init", 4), &initializer)) {
-                return callValue(initializer, argCount);
-            } else if (argCount != 0) {
+            if (klass->initializer != nullptr) return call(klass->initializer, argCount);
+            if (argCount != 0) {
                 std::cerr << "Expected 0 arguments but got " << argCount << "." << std::endl;
                 return false;
             }
             return true;
         }
         else if (isObjType(callee, OBJ_CLOSURE)) {
-            ObjClosure* closure = (ObjClosure*)callee.as.obj;
-            if (argCount != closure->function->arity) {
-                std::cerr << "Expected " << closure->function->arity << " arguments but got " << argCount << "." << std::endl;
-                return false;
-            }
-            if (frameCount == FRAMES_MAX) {
-                std::cerr << "Stack overflow." << std::endl;
-                return false;
-            }
-            CallFrame* newFrame = &frames[frameCount++];
-            newFrame->closure = closure;
-            newFrame->ip = closure->function->chunk.code.data();
-            newFrame->slots = stackTop - argCount - 1;
-            return true;
+            return call((ObjClosure*)callee.asObj(), argCount);
         }
         else if (isObjType(callee, OBJ_NATIVE)) {
-            NativeFn native = ((ObjNative*)callee.as.obj)->function;
+            NativeFn native = ((ObjNative*)callee.asObj())->function;
             Value result = native(this, argCount, stackTop - argCount);
             stackTop -= argCount + 1;
-            if (!push(result)) return false;
+            *stackTop++ = result; // Back in the caller's callee slot.
             return true;
         }
         std::cerr << "Can only call functions and classes." << std::endl;
         return false;
     }
 
-    bool VM::invoke(ObjString* name, int argCount) {
+    bool VM::invokeFromClass(ObjClass* klass, ObjString* name, int argCount, bool tail) {
+        Value method;
+        if (!klass->methods->get(name, &method)) {
+            std::cerr << "Undefined property '" << name->chars() << "'." << std::endl;
+            return false;
+        }
+        ObjClosure* closure = (ObjClosure*)method.asObj();
+        return tail ? tailCall(closure, argCount) : call(closure, argCount);
+    }
+
+    // The caller's locals die here: close over them, then slide the callee
+    // and its arguments down into the caller's window. A mismatched arity
+    // takes call() so it reports the error.
+    bool VM::tailCall(ObjClosure* closure, int argCount) {
+        if (closure->function->arity != argCount) return call(closure, argCount);
+        CallFrame* frame = &frames[frameCount - 1];
+        if (frame->slots + closure->function->maxStack > stackLimit &&
+            !reserve(frameCount, (size_t)(frame->slots - stack) + closure->function->maxStack)) {
+            return false;
+        }
+        closeUpvalues(frame->slots);
+        Value* args = stackTop - argCount - 1;
+        for (int i = 0; i <= argCount; i++) {
+            frame->slots[i] = args[i];
+        }
+        stackTop = frame->slots + argCount + 1;
+        frame->closure = closure;
+        frame->ip = closure->function->chunk.code.data();
+        return true;
+    }
+
+    // Natives and classes take the ordinary path; the OP_RETURN after the
+    // tail call returns their result.
+    bool VM::tailCallValue(Value callee, int argCount) {
+        if (isObjType(callee, OBJ_CLOSURE)) {
+            return tailCall((ObjClosure*)callee.asObj(), argCount);
+        }
+        if (isObjType(callee, OBJ_BOUND_METHOD)) {
+            ObjBoundMethod* bound = (ObjBoundMethod*)callee.asObj();
+            stackTop[-argCount - 1] = bound->receiver;
+            return tailCall(bound->method, argCount);
+        }
+        return callValue(callee, argCount);
+    }
+
+    // OP_GET_PROPERTY: replaces the instance on top of the stack with its
+    // field `name`, or with `name` bound to it as a method.
+    bool VM::getProperty(ObjString* name, InlineCache* cache) {
+        if (!isObjType(peek(0), OBJ_INSTANCE)) {
+            std::cerr << "Only instances have properties." << std::endl;
+            return false;
+        }
+        ObjInstance* instance = (ObjInstance*)peek(0).asObj();
+
+        Value value;
+        if (getField(instance, name, cache, &value)) {
+            stackTop[-1] = value;
+            return true;
+        }
+
+        ObjClosure* method = findMethod(instance->klass, name, cache);
+        if (method == nullptr) {
+            std::cerr << "Undefined property '" << name->chars() << "'." << std::endl;
+            return false;
+        }
+        ObjBoundMethod* bound = allocateBoundMethod(this, peek(0), method);
+        stackTop[-1] = OBJ_VAL((Obj*)bound);
+        return true;
+    }
+
+    // OP_SET_PROPERTY: stores the value on top of the stack into the instance
+    // below it, leaving just the value.
+    bool VM::setProperty(ObjString* name, InlineCache* cache) {
+        if (!isObjType(peek(1), OBJ_INSTANCE)) {
+            std::cerr << "Only instances have fields." << std::endl;
+            return false;
+        }
+        setField((ObjInstance*)peek(1).asObj(), name, cache, peek(0));
+        stackTop[-2] = stackTop[-1];
+        stackTop--;
+        return true;
+    }
+
+    // Slot of `name` in instances of `shape`, or -1 if they lack it.
+    int VM::lookupShape(Shape* shape, ObjString* name, InlineCache* cache) {
+        for (int i = 0; i < cache->shapeCount; i++) {
+            if (cache->shapes[i] == shape) return cache->fieldIndices[i];
+        }
+
+        int index = shapeFind(shape, name);
+        // A megamorphic site starts over rather than growing without bound.
+        if (cache->shapeCount == INLINE_CACHE_ENTRIES) cache->shapeCount = 0;
+        cache->shapes[cache->shapeCount] = shape;
+        cache->transitions[cache->shapeCount] = nullptr;
+        cache->fieldIndices[cache->shapeCount] = index;
+        cache->shapeCount++;
+        return index;
+    }
+
+    // OP_ADD for anything but two numbers: joins the two values on top of the
+    // stack when at least one is a string, replacing them with the result.
+    bool VM::concatenate() {
+        // Each operand's characters; a number operand is formatted into
+        // `number` (at most one side is a number).
+        const char* chars[2];
+        int lengths[2];
+        std::string number;
+        for (int side = 0; side < 2; side++) {
+            Value operand = peek(1 - side);
+            Value other = peek(side);
+            if (isObjType(operand, OBJ_STRING)) {
+                ObjString* string = (ObjString*)operand.asObj();
+                chars[side] = string->chars();
+                lengths[side] = string->length;
+            } else if (operand.isNumber() && isObjType(other, OBJ_STRING)) {
+                double value = operand.asNumber();
+                // Integers, the usual case, skip the "%f" formatting: what it
+                // gives them is the same digits once the zeros are trimmed.
+                if (value > -1e15 && value < 1e15 && value == (double)(long long)value &&
+                    !(value == 0 && std::signbit(value))) {
+                    number = std::to_string((long long)value);
+                } else {
+                    number = std::to_string(value);
+                }
+                if (number.find('.') != std::string::npos) {
+                    while (number.back() == '0') number.pop_back();
+                    if (number.back() == '.') number.pop_back();
+                }
+                chars[side] = number.c_str();
+                lengths[side] = (int)number.length();
+            } else {
+                std::cerr << "Operands must be numbers or strings." << std::endl;
+                return false;
+            }
+        }
+
+        // Most results are short enough to join on the stack; copyString
+        // hashes the joined characters once and copies them into the new
+        // string, if it is new.
+        int length = lengths[0] + lengths[1];
+        char small[256];
+        std::string large;
+        char* joined = small;
+        if (length > (int)sizeof(small)) {
+            large.resize(length);
+            joined = &large[0];
+        }
+        memcpy(joined, chars[0], lengths[0]);
+        memcpy(joined + lengths[0], chars[1], lengths[1]);
+
+        // Both operands stay on the stack until the result exists, so a
+        // collection triggered by copyString cannot free them.
+        ObjString* result = copyString(this, joined, length);
+        pop();
+        pop();
+        return push(OBJ_VAL((Obj*)result));
+    }
+
+    bool VM::getField(ObjInstance* instance, ObjString* name, InlineCache* cache, Value* value) {
+        Shape* shape = instance->shape;
+        if (shape == nullptr) return instance->dictionary->get(name, value);
+
+        // Most sites only ever see one shape; check it before the full lookup.
+        int index = cache->shapeCount > 0 && cache->shapes[0] == shape
+            ? cache->fieldIndices[0] : lookupShape(shape, name, cache);
+        if (index < 0) return false;
+        *value = instance->fields[index];
+        return true;
+    }
+
+    void VM::setField(ObjInstance* instance, ObjString* name, InlineCache* cache, Value value) {
+        Shape* shape = instance->shape;
+        if (shape != nullptr) {
+            for (int i = 0; i < cache->shapeCount; i++) {
+                if (cache->shapes[i] != shape) continue;
+                if (cache->fieldIndices[i] >= 0) {
+                    StoreGuard guard(this);
+                    instance->fields[cache->fieldIndices[i]] = value;
+                    writeBarrier(instance, value);
+                    return;
+                }
+                if (cache->transitions[i] != nullptr) {
+                    instanceAppendField(this, instance, cache->transitions[i], value);
+                    return;
+                }
+                break;
+            }
+        }
+
+        instanceSetField(this, instance, name, value);
+        if (shape == nullptr || instance->shape == nullptr) return;
+
+        // Remember where the field ended up for the next instance in `shape`.
+        int index = lookupShape(shape, name, cache);
+        if (index < 0) {
+            for (int i = 0; i < cache->shapeCount; i++) {
+                if (cache->shapes[i] == shape) cache->transitions[i] = instance->shape;
+            }
+        }
+    }
+
+    ObjClosure* VM::findMethod(ObjClass* klass, ObjString* name, InlineCache* cache) {
+        if (cache->epoch != methodEpoch) {
+            cache->count = 0;
+            cache->epoch = methodEpoch;
+        }
+        for (int i = 0; i < cache->count; i++) {
+            if (cache->classes[i] == klass) return (ObjClosure*)cache->methods[i];
+        }
+
+        Value method;
+        if (!klass->methods->get(name, &method)) return nullptr;
+
+        // A megamorphic site starts over rather than growing without bound.
+        if (cache->count == INLINE_CACHE_ENTRIES) cache->count = 0;
+        cache->classes[cache->count] = klass;
+        cache->methods[cache->count] = method.asObj();
+        cache->count++;
+        return (ObjClosure*)method.asObj();
+    }
+
+    bool VM::invokeCached(ObjString* name, int argCount, InlineCache* cache, bool tail) {
         Value receiver = peek(argCount);
         if (!isObjType(receiver, OBJ_INSTANCE)) {
              std::cerr << "Only instances have methods." << std::endl;
              return false;
         }
-        ObjInstance* instance = (ObjInstance*)receiver.as.obj;
+        ObjInstance* instance = (ObjInstance*)receiver.asObj();
 
+        // Fields shadow methods.
         Value value;
-        if (instance->fields->get(name, &value)) {
+        if (getField(instance, name, cache, &value)) {
             stackTop[-argCount - 1] = value;
-            return callValue(value, argCount);
+            return tail ? tailCallValue(value, argCount) : callValue(value, argCount);
         }
 
-        return invokeFromClass(instance->klass, name, argCount);
+        ObjClosure* method = findMethod(instance->klass, name, cache);
+        if (method == nullptr) {
+            std::cerr << "Undefined property '" << name->chars() << "'." << std::endl;
+            return false;
+        }
+        return tail ? tailCall(method, argCount) : call(method, argCount);
     }
 
-    bool VM::invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
-        Value method;
-        ObjClass* current = klass;
-        while (current != nullptr) {
-            if (current->methods->get(name, &method)) {
-                return callValue(method, argCount);
+    // GC
+
+    void VM::freeObjects() {
+        forgetRemembered();
+        for (Block* block : heap.blocks) {
+            Heap::forEach(block, block->starts, [&](void* object) { freeObject(this, (Obj*)object); });
+            memset(block->starts, 0, sizeof(block->starts));
+            memset(block->old, 0, sizeof(block->old));
+        }
+        for (LargeChunk** list : {&heap.youngLarge, &heap.oldLarge}) {
+            while (*list != nullptr) freeObject(this, (Obj*)Heap::objectIn(*list));
+        }
+    }
+
+    void VM::trackAllocation(size_t size) {
+        bytesAllocated += size;
+        youngBytes += size;
+        // A lazy sweep needs no slices while the allocator has blocks left
+        // to sweep; once it has none, a slice ends the cycle.
+        bool lazy = gcPhase == GC_SWEEP && lazySweep && heap.sweepPending();
+        if (gcPhase != GC_IDLE && !lazy) {
+            // The allocation pays for part of the cycle. If the heap doubles
+            // before the cycle ends, the program is outrunning it.
+            sliceDebt += size;
+            #ifdef DEBUG_STRESS_GC
+                sliceDebt = SIZE_MAX;
+            #endif
+            // Without a budget, what the marker thread leaves is done at once.
+            size_t budget = sliceBudget > 0 ? sliceBudget : SIZE_MAX;
+            if (bytesAllocated / 2 > nextGC) {
+                finishCycle();
+            } else if (markerActive) {
+                if (markerDone.load(std::memory_order_acquire)) collectSlice(budget);
+            } else if (sliceDebt >= sliceBudget * GC_SLICE_RATIO) {
+                sliceDebt = 0;
+                collectSlice(budget);
             }
-            current = current->superclass;
+            return;
         }
+        if (bytesAllocated > nextGC) {
+            if (sliceBudget > 0 || concurrentMarking) {
+                startCycle();
+            } else {
+                collectGarbage();
+            }
+            return;
+        }
+        #ifdef DEBUG_STRESS_GC
+            if (sliceBudget > 0 || concurrentMarking) {
+                startCycle();
+            } else if (nurserySize > 0) {
+                collectYoung();
+            } else {
+                collectGarbage();
+            }
+        #else
+            if (nurserySize > 0 && youngBytes > nurserySize) collectYoung();
+        #endif
+    }
 
-        std::cerr << "Undefined property '" << name->str << "'." << std::endl;
-        return false;
+    void VM::rememberObject(Obj* obj) {
+        if (obj->isRemembered) return;
+        obj->isRemembered = true;
+        remembered.push_back(obj);
     }
 
-    // GC
+    void VM::rememberGlobal(int slot) {
+        globalRemembered[slot] = true;
+        rememberedGlobals.push_back(slot);
+    }
 
-    void VM::freeObjects() {
-        Obj* object = objects;
-        while (object != nullptr) {
-            Obj* next = object->next;
-            freeObject(object);
-            object = next;
-        }
-        objects = nullptr;
+    // After a collection nothing is young, so nothing needs remembering.
+    void VM::forgetRemembered() {
+        for (Obj* obj : remembered) obj->isRemembered = false;
+        remembered.clear();
+        for (int slot : rememberedGlobals) globalRemembered[slot] = false;
+        rememberedGlobals.clear();
+        shapesScanned = shapes.size();
+        youngBytes = 0;
+    }
+
+    void VM::pushRoot(Obj* obj) {
+        tempRoots.push_back(obj);
+    }
+
+    void VM::popRoot() {
+        tempRoots.pop_back();
+    }
+
+    namespace {
+        // Appends the time until it goes out of scope to vm->pauseLog.
+        class PauseTimer {
+        public:
+            explicit PauseTimer(VM* vm) : log(vm->pauseLog) {
+                if (log != nullptr) start = std::chrono::steady_clock::now();
+            }
+            ~PauseTimer() {
+                if (log == nullptr) return;
+                auto end = std::chrono::steady_clock::now();
+                log->push_back(std::chrono::duration<double, std::micro>(end - start).count());
+            }
+
+        private:
+            std::vector<double>* log;
+            std::chrono::steady_clock::time_point start;
+        };
     }
 
     void VM::collectGarbage() {
+        // An unfinished cycle holds mark bits the collection below relies on
+        // being clear.
+        if (gcPhase != GC_IDLE) finishCycle();
+        PauseTimer timer(this);
+
+        #ifdef DEBUG_LOG_GC
+            size_t before = bytesAllocated;
+        #endif
+
+        // Remembered objects may die here, so let go of them first.
+        forgetRemembered();
+        // A lazy sweep runs alongside young collections, so, as in a cycle,
+        // everything must be old first.
+        if (lazySweep) heap.promoteYoung([](void* object) { ((Obj*)object)->isOld = true; });
+        heap.beginMarking();
         markRoots();
+        if (gcThreads > 1) {
+            parallelTrace();
+        } else {
+            traceReferences();
+        }
+
+        // Until the sweep ends, bytesAllocated still counts the garbage; the
+        // threshold is set again then (see collectSlice()).
+        if (lazySweep) {
+            startSweep();
+        } else {
+            sweep();
+        }
+        size_t next = (size_t)(bytesAllocated * gcGrowthFactor);
+        nextGC = next < gcThreshold ? gcThreshold : next;
+
+        #ifdef DEBUG_LOG_GC
+            std::cout << "-- gc collected " << before - bytesAllocated << " bytes (from " << before
+                      << " to " << bytesAllocated << ") next at " << nextGC << std::endl;
+        #endif
+    }
+
+    // Frees the young objects nothing old or rooted points at and promotes
+    // the rest. Old objects are neither traced nor swept, so the work is
+    // proportional to the roots, the remembered sets and the young objects.
+    void VM::collectYoung() {
+        // Nothing is young while a cycle is marking; finish it instead. A
+        // sweep only has old objects left to free, in blocks no young
+        // object shares (see startSweep()).
+        if (gcPhase == GC_MARK) {
+            finishCycle();
+            return;
+        }
+        PauseTimer timer(this);
+
+        #ifdef DEBUG_LOG_GC
+            size_t before = bytesAllocated;
+        #endif
+
+        collectingYoung = true;
+        markRoots();
+        traceReferences();
+        sweepYoung();
+        collectingYoung = false;
+        forgetRemembered();
+
+        #ifdef DEBUG_LOG_GC
+            std::cout << "-- gc young collected " << before - bytesAllocated << " bytes (from " << before
+                      << " to " << bytesAllocated << ")" << std::endl;
+        #endif
+    }
+
+    // Begins an incremental full collection. Everything young becomes old,
+    // so the cycle needs no remembered sets and no minor collections run
+    // while it marks; then only the roots are grayed. Objects allocated while
+    // marking start out old, unmarked.
+    void VM::startCycle() {
+        if (gcPhase != GC_IDLE) finishCycle();
+        PauseTimer timer(this);
+        #ifdef DEBUG_LOG_GC
+            std::cout << "-- gc cycle begin at " << bytesAllocated << " bytes" << std::endl;
+        #endif
+
+        heap.promoteYoung([](void* object) { ((Obj*)object)->isOld = true; });
+        forgetRemembered();
+        heap.beginMarking();
+        sliceDebt = 0;
+        gcPhase = GC_MARK;
+        markRoots();
+        if (concurrentMarking) startMarker();
+    }
+
+    // One bounded step of the cycle: blackens or sweeps at most `budget`
+    // objects. While marking, the write barriers gray whatever the program
+    // stores, so no black object ever points at a white one (the tri-color
+    // invariant) and the gray stack holds all remaining work. Stack slots
+    // are not barriered; finishMarking() rescans them.
+    void VM::collectSlice(size_t budget) {
+        PauseTimer timer(this);
+        if (gcPhase == GC_MARK) {
+            // Waits if the marker is still tracing; normally it is done.
+            if (markerActive) joinMarker();
+            while (budget > 0 && !grayStack.empty()) {
+                Obj* obj = grayStack.back();
+                grayStack.pop_back();
+                blackenObject(obj);
+                budget--;
+            }
+            if (!grayStack.empty()) return;
+            finishMarking();
+        }
+
+        // A block costs one, and each object freed in it one more. The
+        // allocator may have swept some already.
+        while (budget > 0 && heap.sweepPending()) {
+            size_t cost = 1 + heap.sweepNext();
+            budget = budget > cost ? budget - cost : 0;
+        }
+        if (heap.sweepPending()) return;
+
+        heap.releaseFreeBlocks();
+        gcPhase = GC_IDLE;
+        size_t next = (size_t)(bytesAllocated * gcGrowthFactor);
+        nextGC = next < gcThreshold ? gcThreshold : next;
+
+        #ifdef DEBUG_LOG_GC
+            std::cout << "-- gc cycle end at " << bytesAllocated << " bytes, next at " << nextGC << std::endl;
+        #endif
+    }
+
+    // The atomic end of marking: the stack and the other unbarriered roots
+    // may hold objects the barriers never saw. Then sweeping starts.
+    void VM::finishMarking() {
+        for (Value* slot = stack; slot < stackTop; slot++) {
+            markValue(*slot);
+        }
+        for (int i = 0; i < frameCount; i++) {
+            markObject((Obj*)frames[i].closure);
+        }
+        for (ObjUpvalue* upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextUpvalue) {
+            markObject((Obj*)upvalue);
+        }
+        for (Obj* root : tempRoots) {
+            markObject(root);
+        }
+        for (ObjString* symbol : symbols) {
+            markObject((Obj*)symbol);
+        }
         traceReferences();
-        sweep();
+        startSweep();
+    }
+
+    // Ends a marking whose sweep is left to slices or to the allocator. The
+    // string table drops its unmarked keys now, so interning cannot hand
+    // out a string about to be swept, and the few large objects are swept
+    // at once. Every block is queued; the program allocates young objects
+    // while they are swept, in blocks taken after this point, and each
+    // block goes back on the heap's lists once it has been swept.
+    void VM::startSweep() {
+        for (int i = 0; i < strings.capacity; i++) {
+            Entry* entry = &strings.entries[i];
+            if (entry->key != nullptr && !Heap::isMarked(entry->key)) {
+                strings.deleteEntry(entry->key);
+            }
+        }
+        sweepLarge(&heap.oldLarge);
+        heap.resetAllocator();
+        heap.clearTouched();
+        heap.beginSweep();
+        gcPhase = GC_SWEEP;
+    }
+
+    void VM::finishCycle() {
+        while (gcPhase != GC_IDLE) collectSlice(SIZE_MAX);
+    }
+
+    void VM::startMarker() {
+        markerDone = false;
+        markerStop = false;
+        markerActive = true;
+        marker = std::thread(&VM::runMarker, this);
+    }
+
+    void VM::joinMarker() {
+        marker.join();
+        markerActive = false;
+    }
+
+    // The marker thread: drains the gray stack while the program runs. It
+    // only reads objects, and only while holding markLock, which every
+    // store into an object takes too; after each batch it steps aside for
+    // stores that are waiting. Whatever the barriers gray after it stops,
+    // and the unbarriered roots, are left to finishMarking().
+    void VM::runMarker() {
+        std::unique_lock<std::mutex> lock(markLock);
+        int batch = 0;
+        while (!grayStack.empty() && !markerStop.load(std::memory_order_relaxed)) {
+            Obj* obj = grayStack.back();
+            grayStack.pop_back();
+            blackenObject(obj);
+            if (++batch < GC_MARKER_BATCH) continue;
+            batch = 0;
+            if (storesWaiting.load(std::memory_order_relaxed) > 0) {
+                lock.unlock();
+                while (storesWaiting.load(std::memory_order_relaxed) > 0) std::this_thread::yield();
+                lock.lock();
+            }
+        }
+        markerDone.store(true, std::memory_order_release);
+    }
+
+    void VM::shadeConcurrent(Obj* obj) {
+        StoreGuard guard(this);
+        if (!Heap::isMarked(obj)) markObject(obj);
+    }
+
+    void VM::lockStores() {
+        storesWaiting.fetch_add(1, std::memory_order_relaxed);
+        markLock.lock();
+        storesWaiting.fetch_sub(1, std::memory_order_relaxed);
+        storeLocked = true;
+    }
+
+    void VM::unlockStores() {
+        storeLocked = false;
+        markLock.unlock();
     }
 
     void VM::markRoots() {
@@ -583,7 +1705,25 @@ namespace cxxx {
             markValue(*slot);
         }
 
-        markTable(&globals);
+        if (collectingYoung) {
+            // Only globals assigned a young object or created since the last
+            // collection can hold one; old objects that might are traced here.
+            for (int slot : rememberedGlobals) {
+                markObject((Obj*)globalNames[slot]);
+                markValue(globalValues[slot]);
+            }
+            for (Obj* obj : remembered) {
+                blackenObject(obj);
+            }
+        } else {
+            markTable(&globalSlots);
+            for (Value value : globalValues) {
+                markValue(value);
+            }
+        }
+        for (ObjString* symbol : symbols) {
+            markObject((Obj*)symbol);
+        }
 
         // Closures on call frames are usually on stack, but marking them explicitly is safe
         for (int i = 0; i < frameCount; i++) {
@@ -593,6 +1733,15 @@ namespace cxxx {
         for (ObjUpvalue* upvalue = openUpvalues; upvalue != nullptr; upvalue = upvalue->nextUpvalue) {
             markObject((Obj*)upvalue);
         }
+
+        for (Obj* root : tempRoots) {
+            markObject(root);
+        }
+
+        // Shapes outlive the instances that use them, so their keys must too.
+        for (size_t i = collectingYoung ? shapesScanned : 0; i < shapes.size(); i++) {
+            markObject((Obj*)shapes[i]->key);
+        }
     }
 
     void VM::markTable(Table* table) {
@@ -606,14 +1755,13 @@ namespace cxxx {
     }
 
     void VM::markValue(Value value) {
-        if (value.isObj()) markObject(value.as.obj);
+        if (value.isObj()) markObject(value.asObj());
     }
 
     void VM::markObject(Obj* obj) {
         if (obj == nullptr) return;
-        if (obj->isMarked) return;
-
-        obj->isMarked = true;
+        if (collectingYoung && obj->isOld) return;
+        if (!Heap::mark(obj)) return;
         grayStack.push_back(obj);
     }
 
@@ -625,78 +1773,254 @@ namespace cxxx {
         }
     }
 
-    void VM::blackenObject(Obj* obj) {
-        switch (obj->type) {
-            case OBJ_BOUND_METHOD: {
-                ObjBoundMethod* bound = (ObjBoundMethod*)obj;
-                markValue(bound->receiver);
-                markObject((Obj*)bound->method);
-                break;
+    namespace {
+        // Grays everything `obj` references through `marker`: the VM itself,
+        // or one thread's MarkWorker in a parallel trace. Also stamps the
+        // heap lines `obj` covers as live.
+        template <typename Marker>
+        void traceObject(Marker& marker, Obj* obj) {
+            switch (obj->type) {
+                case OBJ_BOUND_METHOD: {
+                    ObjBoundMethod* bound = (ObjBoundMethod*)obj;
+                    marker.markLines(obj, sizeof(ObjBoundMethod));
+                    marker.markValue(bound->receiver);
+                    marker.markObject((Obj*)bound->method);
+                    break;
+                }
+                case OBJ_CLASS: {
+                    ObjClass* klass = (ObjClass*)obj;
+                    marker.markLines(obj, sizeof(ObjClass));
+                    marker.markObject((Obj*)klass->name);
+                    marker.markTable(klass->methods); // Keep methods alive
+                    if (klass->superclass) marker.markObject((Obj*)klass->superclass);
+                    break;
+                }
+                case OBJ_CLOSURE: {
+                    ObjClosure* closure = (ObjClosure*)obj;
+                    marker.markLines(obj, sizeof(ObjClosure));
+                    marker.markObject((Obj*)closure->function);
+                    for (int i = 0; i < closure->upvalueCount; i++) {
+                        marker.markObject((Obj*)closure->upvalues[i]);
+                    }
+                    break;
+                }
+                case OBJ_FUNCTION: {
+                    ObjFunction* function = (ObjFunction*)obj;
+                    marker.markLines(obj, sizeof(ObjFunction));
+                    marker.markObject((Obj*)function->name);
+                    for (size_t i = 0; i < function->chunk.constants.size(); i++) {
+                        marker.markValue(function->chunk.constants[i]);
+                    }
+                    break;
+                }
+                case OBJ_INSTANCE: {
+                    ObjInstance* instance = (ObjInstance*)obj;
+                    marker.markLines(obj, sizeof(ObjInstance) + sizeof(Value) * instance->inlineCapacity);
+                    marker.markObject((Obj*)instance->klass);
+                    if (instance->dictionary != nullptr) {
+                        marker.markTable(instance->dictionary);
+                    } else {
+                        for (int i = 0; i < instance->shape->fieldCount; i++) {
+                            marker.markValue(instance->fields[i]);
+                        }
+                    }
+                    break;
+                }
+                case OBJ_UPVALUE:
+                    marker.markLines(obj, sizeof(ObjUpvalue));
+                    marker.markValue(((ObjUpvalue*)obj)->closed);
+                    break;
+                case OBJ_NATIVE:
+                    marker.markLines(obj, sizeof(ObjNative));
+                    break;
+                case OBJ_STRING:
+                    marker.markLines(obj, ((ObjString*)obj)->size());
+                    break;
             }
-            case OBJ_CLASS: {
-                ObjClass* klass = (ObjClass*)obj;
-                markObject((Obj*)klass->name);
-                markTable(klass->methods); // Keep methods alive
-                if (klass->superclass) markObject((Obj*)klass->superclass);
-                break;
+        }
+
+        // One thread's part of a parallel trace. Its gray objects are on
+        // `local`, which only it touches. Whenever nobody else has work on
+        // offer from it, it moves the older half of `local` to `shared`,
+        // where threads that run dry steal from.
+        struct alignas(64) MarkWorker {
+            Heap* heap = nullptr;
+            std::vector<Obj*> local;
+            std::mutex lock;
+            std::vector<Obj*> shared;        // Guarded by lock
+            std::atomic<size_t> offered{0};  // shared.size(), read without the lock
+
+            void markObject(Obj* obj) {
+                if (obj != nullptr && Heap::markAtomic(obj)) local.push_back(obj);
             }
-            case OBJ_CLOSURE: {
-                ObjClosure* closure = (ObjClosure*)obj;
-                markObject((Obj*)closure->function);
-                for (int i = 0; i < closure->upvalueCount; i++) {
-                    markObject((Obj*)closure->upvalues[i]);
-                }
-                break;
+            void markLines(Obj* obj, size_t size) {
+                heap->markLinesAtomic(obj, size);
+            }
+            void markValue(Value value) {
+                if (value.isObj()) markObject(value.asObj());
             }
-            case OBJ_FUNCTION: {
-                ObjFunction* function = (ObjFunction*)obj;
-                markObject((Obj*)function->name);
-                for (size_t i = 0; i < function->chunk.constants.size(); i++) {
-                    markValue(function->chunk.constants[i]);
+            void markTable(Table* table) {
+                for (int i = 0; i < table->capacity; i++) {
+                    Entry* entry = &table->entries[i];
+                    if (entry->key != nullptr) {
+                        markObject((Obj*)entry->key);
+                        markValue(entry->value);
+                    }
                 }
-                break;
             }
-            case OBJ_INSTANCE: {
-                ObjInstance* instance = (ObjInstance*)obj;
-                markObject((Obj*)instance->klass);
-                markTable(instance->fields);
-                break;
+
+            void offer() {
+                std::lock_guard<std::mutex> guard(lock);
+                size_t half = local.size() / 2;
+                shared.insert(shared.end(), local.begin(), local.begin() + half);
+                local.erase(local.begin(), local.begin() + half);
+                offered.store(shared.size(), std::memory_order_relaxed);
+            }
+        };
+
+        // Moves gray objects to workers[index].local: everything it still
+        // has on offer itself, else half of someone else's offer.
+        bool steal(std::vector<MarkWorker>& workers, int index) {
+            int count = (int)workers.size();
+            MarkWorker& self = workers[index];
+            for (int i = 0; i < count; i++) {
+                MarkWorker& victim = workers[(index + i) % count];
+                if (victim.offered.load(std::memory_order_relaxed) == 0) continue;
+                std::lock_guard<std::mutex> guard(victim.lock);
+                size_t size = victim.shared.size();
+                if (size == 0) continue;
+                size_t take = i == 0 ? size : (size + 1) / 2;
+                self.local.insert(self.local.end(), victim.shared.end() - take, victim.shared.end());
+                victim.shared.resize(size - take);
+                victim.offered.store(victim.shared.size(), std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        bool anyOffered(std::vector<MarkWorker>& workers) {
+            for (MarkWorker& worker : workers) {
+                if (worker.offered.load(std::memory_order_relaxed) > 0) return true;
+            }
+            return false;
+        }
+
+        // The body of each thread in VM::parallelTrace(). A thread that finds
+        // nothing to steal counts itself idle; only a busy thread can offer
+        // work, so once every thread is idle the trace is complete.
+        void traceShare(std::vector<MarkWorker>& workers, std::atomic<int>& idle, int index) {
+            MarkWorker& self = workers[index];
+            for (;;) {
+                while (!self.local.empty()) {
+                    Obj* obj = self.local.back();
+                    self.local.pop_back();
+                    traceObject(self, obj);
+                    if (self.local.size() > 1 && self.offered.load(std::memory_order_relaxed) == 0) {
+                        self.offer();
+                    }
+                }
+                if (steal(workers, index)) continue;
+
+                idle.fetch_add(1);
+                for (;;) {
+                    if (idle.load() == (int)workers.size()) return;
+                    if (anyOffered(workers)) {
+                        idle.fetch_sub(1);
+                        if (steal(workers, index)) break;
+                        idle.fetch_add(1);
+                    }
+                    std::this_thread::yield();
+                }
             }
-            case OBJ_UPVALUE:
-                markValue(((ObjUpvalue*)obj)->closed);
-                break;
-            case OBJ_NATIVE:
-            case OBJ_STRING:
-                break;
         }
     }
 
+    // traceReferences() on gcThreads threads, for full collections: the
+    // roots on the gray stack are dealt out, and threads that run out of
+    // work steal from the others.
+    void VM::parallelTrace() {
+        int threads = gcThreads;
+        std::vector<MarkWorker> workers(threads);
+        for (MarkWorker& worker : workers) worker.heap = &heap;
+        for (size_t i = 0; i < grayStack.size(); i++) {
+            workers[i % threads].local.push_back(grayStack[i]);
+        }
+        grayStack.clear();
+        std::atomic<int> idle(0);
+        gcWorkers.run(threads, [&](int index) { traceShare(workers, idle, index); });
+    }
+
+    void VM::blackenObject(Obj* obj) {
+        traceObject(*this, obj);
+    }
+
+    // Sweeps every block, on up to gcThreads threads. Freeing goes through
+    // the VM's pool and string table, so the threads only sweep the blocks'
+    // bitmaps; this thread then frees what they found dead.
     void VM::sweep() {
         // Remove weak references from string table first
         for (int i = 0; i < strings.capacity; i++) {
             Entry* entry = &strings.entries[i];
-            if (entry->key != nullptr && !entry->key->isMarked) {
+            if (entry->key != nullptr && !Heap::isMarked(entry->key)) {
                 strings.deleteEntry(entry->key);
             }
         }
 
-        Obj* previous = nullptr;
-        Obj* object = objects;
-        while (object != nullptr) {
-            if (object->isMarked) {
-                object->isMarked = false;
-                previous = object;
-                object = object->next;
+        heap.resetAllocator();
+        heap.unlistAll();
+        std::vector<Block*>& blocks = heap.blocks;
+        std::atomic<size_t> nextBlock(0);
+        int threads = (int)std::min((size_t)gcThreads, blocks.size());
+        gcWorkers.run(threads < 1 ? 1 : threads, [&](int) {
+            for (size_t i; (i = nextBlock.fetch_add(1, std::memory_order_relaxed)) < blocks.size();) {
+                heap.sweepBlock(blocks[i], SWEEP_ALL, [](void* object) { ((Obj*)object)->isOld = true; });
+            }
+        });
+        for (Block* block : blocks) {
+            Heap::forEach(block, block->marks, [&](void* object) { freeObject(this, (Obj*)object); });
+            heap.finishSweep(block);
+        }
+        // Old first: sweeping the young list promotes onto the old one.
+        sweepLarge(&heap.oldLarge);
+        sweepLarge(&heap.youngLarge);
+        heap.clearTouched();
+        heap.releaseFreeBlocks();
+    }
+
+    // The sweep of a young collection: only blocks allocated into since the
+    // last one can hold young objects.
+    void VM::sweepYoung() {
+        heap.resetAllocator();
+        for (Block* block : heap.touched) {
+            heap.sweepBlock(block, SWEEP_YOUNG, [](void* object) { ((Obj*)object)->isOld = true; });
+            Heap::forEach(block, block->marks, [&](void* object) {
+                Obj* dead = (Obj*)object;
+                // The string table holds its keys weakly.
+                if (dead->type == OBJ_STRING) strings.deleteEntry((ObjString*)dead);
+                freeObject(this, dead);
+            });
+            heap.finishSweep(block);
+        }
+        sweepLarge(&heap.youngLarge);
+        heap.clearTouched();
+    }
+
+    // Frees the unmarked large objects on `list` and promotes the marked
+    // ones to old.
+    void VM::sweepLarge(LargeChunk** list) {
+        LargeChunk* chunk = *list;
+        while (chunk != nullptr) {
+            LargeChunk* next = chunk->next;
+            Obj* object = (Obj*)Heap::objectIn(chunk);
+            if (chunk->marked) {
+                chunk->marked = false;
+                object->isOld = true;
+                heap.promoteLarge(chunk);
             } else {
-                Obj* unreached = object;
-                object = object->next;
-                if (previous != nullptr) {
-                    previous->next = object;
-                } else {
-                    objects = object;
-                }
-                freeObject(unreached);
+                if (!chunk->old && object->type == OBJ_STRING) strings.deleteEntry((ObjString*)object);
+                freeObject(this, object);
             }
+            chunk = next;
         }
     }
 }
@@ -6,13 +6,48 @@
 #include "value.h"
 #include "table.h"
 #include "object.h"
+#include "pool.h"
+#include "heap.h"
+#include "workers.h"
 #include "../include/cxxx.h" // For InterpretResult
+#include <atomic>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace cxxx {
 
     #define FRAMES_MAX 256
     #define STACK_MAX (FRAMES_MAX * 256)
+    // The frame array and the stack start this small and double on demand,
+    // up to the limits above.
+    #define FRAMES_INITIAL 8
+    #define STACK_INITIAL 256
+
+    #define GC_INITIAL_THRESHOLD (1024 * 1024)
+    #define GC_HEAP_GROW_FACTOR 2.0
+    #define GC_NURSERY_SIZE (256 * 1024)
+    // During an incremental cycle, a slice runs after every GC_SLICE_RATIO
+    // bytes allocated per object of its budget. Objects are bigger than
+    // that, so marking outpaces allocation.
+    #define GC_SLICE_RATIO 8
+    // The marker thread checks for waiting stores after this many objects.
+    #define GC_MARKER_BATCH 64
+    // A full collection marks and sweeps on at most this many threads.
+    #define GC_THREADS_MAX 64
+
+    // Where an incremental collection cycle is (see VM::collectSlice()).
+    enum GCPhase {
+        GC_IDLE,
+        GC_MARK,
+        GC_SWEEP
+    };
+
+    // Names the VM itself looks up, interned once per VM (VM::symbols).
+    enum Symbol {
+        SYMBOL_INIT,
+        SYMBOL_COUNT
+    };
 
     struct CallFrame {
         ObjClosure* closure;
@@ -36,43 +71,232 @@ namespace cxxx {
         Value peek(int distance);
         bool stackEmpty();
 
-        Table globals;
+        // Objects live in `heap`; the arrays and tables they own come from
+        // `pool`. Declared first so they outlive the tables below.
+        Pool pool;
+        Heap heap;
+
+        // Global variables live in a dense array. The compiler resolves each
+        // name to its slot once; slots not yet defined hold UNDEFINED_VAL().
+        Table globalSlots;                 // Name -> slot number
+        std::vector<ObjString*> globalNames;
+        std::vector<Value> globalValues;
+        Value* globalsData = nullptr;      // globalValues.data(), for native code
         Table strings;
+        ObjString* symbols[SYMBOL_COUNT];
 
-        // GC
-        Obj* objects; // Linked list of all objects
+        // Slot for the global `name`, creating an undefined one if needed.
+        int globalSlot(ObjString* name);
+        bool getGlobal(ObjString* name, Value* value);
+        void setGlobal(ObjString* name, Value value);
+
+        // Bumped whenever a class is created or a method table changes;
+        // inline cache entries filled under an older epoch are discarded.
+        uint32_t methodEpoch;
+
+        // Every shape ever created, owned by the VM. shapes[0] is the empty
+        // shape that new instances start from.
+        std::vector<Shape*> shapes;
+        Shape* emptyShape;
+
+        // Baseline JIT (see jit.h). While enabled, a function is compiled once
+        // its hotness, bumped on every call and loop back-edge, reaches
+        // jitThreshold; from then on calls and loops run its native code.
+        bool jitEnabled;
+        int jitThreshold;
+
+        // GC. Collection is generational: objects start young, and whatever
+        // survives a collection is promoted to old. A young collection
+        // (collectYoung()) traces only young objects, from the roots plus the
+        // old objects and globals the write barriers below remembered, and
+        // sweeps only the blocks allocated into since; a full one
+        // (collectGarbage()) traces and sweeps everything. Mark bits live in
+        // the heap's blocks (see heap.h).
+        //
+        // With a slice budget, a full collection instead runs as a cycle of
+        // slices interleaved with the program (see collectSlice()). With
+        // concurrentMarking, a helper thread does the cycle's marking.
         std::vector<Obj*> grayStack; // For GC marking
+        bool collectingYoung;        // Inside collectYoung(): old objects count as marked
+        // Objects that are live but not yet reachable from any other root,
+        // e.g. functions under construction in the compiler.
+        std::vector<Obj*> tempRoots;
+
+        size_t bytesAllocated; // Bytes owned by live (or not yet swept) objects
+        size_t nextGC;         // Collect once bytesAllocated exceeds this
+        size_t gcThreshold;    // Lower bound for nextGC
+        double gcGrowthFactor; // nextGC = live bytes * gcGrowthFactor after a collection
+        size_t youngBytes;     // Charged since the last collection
+        size_t nurserySize;    // Collect young objects once youngBytes exceeds this; 0 = only full collections
+
+        // Old objects that may point at young ones, and global slots that
+        // may hold young objects or were created since the last collection.
+        std::vector<Obj*> remembered;
+        std::vector<int> rememberedGlobals;
+        std::vector<bool> globalRemembered; // Per slot: already in rememberedGlobals
+        size_t shapesScanned;               // shapes[i] with i < shapesScanned have old keys
+
+        GCPhase gcPhase;
+        size_t sliceBudget; // Objects traced or swept per slice; 0 = no incremental cycles
+        size_t sliceDebt;   // Bytes allocated since the last slice
+        // Leave the sweep of every full collection to the allocator, which
+        // sweeps a block whenever it needs one (see Heap::beginSweep()).
+        // Minor collections go on meanwhile.
+        bool lazySweep;
+        // If set, every collection and slice appends its pause in microseconds.
+        std::vector<double>* pauseLog;
+
+        // Concurrent marking (see runMarker()). The marker thread holds
+        // markLock while it traces; the program takes it around stores into
+        // objects (StoreGuard) and to gray objects while the marker runs.
+        bool concurrentMarking;            // Mark each cycle on a helper thread
+        bool markerActive;                 // The helper thread has not been joined
+        bool storeLocked;                  // This thread holds markLock for a store
+        std::mutex markLock;
+        std::atomic<int> storesWaiting;    // Stores blocked on markLock
+        std::atomic<bool> markerDone;      // The gray stack ran dry
+        std::atomic<bool> markerStop;      // Give up; the VM is going away
+        std::thread marker;
+
+        // Parallel collection: heap blocks are swept independently, so the
+        // threads of a full collection share them out.
+        int gcThreads;                     // Threads a full collection uses; 1 = this one only
+        Workers gcWorkers;
+
+        // Write barriers. Call after storing `value` into `holder`, or into
+        // global `slot`, so a young collection finds the reference and an
+        // incremental cycle never leaves a traced object pointing at an
+        // untraced one.
+        void writeBarrier(Obj* holder, Value value) {
+            if (value.isObj()) writeBarrier(holder, value.asObj());
+        }
+        void writeBarrier(Obj* holder, Obj* target) {
+            if (target == nullptr) return;
+            if (holder->isOld && !target->isOld) rememberObject(holder);
+            shade(target);
+        }
+        void globalBarrier(int slot, Value value) {
+            if (!value.isObj()) return;
+            if (!value.asObj()->isOld && !globalRemembered[slot]) rememberGlobal(slot);
+            shade(value.asObj());
+        }
+        // Marks `obj` if a cycle is marking; for references the program
+        // obtains without a store, e.g. from the weak string table.
+        void shade(Obj* obj) {
+            if (gcPhase != GC_MARK) return;
+            if (markerActive) {
+                shadeConcurrent(obj);
+            } else if (!Heap::isMarked(obj)) {
+                markObject(obj);
+            }
+        }
+        void shadeConcurrent(Obj* obj);
+        void lockStores();
+        void unlockStores();
+        void rememberObject(Obj* obj);
+        void rememberGlobal(int slot);
+
+        // Charges `size` bytes to the heap; may run a collection first.
+        void trackAllocation(size_t size);
+        void pushRoot(Obj* obj);
+        void popRoot();
 
         void collectGarbage();
+        void collectYoung();
+        void startCycle();
+        void collectSlice(size_t budget);
+        void finishMarking();
+        void startSweep();
+        void finishCycle();
+        void startMarker();
+        void joinMarker();
+        void runMarker();
         void markObject(Obj* obj);
         void markValue(Value value);
+        void markLines(Obj* obj, size_t size) { heap.markLines(obj, size); }
         void markRoots();
         void traceReferences();
+        void parallelTrace();
         void blackenObject(Obj* obj);
         void sweep();
+        void sweepYoung();
+        void sweepLarge(LargeChunk** list);
+        void forgetRemembered();
         void freeObjects();
         void markTable(Table* table);
 
     private:
-        CallFrame frames[FRAMES_MAX];
+        // The JIT's runtime helpers work on the stack and frames directly.
+        friend struct JitRuntime;
+
+        // Both arrays move when they grow, so nothing may hold a CallFrame*
+        // or a pointer into the stack across a call that pushes a frame.
+        // growStack() fixes up the frames' slots and open upvalues.
+        CallFrame* frames;
         int frameCount;
+        int frameCapacity;
 
-        Value stack[STACK_MAX];
+        Value* stack;
         Value* stackTop;
+        Value* stackLimit; // One past the last allocated slot
         ObjUpvalue* openUpvalues;
 
-        InterpretResult run();
+        // Runs until the frame at index `baseFrame` returns.
+        InterpretResult run(int baseFrame);
 
         void resetStack();
+        // Makes room for `frames` call frames and `values` stack slots,
+        // reporting an overflow past FRAMES_MAX or STACK_MAX.
+        bool reserve(int frames, size_t values);
+        void growFrames(int capacity);
+        void growStack(size_t capacity);
         ObjUpvalue* captureUpvalue(Value* local);
         void closeUpvalues(Value* last);
-        void defineMethod(ObjString* name);
+        bool defineMethod(ObjString* name);
         bool bindMethod(ObjClass* klass, ObjString* name);
+        bool call(ObjClosure* closure, int argCount);
         bool callValue(Value callee, int argCount);
-        bool invoke(ObjString* name, int argCount);
-        bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount);
+        bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount, bool tail = false);
+        // Tail forms: run the callee in the top frame instead of pushing one.
+        bool tailCall(ObjClosure* closure, int argCount);
+        bool tailCallValue(Value callee, int argCount);
+        bool concatenate();
+
+        // JIT entry points: tierUp() compiles `function` once it is hot and
+        // reports whether native code exists; runCallee() runs the frame a
+        // call just pushed (natively when possible) until it returns.
+        bool tierUp(ObjFunction* function);
+        bool runCallee(int baseFrame);
+
+        // Inline-cached variants used by OP_GET_PROPERTY/OP_SET_PROPERTY/OP_INVOKE.
+        bool getProperty(ObjString* name, InlineCache* cache);
+        bool setProperty(ObjString* name, InlineCache* cache);
+        int lookupShape(Shape* shape, ObjString* name, InlineCache* cache);
+        bool getField(ObjInstance* instance, ObjString* name, InlineCache* cache, Value* value);
+        void setField(ObjInstance* instance, ObjString* name, InlineCache* cache, Value value);
+        ObjClosure* findMethod(ObjClass* klass, ObjString* name, InlineCache* cache);
+        bool invokeCached(ObjString* name, int argCount, InlineCache* cache, bool tail = false);
     };
 
+    // Scope around a store into an object and its write barrier. While the
+    // marker thread runs it holds VM::markLock, so the marker never reads a
+    // half-written value or a table or field array being reallocated. The
+    // scope must not allocate through trackAllocation(): a collection
+    // inside it could wait on the marker while holding the lock.
+    class StoreGuard {
+    public:
+        explicit StoreGuard(VM* vm) : vm(vm->markerActive && !vm->storeLocked ? vm : nullptr) {
+            if (this->vm != nullptr) this->vm->lockStores();
+        }
+        ~StoreGuard() {
+            if (vm != nullptr) vm->unlockStores();
+        }
+        StoreGuard(const StoreGuard&) = delete;
+        StoreGuard& operator=(const StoreGuard&) = delete;
+
+    private:
+        VM* vm;
+    };
 }
 
 #endif
@@ -0,0 +1,62 @@
+#include "workers.h"
+
+namespace cxxx {
+
+    Workers::Workers() {
+        task = nullptr;
+        active = 0;
+        pending = 0;
+        generation = 0;
+        stopping = false;
+    }
+
+    Workers::~Workers() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& thread : threads) thread.join();
+    }
+
+    void Workers::run(int count, const std::function<void(int)>& job) {
+        if (count <= 1) {
+            job(0);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            // A new thread waits for the job after the one current now.
+            while ((int)threads.size() < count - 1) {
+                threads.emplace_back(&Workers::loop, this, (int)threads.size() + 1, generation);
+            }
+            task = &job;
+            active = count;
+            pending = count - 1;
+            generation++;
+        }
+        wake.notify_all();
+        job(0);
+
+        std::unique_lock<std::mutex> guard(lock);
+        finished.wait(guard, [this] { return pending == 0; });
+        task = nullptr;
+    }
+
+    void Workers::loop(int index, unsigned seen) {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            wake.wait(guard, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (index >= active) continue;
+
+            const std::function<void(int)>* job = task;
+            guard.unlock();
+            (*job)(index);
+            guard.lock();
+            if (--pending == 0) finished.notify_one();
+        }
+    }
+
+}
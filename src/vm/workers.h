@@ -0,0 +1,45 @@
+#ifndef cxxx_workers_h
+#define cxxx_workers_h
+
+#include "common.h"
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cxxx {
+
+    // Helper threads for the collector's parallel phases. Threads are
+    // started the first time a job needs them and then sleep between jobs,
+    // so a collection does not pay for creating them.
+    class Workers {
+    public:
+        Workers();
+        ~Workers();
+        Workers(const Workers&) = delete;
+        Workers& operator=(const Workers&) = delete;
+
+        // Calls task(i) for every i in [0, count) on `count` threads, the
+        // caller running task(0), and returns once all calls have returned.
+        void run(int count, const std::function<void(int)>& task);
+
+        size_t threadCount() const { return threads.size(); }
+
+    private:
+        std::vector<std::thread> threads; // threads[i] runs task(i + 1)
+        std::mutex lock;
+        std::condition_variable wake;     // A job was posted, or stopping
+        std::condition_variable finished; // pending reached 0
+        const std::function<void(int)>* task;
+        int active;      // Threads the current job uses, counting the caller
+        int pending;     // Helper calls of the current job still running
+        unsigned generation; // Bumped for every job
+        bool stopping;
+
+        void loop(int index, unsigned seen);
+    };
+
+}
+
+#endif
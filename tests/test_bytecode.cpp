@@ -0,0 +1,345 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/bytecode.h"
+#include "test_util.h"
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+
+using namespace cxxx;
+
+static const char* kScript = R"script(
+    fun fib(n) {
+        if (n < 2) return n;
+        return fib(n - 1) + fib(n - 2);
+    }
+    fun makeCounter() {
+        var count = 0;
+        fun step() {
+            count = count + 1;
+            return count;
+        }
+        return step;
+    }
+    class Animal {
+        init(name) { this.name = name; }
+        speak() { return this.name + " makes a sound"; }
+    }
+    class Dog < Animal {
+        init(name) { super.init(name); }
+        speak() { return super.speak() + " (woof)"; }
+    }
+    var counter = makeCounter();
+    counter();
+    var counted = counter();
+    var speech = Dog("Rex").speak();
+    var speechLen = len(speech);
+    var fibResult = fib(15);
+    var flags = !nil == true;
+    var total = 0;
+    for (var i = 0; i < 10; i++) total = total + i * 1.5;
+)script";
+
+static const char* kPath = "test_bytecode.cxxc";
+
+static std::vector<uint8_t> readAll(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+}
+
+static void checkResults(CXXX& vm) {
+    CHECK(vm.getGlobalNumber("counted") == 2.0);
+    CHECK(vm.getGlobalNumber("speechLen") == 24.0);
+    CHECK(vm.getGlobalNumber("fibResult") == 610.0);
+    CHECK(vm.getGlobalBool("flags"));
+    CHECK(vm.getGlobalNumber("total") == 67.5);
+}
+
+void testRoundTrip() {
+    std::cout << "Testing compile to file and run..." << std::endl;
+    {
+        CXXX writer;
+        // Shift the writer's global slots so they differ from the reader's.
+        writer.interpret("var unrelated1 = 1; var unrelated2 = 2;");
+        CHECK(writer.compileToFile(kScript, kPath));
+        // Compiling does not run anything.
+        CHECK(writer.getGlobalNumber("fibResult") == 0.0);
+    }
+
+    CXXX reader;
+    reader.interpret("var other = 3;");
+    CHECK(reader.interpretCompiled(std::string(kPath)) == InterpretResult::OK);
+    checkResults(reader);
+    CHECK(reader.getGlobalNumber("other") == 3.0);
+
+    std::vector<uint8_t> bytes = readAll(kPath);
+    CXXX fromMemory;
+    CHECK(fromMemory.interpretCompiled(bytes.data(), bytes.size()) == InterpretResult::OK);
+    checkResults(fromMemory);
+
+    // The same file runs again in a VM that already holds its globals.
+    CHECK(fromMemory.interpretCompiled(bytes.data(), bytes.size()) == InterpretResult::OK);
+    checkResults(fromMemory);
+}
+
+void testCompileErrors() {
+    std::cout << "Testing compile errors..." << std::endl;
+    CXXX vm;
+    CHECK(!vm.compileToFile("var = ;", kPath));
+    CHECK(vm.interpretCompiled(std::string("does_not_exist.cxxc")) == InterpretResult::COMPILE_ERROR);
+}
+
+void testPreservesChunks() {
+    std::cout << "Testing chunk contents survive a round trip..." << std::endl;
+    VM vm;
+    ObjFunction* script = compile(&vm, kScript);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    std::vector<uint8_t> bytes;
+    writeBytecode(&vm, script, &bytes);
+
+    ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+    CHECK(loaded != nullptr);
+    // Same VM, so global operands map back to the same slots.
+    CHECK(loaded->chunk.code == script->chunk.code);
+    CHECK(loaded->chunk.lines == script->chunk.lines);
+    CHECK(loaded->chunk.constants.size() == script->chunk.constants.size());
+    CHECK(loaded->chunk.inlineCaches.size() == script->chunk.inlineCaches.size());
+    for (size_t i = 0; i < script->chunk.constants.size(); i++) {
+        Value a = script->chunk.constants[i];
+        Value b = loaded->chunk.constants[i];
+        if (isObjType(a, OBJ_FUNCTION)) {
+            ObjFunction* fa = (ObjFunction*)a.asObj();
+            ObjFunction* fb = (ObjFunction*)b.asObj();
+            CHECK(isObjType(b, OBJ_FUNCTION));
+            CHECK(fa->name == fb->name); // Interned
+            CHECK(fa->arity == fb->arity && fa->upvalueCount == fb->upvalueCount);
+            CHECK(fa->chunk.code == fb->chunk.code);
+        } else {
+            CHECK(valuesEqual(a, b));
+        }
+    }
+    vm.popRoot();
+}
+
+void testWritesUnquickenedCode() {
+    std::cout << "Testing quickened code is written in generic form..." << std::endl;
+    VM vm;
+    ObjFunction* script = compile(&vm, "fun add(a, b) { return a + b; } var n = 0; for (var i = 0; i < 3; i++) n = add(n, i);");
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    ObjFunction* add = nullptr;
+    for (Value constant : script->chunk.constants) {
+        if (isObjType(constant, OBJ_FUNCTION)) add = (ObjFunction*)constant.asObj();
+    }
+    CHECK(chunkContains(add->chunk, OP_ADD_NUM));
+    CHECK(chunkContains(script->chunk, OP_CALL_CLOSURE));
+
+    std::vector<uint8_t> bytes;
+    writeBytecode(&vm, script, &bytes);
+    ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+    CHECK(loaded != nullptr);
+    CHECK(!chunkContains(loaded->chunk, OP_CALL_CLOSURE) && chunkContains(loaded->chunk, OP_CALL));
+    vm.popRoot();
+}
+
+void testRejectsDamagedFiles() {
+    std::cout << "Testing damaged files are rejected..." << std::endl;
+    VM writer;
+    ObjFunction* script = compile(&writer, kScript);
+    CHECK(script != nullptr);
+    std::vector<uint8_t> bytes;
+    writeBytecode(&writer, script, &bytes);
+
+    // Wrong magic and wrong version.
+    std::vector<uint8_t> damaged = bytes;
+    damaged[0] = 'X';
+    VM vm;
+    CHECK(readBytecode(&vm, damaged.data(), damaged.size()) == nullptr);
+    damaged = bytes;
+    damaged[4] = BYTECODE_VERSION + 1;
+    CHECK(readBytecode(&vm, damaged.data(), damaged.size()) == nullptr);
+
+    // Every truncation fails cleanly, as does trailing garbage.
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    for (size_t length = 0; length < bytes.size(); length++) {
+        CHECK(readBytecode(&vm, bytes.data(), length) == nullptr);
+    }
+    damaged = bytes;
+    damaged.push_back(0);
+    CHECK(readBytecode(&vm, damaged.data(), damaged.size()) == nullptr);
+
+    // Corrupting any single byte must not crash the loader. It may still
+    // load (e.g. a changed number constant), but then the code verified.
+    for (size_t i = 0; i < bytes.size(); i++) {
+        damaged = bytes;
+        damaged[i] ^= 0x5a;
+        readBytecode(&vm, damaged.data(), damaged.size());
+    }
+    std::cerr.rdbuf(saved);
+}
+
+static ObjFunction* nestedFunction(ObjFunction* function) {
+    for (Value constant : function->chunk.constants) {
+        if (isObjType(constant, OBJ_FUNCTION)) return (ObjFunction*)constant.asObj();
+    }
+    return nullptr;
+}
+
+static int findOp(Chunk& chunk, OpCode op) {
+    for (int offset = 0; offset < (int)chunk.code.size(); offset += chunk.instructionLength(offset)) {
+        if (chunk.code[offset] == op) return offset;
+    }
+    return -1;
+}
+
+// Upvalue operands and captures must name an upvalue the function has or
+// a local of its frame; a file that fails to load leaves the VM's globals
+// as they were.
+void testRejectsBadUpvalues() {
+    std::cout << "Testing upvalue operands are bounds-checked..." << std::endl;
+    const char* source = R"(
+        var before = 1;
+        fun outer(a) {
+            fun middle() {
+                fun inner() { return a; }
+                return inner;
+            }
+            return middle;
+        }
+        var onlyInThisFile = outer(2)()();
+    )";
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    VM writer;
+    ObjFunction* script = compile(&writer, source);
+    CHECK(script != nullptr);
+    writer.pushRoot((Obj*)script);
+    ObjFunction* outer = nestedFunction(script);
+    ObjFunction* middle = nestedFunction(outer);
+    ObjFunction* inner = nestedFunction(middle);
+    CHECK(outer->upvalueCount == 0 && middle->upvalueCount == 1 && inner->upvalueCount == 1);
+
+    VM vm;
+    ObjFunction* prelude = compile(&vm, "var before = 0;");
+    CHECK(prelude != nullptr);
+    size_t globals = vm.globalValues.size();
+    auto expectRejected = [&](Chunk& chunk, int at, uint8_t value) {
+        uint8_t old = chunk.code[at];
+        chunk.code[at] = value;
+        std::vector<uint8_t> bytes;
+        writeBytecode(&writer, script, &bytes);
+        chunk.code[at] = old;
+        ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+        CHECK(loaded == nullptr);
+    };
+
+    int get = findOp(inner->chunk, OP_GET_UPVALUE);
+    CHECK(get >= 0);
+    expectRejected(inner->chunk, get + 1, 1);
+    expectRejected(inner->chunk, get + 1, 255);
+    // middle captures outer's local `a`; inner captures middle's upvalue 0.
+    int closure = findOp(middle->chunk, OP_CLOSURE);
+    CHECK(closure >= 0 && middle->chunk.code[closure + 2] == 0);
+    expectRejected(middle->chunk, closure + 3, 1);
+    expectRejected(middle->chunk, closure + 2, 2);
+    closure = findOp(outer->chunk, OP_CLOSURE);
+    CHECK(closure >= 0 && outer->chunk.code[closure + 2] == 1);
+    expectRejected(outer->chunk, closure + 2, 0);
+    expectRejected(outer->chunk, closure + 3, 200);
+    std::cerr.rdbuf(saved);
+
+    // None of the rejected files added a global.
+    CHECK(vm.globalValues.size() == globals);
+    ObjString* name = copyString(&vm, "onlyInThisFile", 14);
+    Value slot;
+    CHECK(!vm.globalSlots.get(name, &slot));
+
+    // The intact file loads, defining its globals in the slots its code uses.
+    std::vector<uint8_t> bytes;
+    writeBytecode(&writer, script, &bytes);
+    ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+    CHECK(loaded != nullptr);
+    vm.pushRoot((Obj*)loaded);
+    CHECK(vm.globalValues.size() == globals + 2);
+    InterpretResult result = vm.interpret(loaded);
+    CHECK(result == InterpretResult::OK);
+    Value value;
+    bool found = vm.getGlobal(name, &value);
+    CHECK(found && value.asNumber() == 2.0);
+    vm.popRoot();
+    writer.popRoot();
+}
+
+// Verification checks operands, not the types of the values instructions
+// find on the stack; the class-definition and super ops check those as they
+// run. Each file below swaps an instruction that pushes a class or a
+// closure for one that pushes a number, loads, and must fail cleanly.
+void testForgedStackTypes() {
+    std::cout << "Testing class and super ops reject non-classes..." << std::endl;
+    struct Forgery {
+        const char* source;
+        const char* function; // nullptr: the script
+        OpCode op;            // Two bytes long, like the OP_CONSTANT replacing it
+    };
+    const Forgery forgeries[] = {
+        {"var A = 1; class A { m() { return 1; } }", nullptr, OP_CLASS},
+        {"var x = 1; class A { m() { return 1; } }", nullptr, OP_CLOSURE},
+        {"class A {} var x = 1; class B < A {}", nullptr, OP_CLASS},
+        {"class A { m() { return 1; } } class B < A { n() { var f = super.m; return 1; } } B().n();",
+         "n", OP_GET_UPVALUE},
+        {"class A { m(a) { return a; } } class B < A { n() { return super.m(1) + 1; } } B().n();",
+         "n", OP_GET_UPVALUE},
+        {"class A { m(a) { return a; } } class B < A { n() { return super.m(1); } } B().n();",
+         "n", OP_GET_UPVALUE},
+    };
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    for (const Forgery& forgery : forgeries) {
+        VM writer;
+        ObjFunction* script = compile(&writer, forgery.source);
+        CHECK(script != nullptr);
+        writer.pushRoot((Obj*)script);
+        ObjFunction* function = forgery.function == nullptr ? script : findFunction(script, forgery.function);
+        CHECK(function != nullptr);
+        Chunk& chunk = function->chunk;
+        // The last such instruction: in the third script, B's OP_CLASS.
+        int at = -1;
+        for (int offset = 0; offset < (int)chunk.code.size(); offset += chunk.instructionLength(offset)) {
+            if (chunk.code[offset] == forgery.op) at = offset;
+        }
+        int number = -1;
+        for (int i = 0; i < (int)chunk.constants.size(); i++) {
+            if (chunk.constants[i].isNumber()) number = i;
+        }
+        CHECK(at >= 0 && number >= 0 && chunk.instructionLength(at) == 2);
+        chunk.code[at] = OP_CONSTANT;
+        chunk.code[at + 1] = (uint8_t)number;
+        std::vector<uint8_t> bytes;
+        writeBytecode(&writer, script, &bytes);
+        writer.popRoot();
+
+        VM vm;
+        ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+        CHECK(loaded != nullptr);
+        vm.pushRoot((Obj*)loaded);
+        InterpretResult result = vm.interpret(loaded);
+        CHECK(result == InterpretResult::RUNTIME_ERROR);
+        vm.popRoot();
+    }
+    std::cerr.rdbuf(saved);
+}
+
+int main() {
+    testRoundTrip();
+    testCompileErrors();
+    testPreservesChunks();
+    testWritesUnquickenedCode();
+    testRejectsDamagedFiles();
+    testRejectsBadUpvalues();
+    testForgedStackTypes();
+    std::remove(kPath);
+    std::cout << "All bytecode tests passed!" << std::endl;
+    return 0;
+}
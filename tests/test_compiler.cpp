@@ -35,7 +35,7 @@ int main() {
 
     std::cout << "vm address: " << &vm << std::endl;
     std::cout << "vm.strings address: " << &vm.strings << std::endl;
-    std::cout << "vm.globals address: " << &vm.globals << std::endl;
+    std::cout << "vm.globalSlots address: " << &vm.globalSlots << std::endl;
     std::cout << "Calling compile..." << std::endl;
 
     ObjFunction* function = compile(&vm, source);
@@ -49,14 +49,14 @@ int main() {
         ObjString* name = copyString(&vm, "result", 6);
         std::cout << "Checking global 'result'. Address of name: " << name << " hash: " << name->hash << std::endl;
         Value val;
-        if (vm.globals.get(name, &val)) {
+        if (vm.getGlobal(name, &val)) {
              std::cout << "Result: " << val.asNumber() << std::endl;
              assert(std::abs(val.asNumber() - 15.8) < 0.0001);
         } else {
              std::cerr << "Global 'result' not found." << std::endl;
              // Debug dump globals
-             std::cout << "Globals count: " << vm.globals.count << std::endl;
-             printTable(&vm.globals);
+             std::cout << "Globals count: " << vm.globalSlots.count << std::endl;
+             printTable(&vm.globalSlots);
              return 1;
         }
 
@@ -0,0 +1,148 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/jit.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+// A large live graph keeps the marker thread busy while the script
+// rewires it: fields are overwritten, instances outgrow their field arrays
+// and turn into dictionaries, closures are created and upvalues closed and
+// reassigned, classes are declared, and each value's old holder drops it.
+static const char* kMutator = R"(
+    class Node {
+        init(next, item) { this.next = next; this.item = item; }
+    }
+    class Item { init(n) { this.n = n; } }
+    var head = nil;
+    for (var i = 0; i < 20000; i++) head = Node(head, Item(i));
+
+    fun counter() {
+        var count = Item(0);
+        fun bump(item) { var old = count; count = item; return old; }
+        return bump;
+    }
+
+    var spare = Item(20000);
+    for (var round = 0; round < 30; round++) {
+        var bump = counter();
+        class Round { tag() { return round; } }
+        var node = head;
+        var k = 0;
+        while (node != nil) {
+            var item = node.item;
+            node.item = spare;
+            spare = item;
+            k = k + 1;
+            if (k == 100) {
+                k = 0;
+                // Grow a throwaway instance through its field arrays and
+                // into a dictionary.
+                var wide = Round();
+                wide.a = 1; wide.b = 2; wide.c = 3; wide.d = 4; wide.e = 5;
+                wide.f = 6; wide.g = 7; wide.h = 8; wide.i = 9; wide.j = 10;
+                wide.k = Item(k); wide.l = "s" + round; wide.m = bump(Item(k));
+                wide.n = 1; wide.o = 2; wide.p = 3; wide.q = 4; wide.r = 5;
+                wide.s = 6; wide.t = 7; wide.u = 8; wide.v = 9; wide.w = 10;
+                wide.x = 1; wide.y = 2; wide.z = 3; wide.aa = 4; wide.bb = 5;
+                wide.cc = 6; wide.dd = 7; wide.ee = 8; wide.ff = 9; wide.gg = 10;
+                wide.hh = Item(k); wide.ii = "t" + round;
+            }
+            node = node.next;
+        }
+    }
+
+    var total = spare.n;
+    var node = head;
+    while (node != nil) {
+        total = total + node.item.n;
+        node = node.next;
+    }
+)";
+
+void testMutationDuringConcurrentMarking() {
+    std::cout << "Testing heavy mutation while the marker thread runs..." << std::endl;
+    for (bool jit : {false, true}) {
+        VM vm;
+        vm.concurrentMarking = true;
+        vm.gcThreshold = 512 * 1024;
+        vm.nextGC = vm.gcThreshold;
+        vm.jitEnabled = jit && jitAvailable();
+        vm.jitThreshold = 1;
+        runScript(vm, kMutator);
+        vm.finishCycle();
+        // Items 0 to 20000 only change hands.
+        CHECK(globalNumber(vm, "total") == 20000.0 * 20001.0 / 2.0);
+        vm.collectGarbage();
+        CHECK(globalNumber(vm, "total") == 20000.0 * 20001.0 / 2.0);
+    }
+}
+
+void testMarkerOverlapsScript() {
+    std::cout << "Testing marking happens off the script's thread..." << std::endl;
+    VM vm;
+    vm.concurrentMarking = true;
+    runScript(vm, R"(
+        class Node { init(next) { this.next = next; } }
+        var live = nil;
+        for (var i = 0; i < 50000; i++) live = Node(live);
+    )");
+    vm.finishCycle();
+    vm.startCycle();
+    CHECK(vm.markerActive);
+    // The script keeps running and allocating while the helper traces.
+    runScript(vm, "var total = 0; for (var i = 0; i < 1000; i++) total = total + i;");
+    CHECK(globalNumber(vm, "total") == 999.0 * 1000.0 / 2.0);
+    vm.finishCycle();
+    CHECK(!vm.markerActive);
+    CHECK(vm.gcPhase == GC_IDLE);
+    CHECK(vm.grayStack.empty());
+}
+
+void testDestroyWhileMarking() {
+    std::cout << "Testing a VM destroyed mid-cycle stops its marker..." << std::endl;
+    for (int i = 0; i < 10; i++) {
+        VM vm;
+        vm.concurrentMarking = true;
+        runScript(vm, R"(
+            class Node { init(next) { this.next = next; } }
+            var live = nil;
+            for (var i = 0; i < 20000; i++) live = Node(live);
+        )");
+        vm.finishCycle();
+        vm.startCycle();
+    }
+}
+
+void testPublicSwitch() {
+    std::cout << "Testing setGCConcurrent()..." << std::endl;
+    CXXX vm;
+    vm.setGCConcurrent(true);
+    vm.setGCThreshold(64 * 1024);
+    CHECK(vm.interpret(R"(
+        class Pair { init(a, b) { this.a = a; this.b = b; } }
+        var keep = Pair(1, "kept");
+        var total = 0;
+        for (var i = 0; i < 50000; i++) {
+            var p = Pair(i, "item" + i);
+            total = total + p.a - i + 1;
+        }
+        total = total + keep.a;
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50001.0);
+    vm.setGCConcurrent(false);
+    vm.collectGarbage();
+    CHECK(vm.getBytesAllocated() < 1024 * 1024);
+}
+
+int main() {
+    testMutationDuringConcurrentMarking();
+    testMarkerOverlapsScript();
+    testDestroyWhileMarking();
+    testPublicSwitch();
+    std::cout << "All concurrent marking tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+
+void testHeapStaysBounded() {
+    std::cout << "Testing automatic collection..." << std::endl;
+    cxxx::CXXX vm;
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Pair {
+            init(a, b) { this.a = a; this.b = b; }
+        }
+        var total = 0;
+        for (var i = 0; i < 50000; i++) {
+            var p = Pair(i, "item" + i);
+            total = total + p.a - i + 1;
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50000.0);
+
+    // Without collection this loop retains tens of MiB of garbage.
+    std::cout << "Bytes allocated: " << vm.getBytesAllocated() << std::endl;
+    CHECK(vm.getBytesAllocated() < 8 * 1024 * 1024);
+}
+
+void testCollectEveryAllocation() {
+    std::cout << "Testing collection on every allocation..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setGCThreshold(0);
+    vm.setGCGrowthFactor(1.0);
+
+    // Compiling this allocates functions and strings that are not reachable
+    // from the VM until the script runs.
+    cxxx::InterpretResult result = vm.interpret(R"(
+        fun makeCounter(start) {
+            var count = start;
+            fun step(by) {
+                count = count + by;
+                return count;
+            }
+            return step;
+        }
+        class Base {
+            init(name) { this.name = name; }
+            greet() { return "hello " + this.name; }
+        }
+        class Derived < Base {
+            init(name) { super.init(name); }
+            greet() { return super.greet() + "!"; }
+        }
+        var counter = makeCounter(10);
+        counter(1);
+        var counted = counter(2);
+        var greeting = Derived("gc").greet();
+        var greetingLen = len(greeting);
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("counted") == 13.0);
+    CHECK(vm.getGlobalNumber("greetingLen") == 9.0);
+
+    cxxx::Value s = vm.createString("kept alive by setGlobal");
+    vm.setGlobal("s", s);
+    CHECK(vm.interpret("var sLen = len(s);") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("sLen") == 23.0);
+}
+
+void testExplicitCollect() {
+    std::cout << "Testing explicit collection..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setGCThreshold(64 * 1024 * 1024);
+    vm.interpret(R"(
+        var s = "";
+        for (var i = 0; i < 2000; i++) { s = "x" + i; }
+    )");
+    size_t before = vm.getBytesAllocated();
+    vm.collectGarbage();
+    size_t after = vm.getBytesAllocated();
+    std::cout << "Before: " << before << " after: " << after << std::endl;
+    CHECK(after < before);
+}
+
+int main() {
+    testHeapStaysBounded();
+    testCollectEveryAllocation();
+    testExplicitCollect();
+    std::cout << "GC tests passed." << std::endl;
+    return 0;
+}
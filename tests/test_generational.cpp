@@ -0,0 +1,156 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+
+using namespace cxxx;
+
+// Every store below puts a freshly allocated object into something that has
+// already survived a collection. With a one-byte nursery each allocation
+// runs a minor collection, so a missed barrier frees the new object while
+// the old one still points at it.
+static const char* kOldToYoung = R"(
+    class Box { init() { this.value = nil; } }
+    var box = Box();
+    var global = nil;
+    var setCell;
+    var getCell;
+    {
+        var captured = nil;
+        fun keep(v) { captured = v; }
+        fun read() { return captured; }
+        setCell = keep;
+        getCell = read;
+    }
+
+    var total = 0;
+    for (var i = 0; i < 200; i++) {
+        box.value = "field" + i;
+        box.extra = Box();
+        box.extra.value = "nested" + i;
+        global = "global" + i;
+        setCell("upvalue" + i);
+        var junk = "junk" + i;
+        total = total + len(box.value) + len(box.extra.value) + len(global) + len(getCell());
+    }
+
+    class Greeter {
+        greet() { return "hi " + this.name; }
+        name() { return "unused"; }
+    }
+    var greeter = Greeter();
+    greeter.name = "there";
+    var greeting = len(greeter.greet());
+    fun outer() {
+        var prefix = "in" + "ner";
+        fun inner() { return prefix; }
+        return inner;
+    }
+    var closure = outer();
+    var closed = len(closure());
+)";
+
+static void checkOldToYoung(CXXX& vm) {
+    double expected = 0;
+    for (int i = 0; i < 200; i++) {
+        std::string n = std::to_string(i);
+        expected += (double)(5 + n.size()) + (6 + n.size()) + (6 + n.size()) + (7 + n.size());
+    }
+    CHECK(vm.getGlobalNumber("total") == expected);
+    CHECK(vm.getGlobalNumber("greeting") == 8.0);
+    CHECK(vm.getGlobalNumber("closed") == 5.0);
+}
+
+void testOldToYoungReferences() {
+    std::cout << "Testing old-to-young references survive minor collections..." << std::endl;
+    CXXX interpreted;
+    interpreted.setGCThreshold(64 * 1024 * 1024);
+    interpreted.setGCNurserySize(1);
+    CHECK(interpreted.interpret(kOldToYoung) == InterpretResult::OK);
+    checkOldToYoung(interpreted);
+
+    CXXX jitted;
+    jitted.setGCThreshold(64 * 1024 * 1024);
+    jitted.setGCNurserySize(1);
+    jitted.setJITEnabled(true);
+    jitted.setJITThreshold(1);
+    CHECK(jitted.interpret(kOldToYoung) == InterpretResult::OK);
+    checkOldToYoung(jitted);
+}
+
+static const char* kGarbage = R"(
+    class Pair { init(a, b) { this.a = a; this.b = b; } }
+    var keep = Pair(0, "kept");
+    var total = 0;
+    for (var i = 0; i < 50000; i++) {
+        var p = Pair(i, "item" + i);
+        total = total + p.a - i + 1;
+    }
+)";
+
+// Minor collections alone keep the heap small: the threshold for a full
+// collection is never reached.
+void testMinorCollectionsFreeGarbage() {
+    std::cout << "Testing minor collections free short-lived objects..." << std::endl;
+    VM vm;
+    vm.gcThreshold = 64 * 1024 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    ObjFunction* script = compile(&vm, kGarbage);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    vm.popRoot();
+
+    CHECK(vm.nextGC == vm.gcThreshold);
+    std::cout << "Bytes allocated: " << vm.bytesAllocated << std::endl;
+#ifndef DEBUG_STRESS_GC
+    // Stress mode runs a minor collection on every allocation, which
+    // promotes whatever is live at that moment, temporaries included. No
+    // full collection runs below the threshold, so the old space keeps
+    // them; only the real nursery bound keeps the heap this small.
+    CHECK(vm.bytesAllocated < 2 * 1024 * 1024);
+#endif
+
+    Value total = globalValue(vm, "total");
+    CHECK(total.asNumber() == 50000.0);
+
+    // Whatever survived has been promoted, and nothing is left remembered.
+    Value keep = globalValue(vm, "keep");
+    vm.collectYoung();
+    CHECK(keep.asObj()->isOld);
+    CHECK(vm.heap.touched.empty());
+    CHECK(vm.heap.youngLarge == nullptr);
+    CHECK(vm.remembered.empty());
+    CHECK(vm.rememberedGlobals.empty());
+}
+
+void testNurseryDisabled() {
+    std::cout << "Testing a zero nursery leaves collection to full GCs..." << std::endl;
+    CXXX vm;
+    vm.setGCThreshold(64 * 1024 * 1024);
+    vm.setGCNurserySize(0);
+    CHECK(vm.interpret(kGarbage) == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50000.0);
+    size_t before = vm.getBytesAllocated();
+#ifndef DEBUG_STRESS_GC
+    // Stress mode makes every allocation a full collection here, so no
+    // garbage builds up for the last one to free.
+    CHECK(before > 6 * 1024 * 1024);
+#endif
+
+    vm.collectGarbage();
+#ifndef DEBUG_STRESS_GC
+    CHECK(vm.getBytesAllocated() < before / 2);
+#else
+    CHECK(vm.getBytesAllocated() <= before);
+#endif
+}
+
+int main() {
+    testOldToYoungReferences();
+    testMinorCollectionsFreeGarbage();
+    testNurseryDisabled();
+    std::cout << "All generational GC tests passed!" << std::endl;
+    return 0;
+}
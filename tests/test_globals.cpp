@@ -0,0 +1,57 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+
+void testManyGlobals() {
+    std::cout << "Testing more globals than one chunk has constants..." << std::endl;
+    cxxx::CXXX vm;
+    // Global names no longer take constant-pool entries, so a chunk can
+    // refer to more than 256 of them.
+    std::string source = "var g0 = true;\n";
+    for (int i = 1; i < 300; i++) {
+        source += "var g" + std::to_string(i) + " = !g" + std::to_string(i - 1) + ";\n";
+    }
+    source += "g299 = g0;\n";
+    CHECK(vm.interpret(source) == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalBool("g298"));
+    CHECK(!vm.getGlobalBool("g297"));
+    CHECK(vm.getGlobalBool("g299"));
+}
+
+void testUndefinedGlobals() {
+    std::cout << "Testing undefined globals..." << std::endl;
+    cxxx::CXXX vm;
+    // Referencing a name gives it a slot, but it stays undefined.
+    CHECK(vm.interpret("var a = missing;") == cxxx::InterpretResult::RUNTIME_ERROR);
+    CHECK(vm.interpret("missing = 1;") == cxxx::InterpretResult::RUNTIME_ERROR);
+    CHECK(vm.getGlobalNumber("missing") == 0.0);
+    CHECK(vm.interpret("var missing = 3; missing = missing + 1;") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("missing") == 4.0);
+}
+
+void testGlobalsAcrossScripts() {
+    std::cout << "Testing globals shared between scripts and the API..." << std::endl;
+    cxxx::CXXX vm;
+    CHECK(vm.interpret(R"(
+        var count = 0;
+        fun bump() { count = count + 1; return count; }
+    )") == cxxx::InterpretResult::OK);
+    vm.setGlobal("step", cxxx::Value::number(10));
+    CHECK(vm.interpret(R"(
+        for (var i = 0; i < 5; i++) { bump(); }
+        count = count + step;
+    )") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("count") == 15.0);
+
+    vm.setGlobal("count", cxxx::Value::number(100));
+    CHECK(vm.interpret("var after = bump();") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("after") == 101.0);
+}
+
+int main() {
+    testManyGlobals();
+    testUndefinedGlobals();
+    testGlobalsAcrossScripts();
+    std::cout << "Global slot tests passed." << std::endl;
+    return 0;
+}
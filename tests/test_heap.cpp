@@ -0,0 +1,174 @@
+#include "../src/include/cxxx.h"
+#include "../src/vm/heap.h"
+#include "../src/vm/vm.h"
+#include "../src/compiler/compiler.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+using namespace cxxx;
+
+static size_t lineOf(void* object) {
+    return ((uintptr_t)object & (HEAP_BLOCK_SIZE - 1)) / HEAP_LINE_SIZE;
+}
+
+void testBumpAllocation() {
+    std::cout << "Testing objects are bumped through a block..." << std::endl;
+    Heap heap;
+    char* a = (char*)heap.allocate(24);
+    char* b = (char*)heap.allocate(32);
+    char* c = (char*)heap.allocate(1);
+    // Sizes round up to the granule.
+    CHECK(b == a + 32);
+    CHECK(c == b + 32);
+    CHECK(Heap::blockOf(a) == Heap::blockOf(c));
+    CHECK(Heap::blockOf(a)->kind == CHUNK_BLOCK);
+    CHECK(lineOf(a) >= (size_t)HEAP_FIRST_LINE);
+    CHECK(heap.blockCount() == 1);
+    std::memset(a, 0xab, 24);
+
+    int starts = 0;
+    Block* block = Heap::blockOf(a);
+    Heap::forEach(block, block->starts, [&](void*) { starts++; });
+    CHECK(starts == 3);
+    CHECK(heap.touched.size() == 1 && heap.touched[0] == block);
+
+    // Objects over a line fit in the current hole too.
+    void* medium = heap.allocate(HEAP_LINE_SIZE * 3);
+    CHECK(Heap::blockOf(medium) == block);
+    CHECK(heap.blockCount() == 1);
+}
+
+// Half the lines of a full block survive; the allocator then fills exactly
+// the other half before it moves on.
+void testHolesAreReused() {
+    std::cout << "Testing freed lines are reused..." << std::endl;
+    Heap heap;
+    std::vector<void*> objects;
+    Block* block = nullptr;
+    for (;;) {
+        void* object = heap.allocate(32);
+        if (block == nullptr) block = Heap::blockOf(object);
+        if (Heap::blockOf(object) != block) break;
+        objects.push_back(object);
+    }
+    size_t perLine = HEAP_LINE_SIZE / 32;
+    CHECK(objects.size() == (HEAP_LINES - HEAP_FIRST_LINE) * perLine);
+
+    heap.beginMarking();
+    size_t kept = 0;
+    for (void* object : objects) {
+        if (lineOf(object) % 2 != 0) continue;
+        CHECK(Heap::mark(object));
+        CHECK(!Heap::mark(object));
+        heap.markLines(object, 32);
+        kept++;
+    }
+    heap.resetAllocator();
+    int promoted = 0;
+    heap.sweepBlock(block, SWEEP_ALL, [&](void*) { promoted++; });
+    CHECK((size_t)promoted == kept);
+    size_t dead = 0;
+    Heap::forEach(block, block->marks, [&](void* object) {
+        CHECK(lineOf(object) % 2 != 0);
+        heap.release(object, 32);
+        dead++;
+    });
+    CHECK(dead + kept == objects.size());
+    heap.finishSweep(block);
+    CHECK(block->listed);
+    CHECK(heap.recyclable.size() == 1 && heap.recyclable[0] == block);
+    int freeLines = block->freeLines;
+    CHECK(freeLines > 0 && (size_t)freeLines < HEAP_LINES - HEAP_FIRST_LINE);
+    for (uint64_t word : block->marks) CHECK(word == 0);
+
+    // The holes are a line long. Longer objects bump through a block of
+    // their own rather than skip them.
+    void* medium = heap.allocate(HEAP_LINE_SIZE * 3);
+    CHECK(Heap::blockOf(medium) != block);
+    CHECK(heap.blockCount() == 3);
+
+    size_t reused = 0;
+    for (;;) {
+        void* object = heap.allocate(32);
+        if (Heap::blockOf(object) != block) break;
+        CHECK(lineOf(object) % 2 != 0);
+        std::memset(object, 0xcd, 32);
+        reused++;
+    }
+    CHECK(reused == (size_t)freeLines * perLine);
+    CHECK(heap.blockCount() == 4);
+}
+
+void testLargeObjects() {
+    std::cout << "Testing large objects get chunks of their own..." << std::endl;
+    Heap heap;
+    size_t size = HEAP_LARGE_SIZE + 1;
+    char* large = (char*)heap.allocate(size);
+    std::memset(large, 0xef, size);
+    CHECK(Heap::blockOf(large)->kind == CHUNK_LARGE);
+    CHECK(heap.youngLarge == Heap::chunkOf(large));
+    CHECK(heap.largeCount() == 1);
+    CHECK(heap.blockCount() == 0);
+
+    CHECK(!Heap::isMarked(large));
+    CHECK(Heap::markAtomic(large));
+    CHECK(!Heap::mark(large));
+    CHECK(Heap::isMarked(large));
+
+    heap.setOld(large);
+    CHECK(heap.youngLarge == nullptr);
+    CHECK(heap.oldLarge == Heap::chunkOf(large));
+    heap.release(large, size);
+    CHECK(heap.oldLarge == nullptr);
+    CHECK(heap.largeCount() == 0);
+}
+
+// A garbage-heavy script run again and again settles on a fixed number of
+// blocks: collections free lines and whole blocks for reuse.
+void testVMReusesBlocks() {
+    std::cout << "Testing the VM's heap stays the same size across runs..." << std::endl;
+    const char* source = R"(
+        class Box {
+            init(n) { this.a = n; this.b = n; this.c = n; }
+            get() { return this.a + this.c; }
+        }
+        fun adder(n) { fun add(x) { return x + n; } return add; }
+        var total = 0;
+        var keep = nil;
+        for (var i = 0; i < 20000; i++) {
+            var box = Box(i);
+            if (i == 10000) keep = box;
+            total = total + adder(1)(box.get()) - 1;
+        }
+    )";
+    VM vm;
+    vm.gcThreshold = 64 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    ObjFunction* script = compile(&vm, source);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    vm.collectGarbage();
+    size_t blocks = vm.heap.blockCount();
+    for (int i = 0; i < 3; i++) {
+        CHECK(vm.interpret(script) == InterpretResult::OK);
+        vm.collectGarbage();
+    }
+    CHECK(blocks > 0);
+    CHECK(vm.heap.blockCount() == blocks);
+    vm.popRoot();
+
+    Value total = globalValue(vm, "total");
+    CHECK(total.asNumber() == 2.0 * (19999.0 * 20000.0 / 2.0));
+}
+
+int main() {
+    testBumpAllocation();
+    testHolesAreReused();
+    testLargeObjects();
+    testVMReusesBlocks();
+    std::cout << "All heap tests passed!" << std::endl;
+    return 0;
+}
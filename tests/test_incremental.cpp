@@ -0,0 +1,127 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/jit.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+// Values move between objects, globals and closures while a cycle marks.
+// The only reference to a value is often on the stack or in an object that
+// has already been traced, which is what the barriers and the final rescan
+// of the stack have to cover.
+static const char* kShuffle = R"(
+    class Node { init(next, value) { this.next = next; this.value = value; } }
+    class Item { init(n) { this.n = n; this.name = "item" + n; } }
+    var head = nil;
+    for (var i = 0; i < 2000; i++) head = Node(head, Item(i));
+
+    var held = Item(2000);
+    fun keeper() {
+        var kept = Item(2001);
+        fun swap(v) { var old = kept; kept = v; return old; }
+        return swap;
+    }
+    var swap = keeper();
+
+    for (var round = 0; round < 20; round++) {
+        var node = head;
+        while (node != nil) {
+            var taken = node.value;
+            node.value = swap(held);
+            held = taken;
+            var garbage = Node(nil, "g" + round);
+            node = node.next;
+        }
+    }
+
+    var total = 0;
+    var node = head;
+    while (node != nil) {
+        total = total + node.value.n;
+        node = node.next;
+    }
+    total = total + held.n + swap(nil).n;
+)";
+
+
+void testMutationDuringMarking() {
+    std::cout << "Testing values moved during incremental marking survive..." << std::endl;
+    for (bool jit : {false, true}) {
+        VM vm;
+        vm.gcThreshold = 256 * 1024;
+        vm.nextGC = vm.gcThreshold;
+        vm.sliceBudget = 8;
+        vm.jitEnabled = jit && jitAvailable();
+        vm.jitThreshold = 1;
+        runScript(vm, kShuffle);
+        vm.finishCycle();
+        // Items 0 to 2001 only move around.
+        CHECK(globalNumber(vm, "total") == 2001.0 * 2002.0 / 2.0);
+    }
+}
+
+void testCycleRunsInSlices() {
+    std::cout << "Testing a cycle is spread over bounded slices..." << std::endl;
+    VM vm;
+    std::vector<double> pauses;
+    vm.pauseLog = &pauses;
+    vm.sliceBudget = 100;
+    runScript(vm, R"(
+        class Node { init(next) { this.next = next; } }
+        var live = nil;
+        for (var i = 0; i < 20000; i++) live = Node(live);
+        for (var i = 0; i < 20000; i++) Node(nil);
+    )");
+    vm.finishCycle();
+    vm.collectGarbage();
+    size_t live = vm.bytesAllocated;
+
+    runScript(vm, "for (var i = 0; i < 20000; i++) Node(nil);");
+    vm.finishCycle();
+    vm.startCycle();
+    CHECK(vm.gcPhase == GC_MARK);
+    int slices = 0;
+    while (vm.gcPhase != GC_IDLE) {
+        vm.collectSlice(vm.sliceBudget);
+        slices++;
+    }
+    // 20000 live nodes take at least 200 marking slices of 100 objects.
+    CHECK(slices > 200);
+    CHECK(vm.grayStack.empty());
+    CHECK(vm.bytesAllocated <= live);
+    CHECK(!pauses.empty());
+}
+
+void testCollectFinishesCycle() {
+    std::cout << "Testing explicit collections during a cycle..." << std::endl;
+    CXXX vm;
+    vm.setGCThreshold(16 * 1024);
+    vm.setGCSliceBudget(10);
+    CHECK(vm.interpret(R"(
+        class Pair { init(a, b) { this.a = a; this.b = b; } }
+        var keep = Pair(1, "kept");
+        var total = 0;
+        for (var i = 0; i < 20000; i++) {
+            var p = Pair(i, "item" + i);
+            total = total + p.a - i + 1;
+        }
+    )") == InterpretResult::OK);
+    vm.collectGarbage();
+    CHECK(vm.getGlobalNumber("total") == 20000.0);
+    CHECK(vm.interpret("var kept = len(keep.b);") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("kept") == 4.0);
+    vm.setGCSliceBudget(0);
+    CHECK(vm.interpret("var again = keep.a;") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("again") == 1.0);
+}
+
+int main() {
+    testMutationDuringMarking();
+    testCycleRunsInSlices();
+    testCollectFinishesCycle();
+    std::cout << "All incremental GC tests passed!" << std::endl;
+    return 0;
+}
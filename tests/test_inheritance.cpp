@@ -0,0 +1,169 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+#include <string>
+
+using namespace cxxx;
+
+void testOverrides() {
+    std::cout << "Testing overrides win over copied-down methods..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class A {
+            name() { return 1; }
+            both() { return this.name() * 10; }
+        }
+        class B < A {
+            name() { return 2; }
+        }
+        class C < B {
+            both() { return super.both() + 5; }
+        }
+        var a = A().both();
+        var b = B().both();
+        var c = C().both();
+        var cName = C().name();
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("a") == 10.0);
+    CHECK(vm.getGlobalNumber("b") == 20.0);
+    CHECK(vm.getGlobalNumber("c") == 25.0);
+    CHECK(vm.getGlobalNumber("cName") == 2.0);
+}
+
+void testSubclassDoesNotLeakUpwards() {
+    std::cout << "Testing subclass methods stay out of the superclass..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class A { base() { return 1; } }
+        class B < A { extra() { return 2; } }
+        var viaB = B().extra() + B().base();
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("viaB") == 3.0);
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    CHECK(vm.interpret("A().extra();") == InterpretResult::RUNTIME_ERROR);
+    std::cerr.rdbuf(saved);
+}
+
+void testInheritedInitializer() {
+    std::cout << "Testing initializers are inherited..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class Point {
+            init(x, y) { this.x = x; this.y = y; }
+            sum() { return this.x + this.y; }
+        }
+        class Named < Point {}
+        class Labeled < Named {
+            init(x, y) { super.init(x * 2, y * 2); }
+        }
+        var named = Named(3, 4).sum();
+        var labeled = Labeled(3, 4).sum();
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("named") == 7.0);
+    CHECK(vm.getGlobalNumber("labeled") == 14.0);
+}
+
+void testDeepHierarchy() {
+    std::cout << "Testing deep hierarchies..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class L0 {
+            depth() { return 0; }
+            root() { return 42; }
+        }
+        class L1 < L0 { depth() { return 1; } }
+        class L2 < L1 {}
+        class L3 < L2 {}
+        class L4 < L3 { depth() { return super.depth() + 4; } }
+        class L5 < L4 {}
+        class L6 < L5 {}
+        class L7 < L6 {}
+        class L8 < L7 {}
+        class L9 < L8 {}
+        var o = L9();
+        var depth = o.depth();
+        var bound = o.root;
+        var root = bound();
+        var isRoot = o instanceof L0;
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("depth") == 5.0);
+    CHECK(vm.getGlobalNumber("root") == 42.0);
+    CHECK(vm.getGlobalBool("isRoot"));
+}
+
+void testInstanceOf() {
+    std::cout << "Testing instanceof against the class display..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class Root {}
+        class Left < Root {}
+        class LeftLeaf < Left {}
+        class Right < Root {}
+        class Other {}
+        var leaf = LeftLeaf();
+        var selfCheck = leaf instanceof LeftLeaf;
+        var parent = leaf instanceof Left;
+        var root = leaf instanceof Root;
+        var sibling = leaf instanceof Right;
+        var unrelated = leaf instanceof Other;
+        var deeper = Left() instanceof LeftLeaf;
+        var sameDepth = Right() instanceof Left;
+        var notInstance = 3 instanceof Root;
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalBool("selfCheck"));
+    CHECK(vm.getGlobalBool("parent"));
+    CHECK(vm.getGlobalBool("root"));
+    CHECK(!vm.getGlobalBool("sibling"));
+    CHECK(!vm.getGlobalBool("unrelated"));
+    CHECK(!vm.getGlobalBool("deeper"));
+    CHECK(!vm.getGlobalBool("sameDepth"));
+    CHECK(!vm.getGlobalBool("notInstance"));
+
+    // Deep enough to need more than a handful of display entries.
+    std::string source = "class D0 {}\n";
+    for (int i = 1; i <= 40; i++) {
+        source += "class D" + std::to_string(i) + " < D" + std::to_string(i - 1) + " {}\n";
+    }
+    source += "var d = D40();\n"
+              "var count = 0;\n"
+              "if (d instanceof D0) count = count + 1;\n"
+              "if (d instanceof D17) count = count + 1;\n"
+              "if (d instanceof D40) count = count + 1;\n"
+              "if (D17() instanceof D18) count = count + 100;\n";
+    CHECK(vm.interpret(source) == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("count") == 3.0);
+}
+
+void testInitializerCache() {
+    std::cout << "Testing the cached initializer..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        class Base { init(n) { this.n = n; } }
+        class Same < Base {}
+        class Own < Base { init() { this.n = 99; } }
+        class Plain {}
+        var total = Base(1).n + Same(2).n + Own().n;
+        var plain = Plain();
+        var reinit = Base(5);
+        var again = reinit.init(7).n;
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 102.0);
+    CHECK(vm.getGlobalNumber("again") == 7.0);
+
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    CHECK(vm.interpret("Plain(1);") == InterpretResult::RUNTIME_ERROR);
+    CHECK(vm.interpret("Own(1);") == InterpretResult::RUNTIME_ERROR);
+    CHECK(vm.interpret("Same();") == InterpretResult::RUNTIME_ERROR);
+    std::cerr.rdbuf(saved);
+}
+
+int main() {
+    testOverrides();
+    testSubclassDoesNotLeakUpwards();
+    testInheritedInitializer();
+    testDeepHierarchy();
+    testInstanceOf();
+    testInitializerCache();
+    std::cout << "All inheritance tests passed!" << std::endl;
+    return 0;
+}
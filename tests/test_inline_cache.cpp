@@ -0,0 +1,115 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+
+void testPolymorphicSite() {
+    std::cout << "Testing polymorphic call site..." << std::endl;
+    cxxx::CXXX vm;
+    // One `s.area()` site sees six receiver classes, more than a cache holds.
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class A { area() { return 1; } }
+        class B { area() { return 2; } }
+        class C { area() { return 3; } }
+        class D { area() { return 4; } }
+        class E { area() { return 5; } }
+        class F < A {}
+        fun pick(i) {
+            if (i == 0) return A();
+            if (i == 1) return B();
+            if (i == 2) return C();
+            if (i == 3) return D();
+            if (i == 4) return E();
+            return F();
+        }
+        var total = 0;
+        for (var round = 0; round < 50; round++) {
+            for (var i = 0; i < 6; i++) {
+                var s = pick(i);
+                total = total + s.area();
+            }
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50.0 * 16.0);
+}
+
+void testFieldsShadowMethods() {
+    std::cout << "Testing fields shadowing cached methods..." << std::endl;
+    cxxx::CXXX vm;
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Greeter {
+            hello() { return 1; }
+        }
+        fun two() { return 2; }
+        fun call(g) { return g.hello(); }
+        var g1 = Greeter();
+        var g2 = Greeter();
+        g2.hello = two;
+        var a = call(g1);
+        var b = call(g2);
+        var c = call(g1);
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("a") == 1.0);
+    CHECK(vm.getGlobalNumber("b") == 2.0);
+    CHECK(vm.getGlobalNumber("c") == 1.0);
+}
+
+void testFieldSlotsAcrossLayouts() {
+    std::cout << "Testing field slots across table layouts..." << std::endl;
+    cxxx::CXXX vm;
+    // The same `o.z` sites read instances whose fields were added in
+    // different orders and numbers.
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Box {}
+        fun readZ(o) { return o.z; }
+        fun writeZ(o, v) { o.z = v; }
+        var total = 0;
+        var wide = false;
+        for (var i = 0; i < 40; i++) {
+            var o = Box();
+            wide = !wide;
+            if (wide) {
+                o.a = 1; o.b = 2; o.c = 3; o.d = 4; o.e = 5; o.f = 6; o.g = 7;
+            }
+            o.z = i;
+            writeZ(o, readZ(o) + 1);
+            total = total + readZ(o);
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 820.0);
+}
+
+void testClassesRecreatedUnderGC() {
+    std::cout << "Testing classes recreated while collecting..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setGCThreshold(0);
+    vm.setGCGrowthFactor(1.0);
+    // Every make() call creates a fresh class; collected classes may reuse
+    // addresses that the `o.get()` cache has seen.
+    cxxx::InterpretResult result = vm.interpret(R"(
+        fun make(v) {
+            class K {
+                get() { return v; }
+            }
+            return K();
+        }
+        var total = 0;
+        for (var i = 0; i < 200; i++) {
+            var o = make(i);
+            total = total + o.get();
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 19900.0);
+}
+
+int main() {
+    testPolymorphicSite();
+    testFieldsShadowMethods();
+    testFieldSlotsAcrossLayouts();
+    testClassesRecreatedUnderGC();
+    std::cout << "Inline cache tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+#include <string>
+
+// Runs `source` with the JIT at `threshold` and returns the global `name`.
+// Every script is also run interpreted, and both must agree.
+double runJit(const std::string& source, const char* name, int threshold = 1) {
+    cxxx::CXXX interpreted;
+    CHECK(interpreted.interpret(source) == cxxx::InterpretResult::OK);
+
+    cxxx::CXXX jitted;
+    jitted.setJITEnabled(true);
+    jitted.setJITThreshold(threshold);
+    CHECK(jitted.interpret(source) == cxxx::InterpretResult::OK);
+
+    double expected = interpreted.getGlobalNumber(name);
+    double actual = jitted.getGlobalNumber(name);
+    if (expected != actual) {
+        std::cerr << name << ": interpreted " << expected << ", jitted " << actual << std::endl;
+    }
+    CHECK(expected == actual);
+    return actual;
+}
+
+void testArithmeticAndLoops() {
+    std::cout << "Testing arithmetic and loops..." << std::endl;
+    CHECK(runJit(R"(
+        var sum = 0;
+        for (var i = 0; i < 10000; i++) {
+            sum = sum + i * 2 - i / 2;
+        }
+    )", "sum") == 74992500.0);
+
+    CHECK(runJit(R"(
+        var result = 0;
+        var i = 0;
+        while (i < 100) {
+            var j = 0;
+            while (j < 100) {
+                if (j == 50) {
+                    j = j + 1;
+                    continue;
+                }
+                if (!(j > 90)) result = result + 1;
+                j = j + 1;
+            }
+            i = i + 1;
+        }
+        var negated = -result;
+    )", "negated") == -9000.0);
+
+    // Loops that tier up part-way through, at the default threshold.
+    CHECK(runJit(R"(
+        var count = 0;
+        for (var i = 0; i < 5000; i++) {
+            for (var j = 10; j > 0; j--) count = count + 1;
+        }
+    )", "count", 1000) == 50000.0);
+}
+
+void testCalls() {
+    std::cout << "Testing calls between native and interpreted frames..." << std::endl;
+    CHECK(runJit(R"(
+        fun fib(n) {
+            if (n < 2) return n;
+            return fib(n - 1) + fib(n - 2);
+        }
+        var result = fib(20);
+    )", "result") == 6765.0);
+
+    // `inner` tiers up while `outer` is still interpreted, and vice versa.
+    CHECK(runJit(R"(
+        fun inner(x) { return x + 1; }
+        fun outer(n) {
+            var total = 0;
+            for (var i = 0; i < n; i++) total = total + inner(i);
+            return total;
+        }
+        var result = 0;
+        for (var k = 0; k < 20; k++) result = result + outer(k);
+    )", "result", 50) == 1330.0);
+
+    // Native functions and string concatenation from native code.
+    CHECK(runJit(R"(
+        var s = "";
+        for (var i = 0; i < 50; i++) s = s + i;
+        var length = len(s);
+    )", "length") == 90.0);
+}
+
+void testClosuresAndClasses() {
+    std::cout << "Testing closures and classes..." << std::endl;
+    CHECK(runJit(R"(
+        fun makeCounter() {
+            var count = 0;
+            fun step() {
+                count = count + 1;
+                return count;
+            }
+            return step;
+        }
+        var counter = makeCounter();
+        var last = 0;
+        for (var i = 0; i < 500; i++) last = counter();
+    )", "last") == 500.0);
+
+    CHECK(runJit(R"(
+        var sum = 0;
+        for (var i = 0; i < 100; i++) {
+            var captured = i;
+            fun get() { return captured; }
+            sum = sum + get();
+        }
+    )", "sum") == 4950.0);
+
+    CHECK(runJit(R"(
+        class Counter {
+            init() { this.n = 0; }
+            inc() { this.n = this.n + 1; }
+        }
+        class Loud < Counter {
+            init() { super.init(); }
+            inc() { super.inc(); this.n = this.n + 1; }
+        }
+        var c = Counter();
+        var d = Loud();
+        for (var i = 0; i < 1000; i++) {
+            c.inc();
+            d.inc();
+        }
+        var result = c.n + d.n;
+        var isLoud = d instanceof Counter;
+    )", "result") == 3000.0);
+}
+
+void testRuntimeErrors() {
+    std::cout << "Testing runtime errors in compiled code..." << std::endl;
+    const char* scripts[] = {
+        "fun f(x) { return 10 / x; } var r = 0; for (var i = 5; i > -5; i--) r = r + f(i);",
+        "fun f(n) { var s = 0; for (var i = 0; i < n; i++) s = s + missing; return s; } f(10);",
+        "fun f(n) { return 1 + f(n + 1); } f(0);",
+        "fun f(x) { return x.field; } for (var i = 0; i < 10; i++) f(i);",
+    };
+    for (const char* script : scripts) {
+        cxxx::CXXX vm;
+        vm.setJITEnabled(true);
+        vm.setJITThreshold(1);
+        CHECK(vm.interpret(script) == cxxx::InterpretResult::RUNTIME_ERROR);
+    }
+}
+
+void testGarbageCollection() {
+    std::cout << "Testing collection during compiled code..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setJITEnabled(true);
+    vm.setJITThreshold(1);
+    vm.setGCThreshold(0);
+    vm.setGCGrowthFactor(1.0);
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Pair {
+            init(a, b) { this.a = a; this.b = b; }
+        }
+        fun make(i) { return Pair(i, "item" + i); }
+        var total = 0;
+        for (var i = 0; i < 300; i++) {
+            var p = make(i);
+            total = total + p.a + len(p.b);
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    // sum(i) + sum(len("item" + i)) = 44850 + 4*300 + (10 + 180 + 600).
+    CHECK(vm.getGlobalNumber("total") == 46840.0);
+}
+
+// Compiled code finds the globals array through VM::globalsData, so it
+// must see the array move when later scripts declare new globals.
+void testGrowingGlobals() {
+    std::cout << "Testing globals declared after compilation..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setJITEnabled(true);
+    vm.setJITThreshold(1);
+    CHECK(vm.interpret(R"(
+        var g = 1;
+        fun bump() { g = g + 1; return g; }
+        for (var i = 0; i < 10; i++) bump();
+    )") == cxxx::InterpretResult::OK);
+    for (int script = 0; script < 5; script++) {
+        std::string declarations;
+        for (int i = script * 200; i < (script + 1) * 200; i++) declarations += "var extra" + std::to_string(i) + ";\n";
+        CHECK(vm.interpret(declarations) == cxxx::InterpretResult::OK);
+    }
+    CHECK(vm.interpret("extra999 = 1000; var after = bump() + extra999;") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("g") == 12.0);
+    CHECK(vm.getGlobalNumber("after") == 1012.0);
+}
+
+void testToggle() {
+    std::cout << "Testing runtime switch..." << std::endl;
+    cxxx::CXXX vm;
+    bool available = vm.setJITEnabled(true);
+    std::cout << "JIT available: " << (available ? "yes" : "no") << std::endl;
+    vm.setJITThreshold(1);
+    CHECK(vm.interpret("fun sq(x) { return x * x; } var a = 0; for (var i = 0; i < 10; i++) a = a + sq(i);") ==
+           cxxx::InterpretResult::OK);
+    CHECK(!vm.setJITEnabled(false));
+    // Already compiled code is simply not entered any more.
+    CHECK(vm.interpret("var b = 0; for (var i = 0; i < 10; i++) b = b + sq(i);") == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("a") == 285.0);
+    CHECK(vm.getGlobalNumber("b") == 285.0);
+}
+
+int main() {
+    testArithmeticAndLoops();
+    testCalls();
+    testClosuresAndClasses();
+    testRuntimeErrors();
+    testGarbageCollection();
+    testGrowingGlobals();
+    testToggle();
+    std::cout << "All JIT tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,166 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+// A long-lived list with eight times as much garbage, strings included.
+static const char* kHeap = R"(
+    class Node { init(next, name) { this.next = next; this.name = name; } }
+    var keep = nil;
+    for (var i = 0; i < 20000; i++) {
+        keep = Node(keep, "keep" + i);
+        for (var j = 0; j < 8; j++) Node(nil, "drop" + i);
+    }
+)";
+
+static const char* kCheck = R"(
+    var count = 0;
+    var node = keep;
+    while (node != nil) {
+        if (node.name == "keep" + (19999 - count)) count = count + 1;
+        node = node.next;
+    }
+)";
+
+void testSweepLeftToAllocator() {
+    std::cout << "Testing the allocator sweeps what a collection marked..." << std::endl;
+    size_t eager = 0;
+    {
+        VM vm;
+        vm.gcThreshold = 256 * 1024 * 1024;
+        vm.nextGC = vm.gcThreshold;
+        vm.nurserySize = 0;
+        runScript(vm, kHeap);
+        vm.collectGarbage();
+        eager = vm.bytesAllocated;
+    }
+
+    VM vm;
+    vm.gcThreshold = 256 * 1024 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    vm.nurserySize = 0;
+    vm.lazySweep = true;
+    runScript(vm, kHeap);
+    size_t before = vm.bytesAllocated;
+    vm.collectGarbage();
+    // Marked only: nothing is freed yet, but no dead string can be found.
+    CHECK(vm.gcPhase == GC_SWEEP);
+    CHECK(vm.heap.sweepPending());
+    CHECK(vm.bytesAllocated == before);
+    size_t blocks = vm.heap.blockCount();
+
+    // New objects fill the lines the allocator sweeps free, so the heap
+    // hardly grows while the garbage goes.
+    runScript(vm, "var fresh = nil; for (var i = 0; i < 5000; i++) fresh = Node(fresh, nil);");
+    CHECK(vm.heap.blockCount() <= blocks + 1);
+    CHECK(vm.bytesAllocated < before / 2);
+
+    vm.finishCycle();
+    CHECK(vm.gcPhase == GC_IDLE);
+    CHECK(!vm.heap.sweepPending());
+    runScript(vm, "fresh = nil;");
+    vm.collectGarbage();
+    vm.finishCycle();
+    CHECK(vm.bytesAllocated <= eager + 1024);
+    runScript(vm, kCheck);
+    CHECK(globalNumber(vm, "count") == 20000.0);
+}
+
+// The string table drops dead strings as soon as marking ends, so interning
+// an equal string makes a new one rather than reviving one still unswept.
+void testDeadStringsNotReused() {
+    std::cout << "Testing interning never returns a string awaiting the sweep..." << std::endl;
+    VM vm;
+    vm.lazySweep = true;
+    runScript(vm, R"(
+        var kept = "alive" + 1;
+        for (var i = 0; i < 1000; i++) "dead" + i;
+    )");
+    vm.collectGarbage();
+    CHECK(vm.heap.sweepPending());
+    ObjString* probe = copyString(&vm, "dead500", 7);
+    CHECK(!probe->isOld);
+    CHECK(!Heap::isMarked(probe));
+    ObjString* kept = copyString(&vm, "alive1", 6);
+    CHECK(kept->isOld);
+    vm.finishCycle();
+}
+
+// Minor collections run while blocks wait to be swept, and neither frees
+// what the other still needs.
+void testYoungCollectionsDuringSweep() {
+    std::cout << "Testing minor collections during a lazy sweep..." << std::endl;
+    VM vm;
+    vm.lazySweep = true;
+    vm.gcThreshold = 256 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    vm.nurserySize = 32 * 1024;
+    runScript(vm, kHeap);
+    runScript(vm, R"(
+        var total = 0;
+        for (var round = 0; round < 20; round++) {
+            var node = keep;
+            var i = 0;
+            while (i < 1000) {
+                node.name = "renamed" + i;
+                total = total + 1;
+                node = node.next;
+                i = i + 1;
+            }
+        }
+        var renamed = 0;
+        var node = keep;
+        for (var i = 0; i < 1000; i++) {
+            if (node.name == "renamed" + i) renamed = renamed + 1;
+            node = node.next;
+        }
+    )");
+    CHECK(globalNumber(vm, "total") == 20000.0);
+    CHECK(globalNumber(vm, "renamed") == 1000.0);
+    vm.finishCycle();
+    vm.collectGarbage();
+    vm.finishCycle();
+    runScript(vm, R"(
+        var count = 0;
+        node = keep;
+        while (node != nil) { count = count + 1; node = node.next; }
+    )");
+    CHECK(globalNumber(vm, "count") == 20000.0);
+}
+
+void testPublicSetting() {
+    std::cout << "Testing setGCLazySweep()..." << std::endl;
+    CXXX vm;
+    vm.setGCLazySweep(true);
+    vm.setGCThreshold(128 * 1024);
+    CHECK(vm.interpret(R"(
+        class Pair { init(a, b) { this.a = a; this.b = b; } }
+        var keep = nil;
+        var total = 0;
+        for (var i = 0; i < 50000; i++) {
+            var p = Pair(i, "item" + i);
+            if (i < 5000) keep = Pair(keep, p);
+            total = total + p.a - i + 1;
+        }
+        var kept = 0;
+        while (keep != nil) { kept = kept + 1; keep = keep.a; }
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50000.0);
+    CHECK(vm.getGlobalNumber("kept") == 5000.0);
+    vm.collectGarbage();
+    vm.setGCLazySweep(false);
+    vm.collectGarbage();
+}
+
+int main() {
+    testSweepLeftToAllocator();
+    testDeadStringsNotReused();
+    testYoungCollectionsDuringSweep();
+    testPublicSetting();
+    std::cout << "All lazy sweep tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,200 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/workers.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+// A live heap with both wide and deep parts, every kind of object, and as
+// much garbage again.
+static const char* kHeap = R"(
+    class Tree {
+        init(depth, n) {
+            this.n = n;
+            this.label = "t" + n;
+            if (depth > 0) {
+                this.left = Tree(depth - 1, 2 * n);
+                this.right = Tree(depth - 1, 2 * n + 1);
+            } else {
+                this.left = nil;
+                this.right = nil;
+            }
+        }
+        sum() {
+            var total = this.n;
+            if (this.left != nil) total = total + this.left.sum() + this.right.sum();
+            return total;
+        }
+    }
+    class Node { init(next, value) { this.next = next; this.value = value; } }
+    fun make(n) {
+        fun get() { return n; }
+        return get;
+    }
+
+    var tree = Tree(12, 1);
+    var chain = nil;
+    for (var i = 0; i < 5000; i++) {
+        chain = Node(chain, make(i));
+        Node(nil, "garbage" + i);
+        Tree(2, i);
+    }
+    var wide = Node(nil, nil);
+    wide.a = 1; wide.b = 2; wide.c = 3; wide.d = 4; wide.e = 5; wide.f = 6;
+    wide.g = 7; wide.h = 8; wide.i = 9; wide.j = 10; wide.k = 11; wide.l = 12;
+    wide.m = 13; wide.n = 14; wide.o = 15; wide.p = 16; wide.q = 17; wide.r = 18;
+    wide.s = 19; wide.t = 20; wide.u = 21; wide.v = 22; wide.w = 23; wide.x = 24;
+    wide.y = 25; wide.z = 26; wide.aa = 27; wide.bb = 28; wide.cc = 29;
+    wide.dd = 30; wide.ee = 31; wide.ff = 32; wide.gg = Tree(3, 1);
+    var bound = tree.sum;
+)";
+
+static const char* kCheck = R"(
+    var treeSum = bound();
+    var chainSum = 0;
+    var node = chain;
+    while (node != nil) {
+        chainSum = chainSum + node.value();
+        node = node.next;
+    }
+    var wideSum = wide.a + wide.ff + wide.gg.sum();
+)";
+
+void testThreadCountsAgree() {
+    std::cout << "Testing parallel collections keep exactly what a serial one keeps..." << std::endl;
+    size_t serialBytes = 0;
+    for (int threads : {1, 2, 4, 8}) {
+        VM vm;
+        vm.gcThreshold = 256 * 1024 * 1024;
+        vm.nextGC = vm.gcThreshold;
+        vm.nurserySize = 0;
+        vm.gcThreads = threads;
+        runScript(vm, kHeap);
+        vm.collectGarbage();
+        if (threads == 1) serialBytes = vm.bytesAllocated;
+        CHECK(vm.bytesAllocated == serialBytes);
+
+        // Nothing is left marked, so a second collection changes nothing.
+        for (Block* block : vm.heap.blocks) {
+            for (uint64_t word : block->marks) CHECK(word == 0);
+        }
+        vm.collectGarbage();
+        CHECK(vm.bytesAllocated == serialBytes);
+
+        runScript(vm, kCheck);
+        // Tree(depth, 1) numbers its nodes 1 to 2^(depth + 1) - 1.
+        CHECK(globalNumber(vm, "treeSum") == 8191.0 * 8192.0 / 2.0);
+        CHECK(globalNumber(vm, "chainSum") == 4999.0 * 5000.0 / 2.0);
+        CHECK(globalNumber(vm, "wideSum") == 1.0 + 32.0 + 15.0 * 16.0 / 2.0);
+    }
+}
+
+// Every block's bitmaps agree: only objects are old, and the lines the
+// allocator may reuse hold none.
+static size_t checkBlocks(VM& vm) {
+    size_t objects = 0;
+    for (Block* block : vm.heap.blocks) {
+        for (int i = 0; i < HEAP_BITMAP_WORDS; i++) {
+            CHECK((block->old[i] & ~block->starts[i]) == 0);
+            CHECK(block->marks[i] == 0);
+        }
+        Heap::forEach(block, block->starts, [&](void* object) {
+            size_t line = ((uintptr_t)object & (HEAP_BLOCK_SIZE - 1)) / HEAP_LINE_SIZE;
+            CHECK(block->used[line]);
+            objects++;
+        });
+    }
+    return objects;
+}
+
+void testBlockSweep() {
+    std::cout << "Testing blocks swept on several threads..." << std::endl;
+    VM vm;
+    vm.gcThreads = 4;
+    runScript(vm, R"(
+        class Node { init(next) { this.next = next; } }
+        var keep = nil;
+        for (var i = 0; i < 60000; i++) {
+            keep = Node(keep);
+            Node(nil);
+        }
+    )");
+    vm.collectGarbage();
+    size_t objects = checkBlocks(vm);
+    CHECK(objects >= 60000);
+    size_t blocks = vm.heap.blockCount();
+    CHECK(blocks > 4);
+
+    // Dropping most of the heap frees its blocks, and the ones kept for
+    // reuse are bounded.
+    runScript(vm, "for (var i = 0; i < 55000; i++) keep = keep.next;");
+    vm.collectGarbage();
+    CHECK(checkBlocks(vm) < objects);
+    CHECK(vm.heap.blockCount() < blocks);
+
+    // An incremental cycle sweeps the same blocks a slice at a time.
+    vm.sliceBudget = 100;
+    vm.startCycle();
+    vm.finishCycle();
+    vm.sliceBudget = 0;
+    checkBlocks(vm);
+    runScript(vm, "for (var i = 0; i < 20000; i++) keep = Node(keep); var n = 0; while (keep != nil) { n = n + 1; keep = keep.next; }");
+    vm.collectGarbage();
+    checkBlocks(vm);
+    CHECK(globalNumber(vm, "n") == 25000.0);
+}
+
+void testWorkers() {
+    std::cout << "Testing the worker group runs every index once..." << std::endl;
+    Workers workers;
+    for (int round = 0; round < 50; round++) {
+        int count = 1 + round % 8;
+        std::vector<int> calls(count, 0);
+        workers.run(count, [&](int index) { calls[index]++; });
+        for (int c : calls) CHECK(c == 1);
+    }
+    CHECK(workers.threadCount() == 7);
+}
+
+void testPublicSetting() {
+    std::cout << "Testing setGCThreads()..." << std::endl;
+    CXXX vm;
+    vm.setGCThreads(4);
+    vm.setGCThreshold(256 * 1024);
+    vm.setGCNurserySize(0);
+    CHECK(vm.interpret(R"(
+        class Pair { init(a, b) { this.a = a; this.b = b; } }
+        var keep = nil;
+        var total = 0;
+        var every = 0;
+        for (var i = 0; i < 50000; i++) {
+            var p = Pair(i, "item" + i);
+            every = every + 1;
+            if (every == 10) {
+                keep = Pair(keep, p);
+                every = 0;
+            }
+            total = total + p.a - i + 1;
+        }
+        var kept = 0;
+        while (keep != nil) { kept = kept + 1; keep = keep.a; }
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 50000.0);
+    CHECK(vm.getGlobalNumber("kept") == 5000.0);
+    vm.setGCThreads(0);
+    vm.collectGarbage();
+    vm.setGCThreads(1000);
+    vm.collectGarbage();
+}
+
+int main() {
+    testThreadCountsAgree();
+    testBlockSweep();
+    testWorkers();
+    testPublicSetting();
+    std::cout << "All parallel GC tests passed!" << std::endl;
+    return 0;
+}
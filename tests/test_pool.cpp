@@ -0,0 +1,116 @@
+#include "../src/include/cxxx.h"
+#include "../src/vm/pool.h"
+#include "../src/vm/vm.h"
+#include "../src/compiler/compiler.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+#include <vector>
+
+using namespace cxxx;
+
+void testSizeClasses() {
+    std::cout << "Testing size classes and block reuse..." << std::endl;
+    Pool pool;
+    void* a = pool.allocate(24);
+    void* b = pool.allocate(32);
+    std::memset(a, 0xab, 24);
+    std::memset(b, 0xcd, 32);
+    pool.free(a, 24);
+    // 17..32 bytes share a class, so the block comes straight back.
+    void* c = pool.allocate(20);
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(c == a);
+    CHECK(pool.slabCount() == 1);
+#endif
+
+    // Another class gets its own slab.
+    void* d = pool.allocate(100);
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(pool.slabCount() == 2);
+#endif
+
+    // Large requests bypass the slabs.
+    void* large = pool.allocate(POOL_MAX_SIZE + 1);
+    std::memset(large, 0, POOL_MAX_SIZE + 1);
+    pool.free(large, POOL_MAX_SIZE + 1);
+    void* empty = pool.allocate(0);
+    pool.free(empty, 0);
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(pool.slabCount() == 2);
+#endif
+
+    pool.free(b, 32);
+    pool.free(c, 20);
+    pool.free(d, 100);
+}
+
+void testSlabsFill() {
+    std::cout << "Testing slabs fill before new ones are taken..." << std::endl;
+    Pool pool;
+    std::vector<void*> blocks;
+    int perSlab = POOL_SLAB_SIZE / 64;
+    for (int i = 0; i < perSlab * 3; i++) {
+        void* block = pool.allocate(64);
+        std::memset(block, i & 0xff, 64);
+        blocks.push_back(block);
+    }
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(pool.slabCount() == 3);
+#endif
+    for (void* block : blocks) pool.free(block, 64);
+    for (int i = 0; i < perSlab * 3; i++) blocks[i] = pool.allocate(64);
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(pool.slabCount() == 3);
+#endif
+    for (void* block : blocks) pool.free(block, 64);
+}
+
+// The upvalue arrays, field arrays and tables of collected objects all go
+// back to the VM's pool, so running the same garbage-heavy script again
+// takes no new slabs.
+void testVMReusesFreedObjects() {
+    std::cout << "Testing the VM recycles what the GC frees..." << std::endl;
+    const char* source = R"(
+        class Box {
+            init(n) { this.a = n; this.b = n; this.c = n; this.d = n; this.e = n; }
+            get() { return this.a + this.e; }
+        }
+        fun adder(n) { fun add(x) { return x + n; } return add; }
+        var total = 0;
+        for (var i = 0; i < 20000; i++) {
+            var box = Box(i);
+            var method = box.get;
+            total = total + adder(1)(method()) - 1;
+        }
+    )";
+    VM vm;
+    vm.gcThreshold = 64 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    ObjFunction* script = compile(&vm, source);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    vm.collectGarbage();
+    size_t slabs = vm.pool.slabCount();
+    for (int i = 0; i < 3; i++) {
+        CHECK(vm.interpret(script) == InterpretResult::OK);
+        vm.collectGarbage();
+    }
+#ifdef CXXX_POOL_ALLOCATOR
+    CHECK(slabs > 0);
+#endif
+    CHECK(vm.pool.slabCount() == slabs);
+    vm.popRoot();
+
+    Value total = globalValue(vm, "total");
+    CHECK(total.asNumber() == 2.0 * (19999.0 * 20000.0 / 2.0));
+}
+
+int main() {
+    testSizeClasses();
+    testSlabsFill();
+    testVMReusesFreedObjects();
+    std::cout << "All pool allocator tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+void testAddQuickensAndFallsBack() {
+    std::cout << "Testing OP_ADD quickening..." << std::endl;
+    VM vm;
+    ObjFunction* function = compile(&vm, R"(
+        fun add(a, b) { return a + b; }
+        fun addNumbers(a, b) { return a + b; }
+        var n = add(1, 2);
+        var s = add("a", "b");
+        var mixed = add("x", 1);
+        var m = add(3, 4);
+        var k = addNumbers(5, 6);
+    )");
+    CHECK(function != nullptr);
+    vm.pushRoot((Obj*)function);
+    ObjFunction* add = findFunction(function, "add");
+    ObjFunction* addNumbers = findFunction(function, "addNumbers");
+    CHECK(add != nullptr && chunkContains(add->chunk, OP_ADD));
+
+    CHECK(vm.interpret(function) == InterpretResult::OK);
+    // The site fell back once, so it settles on the generic op even though
+    // the last call saw numbers again; a site that only saw numbers stays
+    // specialized.
+    CHECK(chunkContains(add->chunk, OP_ADD) && !chunkContains(add->chunk, OP_ADD_NUM));
+    CHECK(chunkContains(addNumbers->chunk, OP_ADD_NUM));
+    CHECK(globalNumber(vm, "k") == 11.0);
+    CHECK(globalNumber(vm, "n") == 3.0);
+    CHECK(globalNumber(vm, "m") == 7.0);
+    Value s = globalValue(vm, "s");
+    CHECK(isObjType(s, OBJ_STRING) && strcmp(((ObjString*)s.asObj())->chars(), "ab") == 0);
+    Value mixed = globalValue(vm, "mixed");
+    CHECK(isObjType(mixed, OBJ_STRING) && strcmp(((ObjString*)mixed.asObj())->chars(), "x1") == 0);
+    vm.popRoot();
+}
+
+void testCallQuickensAndFallsBack() {
+    std::cout << "Testing OP_CALL quickening..." << std::endl;
+    CXXX vm;
+    // One call site sees closures, a native, a class and a bound method.
+    InterpretResult result = vm.interpret(R"(
+        fun one() { return 1; }
+        fun two() { return 2; }
+        class Three { init() { this.v = 3; } get() { return this.v; } }
+        var t = Three();
+        fun pick(i) {
+            if (i == 0) return one;
+            if (i == 1) return two;
+            if (i == 2) return clock;
+            if (i == 3) return Three;
+            return t.get;
+        }
+        var total = 0;
+        for (var round = 0; round < 3; round++) {
+            for (var i = 0; i < 5; i++) {
+                var f = pick(i);
+                var r = f();
+                if (i == 2) r = 0;
+                if (i == 3) r = r.v;
+                total = total + r;
+            }
+        }
+    )");
+    CHECK(result == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 3.0 * (1 + 2 + 3 + 3));
+}
+
+void testPolymorphicCallSettles() {
+    std::cout << "Testing a polymorphic call site settles on OP_CALL..." << std::endl;
+    VM vm;
+    ObjFunction* function = compile(&vm, R"(
+        fun one() { return 1; }
+        class Box {}
+        fun callAny(f) { var r = f(); return r; }
+        fun callOne() { var r = one(); return r; }
+        var total = 0;
+        for (var i = 0; i < 10; i++) {
+            total = total + callAny(one);
+            callAny(Box);
+            total = total + callOne();
+        }
+    )");
+    CHECK(function != nullptr);
+    vm.pushRoot((Obj*)function);
+    CHECK(vm.interpret(function) == InterpretResult::OK);
+    ObjFunction* callAny = findFunction(function, "callAny");
+    CHECK(chunkContains(callAny->chunk, OP_CALL) && !chunkContains(callAny->chunk, OP_CALL_CLOSURE));
+    CHECK(chunkContains(findFunction(function, "callOne")->chunk, OP_CALL_CLOSURE));
+    CHECK(globalNumber(vm, "total") == 20.0);
+    vm.popRoot();
+}
+
+void testArityMismatchAfterQuickening() {
+    std::cout << "Testing arity errors on a quickened call..." << std::endl;
+    CXXX vm;
+    InterpretResult result = vm.interpret(R"(
+        fun one(a) { return a; }
+        fun two(a, b) { return a + b; }
+        fun callWithOne(f) { return f(1); }
+        var a = callWithOne(one);
+        var b = callWithOne(two);
+    )");
+    CHECK(result == InterpretResult::RUNTIME_ERROR);
+    CHECK(vm.getGlobalNumber("a") == 1.0);
+}
+
+int main() {
+    testAddQuickensAndFallsBack();
+    testCallQuickensAndFallsBack();
+    testPolymorphicCallSettles();
+    testArityMismatchAfterQuickening();
+    std::cout << "Quickening tests passed." << std::endl;
+    return 0;
+}
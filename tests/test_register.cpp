@@ -0,0 +1,184 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+#include <initializer_list>
+
+using namespace cxxx;
+
+static const OpCode kRegisterOps[] = {
+    OP_MOVE, OP_LOAD_CONSTANT, OP_ADD_RR, OP_ADD_RK, OP_SUBTRACT_RR, OP_SUBTRACT_RK,
+    OP_MULTIPLY_RR, OP_MULTIPLY_RK, OP_DIVIDE_RR, OP_DIVIDE_RK,
+    OP_LESS_JUMP_IF_FALSE_RR, OP_LESS_JUMP_IF_FALSE_RK, OP_GREATER_JUMP_IF_FALSE_RR,
+    OP_GREATER_JUMP_IF_FALSE_RK, OP_EQUAL_JUMP_IF_FALSE_RR, OP_EQUAL_JUMP_IF_FALSE_RK
+};
+
+static void emit(Chunk& chunk, std::initializer_list<int> bytes) {
+    for (int byte : bytes) chunk.write((uint8_t)byte, 1);
+}
+
+// Exercises every register form, comparing interpreted and jitted runs.
+static const char* kScript = R"(
+    fun arithmetic(a, b) {
+        var x = 0;
+        var total = 0;
+        x = a;              total = total + x;
+        x = 7;              total = total + x;
+        x = a + b;          total = total + x;
+        x = a + 1;          total = total + x;
+        x = a - b;          total = total + x;
+        x = b - 2;          total = total + x;
+        x = a * b;          total = total + x;
+        x = 3 * a;          total = total + x;
+        x = b / a;          total = total + x;
+        x = a / 4;          total = total + x;
+        x += a;             total = total + x;
+        return total;
+    }
+    fun compare(n) {
+        var hits = 0;
+        var limit = 5;
+        for (var i = 0; i < n; i++) {
+            if (i < limit) hits = hits + 1;
+            if (i > limit) hits = hits + 10;
+            if (i == limit) hits = hits + 100;
+            if (2 < i) hits = hits + 1000;
+            if (8 > i) hits = hits + 10000;
+            if (3 == i) hits = hits + 100000;
+        }
+        return hits;
+    }
+    fun strings(n) {
+        var s = "";
+        var tag = "x";
+        for (var i = 0; i < n; i++) {
+            s = s + tag;
+            s = s + i;
+            s = s + "-";
+        }
+        var kind = 0;
+        switch (tag) {
+            case "y": kind = 1;
+            case "x": kind = 2;
+        }
+        return len(s) * 10 + kind;
+    }
+    var arithmeticResult = 0;
+    var compareResult = 0;
+    var stringResult = 0;
+    for (var round = 0; round < 20; round++) {
+        arithmeticResult = arithmetic(8, 2);
+        compareResult = compare(10);
+        stringResult = strings(12);
+    }
+)";
+
+void testCompiledForm() {
+    std::cout << "Testing which backend compiled the script..." << std::endl;
+    VM vm;
+    ObjFunction* script = compile(&vm, kScript);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    int found = 0;
+    for (OpCode op : kRegisterOps) {
+        for (Value constant : script->chunk.constants) {
+            if (isObjType(constant, OBJ_FUNCTION) && chunkContains(((ObjFunction*)constant.asObj())->chunk, op)) {
+                found++;
+                break;
+            }
+        }
+    }
+#ifdef CXXX_REGISTER_VM
+    CHECK(found == (int)(sizeof(kRegisterOps) / sizeof(kRegisterOps[0])));
+#else
+    CHECK(found == 0);
+#endif
+    vm.popRoot();
+}
+
+void testSemantics() {
+    std::cout << "Testing results, interpreted and jitted..." << std::endl;
+    CXXX interpreted;
+    CHECK(interpreted.interpret(kScript) == InterpretResult::OK);
+    // 8 + 7 + 10 + 9 + 6 + 0 + 16 + 24 + 0.25 + 2 + 10
+    CHECK(interpreted.getGlobalNumber("arithmeticResult") == 92.25);
+    // i < 5: 5, i > 5: 4, i == 5: 1, i > 2: 7, i < 8: 8, i == 3: 1
+    CHECK(interpreted.getGlobalNumber("compareResult") == 5 + 40 + 100 + 7000 + 80000 + 100000);
+    // "x0-" through "x9-" are 3 characters, "x10-" and "x11-" are 4.
+    CHECK(interpreted.getGlobalNumber("stringResult") == 382.0);
+
+    CXXX jitted;
+    jitted.setJITEnabled(true);
+    jitted.setJITThreshold(1);
+    CHECK(jitted.interpret(kScript) == InterpretResult::OK);
+    CHECK(jitted.getGlobalNumber("arithmeticResult") == 92.25);
+    CHECK(jitted.getGlobalNumber("compareResult") == interpreted.getGlobalNumber("compareResult"));
+    CHECK(jitted.getGlobalNumber("stringResult") == 382.0);
+}
+
+void testRuntimeErrors() {
+    std::cout << "Testing runtime errors..." << std::endl;
+    const char* scripts[] = {
+        "fun f(a) { var x = 0; x = a / 0; return x; } f(1);",
+        "fun f(a, b) { var x = 0; x = a / b; return x; } f(1, 0);",
+        "fun f(a, b) { var x = 0; x = a + b; return x; } f(1, nil);",
+    };
+    for (const char* script : scripts) {
+        for (int jit = 0; jit < 2; jit++) {
+            CXXX vm;
+            vm.setJITEnabled(jit == 1);
+            vm.setJITThreshold(1);
+            CHECK(vm.interpret(script) == InterpretResult::RUNTIME_ERROR);
+        }
+    }
+}
+
+// Register instructions run in every build, whichever form the compiler
+// emits, so assemble a loop by hand.
+void testHandAssembled() {
+    std::cout << "Testing hand-assembled register code..." << std::endl;
+    VM vm;
+    ObjFunction* function = allocateFunction(&vm);
+    vm.pushRoot((Obj*)function);
+    Chunk& chunk = function->chunk;
+    int zero = chunk.addConstant(NUMBER_VAL(0));
+    int one = chunk.addConstant(NUMBER_VAL(1));
+    int ten = chunk.addConstant(NUMBER_VAL(10));
+    int global = vm.globalSlot(copyString(&vm, "result", 6));
+
+    // slot 1 = i, slot 2 = sum, slot 3 = scratch
+    emit(chunk, {OP_CONSTANT, zero, OP_CONSTANT, zero, OP_CONSTANT, zero});
+    int loop = (int)chunk.code.size();
+    emit(chunk, {OP_LESS_JUMP_IF_FALSE_RK, 1, ten, 0, 11});  // while (i < 10)
+    emit(chunk, {OP_ADD_RR, 2, 2, 1});                       //   sum = sum + i
+    emit(chunk, {OP_ADD_RK, 1, 1, one});                     //   i = i + 1
+    int back = (int)chunk.code.size() + 3 - loop;
+    emit(chunk, {OP_LOOP, back >> 8, back & 0xff});
+    emit(chunk, {OP_MULTIPLY_RK, 3, 2, ten});                // scratch = sum * 10   (450)
+    emit(chunk, {OP_SUBTRACT_RR, 3, 3, 2});                  // scratch -= sum       (405)
+    emit(chunk, {OP_DIVIDE_RR, 3, 3, 1});                    // scratch /= i         (40.5)
+    emit(chunk, {OP_GREATER_JUMP_IF_FALSE_RR, 3, 1, 0, 4});  // if (scratch > i)
+    emit(chunk, {OP_ADD_RR, 3, 3, 3});                       //   scratch += scratch (81)
+    emit(chunk, {OP_EQUAL_JUMP_IF_FALSE_RK, 1, ten, 0, 4});  // if (i == 10)
+    emit(chunk, {OP_SUBTRACT_RK, 3, 3, one});                //   scratch -= 1       (80)
+    emit(chunk, {OP_MOVE, 2, 3});                            // sum = scratch
+    emit(chunk, {OP_DIVIDE_RK, 2, 2, ten});                  // sum /= 10           (8)
+    emit(chunk, {OP_GET_LOCAL, 2, OP_DEFINE_GLOBAL, global >> 8, global & 0xff});
+    emit(chunk, {OP_LOAD_CONSTANT, 1, zero, OP_GET_LOCAL, 1, OP_RETURN});
+
+    CHECK(vm.interpret(function) == InterpretResult::OK);
+    Value result = globalValue(vm, "result");
+    CHECK(result.asNumber() == 8.0);
+    vm.popRoot();
+}
+
+int main() {
+    testCompiledForm();
+    testSemantics();
+    testRuntimeErrors();
+    testHandAssembled();
+    std::cout << "All register instruction tests passed!" << std::endl;
+    return 0;
+}
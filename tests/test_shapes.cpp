@@ -0,0 +1,114 @@
+#include "../src/include/cxxx.h"
+#include "test_util.h"
+#include <iostream>
+
+void testInsertionOrders() {
+    std::cout << "Testing fields added in different orders..." << std::endl;
+    cxxx::CXXX vm;
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Point {}
+        fun sum(p) { return p.x * 100 + p.y * 10 + p.z; }
+        var p1 = Point();
+        p1.x = 1; p1.y = 2; p1.z = 3;
+        var p2 = Point();
+        p2.z = 3; p2.y = 2; p2.x = 1;
+        var p3 = Point();
+        p3.y = 2; p3.x = 1; p3.z = 3;
+        p3.y = 5;
+        var a = sum(p1);
+        var b = sum(p2);
+        var c = sum(p3);
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("a") == 123.0);
+    CHECK(vm.getGlobalNumber("b") == 123.0);
+    CHECK(vm.getGlobalNumber("c") == 153.0);
+}
+
+void testGrowingPastInlineStorage() {
+    std::cout << "Testing instances outgrowing their inline fields..." << std::endl;
+    cxxx::CXXX vm;
+    // The first instance sizes the class for two fields; later ones add
+    // more from the same constructor sites and must spill correctly.
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Bag {
+            init(n) {
+                this.a = 1;
+                this.b = 2;
+                if (n > 0) { this.c = 3; this.d = 4; this.e = 5; }
+                if (n > 1) { this.f = 6; this.g = 7; this.h = 8; this.i = 9; }
+            }
+        }
+        var total = 0;
+        for (var n = 0; n < 3; n++) {
+            var o = Bag(n);
+            total = total + o.a + o.b;
+            if (n > 0) total = total + o.c + o.d + o.e;
+            if (n > 1) total = total + o.f + o.g + o.h + o.i;
+        }
+        var again = Bag(2);
+        var last = again.i;
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 3.0 + 15.0 + 45.0);
+    CHECK(vm.getGlobalNumber("last") == 9.0);
+}
+
+void testDictionaryMode() {
+    std::cout << "Testing instances with many fields..." << std::endl;
+    cxxx::CXXX vm;
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Wide {}
+        var o = Wide();
+        o.f0 = 0; o.f1 = 1; o.f2 = 2; o.f3 = 3; o.f4 = 4; o.f5 = 5; o.f6 = 6; o.f7 = 7;
+        o.f8 = 8; o.f9 = 9; o.f10 = 10; o.f11 = 11; o.f12 = 12; o.f13 = 13; o.f14 = 14; o.f15 = 15;
+        o.f16 = 16; o.f17 = 17; o.f18 = 18; o.f19 = 19; o.f20 = 20; o.f21 = 21; o.f22 = 22; o.f23 = 23;
+        o.f24 = 24; o.f25 = 25; o.f26 = 26; o.f27 = 27; o.f28 = 28; o.f29 = 29; o.f30 = 30; o.f31 = 31;
+        o.f32 = 32; o.f33 = 33; o.f34 = 34; o.f35 = 35; o.f36 = 36; o.f37 = 37; o.f38 = 38; o.f39 = 39;
+        o.f0 = 100;
+        var total = o.f0 + o.f1 + o.f2 + o.f3 + o.f4 + o.f5 + o.f6 + o.f7 + o.f8 + o.f9 +
+            o.f10 + o.f11 + o.f12 + o.f13 + o.f14 + o.f15 + o.f16 + o.f17 + o.f18 + o.f19 +
+            o.f20 + o.f21 + o.f22 + o.f23 + o.f24 + o.f25 + o.f26 + o.f27 + o.f28 + o.f29 +
+            o.f30 + o.f31 + o.f32 + o.f33 + o.f34 + o.f35 + o.f36 + o.f37 + o.f38 + o.f39;
+        var other = Wide();
+        other.f39 = 1;
+        var single = other.f39;
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 780.0 + 100.0);
+    CHECK(vm.getGlobalNumber("single") == 1.0);
+}
+
+void testFieldsUnderGC() {
+    std::cout << "Testing shaped fields while collecting..." << std::endl;
+    cxxx::CXXX vm;
+    vm.setGCThreshold(0);
+    vm.setGCGrowthFactor(1.0);
+    cxxx::InterpretResult result = vm.interpret(R"(
+        class Node {}
+        var head = nil;
+        for (var i = 0; i < 100; i++) {
+            var n = Node();
+            n.label = "node";
+            n.next = head;
+            n.value = i;
+            head = n;
+        }
+        var total = 0;
+        while (head != nil) {
+            total = total + head.value + len(head.label);
+            head = head.next;
+        }
+    )");
+    CHECK(result == cxxx::InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("total") == 4950.0 + 400.0);
+}
+
+int main() {
+    testInsertionOrders();
+    testGrowingPastInlineStorage();
+    testDictionaryMode();
+    testFieldsUnderGC();
+    std::cout << "Shape tests passed." << std::endl;
+    return 0;
+}
@@ -0,0 +1,167 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "../src/vm/bytecode.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+#include <initializer_list>
+
+using namespace cxxx;
+
+static void emit(Chunk& chunk, std::initializer_list<int> bytes) {
+    for (int byte : bytes) chunk.write((uint8_t)byte, 1);
+}
+
+static const char* kScript = R"(
+    fun add(a, b) { return a + b; }
+    fun nested(a) { return a + (a + (a + a)); }
+    fun leaf() { return 1; }
+    var total = 0;
+    for (var i = 0; i < 3; i++) total = total + leaf();
+)";
+
+void testMeasuredDepth() {
+    std::cout << "Testing compiled functions record their stack depth..." << std::endl;
+    VM vm;
+    ObjFunction* script = compile(&vm, kScript);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    // The callee and both parameters, then a and b pushed on top.
+    CHECK(findFunction(script, "add")->maxStack == 5);
+    CHECK(findFunction(script, "nested")->maxStack == 6);
+    CHECK(findFunction(script, "leaf")->maxStack == 2);
+    CHECK(script->maxStack > 1 && script->maxStack < 16);
+
+    // The loader measures what it reads rather than trusting the file.
+    std::vector<uint8_t> bytes;
+    writeBytecode(&vm, script, &bytes);
+    ObjFunction* loaded = readBytecode(&vm, bytes.data(), bytes.size());
+    CHECK(loaded != nullptr);
+    CHECK(loaded->maxStack == script->maxStack);
+    CHECK(findFunction(loaded, "nested")->maxStack == 6);
+    vm.popRoot();
+}
+
+void testOverflowAtCall() {
+    std::cout << "Testing overflow is caught when the frame is pushed..." << std::endl;
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    CXXX deep;
+    CHECK(deep.interpret("fun down(n) { return 1 + down(n + 1); } down(0);") == InterpretResult::RUNTIME_ERROR);
+    // The VM is usable again afterwards.
+    CHECK(deep.interpret("var after = 1 + 2;") == InterpretResult::OK);
+    CHECK(deep.getGlobalNumber("after") == 3.0);
+
+    // A function that needs more stack than is left fails the call, both
+    // through OP_CALL and through the quickened OP_CALL_CLOSURE.
+    VM vm;
+    ObjFunction* script = compile(&vm, kScript);
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    ObjFunction* leaf = findFunction(script, "leaf");
+    int measured = leaf->maxStack;
+    leaf->maxStack = STACK_MAX;
+    CHECK(vm.interpret(script) == InterpretResult::RUNTIME_ERROR);
+    leaf->maxStack = measured;
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    leaf->maxStack = STACK_MAX;
+    CHECK(vm.interpret(script) == InterpretResult::RUNTIME_ERROR);
+    leaf->maxStack = measured;
+    CHECK(vm.interpret(script) == InterpretResult::OK);
+    vm.popRoot();
+    std::cerr.rdbuf(saved);
+}
+
+// The stack and frame array start small; growing them mid-run must carry
+// frames and open upvalues along.
+void testGrowth() {
+    std::cout << "Testing the stack grows under live frames and upvalues..." << std::endl;
+    const char* script = R"(
+        var deepSum = 0;
+        var keep;
+        fun build(n, prev) {
+            var local = n;
+            fun get() {
+                if (prev == nil) return local;
+                return local + prev();
+            }
+            if (n == 100) {
+                deepSum = get();
+                keep = get;
+                return 0;
+            }
+            return 1 + build(n + 1, get);
+        }
+        var depth = build(1, nil);
+        var closedSum = keep();
+
+        // Simple enough for the JIT, whose calls grow the arrays under it.
+        fun down(n) {
+            if (n == 0) return 0;
+            return down(n - 1) + n;
+        }
+        var plain = down(200);
+    )";
+    for (int jit = 0; jit < 2; jit++) {
+        CXXX vm;
+        vm.setJITEnabled(jit == 1);
+        vm.setJITThreshold(1);
+        CHECK(vm.interpret(script) == InterpretResult::OK);
+        CHECK(vm.getGlobalNumber("depth") == 99.0);
+        CHECK(vm.getGlobalNumber("deepSum") == 5050.0);
+        CHECK(vm.getGlobalNumber("closedSum") == 5050.0);
+        CHECK(vm.getGlobalNumber("plain") == 20100.0);
+    }
+}
+
+void testRejectsBadCode() {
+    std::cout << "Testing inconsistent code is rejected..." << std::endl;
+    VM vm;
+    ObjFunction* function = allocateFunction(&vm);
+    vm.pushRoot((Obj*)function);
+    Chunk& chunk = function->chunk;
+    int k = chunk.addConstant(NUMBER_VAL(1));
+
+    emit(chunk, {OP_CONSTANT, k, OP_CONSTANT, k, OP_ADD, OP_RETURN});
+    CHECK(chunk.maxStackDepth(1) == 3);
+    CHECK(chunk.maxStackDepth(2) == 4);
+
+    // Pops the callee.
+    chunk.code.clear();
+    emit(chunk, {OP_POP, OP_CONSTANT, k, OP_RETURN});
+    CHECK(chunk.maxStackDepth(1) == -1);
+
+    // Reaches the second constant one deep on one path, two on the other.
+    chunk.code.clear();
+    emit(chunk, {OP_CONSTANT, k, OP_POP_JUMP_IF_FALSE, 0, 2, OP_CONSTANT, k, OP_CONSTANT, k, OP_RETURN});
+    CHECK(chunk.maxStackDepth(1) == -1);
+
+    // A local that does not exist yet.
+    chunk.code.clear();
+    emit(chunk, {OP_GET_LOCAL, 1, OP_RETURN});
+    CHECK(chunk.maxStackDepth(1) == -1);
+    CHECK(chunk.maxStackDepth(2) == 3);
+
+    // Runs off the end, and jumps into the middle of an instruction.
+    chunk.code.clear();
+    emit(chunk, {OP_CONSTANT, k});
+    CHECK(chunk.maxStackDepth(1) == -1);
+    chunk.code.clear();
+    emit(chunk, {OP_JUMP, 0, 1, OP_CONSTANT, k, OP_RETURN});
+    CHECK(chunk.maxStackDepth(1) == -1);
+
+    // Unreachable code is not held against the function.
+    chunk.code.clear();
+    emit(chunk, {OP_CONSTANT, k, OP_RETURN, OP_POP, OP_POP});
+    CHECK(chunk.maxStackDepth(1) == 2);
+    vm.popRoot();
+}
+
+int main() {
+    testMeasuredDepth();
+    testOverflowAtCall();
+    testGrowth();
+    testRejectsBadCode();
+    std::cout << "All stack depth tests passed!" << std::endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+static ObjString* globalString(VM& vm, const char* name) {
+    Value value = globalValue(vm, name);
+    CHECK(isObjType(value, OBJ_STRING));
+    return (ObjString*)value.asObj();
+}
+
+void testInlineCharacters() {
+    std::cout << "Testing characters follow the string header..." << std::endl;
+    VM vm;
+    size_t before = vm.bytesAllocated;
+    ObjString* string = copyString(&vm, "hello", 5);
+    vm.pushRoot((Obj*)string);
+    CHECK(string->length == 5);
+    CHECK(string->chars() == (char*)string + sizeof(ObjString));
+    CHECK(string->chars()[5] == '\0');
+    CHECK(strcmp(string->chars(), "hello") == 0);
+    CHECK(string->size() == sizeof(ObjString) + 6);
+    CHECK(vm.bytesAllocated - before >= string->size());
+
+    // Interning finds the same object, and the empty string is a string too.
+    CHECK(copyString(&vm, "hello", 5) == string);
+    CHECK(copyString(&vm, "help", 4) != string);
+    ObjString* empty = copyString(&vm, "", 0);
+    CHECK(empty->length == 0 && empty->chars()[0] == '\0');
+    vm.pushRoot((Obj*)empty);
+    CHECK(copyString(&vm, "", 0) == empty);
+    vm.popRoot();
+    vm.popRoot();
+}
+
+// Joins go through a stack buffer when short and a heap one when not;
+// strings past the large-object size get a chunk of their own.
+void testConcatenation() {
+    std::cout << "Testing concatenation of short and long strings..." << std::endl;
+    VM vm;
+    runScript(vm, R"(
+        var mixed = "a" + 1 + "b" + 2.5 + "c" + -3;
+        var numbers = "" + -0 + " " + 123456789012345 + " " + 100000000000000000000;
+        var medium = "";
+        for (var i = 0; i < 40; i++) medium = medium + "0123456789";
+        var large = "";
+        for (var i = 0; i < 12; i++) large = large + medium;
+    )");
+    CHECK(strcmp(globalString(vm, "mixed")->chars(), "a1b2.5c-3") == 0);
+    CHECK(strcmp(globalString(vm, "numbers")->chars(),
+                  "-0 123456789012345 100000000000000000000") == 0);
+    CHECK(globalString(vm, "medium")->length == 400);
+    ObjString* large = globalString(vm, "large");
+    CHECK(large->length == 4800);
+    for (int i = 0; i < large->length; i++) CHECK(large->chars()[i] == '0' + i % 10);
+    CHECK(large->chars()[large->length] == '\0');
+
+    runScript(vm, R"(
+        var huge = large + large;
+        for (var i = 0; i < 10; i++) "garbage" + huge;
+    )");
+    ObjString* huge = globalString(vm, "huge");
+    CHECK(huge->length == 9600);
+    CHECK(Heap::blockOf(huge)->kind == CHUNK_LARGE);
+    vm.collectGarbage();
+    vm.finishCycle();
+    CHECK(vm.heap.largeCount() == 1);
+    CHECK(memcmp(huge->chars() + 4800, large->chars(), 4800) == 0);
+}
+
+// Bytes charged for objects, leaving out the string table's entries.
+static size_t objectBytes(VM& vm) {
+    return vm.bytesAllocated - sizeof(Entry) * vm.strings.capacity;
+}
+
+// What a dead string was charged comes back when it is freed.
+void testAccounting() {
+    std::cout << "Testing strings are charged and refunded alike..." << std::endl;
+    VM vm;
+    vm.gcThreshold = 256 * 1024 * 1024;
+    vm.nextGC = vm.gcThreshold;
+    vm.nurserySize = 0;
+    const char* source = R"(
+        var keep = "kept" + 1;
+        for (var i = 0; i < 2000; i++) {
+            var s = "item" + i;
+            s = s + s + s + s;
+        }
+    )";
+    runScript(vm, source);
+    vm.collectGarbage();
+    size_t settled = objectBytes(vm);
+    runScript(vm, source);
+    vm.collectGarbage();
+    vm.finishCycle();
+    CHECK(objectBytes(vm) <= settled + 1024);
+    CHECK(strcmp(globalString(vm, "keep")->chars(), "kept1") == 0);
+}
+
+void testLibrary() {
+    std::cout << "Testing len() and strAt()..." << std::endl;
+    CXXX vm;
+    CHECK(vm.interpret(R"(
+        var text = "a" + "bc" + 42;
+        var length = len(text);
+        var copy = "";
+        for (var i = 0; i < len(text); i++) copy = copy + strAt(text, i);
+        var same = 0;
+        if (copy == text) same = 1;
+        var outside = 0;
+        if (strAt(text, 5) == nil) outside = outside + 1;
+        if (strAt(text, -1) == nil) outside = outside + 1;
+    )") == InterpretResult::OK);
+    CHECK(vm.getGlobalNumber("length") == 5.0);
+    CHECK(vm.getGlobalNumber("same") == 1.0);
+    CHECK(vm.getGlobalNumber("outside") == 2.0);
+}
+
+int main() {
+    testInlineCharacters();
+    testConcatenation();
+    testAccounting();
+    testLibrary();
+    std::cout << "All string tests passed!" << std::endl;
+    return 0;
+}
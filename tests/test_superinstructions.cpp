@@ -0,0 +1,108 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+
+using namespace cxxx;
+
+void testFusedLoop() {
+    std::cout << "Testing fused loop instructions..." << std::endl;
+    VM vm;
+    ObjFunction* function = compile(&vm, R"(
+        var sum = 0;
+        for (var i = 0; i < 10; i++) {
+            sum = sum + i;
+        }
+    )");
+    CHECK(function != nullptr);
+    Chunk& chunk = function->chunk;
+#ifdef CXXX_REGISTER_VM
+    // `i` is a local, so the register backend compares it in place.
+    CHECK(chunkContains(chunk, OP_LESS_JUMP_IF_FALSE_RK));
+#else
+    CHECK(chunkContains(chunk, OP_LESS_JUMP_IF_FALSE));
+#endif
+    CHECK(chunkContains(chunk, OP_INCREMENT_LOCAL));
+    CHECK(chunkContains(chunk, OP_SET_GLOBAL_POP));
+    CHECK(!chunkContains(chunk, OP_LESS));
+    CHECK(!chunkContains(chunk, OP_JUMP_IF_FALSE));
+    CHECK(vm.interpret(function) == InterpretResult::OK);
+}
+
+void testJumpTargetBarrier() {
+    std::cout << "Testing no fusion across jump targets..." << std::endl;
+    VM vm;
+    // The `<` ends the ternary's else branch, and the then branch jumps to
+    // just after it, so it must not be folded into the if's jump.
+    ObjFunction* function = compile(&vm, R"(
+        var a = 1;
+        var b = 2;
+        var flag = true;
+        var result = 0;
+        if (flag ? false : a < b) result = 1; else result = 2;
+    )");
+    CHECK(function != nullptr);
+    CHECK(chunkContains(function->chunk, OP_LESS));
+    CHECK(vm.interpret(function) == InterpretResult::OK);
+    Value result = globalValue(vm, "result");
+    CHECK(result.asNumber() == 2.0);
+}
+
+void testIncrementSemantics() {
+    std::cout << "Testing increment and decrement results..." << std::endl;
+    CXXX vm;
+    InterpretResult result = vm.interpret(R"(
+        fun run() {
+            var i = 5;
+            var a = i++;
+            var b = ++i;
+            var c = i--;
+            var d = --i;
+            var s = "n";
+            s++;
+            return a * 1000 + b * 100 + c * 10 + d + len(s);
+        }
+        var value = run();
+    )");
+    CHECK(result == InterpretResult::OK);
+    // a = 5, b = 7, c = 7, d = 5, s = "n1"
+    CHECK(vm.getGlobalNumber("value") == 5000.0 + 700.0 + 70.0 + 5.0 + 2.0);
+}
+
+void testControlFlowAroundFusedJumps() {
+    std::cout << "Testing loops, switch and ternary with fused jumps..." << std::endl;
+    CXXX vm;
+    InterpretResult result = vm.interpret(R"(
+        var total = 0;
+        for (var i = 0; i < 20; i++) {
+            if (i == 3) continue;
+            if (i < 15) {
+                total = total + (i < 10 ? 1 : 2);
+            } else {
+                break;
+            }
+        }
+        var j = 0;
+        while (j < 5) {
+            switch (j) {
+                case 1: total = total + 100;
+                case 3: total = total + 1000;
+                default: total = total + 0;
+            }
+            j = j + 1;
+        }
+    )");
+    CHECK(result == InterpretResult::OK);
+    // Nine 1s (0-9 without 3), five 2s (10-14), then the switch adds 1100.
+    CHECK(vm.getGlobalNumber("total") == 9.0 + 10.0 + 1100.0);
+}
+
+int main() {
+    testFusedLoop();
+    testJumpTargetBarrier();
+    testIncrementSemantics();
+    testControlFlowAroundFusedJumps();
+    std::cout << "Superinstruction tests passed." << std::endl;
+    return 0;
+}
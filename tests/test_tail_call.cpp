@@ -0,0 +1,159 @@
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include "test_util.h"
+#include <iostream>
+#include <cstring>
+
+using namespace cxxx;
+
+static const char* kScript = R"(
+    fun count(n, acc) {
+        if (n == 0) return acc;
+        return count(n - 1, acc + 1);
+    }
+    fun isEven(n) {
+        if (n == 0) return true;
+        return isOdd(n - 1);
+    }
+    fun isOdd(n) {
+        if (n == 0) return false;
+        return isEven(n - 1);
+    }
+
+    // The tail call must close `local` before reusing its slot.
+    var saved;
+    fun clobber(a) { var b = 111; var c = 222; return a; }
+    fun capture(n) {
+        var local = n * 2;
+        fun get() { return local; }
+        saved = get;
+        return clobber(n);
+    }
+
+    class Counter {
+        init() { this.steps = 0; }
+        run(n) {
+            if (n == 0) return this.steps;
+            this.steps = this.steps + 1;
+            var next = this.run;
+            return next(n - 1);
+        }
+    }
+    // Method tail calls: through `this`, through `super`, and through a
+    // field holding a function.
+    class Walker {
+        down(n, acc) {
+            if (n == 0) return acc;
+            return this.down(n - 1, acc + 1);
+        }
+    }
+    class SuperWalker < Walker {
+        down(n, acc) { return super.down(n, acc); }
+    }
+    class Holder {
+        init() { this.next = count; }
+        run(n) { return this.next(n, 0); }
+    }
+    class Point { init(x, y) { this.x = x; this.y = y; } }
+    fun makePoint(x) { return Point(x, 2); }
+    fun length(s) { return len(s); }
+
+    var counted = count(100000, 0);
+    var even = isEven(10001);
+    var returned = capture(21);
+    var captured = saved();
+    var steps = Counter().run(5000);
+    var walked = Walker().down(100000, 0);
+    var superWalked = SuperWalker().down(100000, 0);
+    var held = Holder().run(100000);
+    var pointX = makePoint(7).x;
+    var textLength = length("tail");
+)";
+
+static void checkResults(CXXX& vm) {
+    CHECK(vm.getGlobalNumber("counted") == 100000.0);
+    CHECK(!vm.getGlobalBool("even"));
+    CHECK(vm.getGlobalNumber("returned") == 21.0);
+    CHECK(vm.getGlobalNumber("captured") == 42.0);
+    CHECK(vm.getGlobalNumber("steps") == 5000.0);
+    CHECK(vm.getGlobalNumber("walked") == 100000.0);
+    CHECK(vm.getGlobalNumber("superWalked") == 100000.0);
+    CHECK(vm.getGlobalNumber("held") == 100000.0);
+    CHECK(vm.getGlobalNumber("pointX") == 7.0);
+    CHECK(vm.getGlobalNumber("textLength") == 4.0);
+}
+
+void testCompiledForm() {
+    std::cout << "Testing which calls become tail calls..." << std::endl;
+    VM vm;
+    ObjFunction* script = compile(&vm, R"(
+        fun f(n) { return n; }
+        fun tail(n) { return f(n); }
+        fun notTail(n) { return f(n) + 1; }
+        fun inBranch(n) { if (n > 0) return f(n); return 0; }
+        fun statement(n) { f(n); return n; }
+        class A { m(n) { return n; } }
+        class B < A {
+            viaThis(n) { return this.m(n); }
+            viaSuper(n) { return super.m(n); }
+            notTailThis(n) { return this.m(n) + 1; }
+            notTailSuper(n) { return super.m(n) + 1; }
+        }
+    )");
+    CHECK(script != nullptr);
+    vm.pushRoot((Obj*)script);
+    CHECK(chunkContains(findFunction(script, "tail")->chunk, OP_TAIL_CALL));
+    CHECK(chunkContains(findFunction(script, "inBranch")->chunk, OP_TAIL_CALL));
+    CHECK(!chunkContains(findFunction(script, "notTail")->chunk, OP_TAIL_CALL));
+    CHECK(!chunkContains(findFunction(script, "statement")->chunk, OP_TAIL_CALL));
+
+    // Methods are constants of the script, like functions.
+    CHECK(chunkContains(findFunction(script, "viaThis")->chunk, OP_TAIL_INVOKE));
+    CHECK(chunkContains(findFunction(script, "viaSuper")->chunk, OP_TAIL_SUPER_INVOKE));
+    CHECK(chunkContains(findFunction(script, "notTailThis")->chunk, OP_INVOKE));
+    CHECK(!chunkContains(findFunction(script, "notTailThis")->chunk, OP_TAIL_INVOKE));
+    CHECK(chunkContains(findFunction(script, "notTailSuper")->chunk, OP_SUPER_INVOKE));
+    CHECK(!chunkContains(findFunction(script, "notTailSuper")->chunk, OP_TAIL_SUPER_INVOKE));
+    vm.popRoot();
+}
+
+void testConstantStack() {
+    std::cout << "Testing deep tail recursion, interpreted and jitted..." << std::endl;
+    CXXX interpreted;
+    CHECK(interpreted.interpret(kScript) == InterpretResult::OK);
+    checkResults(interpreted);
+
+    CXXX jitted;
+    jitted.setJITEnabled(true);
+    jitted.setJITThreshold(1);
+    CHECK(jitted.interpret(kScript) == InterpretResult::OK);
+    checkResults(jitted);
+}
+
+void testErrors() {
+    std::cout << "Testing errors in tail calls..." << std::endl;
+    const char* scripts[] = {
+        "fun f(a, b) { return a; } fun g() { return f(1); } g();",
+        "fun g() { var x = 3; return x(); } g();",
+        "fun g() { return missing(); } g();",
+        "class C { m(a) { return a; } g() { return this.m(); } } C().g();",
+        "class C { g() { return this.missing(); } } C().g();",
+        "class A { m(a) { return a; } } class B < A { g() { return super.m(); } } B().g();",
+        "class A {} class B < A { g() { return super.missing(); } } B().g();",
+    };
+    std::streambuf* saved = std::cerr.rdbuf(nullptr);
+    for (const char* script : scripts) {
+        CXXX vm;
+        CHECK(vm.interpret(script) == InterpretResult::RUNTIME_ERROR);
+    }
+    std::cerr.rdbuf(saved);
+}
+
+int main() {
+    testCompiledForm();
+    testConstantStack();
+    testErrors();
+    std::cout << "All tail call tests passed!" << std::endl;
+    return 0;
+}
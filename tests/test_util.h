@@ -0,0 +1,67 @@
+#ifndef cxxx_test_util_h
+#define cxxx_test_util_h
+
+#include "../src/include/cxxx.h"
+#include "../src/compiler/compiler.h"
+#include "../src/vm/vm.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+// assert() that stays in NDEBUG builds. Checks often run the code under
+// test, so they must not compile away with it.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            std::abort(); \
+        } \
+    } while (0)
+
+namespace cxxx {
+
+    // Compiles and runs `source` as a script in `vm`, which must succeed.
+    inline void runScript(VM& vm, const char* source) {
+        ObjFunction* script = compile(&vm, source);
+        CHECK(script != nullptr);
+        vm.pushRoot((Obj*)script);
+        InterpretResult result = vm.interpret(script);
+        CHECK(result == InterpretResult::OK);
+        vm.popRoot();
+    }
+
+    // The value of the global `name`, which must be defined.
+    inline Value globalValue(VM& vm, const char* name) {
+        Value value;
+        bool found = vm.getGlobal(copyString(&vm, name, (int)strlen(name)), &value);
+        CHECK(found);
+        return value;
+    }
+
+    inline double globalNumber(VM& vm, const char* name) {
+        Value value = globalValue(vm, name);
+        CHECK(value.isNumber());
+        return value.asNumber();
+    }
+
+    // Whether some instruction in `chunk` is `op`.
+    inline bool chunkContains(Chunk& chunk, OpCode op) {
+        for (int offset = 0; offset < (int)chunk.code.size(); offset += chunk.instructionLength(offset)) {
+            if (chunk.code[offset] == op) return true;
+        }
+        return false;
+    }
+
+    // The function named `name` among `script`'s constants, or nullptr.
+    inline ObjFunction* findFunction(ObjFunction* script, const char* name) {
+        for (Value constant : script->chunk.constants) {
+            if (!isObjType(constant, OBJ_FUNCTION)) continue;
+            ObjFunction* function = (ObjFunction*)constant.asObj();
+            if (function->name != nullptr && strcmp(function->name->chars(), name) == 0) return function;
+        }
+        return nullptr;
+    }
+
+}
+
+#endif
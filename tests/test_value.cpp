@@ -0,0 +1,50 @@
+#include "../src/vm/vm.h"
+#include "../src/vm/value.h"
+#include "../src/vm/object.h"
+#include "test_util.h"
+#include <iostream>
+#include <cmath>
+#include <limits>
+
+using namespace cxxx;
+
+// Exercises the Value accessor API; passes for both the tagged-union and
+// the NaN-boxed (CXXX_NAN_BOXING) representation.
+int main() {
+    std::cout << "sizeof(Value) = " << sizeof(Value) << std::endl;
+
+    Value n = NUMBER_VAL(3.5);
+    CHECK(n.isNumber() && !n.isBool() && !n.isNil() && !n.isObj());
+    CHECK(n.asNumber() == 3.5);
+
+    Value inf = NUMBER_VAL(std::numeric_limits<double>::infinity());
+    CHECK(inf.isNumber() && std::isinf(inf.asNumber()));
+
+    Value nan = NUMBER_VAL(std::numeric_limits<double>::quiet_NaN());
+    CHECK(nan.isNumber() && std::isnan(nan.asNumber()));
+    CHECK(!valuesEqual(nan, nan));
+
+    CHECK(valuesEqual(NUMBER_VAL(0.0), NUMBER_VAL(-0.0)));
+
+    Value t = BOOL_VAL(true);
+    Value f = BOOL_VAL(false);
+    CHECK(t.isBool() && f.isBool() && !t.isNumber() && !t.isNil());
+    CHECK(t.asBool() && !f.asBool());
+    CHECK(!valuesEqual(t, f));
+
+    Value nil = NIL_VAL();
+    CHECK(nil.isNil() && !nil.isBool() && !nil.isNumber() && !nil.isObj());
+    CHECK(valuesEqual(nil, NIL_VAL()));
+    CHECK(!valuesEqual(nil, f));
+
+    VM vm;
+    ObjString* hello = copyString(&vm, "hello", 5);
+    Value s = OBJ_VAL((Obj*)hello);
+    CHECK(s.isObj() && !s.isNumber() && !s.isNil() && !s.isBool());
+    CHECK(s.asObj() == (Obj*)hello);
+    CHECK(isObjType(s, OBJ_STRING));
+    CHECK(valuesEqual(s, OBJ_VAL((Obj*)copyString(&vm, "hello", 5))));
+
+    std::cout << "Value tests passed." << std::endl;
+    return 0;
+}